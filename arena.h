@@ -0,0 +1,130 @@
+// Linear arenas for main.c.
+// An arena hands out memory from large blocks by bumping an offset, and frees every allocation at once.
+// Each loaded scene keeps the many small structures of its models and objects in one, so unloading it is one call.
+//
+// - Allocations are aligned to ARENA_ALIGNMENT bytes and cannot be freed or grown on their own.
+// - Allocations bigger than a quarter of the block size get a block of their own, so they do not waste the rest of the current one.
+// - An arena is only used by one thread at a time. A loader thread fills its own arena, which the scene adopts once the loader is done.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// The default size of an arena's blocks, and the alignment of every allocation.
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_ALIGNMENT 16
+
+// A block of an arena. Its memory starts at the first aligned address after the header.
+struct arena_block {
+    struct arena_block* next;
+    size_t size;
+    size_t used;
+};
+
+// An arena: its blocks, newest first, with the first being the one allocations are bumped from,
+// and how many bytes have been handed out and reserved from the system.
+struct arena {
+    struct arena_block* blocks;
+    size_t block_size;
+    size_t num_blocks;
+    size_t used;
+    size_t reserved;
+};
+
+// The size of a block's header, rounded up so the block's memory is aligned.
+#define ARENA_HEADER_SIZE ((sizeof(struct arena_block) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+// Start an empty arena, with blocks of block_size bytes, or ARENA_BLOCK_SIZE if zero. Nothing is allocated until it is needed.
+static inline void arena_init(struct arena* arena, size_t block_size) {
+    memset(arena, 0, sizeof(struct arena));
+    arena->block_size = block_size == 0 ? ARENA_BLOCK_SIZE : block_size;
+}
+
+// Allocate a new block of at least size bytes, and link it in after the current block if it is only for one large allocation.
+static inline struct arena_block* arena_add_block(struct arena* arena, size_t size, bool current) {
+    struct arena_block* block = malloc(ARENA_HEADER_SIZE + size);
+    if (block == NULL) return NULL;
+    block->size = size;
+    block->used = 0;
+    if (current == true || arena->blocks == NULL) {
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    else {
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+    }
+    arena->num_blocks++;
+    arena->reserved = arena->reserved + ARENA_HEADER_SIZE + size;
+    return block;
+}
+
+// Allocate size bytes, uninitialised. Returns NULL if the system is out of memory.
+static inline void* arena_alloc(struct arena* arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (size == 0) size = ARENA_ALIGNMENT;
+
+    struct arena_block* block = arena->blocks;
+    if (block == NULL || block->used + size > block->size) {
+        bool large = size > arena->block_size / 4;
+        block = arena_add_block(arena, large == true ? size : arena->block_size, large == false);
+        if (block == NULL) return NULL;
+    }
+    void* memory = (unsigned char*)block + ARENA_HEADER_SIZE + block->used;
+    block->used = block->used + size;
+    arena->used = arena->used + size;
+    return memory;
+}
+
+// Allocate count elements of size bytes, set to zero. Returns NULL if the system is out of memory or the size overflows.
+static inline void* arena_calloc(struct arena* arena, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+    void* memory = arena_alloc(arena, count * size);
+    if (memory != NULL) memset(memory, 0, count * size);
+    return memory;
+}
+
+// Copy a string into the arena. Returns NULL if the system is out of memory.
+static inline char* arena_strdup(struct arena* arena, const char* string) {
+    size_t length = strlen(string) + 1;
+    char* copy = arena_alloc(arena, length);
+    if (copy != NULL) memcpy(copy, string, length);
+    return copy;
+}
+
+// Move every block of one arena into another, leaving the first empty. The allocations stay where they are,
+// and are freed with the arena they were moved to. The destination keeps bumping from its own current block.
+static inline void arena_adopt(struct arena* arena, struct arena* other) {
+    if (other->blocks == NULL) return;
+    struct arena_block* last = other->blocks;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    if (arena->blocks == NULL) {
+        arena->blocks = other->blocks;
+    }
+    else {
+        last->next = arena->blocks->next;
+        arena->blocks->next = other->blocks;
+    }
+    arena->num_blocks = arena->num_blocks + other->num_blocks;
+    arena->used = arena->used + other->used;
+    arena->reserved = arena->reserved + other->reserved;
+    arena_init(other, other->block_size);
+}
+
+// Free every allocation at once, leaving the arena empty and ready to use again.
+static inline void arena_free(struct arena* arena) {
+    while (arena->blocks != NULL) {
+        struct arena_block* next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    arena_init(arena, arena->block_size);
+}
+
+#endif
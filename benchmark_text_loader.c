@@ -0,0 +1,221 @@
+// Benchmarks the parallel text model parser in text_model_parser.h against the original
+// fgets() and sscanf() loader that object_new() used, on the shipped model and on a large
+// synthetic model, and checks that both loaders produce the same vertices and indices, reading the parser's vertices
+// through the same attribute layout the renderer draws them with.
+//
+// Usage: ./benchmark_text_loader [--threads N] [--lines N] [--repeats N] [--keep] [model_file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "model_format.h"
+#include "text_model_parser.h"
+
+// Where the synthetic model is written, and how many lines it has by default.
+#define SYNTHETIC_FILENAME "benchmark_synthetic_model"
+#define SYNTHETIC_DEFAULT_LINES 10000000
+
+// The original loader, kept here as the baseline. It counts lines, rewinds and sscanf()s every line.
+bool legacy_load(const char* filename, struct text_model* model, uint16_t** indices) {
+    FILE* obj_file = fopen(filename, "r");
+    if (obj_file == NULL) return false;
+
+    size_t num_vertices = 0;
+    size_t num_indices = 0;
+    char buffer[4096];
+    while (fgets(buffer, 4096, obj_file) != NULL) {
+        if (buffer[0] == 'v' && buffer[1] == ' ') num_vertices++;
+        if (buffer[0] == 'f') num_indices++;
+    }
+    rewind(obj_file);
+
+    model->vertices = malloc(sizeof(struct model_file_vertex) * (num_vertices + 1));
+    *indices = malloc(sizeof(uint16_t) * (num_indices + 1));
+    if (model->vertices == NULL || *indices == NULL) {
+        fclose(obj_file);
+        return false;
+    }
+    model->num_vertices = num_vertices;
+    model->num_indices = num_indices;
+    model->indices = NULL;
+
+    size_t vertices_index = 0;
+    size_t indices_index = 0;
+    while (fgets(buffer, 4096, obj_file) != NULL) {
+        if (buffer[0] == 'v' && buffer[1] == ' ') {
+            struct model_file_vertex* vertex = &model->vertices[vertices_index];
+            *vertex = (struct model_file_vertex){{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 1.0}, {0.0, 0.0, 0.0}};
+            sscanf(buffer, "v %f %f %f %f %f %f %f %f %f %f",
+            &vertex->position[0], &vertex->position[1], &vertex->position[2],
+            &vertex->vertex_color[0], &vertex->vertex_color[1], &vertex->vertex_color[2], &vertex->vertex_color[3],
+            &vertex->normal[0], &vertex->normal[1], &vertex->normal[2]);
+            vertices_index++;
+        }
+
+        if (buffer[0] == 'f') {
+            (*indices)[indices_index] = 0;
+            sscanf(buffer, "f %hu", &(*indices)[indices_index]);
+            indices_index++;
+        }
+    }
+    fclose(obj_file);
+    return true;
+}
+
+// Return the current time in seconds from a monotonic clock.
+double benchmark_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// A small deterministic random number generator, so synthetic files are identical between runs.
+uint32_t benchmark_random(uint64_t* state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*state >> 33);
+}
+
+// Write a synthetic model in the converter's output format with the given number of lines.
+// Like the shipped model, there are roughly six face lines for every vertex line.
+bool benchmark_write_synthetic(const char* filename, size_t num_lines) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) return false;
+
+    uint64_t state = 1;
+    size_t num_vertices = num_lines / 7;
+    for (size_t i=0; i < num_vertices; i++) {
+        float values[TEXT_MODEL_VERTEX_VALUES];
+        for (int j=0; j < TEXT_MODEL_VERTEX_VALUES; j++) {
+            values[j] = (float)benchmark_random(&state) / (float)UINT32_MAX * 2000.0 - 1000.0;
+        }
+        fprintf(file, "v %f %f %f %f %f %f %f %f %f %f\n", values[0], values[1], values[2], values[3], values[4], values[5], values[6], values[7], values[8], values[9]);
+    }
+    for (size_t i=num_vertices; i < num_lines; i++) {
+        fprintf(file, "f %u\n", benchmark_random(&state) % 65536);
+    }
+    return fclose(file) == 0;
+}
+
+// Compare two floats the way they were written, which is with six decimal places.
+bool benchmark_float_matches(float a, float b) {
+    return fabsf(a - b) <= 1e-6f * fmaxf(1.0f, fabsf(a));
+}
+
+// Read one attribute of a vertex from a vertex buffer the way the renderer's vertex attribute pointers do:
+// components floats at a byte offset, with vertices sizeof(struct model_file_vertex) bytes apart.
+void benchmark_read_attribute(const void* buffer, size_t index, size_t offset, int components, float* result) {
+    memcpy(result, (const unsigned char*)buffer + index * sizeof(struct model_file_vertex) + offset, sizeof(float) * components);
+}
+
+// Count the vertices and indices that differ between the two loaders.
+// The parser's vertices are read back through the attribute layout main.c draws them with,
+// and compared with the legacy loader's values field by field.
+size_t benchmark_compare(struct text_model* fast, struct text_model* legacy, uint16_t* legacy_indices) {
+    if (fast->num_vertices != legacy->num_vertices || fast->num_indices != legacy->num_indices) {
+        return SIZE_MAX;
+    }
+
+    size_t mismatches = 0;
+    for (size_t i=0; i < fast->num_vertices; i++) {
+        float a[TEXT_MODEL_VERTEX_VALUES];
+        benchmark_read_attribute(fast->vertices, i, offsetof(struct model_file_vertex, position), 3, &a[0]);
+        benchmark_read_attribute(fast->vertices, i, offsetof(struct model_file_vertex, vertex_color), 4, &a[3]);
+        benchmark_read_attribute(fast->vertices, i, offsetof(struct model_file_vertex, normal), 3, &a[7]);
+        struct model_file_vertex* vertex = &legacy->vertices[i];
+        const float b[TEXT_MODEL_VERTEX_VALUES] = {
+            vertex->position[0], vertex->position[1], vertex->position[2],
+            vertex->vertex_color[0], vertex->vertex_color[1], vertex->vertex_color[2], vertex->vertex_color[3],
+            vertex->normal[0], vertex->normal[1], vertex->normal[2]
+        };
+        for (int j=0; j < TEXT_MODEL_VERTEX_VALUES; j++) {
+            if (benchmark_float_matches(a[j], b[j]) == false) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    for (size_t i=0; i < fast->num_indices; i++) {
+        if ((uint16_t)fast->indices[i] != legacy_indices[i]) mismatches++;
+    }
+    return mismatches;
+}
+
+// Time both loaders on a file, keeping the best of several runs, and print the results.
+bool benchmark_file(const char* filename, unsigned int num_threads, int repeats) {
+    double legacy_best = INFINITY;
+    double fast_best = INFINITY;
+    struct text_model legacy = {NULL, 0, NULL, 0};
+    struct text_model fast = {NULL, 0, NULL, 0};
+    uint16_t* legacy_indices = NULL;
+
+    for (int i=0; i < repeats; i++) {
+        free(legacy.vertices);
+        free(legacy_indices);
+        double start = benchmark_time();
+        if (legacy_load(filename, &legacy, &legacy_indices) == false) {
+            printf("benchmark_file(): Legacy loader failed on '%s'.\n", filename);
+            return false;
+        }
+        double elapsed = benchmark_time() - start;
+        if (elapsed < legacy_best) legacy_best = elapsed;
+
+        text_model_free(&fast);
+        start = benchmark_time();
+        if (text_model_parse(filename, num_threads, &fast) == false) {
+            printf("benchmark_file(): Parallel parser failed on '%s'.\n", filename);
+            return false;
+        }
+        elapsed = benchmark_time() - start;
+        if (elapsed < fast_best) fast_best = elapsed;
+    }
+
+    size_t mismatches = benchmark_compare(&fast, &legacy, legacy_indices);
+    printf("%s: %zu vertices, %zu indices\n", filename, fast.num_vertices, fast.num_indices);
+    printf("  legacy sscanf loader:   %10.3f ms\n", legacy_best * 1000.0);
+    printf("  parallel parser:        %10.3f ms (%.2fx)\n", fast_best * 1000.0, legacy_best / fast_best);
+    if (mismatches == SIZE_MAX) printf("  results: count mismatch (legacy %zu/%zu)\n", legacy.num_vertices, legacy.num_indices);
+    else printf("  results: %zu mismatches\n", mismatches);
+
+    free(legacy.vertices);
+    free(legacy_indices);
+    text_model_free(&fast);
+    return mismatches == 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Process arguments.
+    unsigned int num_threads = 0;
+    size_t num_lines = SYNTHETIC_DEFAULT_LINES;
+    int repeats = 3;
+    bool keep = false;
+    const char* model_filename = "output_model";
+    for (int i=1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) num_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--lines") == 0 && i + 1 < argc) num_lines = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) repeats = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--keep") == 0) keep = true;
+        else model_filename = argv[i];
+    }
+    if (repeats < 1) repeats = 1;
+
+    bool success = benchmark_file(model_filename, num_threads, repeats);
+
+    // Benchmark the synthetic model.
+    if (num_lines > 0) {
+        printf("Writing %zu line synthetic model to '%s'.\n", num_lines, SYNTHETIC_FILENAME);
+        if (benchmark_write_synthetic(SYNTHETIC_FILENAME, num_lines) == false) {
+            printf("main(): Failed to write synthetic model. Exiting.\n");
+            return -1;
+        }
+        success = benchmark_file(SYNTHETIC_FILENAME, num_threads, repeats) && success;
+        if (keep == false) remove(SYNTHETIC_FILENAME);
+    }
+
+    return success ? 0 : -1;
+}
@@ -1,23 +1,88 @@
+// Variants are compiled with some of these defined:
+// - FLAT_SHADING: light each triangle with its face normal, found from screen space derivatives, instead of the interpolated vertex normals.
+// - SPECULAR: add Blinn-Phong highlights to the ambient and diffuse lighting.
+// - CLUSTERED_LIGHTS: add the diffuse light of the point lights assigned to the fragment's cluster by light_cluster.h.
+//   The cluster grid and texture sizes are defined alongside it by main.c.
+
+#ifdef FLAT_SHADING
 #extension GL_OES_standard_derivatives: enable
+#endif
 
 uniform highp vec3 object_color;
 uniform highp vec3 light_color;
 uniform highp vec3 light_position;
+#ifdef SPECULAR
+uniform highp vec3 camera_position;
+#endif
 
 varying highp vec3 fragment_position;
 varying highp vec4 fragment_color;
 varying highp vec3 fragment_normal;
 
-void main(void) {
-    // Flat shading code
-    //highp vec3 x_tangent = dFdx(fragment_position.xyz);
-    //highp vec3 y_tangent = dFdy(fragment_position.xyz);
-    //highp vec3 face_normal = normalize(cross(x_tangent, y_tangent));
-    //highp vec3 norm = normalize(face_normal);
+#ifdef CLUSTERED_LIGHTS
+// Each cluster texel holds the offset of its first light index as 16 bits, then its light count.
+// Each index texel holds a light's index as 16 bits. Each light is three texels down a column of the light texture:
+// x and y, z and the radius, as 16 bit values across light_offset and light_scale, then the colour.
+uniform sampler2D light_texture;
+uniform sampler2D cluster_texture;
+uniform sampler2D light_index_texture;
+// Tiles per pixel across the screen, then slice = log(depth) * z + w.
+uniform highp vec4 cluster_parameters;
+uniform highp vec4 light_offset;
+uniform highp vec4 light_scale;
 
-    // Else use passed in normal to use smooth shading
-    highp vec3 norm = normalize(fragment_normal);
+// Read two bytes of a texel as a 16 bit number.
+highp float decode_uint16(highp vec2 bytes) {
+    return dot(floor(bytes * 255.0 + 0.5), vec2(1.0, 256.0));
+}
+
+// Read one of a texture's texels by its column and row.
+highp vec4 texel(sampler2D source, highp vec2 size, highp float column, highp float row) {
+    return texture2D(source, (vec2(column, row) + 0.5) / size);
+}
+
+// Add up the diffuse light of the point lights in the fragment's cluster.
+// Loops in OpenGL ES 2.0 need a constant bound, so the loop runs to the most lights a cluster can hold and stops early.
+highp vec3 clustered_lights(highp vec3 norm) {
+    highp float depth = 1.0 / gl_FragCoord.w;
+    highp vec2 tile = floor(gl_FragCoord.xy * cluster_parameters.xy);
+    highp float slice = clamp(floor(log(depth) * cluster_parameters.z + cluster_parameters.w), 0.0, CLUSTERS_Z - 1.0);
+    highp vec4 cluster = texel(cluster_texture, vec2(CLUSTERS_X * CLUSTERS_Y, CLUSTERS_Z), tile.y * CLUSTERS_X + tile.x, slice);
+    highp float first = decode_uint16(cluster.xy);
+    highp float count = floor(cluster.z * 255.0 + 0.5);
+
+    highp vec3 result = vec3(0.0);
+    for (int i = 0; i < CLUSTER_MAX_LIGHTS; i++) {
+        if (float(i) >= count) break;
+        highp float entry = first + float(i);
+        highp float index = decode_uint16(texel(light_index_texture, LIGHT_INDEX_TEXTURE_SIZE,
+            mod(entry, LIGHT_INDEX_TEXTURE_SIZE.x), floor(entry / LIGHT_INDEX_TEXTURE_SIZE.x)).xy);
+        highp float column = mod(index, LIGHT_TEXTURE_SIZE.x);
+        highp float row = floor(index / LIGHT_TEXTURE_SIZE.x) * 3.0;
+        highp vec4 xy = texel(light_texture, LIGHT_TEXTURE_SIZE, column, row);
+        highp vec4 zr = texel(light_texture, LIGHT_TEXTURE_SIZE, column, row + 1.0);
+        highp vec4 color = texel(light_texture, LIGHT_TEXTURE_SIZE, column, row + 2.0);
+        highp vec4 light = vec4(decode_uint16(xy.xy), decode_uint16(xy.zw), decode_uint16(zr.xy), decode_uint16(zr.zw)) / 65535.0 * light_scale + light_offset;
 
+        // Fade the light out smoothly to nothing at its radius.
+        highp vec3 to_light = light.xyz - fragment_position;
+        highp float light_distance = length(to_light);
+        highp float falloff = clamp(1.0 - light_distance / light.w, 0.0, 1.0);
+        highp float diff = max(dot(norm, to_light / max(light_distance, 0.0001)), 0.0);
+        result = result + diff * falloff * falloff * color.rgb;
+    }
+    return result;
+}
+#endif
+
+void main(void) {
+#ifdef FLAT_SHADING
+    highp vec3 x_tangent = dFdx(fragment_position.xyz);
+    highp vec3 y_tangent = dFdy(fragment_position.xyz);
+    highp vec3 norm = normalize(cross(x_tangent, y_tangent));
+#else
+    highp vec3 norm = normalize(fragment_normal);
+#endif
 
     highp float ambient_strength = 0.5;
     highp vec3 ambient = ambient_strength * light_color;
@@ -26,6 +91,16 @@ void main(void) {
     highp vec3 diffuse = diff * light_color;
     highp vec3 result = (ambient + diffuse) * fragment_color.xyz;
 
-    
+#ifdef CLUSTERED_LIGHTS
+    result = result + clustered_lights(norm) * fragment_color.xyz;
+#endif
+
+#ifdef SPECULAR
+    highp vec3 view_direction = normalize(camera_position - fragment_position);
+    highp vec3 halfway = normalize(light_direction + view_direction);
+    highp float specular = pow(max(dot(norm, halfway), 0.0), 32.0) * 0.5;
+    result = result + specular * light_color;
+#endif
+
     gl_FragColor = vec4(result, fragment_color.w);
 }
\ No newline at end of file
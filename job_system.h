@@ -0,0 +1,305 @@
+// A work stealing job system for main.c.
+// A job is a function and its data. The threads that run them, one worker per core besides the main thread,
+// each keep a queue of the jobs they submitted, take from its newest end, and steal from the oldest end of
+// the other queues when theirs runs dry, so jobs spawned from inside a job stay on the thread that spawned them
+// while idle threads spread the rest.
+//
+// - Every job counts down a counter when it finishes. Waiting on a counter runs queued jobs until it reaches zero,
+//   so a job can submit more jobs and wait for them without holding up a worker.
+// - Each queue is guarded by its own mutex, which is cheap next to jobs that each cull a share of the scene.
+//   Workers sleep on a condition variable while every queue is empty.
+// - Web builds without pthread support have no workers, and run every job as soon as it is submitted.
+
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+// Jobs are run on worker threads everywhere except web builds without pthread support.
+#ifndef JOB_SYSTEM_THREADS
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define JOB_SYSTEM_THREADS 0
+#else
+#define JOB_SYSTEM_THREADS 1
+#endif
+#endif
+
+#if JOB_SYSTEM_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __EMSCRIPTEN__
+#include <emscripten/threading.h>
+#endif
+#endif
+
+// The most worker threads, and the most jobs one thread's queue holds. Jobs submitted to a full queue are run straight away.
+// The queue capacity must be a power of two.
+#define JOB_SYSTEM_MAX_WORKERS 31
+#define JOB_QUEUE_CAPACITY 256
+
+// Counts the jobs of a batch still to finish. Starts at zero, and is only read through job_wait().
+struct job_counter {
+    _Atomic uint32_t pending;
+};
+
+// A job: the function to run, its data, and the counter to count down once it has run.
+struct job {
+    void (*function)(void* data);
+    void* data;
+    struct job_counter* counter;
+};
+
+// One thread's jobs, as a ring. The owner pushes and takes at the bottom, and thieves take from the top.
+struct job_queue {
+    struct job jobs[JOB_QUEUE_CAPACITY];
+    uint32_t top;
+    uint32_t bottom;
+    #if JOB_SYSTEM_THREADS
+    pthread_mutex_t mutex;
+    #endif
+};
+
+#if JOB_SYSTEM_THREADS
+// A worker thread and the queue it owns.
+struct job_worker {
+    struct job_system* system;
+    pthread_t thread;
+    uint32_t index;
+};
+#endif
+
+// The workers and every thread's queue. Queue zero belongs to the main thread, and to any other thread that submits jobs.
+struct job_system {
+    uint32_t num_workers;
+    struct job_queue* queues;
+    _Atomic uint32_t queued;
+    #if JOB_SYSTEM_THREADS
+    struct job_worker* workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    bool quit;
+    #endif
+};
+
+// The queue of the calling thread: its worker's, or the main thread's.
+static _Thread_local uint32_t job_thread_queue = 0;
+
+// Return how many workers to start: one for every core but the one the main thread runs on.
+static uint32_t job_system_default_workers() {
+    #if JOB_SYSTEM_THREADS
+    #ifdef __EMSCRIPTEN__
+    long cores = emscripten_num_logical_cores();
+    #else
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+    if (cores <= 1) return 0;
+    return cores - 1 < JOB_SYSTEM_MAX_WORKERS ? (uint32_t)(cores - 1) : JOB_SYSTEM_MAX_WORKERS;
+    #else
+    return 0;
+    #endif
+}
+
+// Take a job for the given thread: the newest from its own queue, or else the oldest from another's, starting after its own.
+// Returns false if every queue is empty.
+static bool job_take(struct job_system* system, uint32_t index, struct job* job) {
+    if (atomic_load(&system->queued) == 0) return false;
+    uint32_t num_queues = system->num_workers + 1;
+    for (uint32_t i=0; i < num_queues; i++) {
+        uint32_t victim = (index + i) % num_queues;
+        struct job_queue* queue = &system->queues[victim];
+        bool taken = false;
+        #if JOB_SYSTEM_THREADS
+        pthread_mutex_lock(&queue->mutex);
+        #endif
+        if (queue->bottom != queue->top) {
+            if (victim == index) {
+                queue->bottom--;
+                *job = queue->jobs[queue->bottom & (JOB_QUEUE_CAPACITY - 1)];
+            }
+            else {
+                *job = queue->jobs[queue->top & (JOB_QUEUE_CAPACITY - 1)];
+                queue->top++;
+            }
+            taken = true;
+        }
+        #if JOB_SYSTEM_THREADS
+        pthread_mutex_unlock(&queue->mutex);
+        #endif
+        if (taken == true) {
+            atomic_fetch_sub(&system->queued, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Run a job and count down its counter, waking any thread waiting on it when it was the last.
+static void job_run(struct job_system* system, struct job* job) {
+    job->function(job->data);
+    if (atomic_fetch_sub(&job->counter->pending, 1) == 1) {
+        #if JOB_SYSTEM_THREADS
+        pthread_mutex_lock(&system->mutex);
+        pthread_cond_broadcast(&system->wake);
+        pthread_mutex_unlock(&system->mutex);
+        #else
+        (void)system;
+        #endif
+    }
+}
+
+#if JOB_SYSTEM_THREADS
+// Run jobs from any queue until told to quit, sleeping while there are none.
+static void* job_worker_run(void* argument) {
+    struct job_worker* worker = argument;
+    struct job_system* system = worker->system;
+    job_thread_queue = worker->index;
+
+    while (true) {
+        struct job job;
+        if (job_take(system, worker->index, &job) == true) {
+            job_run(system, &job);
+            continue;
+        }
+        pthread_mutex_lock(&system->mutex);
+        while (atomic_load(&system->queued) == 0 && system->quit == false) {
+            pthread_cond_wait(&system->wake, &system->mutex);
+        }
+        bool quit = system->quit;
+        pthread_mutex_unlock(&system->mutex);
+        if (quit == true) break;
+    }
+    return NULL;
+}
+
+// Tell the workers to quit and join the first num_started of them, then destroy the locks and free the queues and workers.
+// The system is left with no workers and no queues, so freeing it again does nothing.
+static void job_system_stop(struct job_system* system, uint32_t num_started) {
+    pthread_mutex_lock(&system->mutex);
+    system->quit = true;
+    pthread_cond_broadcast(&system->wake);
+    pthread_mutex_unlock(&system->mutex);
+    for (uint32_t i=0; i < num_started; i++) {
+        pthread_join(system->workers[i].thread, NULL);
+    }
+    for (uint32_t i=0; i <= system->num_workers; i++) {
+        pthread_mutex_destroy(&system->queues[i].mutex);
+    }
+    pthread_mutex_destroy(&system->mutex);
+    pthread_cond_destroy(&system->wake);
+    free(system->workers);
+    free(system->queues);
+    system->workers = NULL;
+    system->queues = NULL;
+    system->num_workers = 0;
+}
+#endif
+
+// Allocate the queues and start num_workers worker threads, at most JOB_SYSTEM_MAX_WORKERS. Returns false on failure,
+// after stopping any workers already started and freeing everything, so the system holds nothing.
+// Without thread support no workers are started, whatever is asked for.
+static bool job_system_init(struct job_system* system, uint32_t num_workers) {
+    memset(system, 0, sizeof(struct job_system));
+    #if JOB_SYSTEM_THREADS
+    system->num_workers = num_workers < JOB_SYSTEM_MAX_WORKERS ? num_workers : JOB_SYSTEM_MAX_WORKERS;
+    #else
+    (void)num_workers;
+    #endif
+    system->queues = calloc(system->num_workers + 1, sizeof(struct job_queue));
+    if (system->queues == NULL) return false;
+
+    #if JOB_SYSTEM_THREADS
+    for (uint32_t i=0; i <= system->num_workers; i++) {
+        pthread_mutex_init(&system->queues[i].mutex, NULL);
+    }
+    pthread_mutex_init(&system->mutex, NULL);
+    pthread_cond_init(&system->wake, NULL);
+    system->workers = calloc(system->num_workers + 1, sizeof(struct job_worker));
+    if (system->workers == NULL) {
+        job_system_stop(system, 0);
+        return false;
+    }
+    for (uint32_t i=0; i < system->num_workers; i++) {
+        system->workers[i].system = system;
+        system->workers[i].index = i + 1;
+        if (pthread_create(&system->workers[i].thread, NULL, job_worker_run, &system->workers[i]) != 0) {
+            job_system_stop(system, i);
+            return false;
+        }
+    }
+    #endif
+    return true;
+}
+
+// Submit count jobs to the calling thread's queue, each counting down the counter when it finishes, and wake the workers.
+// Jobs that do not fit in the queue, and every job when there are no workers to hand them to, are run straight away.
+static void job_submit(struct job_system* system, void (*function)(void* data), void* data, size_t size, size_t count, struct job_counter* counter) {
+    atomic_fetch_add(&counter->pending, (uint32_t)count);
+    uint32_t index = job_thread_queue;
+    struct job_queue* queue = &system->queues[index];
+    size_t pushed = 0;
+    for (size_t i=0; i < count; i++) {
+        struct job job = {function, (unsigned char*)data + i * size, counter};
+        bool full = true;
+        if (system->num_workers > 0) {
+            #if JOB_SYSTEM_THREADS
+            pthread_mutex_lock(&queue->mutex);
+            #endif
+            full = queue->bottom - queue->top == JOB_QUEUE_CAPACITY;
+            if (full == false) {
+                queue->jobs[queue->bottom & (JOB_QUEUE_CAPACITY - 1)] = job;
+                queue->bottom++;
+                atomic_fetch_add(&system->queued, 1);
+                pushed++;
+            }
+            #if JOB_SYSTEM_THREADS
+            pthread_mutex_unlock(&queue->mutex);
+            #endif
+        }
+        if (full == true) job_run(system, &job);
+    }
+    if (pushed == 0) return;
+
+    #if JOB_SYSTEM_THREADS
+    pthread_mutex_lock(&system->mutex);
+    pthread_cond_broadcast(&system->wake);
+    pthread_mutex_unlock(&system->mutex);
+    #endif
+}
+
+// Run queued jobs on the calling thread until every job counting down the counter has finished,
+// sleeping while the ones left are running elsewhere.
+static void job_wait(struct job_system* system, struct job_counter* counter) {
+    uint32_t index = job_thread_queue;
+    while (atomic_load(&counter->pending) > 0) {
+        struct job job;
+        if (job_take(system, index, &job) == true) {
+            job_run(system, &job);
+            continue;
+        }
+        #if JOB_SYSTEM_THREADS
+        pthread_mutex_lock(&system->mutex);
+        while (atomic_load(&counter->pending) > 0 && atomic_load(&system->queued) == 0) {
+            pthread_cond_wait(&system->wake, &system->mutex);
+        }
+        pthread_mutex_unlock(&system->mutex);
+        #endif
+    }
+}
+
+// Stop the worker threads and free the queues. Every job submitted must have finished.
+static void job_system_free(struct job_system* system) {
+    if (system->queues == NULL) return;
+    #if JOB_SYSTEM_THREADS
+    job_system_stop(system, system->num_workers);
+    #else
+    free(system->queues);
+    system->queues = NULL;
+    #endif
+}
+
+#endif
@@ -0,0 +1,254 @@
+// Clustered light assignment for main.c.
+// The view frustum is split into a grid of clusters: tiles across the screen, and slices along the view direction
+// spaced exponentially between the near and far planes. Every frame, each point light is assigned to the clusters
+// its sphere of influence reaches, and the fragment shader only loops over the lights of the cluster it falls in.
+//
+// - Clusters are stored slice by slice, and tile by tile within a slice, starting from the bottom left of the screen,
+//   the same order as gl_FragCoord.
+// - Lights are given as view space spheres. A slice rejects the lights outside its depth range, then tests the rest
+//   against four of its tiles' bounding boxes at a time with the lanes_*() SIMD functions.
+// - The slices are dealt out in turn to bands, one for each thread of the job system, each assigned by a job,
+//   so no two threads write the same cluster and the crowded slices near the camera are shared between them.
+// - The result is packed into two RGBA8 textures, which need nothing beyond OpenGL ES 2.0 and WebGL 1 to sample:
+//   one texel per cluster holding a 16 bit offset and a count, and one texel per light index holding the 16 bit index.
+//
+// Include after simd.h and job_system.h.
+
+#ifndef LIGHT_CLUSTER_H
+#define LIGHT_CLUSTER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+// The size of the cluster grid. The number of tiles in a slice must be a multiple of four.
+#define LIGHT_CLUSTER_X 16
+#define LIGHT_CLUSTER_Y 9
+#define LIGHT_CLUSTER_Z 32
+#define LIGHT_CLUSTER_TILES (LIGHT_CLUSTER_X * LIGHT_CLUSTER_Y)
+#define LIGHT_CLUSTER_COUNT (LIGHT_CLUSTER_TILES * LIGHT_CLUSTER_Z)
+
+// The most lights one cluster can hold, which is also the fixed bound of the fragment shader's loop.
+// Lights past it are dropped from the cluster and counted.
+#define LIGHT_CLUSTER_MAX_PER_CLUSTER 64
+
+// The most lights, and light indices across all clusters, that fit in the textures. Both must fit in 16 bits.
+#define LIGHT_CLUSTER_MAX_LIGHTS 4096
+#define LIGHT_CLUSTER_INDEX_WIDTH 1024
+#define LIGHT_CLUSTER_INDEX_HEIGHT 64
+#define LIGHT_CLUSTER_MAX_INDICES (LIGHT_CLUSTER_INDEX_WIDTH * LIGHT_CLUSTER_INDEX_HEIGHT)
+
+// The most interleaved bands the slices are assigned in, one slice each.
+#define LIGHT_CLUSTER_MAX_BANDS LIGHT_CLUSTER_Z
+
+// The job assigning one band of a grid.
+struct light_cluster_band {
+    struct light_cluster_grid* grid;
+    uint32_t band;
+};
+
+// The view space bounds of every cluster, the lights assigned to them this frame, and the packed textures.
+struct light_cluster_grid {
+    // The bounds of each tile in each slice, and the depth range of each slice, as positive distances.
+    float* min_x;
+    float* min_y;
+    float* max_x;
+    float* max_y;
+    float slice_near[LIGHT_CLUSTER_Z];
+    float slice_far[LIGHT_CLUSTER_Z];
+    float projection[4];
+    // This frame's lights, as view space spheres.
+    const float* light_x;
+    const float* light_y;
+    const float* light_z;
+    const float* light_radius;
+    uint32_t num_lights;
+    // The lights of each cluster, and how many there are, before packing.
+    uint16_t* lights;
+    uint8_t* counts;
+    uint32_t band_dropped[LIGHT_CLUSTER_MAX_BANDS];
+    struct light_cluster_band bands[LIGHT_CLUSTER_MAX_BANDS];
+    uint32_t num_bands;
+    // The packed textures: LIGHT_CLUSTER_TILES x LIGHT_CLUSTER_Z cluster texels, and LIGHT_CLUSTER_INDEX_WIDTH x LIGHT_CLUSTER_INDEX_HEIGHT index texels.
+    uint8_t* cluster_texels;
+    uint8_t* index_texels;
+    uint32_t num_indices;
+    uint32_t num_dropped;
+};
+
+// Assign this frame's lights to the clusters of one band: every num_bands'th slice, starting from the band's own.
+static void light_cluster_assign_band(struct light_cluster_grid* grid, uint32_t band) {
+    uint32_t dropped = 0;
+    lanes zero = lanes_splat(0.0f);
+    lanes one = lanes_splat(1.0f);
+
+    for (uint32_t slice=band; slice < LIGHT_CLUSTER_Z; slice=slice + grid->num_bands) {
+        uint8_t* counts = &grid->counts[slice * LIGHT_CLUSTER_TILES];
+        uint16_t* lights = &grid->lights[(size_t)slice * LIGHT_CLUSTER_TILES * LIGHT_CLUSTER_MAX_PER_CLUSTER];
+        memset(counts, 0, LIGHT_CLUSTER_TILES);
+        float slice_near = grid->slice_near[slice];
+        float slice_far = grid->slice_far[slice];
+
+        for (uint32_t light=0; light < grid->num_lights; light++) {
+            // View space looks down negative z, so the light's depth is -z.
+            float depth = -grid->light_z[light];
+            float radius = grid->light_radius[light];
+            if (depth + radius < slice_near || depth - radius > slice_far) continue;
+
+            // The distance along z to the slice is the same for every tile in it.
+            float dz = depth < slice_near ? slice_near - depth : (depth > slice_far ? depth - slice_far : 0.0f);
+            lanes centre_x = lanes_splat(grid->light_x[light]);
+            lanes centre_y = lanes_splat(grid->light_y[light]);
+            lanes reach = lanes_splat(radius * radius - dz * dz);
+
+            for (uint32_t tile=0; tile < LIGHT_CLUSTER_TILES; tile=tile + 4) {
+                const float* min_x = &grid->min_x[slice * LIGHT_CLUSTER_TILES + tile];
+                const float* min_y = &grid->min_y[slice * LIGHT_CLUSTER_TILES + tile];
+                const float* max_x = &grid->max_x[slice * LIGHT_CLUSTER_TILES + tile];
+                const float* max_y = &grid->max_y[slice * LIGHT_CLUSTER_TILES + tile];
+                // The distance from the centre to a box along an axis is how far it lies below the minimum or above the maximum.
+                lanes dx = lanes_add(lanes_max(lanes_sub(lanes_load(min_x), centre_x), zero), lanes_max(lanes_sub(centre_x, lanes_load(max_x)), zero));
+                lanes dy = lanes_add(lanes_max(lanes_sub(lanes_load(min_y), centre_y), zero), lanes_max(lanes_sub(centre_y, lanes_load(max_y)), zero));
+                lanes mask = lanes_ge(reach, lanes_add(lanes_mul(dx, dx), lanes_mul(dy, dy)));
+                if (lanes_any(mask) == false) continue;
+
+                float hit[4];
+                lanes_store(hit, lanes_and(mask, one));
+                for (uint32_t i=0; i < 4; i++) {
+                    if (hit[i] != 1.0f) continue;
+                    uint32_t cluster = tile + i;
+                    if (counts[cluster] == LIGHT_CLUSTER_MAX_PER_CLUSTER) {
+                        dropped++;
+                        continue;
+                    }
+                    lights[cluster * LIGHT_CLUSTER_MAX_PER_CLUSTER + counts[cluster]] = (uint16_t)light;
+                    counts[cluster]++;
+                }
+            }
+        }
+    }
+    grid->band_dropped[band] = dropped;
+}
+
+// Assign a band as a job.
+static void light_cluster_band_job(void* data) {
+    struct light_cluster_band* band = data;
+    light_cluster_assign_band(band->grid, band->band);
+}
+
+// Allocate the grid. Returns false on failure.
+static bool light_cluster_init(struct light_cluster_grid* grid) {
+    memset(grid, 0, sizeof(struct light_cluster_grid));
+    grid->min_x = malloc(sizeof(float) * LIGHT_CLUSTER_COUNT);
+    grid->min_y = malloc(sizeof(float) * LIGHT_CLUSTER_COUNT);
+    grid->max_x = malloc(sizeof(float) * LIGHT_CLUSTER_COUNT);
+    grid->max_y = malloc(sizeof(float) * LIGHT_CLUSTER_COUNT);
+    grid->lights = malloc(sizeof(uint16_t) * LIGHT_CLUSTER_COUNT * LIGHT_CLUSTER_MAX_PER_CLUSTER);
+    grid->counts = calloc(LIGHT_CLUSTER_COUNT, sizeof(uint8_t));
+    grid->cluster_texels = calloc(LIGHT_CLUSTER_COUNT, 4);
+    grid->index_texels = calloc(LIGHT_CLUSTER_MAX_INDICES, 4);
+    if (grid->min_x == NULL || grid->min_y == NULL || grid->max_x == NULL || grid->max_y == NULL ||
+        grid->lights == NULL || grid->counts == NULL || grid->cluster_texels == NULL || grid->index_texels == NULL) {
+        return false;
+    }
+    for (uint32_t i=0; i < LIGHT_CLUSTER_MAX_BANDS; i++) {
+        grid->bands[i].grid = grid;
+        grid->bands[i].band = i;
+    }
+    grid->num_bands = 1;
+    return true;
+}
+
+// Build the bounds of every cluster for a perspective projection, given its vertical field of view in radians.
+// Nothing is rebuilt when the projection has not changed.
+static void light_cluster_set_projection(struct light_cluster_grid* grid, float fov, float aspect, float near, float far) {
+    if (grid->projection[0] == fov && grid->projection[1] == aspect && grid->projection[2] == near && grid->projection[3] == far) return;
+    grid->projection[0] = fov;
+    grid->projection[1] = aspect;
+    grid->projection[2] = near;
+    grid->projection[3] = far;
+
+    float tan_y = tanf(fov * 0.5f);
+    float tan_x = tan_y * aspect;
+    for (uint32_t slice=0; slice < LIGHT_CLUSTER_Z; slice++) {
+        grid->slice_near[slice] = near * powf(far / near, (float)slice / LIGHT_CLUSTER_Z);
+        grid->slice_far[slice] = near * powf(far / near, (float)(slice + 1) / LIGHT_CLUSTER_Z);
+    }
+
+    // A tile's sides spread out with depth, so its box spans the tile at whichever end of the slice is wider.
+    for (uint32_t slice=0; slice < LIGHT_CLUSTER_Z; slice++) {
+        for (uint32_t y=0; y < LIGHT_CLUSTER_Y; y++) {
+            for (uint32_t x=0; x < LIGHT_CLUSTER_X; x++) {
+                float left = (2.0f * x / LIGHT_CLUSTER_X - 1.0f) * tan_x;
+                float right = (2.0f * (x + 1) / LIGHT_CLUSTER_X - 1.0f) * tan_x;
+                float bottom = (2.0f * y / LIGHT_CLUSTER_Y - 1.0f) * tan_y;
+                float top = (2.0f * (y + 1) / LIGHT_CLUSTER_Y - 1.0f) * tan_y;
+                float depths[2] = {grid->slice_near[slice], grid->slice_far[slice]};
+                uint32_t cluster = slice * LIGHT_CLUSTER_TILES + y * LIGHT_CLUSTER_X + x;
+                grid->min_x[cluster] = fminf(left * depths[0], left * depths[1]);
+                grid->max_x[cluster] = fmaxf(right * depths[0], right * depths[1]);
+                grid->min_y[cluster] = fminf(bottom * depths[0], bottom * depths[1]);
+                grid->max_y[cluster] = fmaxf(top * depths[0], top * depths[1]);
+            }
+        }
+    }
+}
+
+// Assign view space lights to the clusters as a band job for each thread of the job system, waiting for them all and helping with the bands left,
+// then pack the result into the cluster and index texels. Lights past LIGHT_CLUSTER_MAX_LIGHTS are ignored.
+static void light_cluster_assign(struct light_cluster_grid* grid, struct job_system* jobs, const float* x, const float* y, const float* z, const float* radius, uint32_t count) {
+    grid->light_x = x;
+    grid->light_y = y;
+    grid->light_z = z;
+    grid->light_radius = radius;
+    grid->num_lights = count < LIGHT_CLUSTER_MAX_LIGHTS ? count : LIGHT_CLUSTER_MAX_LIGHTS;
+
+    grid->num_bands = jobs->num_workers + 1 < LIGHT_CLUSTER_MAX_BANDS ? jobs->num_workers + 1 : LIGHT_CLUSTER_MAX_BANDS;
+    struct job_counter counter = {0};
+    job_submit(jobs, light_cluster_band_job, grid->bands, sizeof(struct light_cluster_band), grid->num_bands, &counter);
+    job_wait(jobs, &counter);
+
+    // Lay the clusters' lists out one after another, in cluster order.
+    grid->num_indices = 0;
+    grid->num_dropped = 0;
+    for (uint32_t i=0; i < grid->num_bands; i++) {
+        grid->num_dropped = grid->num_dropped + grid->band_dropped[i];
+    }
+    for (uint32_t cluster=0; cluster < LIGHT_CLUSTER_COUNT; cluster++) {
+        uint32_t cluster_count = grid->counts[cluster];
+        if (grid->num_indices + cluster_count > LIGHT_CLUSTER_MAX_INDICES) {
+            grid->num_dropped = grid->num_dropped + cluster_count - (LIGHT_CLUSTER_MAX_INDICES - grid->num_indices);
+            cluster_count = LIGHT_CLUSTER_MAX_INDICES - grid->num_indices;
+        }
+        uint8_t* texel = &grid->cluster_texels[cluster * 4];
+        texel[0] = (uint8_t)(grid->num_indices & 0xFF);
+        texel[1] = (uint8_t)(grid->num_indices >> 8);
+        texel[2] = (uint8_t)cluster_count;
+        texel[3] = 0;
+
+        const uint16_t* lights = &grid->lights[(size_t)cluster * LIGHT_CLUSTER_MAX_PER_CLUSTER];
+        for (uint32_t i=0; i < cluster_count; i++) {
+            uint8_t* index = &grid->index_texels[(grid->num_indices + i) * 4];
+            index[0] = (uint8_t)(lights[i] & 0xFF);
+            index[1] = (uint8_t)(lights[i] >> 8);
+        }
+        grid->num_indices = grid->num_indices + cluster_count;
+    }
+}
+
+// Free the grid.
+static void light_cluster_free(struct light_cluster_grid* grid) {
+    free(grid->min_x);
+    free(grid->min_y);
+    free(grid->max_x);
+    free(grid->max_y);
+    free(grid->lights);
+    free(grid->counts);
+    free(grid->cluster_texels);
+    free(grid->index_texels);
+}
+
+#endif
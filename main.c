@@ -4,13 +4,31 @@
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <cglm/cglm.h>
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
+#include <emscripten/heap.h>
 #endif
 
+#include "model_format.h"
+#include "model_stream.h"
+#include "text_model_parser.h"
+#include "mesh_split.h"
+#include "mesh_cluster.h"
+#include "simd.h"
+#include "job_system.h"
+#include "occlusion.h"
+#include "light_cluster.h"
+#include "profiler.h"
+#include "arena.h"
+
 // Program status variables
 #define RUNNING 1
 #define QUIT 0
@@ -19,6 +37,159 @@
 #define SCREEN_WIDTH 1280
 #define SCREEN_HEIGHT 720
 
+// The camera's vertical field of view in degrees, and its near and far planes.
+#define CAMERA_FOV 45.0f
+#define CAMERA_NEAR 0.1f
+#define CAMERA_FAR 1000000.0f
+
+// Levels of detail are picked so simplification moves the surface by at most this many pixels on screen.
+// A mesh only switches to a coarser level once the error is this fraction below the threshold, and only
+// returns to a finer level once the error is this fraction above it, so levels do not flicker.
+#define LOD_PIXEL_ERROR 1.0f
+#define LOD_HYSTERESIS 0.25f
+
+// Every shader variant binds its vertex attributes to these locations, so a mesh's vertex array object works with all of them.
+// The instance model matrix takes four locations, one per column.
+#define ATTRIBUTE_POSITION 0
+#define ATTRIBUTE_VERTEX_COLOR 1
+#define ATTRIBUTE_VERTEX_NORMAL 2
+#define ATTRIBUTE_INSTANCE_MODEL 3
+#define ATTRIBUTE_INSTANCE_TINT 7
+
+// The features a shader variant is compiled with, each injected into the shader sources as a #define.
+// Flat shading and specular lighting are chosen for the whole scene, and the others by the mesh being drawn.
+#define SHADER_FEATURE_FLAT_SHADING (1 << 0)
+#define SHADER_FEATURE_QUANTISED (1 << 1)
+#define SHADER_FEATURE_INSTANCED (1 << 2)
+#define SHADER_FEATURE_SPECULAR (1 << 3)
+#define SHADER_FEATURE_CLUSTERED_LIGHTS (1 << 4)
+#define SHADER_FEATURE_COUNT 5
+
+// Linked shader programs are cached in this directory on native builds, keyed by the driver, the sources and the features.
+#define SHADER_CACHE_DIRECTORY "shader_cache"
+#define SHADER_CACHE_MAGIC 0x48535943
+
+// Point lights drift around the scene, lighting it through the clustered light grid in light_cluster.h.
+// The demo scatters this many unless told otherwise with --lights, each reaching about this fraction of the scene's size.
+#define LIGHT_DEFAULT_COUNT 1024
+#define LIGHT_RADIUS_FRACTION 0.03f
+
+// Point lights are stored in an RGBA8 texture, three texels per light in one column of three consecutive rows:
+// x and y, then z and the radius, as 16 bit values across the bounds of all lights, then the colour.
+#define LIGHT_TEXTURE_WIDTH 1024
+#define LIGHT_TEXTURE_HEIGHT (LIGHT_CLUSTER_MAX_LIGHTS / LIGHT_TEXTURE_WIDTH * 3)
+
+// The texture units the clustered lighting textures are bound to.
+#define LIGHT_TEXTURE_UNIT 0
+#define LIGHT_CLUSTER_TEXTURE_UNIT 1
+#define LIGHT_INDEX_TEXTURE_UNIT 2
+
+// The scene is drawn into an offscreen render target at between these fractions of the window's size, stretched over the window,
+// aiming for frames to cost this many milliseconds unless told otherwise with --target-frame-ms. The scale is reconsidered every
+// few frames from their average cost, moving towards where the cost would meet the target with this much headroom, by at most
+// these factors at a time: quickly down when over budget, and slowly up.
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.5f
+#define DYNAMIC_RESOLUTION_MAX_SCALE 1.0f
+#define DYNAMIC_RESOLUTION_TARGET_MS 16.0
+#define DYNAMIC_RESOLUTION_INTERVAL 8
+#define DYNAMIC_RESOLUTION_HEADROOM 0.85
+#define DYNAMIC_RESOLUTION_MAX_DECREASE 0.8f
+#define DYNAMIC_RESOLUTION_MAX_INCREASE 1.05f
+
+// The texture unit the render target is bound to while it is stretched over the window.
+#define DYNAMIC_RESOLUTION_TEXTURE_UNIT 3
+
+// WebGL 1 guarantees a packed depth and stencil renderbuffer, which has more depth precision than its only plain depth format.
+#ifndef GL_DEPTH_STENCIL
+#define GL_DEPTH_STENCIL 0x84F9
+#endif
+#ifndef GL_DEPTH_STENCIL_ATTACHMENT
+#define GL_DEPTH_STENCIL_ATTACHMENT 0x821A
+#endif
+
+// Render passes, in the order they are drawn: opaque geometry without blending, then translucent geometry blended over it.
+#define RENDER_PASS_OPAQUE 0
+#define RENDER_PASS_TRANSLUCENT 1
+
+// Static objects whose models have at most this many vertices are merged into shared batch pages,
+// each holding up to STATIC_BATCH_PAGE_VERTICES vertices so it can be drawn with 16 bit indices.
+#define STATIC_BATCH_MAX_VERTICES 16384
+#define STATIC_BATCH_PAGE_VERTICES 65536
+
+// Without instancing, runs of instances of a level of detail with at most this many vertices are copied into world space on the CPU
+// and drawn together, up to DYNAMIC_BATCH_VERTICES vertices a draw call so they can be drawn with 16 bit indices.
+#define DYNAMIC_BATCH_MAX_VERTICES 1024
+#define DYNAMIC_BATCH_VERTICES 65536
+
+// Meshes of occluder objects are rasterised into the occlusion buffer when they cover at least this many pixels
+// across on screen, up to this many triangles a frame, at the level of detail they were last drawn at.
+#define OCCLUSION_OCCLUDER_PIXELS 64.0f
+#define OCCLUSION_MAX_TRIANGLES 65536
+
+// Culling is split into this many jobs for every thread that runs them, so threads that finish early can steal the rest.
+// Objects whose cluster trees have at least this many nodes are split into their subtrees until there are enough pieces to go round.
+#define CULL_JOBS_PER_THREAD 4
+#define CULL_SPLIT_NODES 64
+
+// Builds made with -DBENCHMARK_BUILD=1 run the headless benchmark without needing --benchmark.
+#ifndef BENCHMARK_BUILD
+#define BENCHMARK_BUILD 0
+#endif
+
+// The benchmark draws this many frames unless told otherwise, after a few untimed frames to warm up caches and drivers.
+// Its scripted camera path orbits the scene at this many times the scene's bounding radius.
+#define BENCHMARK_FRAMES 1000
+#define BENCHMARK_WARMUP_FRAMES 30
+#define BENCHMARK_ORBIT_RADIUS 1.2f
+
+// The simulation advances in fixed steps, this many a second whatever the frame rate, and catches up by at most
+// this many steps a frame so that a long stall does not snowball into ever longer frames.
+#define SIMULATION_RATE 120
+#define SIMULATION_MAX_STEPS 8
+
+// Frame pacing sleeps until this many seconds before a frame is due and spins for the rest, as sleeping overshoots.
+// Frame times and their jitter are measured over this many frames.
+#define FRAME_SPIN_SECONDS 0.002
+#define FRAME_HISTORY 120
+
+// The file the profiler's Chrome trace is exported to.
+#define PROFILER_TRACE_FILENAME "profile_trace.json"
+
+// The most mesh data uploaded to the GPU per frame while objects are streaming in.
+#define UPLOAD_BUDGET_BYTES (4 * 1024 * 1024)
+
+// Builds made with -DRELEASE_CPU_MESHES=1 free the CPU copies of meshes once they are on the GPU and nothing else needs them,
+// unless run with --keep-cpu-meshes. Web builds do by default, as the WebAssembly heap is small.
+#ifndef RELEASE_CPU_MESHES
+#ifdef __EMSCRIPTEN__
+#define RELEASE_CPU_MESHES 1
+#else
+#define RELEASE_CPU_MESHES 0
+#endif
+#endif
+
+// A freed mesh's GPU buffer is reused for a new one needing at least this fraction of its size.
+#define BUFFER_POOL_MIN_FILL 0.5
+
+// Objects are loaded on a background thread everywhere except web builds without pthread support.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define THREADS_AVAILABLE 0
+#else
+#define THREADS_AVAILABLE 1
+#include <pthread.h>
+#endif
+
+// Streamed models written by 'object_converter_tool --stream' are read from disk this many bytes at a time,
+// decoding each piece as it arrives. Web builds made with -DMODEL_STREAM_FETCH=1 download the stream instead
+// of embedding a model, and draw each mesh's coarsest levels while the rest is still on its way.
+#define MODEL_STREAM_READ_SIZE 65536
+#ifndef MODEL_STREAM_FETCH
+#define MODEL_STREAM_FETCH 0
+#endif
+#if MODEL_STREAM_FETCH && (!defined(__EMSCRIPTEN__) || THREADS_AVAILABLE)
+#error "MODEL_STREAM_FETCH needs a web build without pthreads, as compile_web makes."
+#endif
+
 // Shader attributes.
 struct attributes {
     GLint position;
@@ -27,16 +198,28 @@ struct attributes {
     GLint fragment_color;
     GLint vertex_normal;
     GLint fragment_normal;
+    GLint instance_model;
+    GLint instance_tint;
 };
 
 // Shader uniforms
+// Variants without instancing take the model matrix and tint as uniforms.
 struct uniforms {
-    GLint model;
     GLint view;
     GLint projection;
     GLint light_color;
     GLint light_position;
     GLint camera_position;
+    GLint position_offset;
+    GLint position_scale;
+    GLint model;
+    GLint tint;
+    GLint light_texture;
+    GLint cluster_texture;
+    GLint light_index_texture;
+    GLint cluster_parameters;
+    GLint light_offset;
+    GLint light_scale;
 };
 
 // Store mouse data
@@ -48,8 +231,12 @@ struct mouse {
 };
 
 // Store camera data
+// The simulation moves position in fixed steps, remembering where the last step started in previous_position.
+// Frames are drawn from render_position, part of the way between the two.
 struct camera {
     vec3 position;
+    vec3 previous_position;
+    vec3 render_position;
     vec3 front;
     vec3 up;
 
@@ -60,10 +247,44 @@ struct camera {
     struct mouse mouse;
 };
 
+// A point on a camera path.
+struct camera_keyframe {
+    vec3 position;
+    float yaw;
+    float pitch;
+};
+
+// Settings for the headless benchmark, from the command line.
+// Without a camera path the benchmark orbits the scene.
+struct benchmark {
+    bool enabled;
+    unsigned int frames;
+    char* camera_path;
+    char* output;
+    bool occlusion_culling;
+    unsigned int lights;
+};
+
 // Store timing data to render the scene smoothly.
+// The simulation runs in fixed steps of delta_time, with the time it has still to catch up on in accumulator,
+// and frames are drawn alpha of the way from the previous step to the latest.
+// Frames are paced by the swap interval and an optional cap in frames per second. Low latency mode waits for the cap
+// before reading input rather than after, and lets the GPU finish each frame before the next one starts.
+// The durations of the last FRAME_HISTORY frames give the frame time and its jitter.
 struct timing {
     float delta_time;
-    float last_time;
+    double last_time;
+    double accumulator;
+    float alpha;
+    int swap_interval;
+    unsigned int frame_cap;
+    bool low_latency;
+    double next_frame;
+    double frame_durations[FRAME_HISTORY];
+    unsigned int num_frame_durations;
+    unsigned int next_frame_duration;
+    bool low_latency_key;
+    bool vsync_key;
 };
 
 // Store light data.
@@ -72,44 +293,469 @@ struct light {
     vec3 light_position;
 };
 
-// Vertex data
-struct vertex {
+// A point light circling around an anchor point, lighting everything within its radius.
+struct point_light {
+    vec3 anchor;
     vec3 position;
-    vec4 vertex_color;
-    vec3 normal;
+    vec3 color;
+    float radius;
+    float phase;
+    float speed;
+};
+
+// The values last uploaded to a shader's uniforms, so uploads that would not change anything are skipped.
+struct uniform_values {
+    vec3 light_color;
+    vec3 light_position;
+    vec3 camera_position;
+    mat4 view;
+    mat4 projection;
+    vec3 position_offset;
+    vec3 position_scale;
+    mat4 model;
+    vec4 tint;
+    vec4 cluster_parameters;
+    vec4 light_offset;
+    vec4 light_scale;
 };
 
 // A shader program struct.
 // This stores the link to a compiled shader program as well as attributes and uniforms.
+// Each is one variant of vertex.glsl and fragment.glsl, compiled with the SHADER_FEATURE_* bits in features the first time it is used.
+// The id orders draws using the shader in the render queue.
 struct shader {
     GLuint shader;
+    uint32_t id;
+    uint32_t features;
     struct attributes attributes;
     struct uniforms uniforms;
+    struct uniform_values values;
     struct shader* next;
 };
 
+// A level of detail of a mesh: a range of the mesh's indices, and how far in model units simplification moved the surface.
+// Its triangles use only the first num_vertices vertices, which lets streamed meshes draw a level as soon as that prefix has arrived.
+struct mesh_lod {
+    unsigned int first_index;
+    unsigned int num_indices;
+    float error;
+    unsigned int num_vertices;
+};
+
 // A mesh of verticies, vertex colours and faces.
 // It also contains data for VBO, EBO and VAO so OpenGL can load the data into GPU and process it.
+// Indices are GL_UNSIGNED_SHORT unless the mesh has more than 65,536 vertices and 32 bit indices are supported.
+// Vertices are either struct model_file_vertex, the one float layout shared with binary files and the text parser,
+// or quantised struct model_file_packed_vertex which the vertex shader dequantises with the position scale and offset.
+// The indices hold every level of detail's triangles one after another, all drawn from the same vertices.
+// Meshes with any vertex colour less than fully opaque are translucent, and drawn blended after everything opaque.
+// The id is given when the mesh is uploaded, and orders draws using the mesh in the render queue.
+// Meshes holding the geometry of a static batch page point back at the page.
+// Only the first available vertices and indices have been loaded, which is all of them unless the mesh is streaming in,
+// and levels from ready_lod on are uploaded and drawable. Streamed meshes store their coarsest level first.
+// Mapped meshes point into their model's memory mapped file rather than owning their vertices and indices.
+// Either may be NULL once the mesh is on the GPU, if its CPU copies have been released. Meshes of occluders then keep
+// the decoded positions and indices of their coarsest level of detail, for occlusion culling to rasterise.
+// Its buffers may be recycled from an unloaded scene's meshes, and be larger than it needs.
 struct mesh {
-    struct vertex *vertices;
+    void *vertices;
     unsigned int num_vertices;
-    GLushort *indices;
+    uint32_t vertex_format;
+    vec3 position_offset;
+    vec3 position_scale;
+    vec3 bounds_min;
+    vec3 bounds_max;
+    vec3 bounds_centre;
+    float bounds_radius;
+    void *indices;
     unsigned int num_indices;
+    GLenum index_type;
+    struct mesh_lod lods[MODEL_FORMAT_MAX_LODS];
+    unsigned int num_lods;
+    bool translucent;
+    bool mapped;
+    uint32_t id;
+    struct batch_page* page;
     GLuint VBO;
     GLuint EBO;
     GLuint VAO;
+    size_t vertex_buffer_size;
+    size_t index_buffer_size;
+    size_t uploaded_vertex_bytes;
+    size_t uploaded_index_bytes;
+    unsigned int available_vertices;
+    unsigned int available_indices;
+    unsigned int ready_lod;
+    bool uploaded;
+    float* occluder_positions;
+    void* occluder_indices;
+    unsigned int occluder_num_vertices;
+    unsigned int occluder_num_indices;
     struct mesh* next;
 };
 
-// A template to create objects.
-// This stores mesh information, world position, size, rotation and a link to the next object.
-struct object {
+// A node of a model's cluster tree, with bounds in model space enclosing its whole subtree.
+// Children are the num_children nodes starting at first_child. The subtree's meshes are the num_meshes
+// entries of the model's mesh table starting at first_mesh, and only leaves own meshes directly.
+struct cluster_node {
+    vec3 bounds_min;
+    vec3 bounds_max;
+    uint32_t first_child;
+    uint32_t num_children;
+    uint32_t first_mesh;
+    uint32_t num_meshes;
+};
+
+// Loads a model's meshes in the background.
+// The loader thread appends finished meshes to the pending list, and the main thread moves them
+// into the model and uploads them to the GPU a few megabytes per frame.
+// Streamed models publish their meshes empty as soon as the tables have arrived, and then how many of each
+// mesh's vertices and indices have been decoded, indexed by the mesh table, after every piece.
+// The meshes and cluster tree are allocated from the loader's own arena, which the scene adopts when the loader is freed.
+// A loader that could not download its file finishes with failed set, for the main thread to report.
+struct loader {
+    char* filename;
+    struct arena arena;
+    struct mesh* pending;
+    struct mesh** pending_tail;
+    struct cluster_node* nodes;
+    size_t num_nodes;
+    void* mapping;
+    size_t mapping_size;
+    bool started;
+    bool finished;
+    bool failed;
+    double start_time;
+    bool streaming;
+    struct model_stream_decoder stream;
+    struct mesh** stream_meshes;
+    unsigned int* available_vertices;
+    unsigned int* available_indices;
+    size_t num_stream_meshes;
+    uint64_t bytes_received;
+    uint64_t bytes_decoded;
+    uint64_t bytes_taken;
+    double decode_time;
+    double first_draw_time;
+    uint64_t first_draw_bytes;
+    #if THREADS_AVAILABLE
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    #endif
+};
+
+// A model loaded from a file, shared by every object drawn with it.
+// The meshes are kept both as a list, which they are streamed in through, and as a table the cluster tree indexes.
+// The bounds are the root node's bounds, in model space.
+// The model counts the objects using it, and is freed when the last is deleted, or once it has loaded if it is still loading.
+// Once its meshes' CPU copies have been released, only what culling needs, the bounds and the cluster tree, stays in memory.
+struct model {
     char* name;
     struct mesh* meshes;
-    vec3 position;
-    vec3 scale;
-    float rotation;
-    struct object* next;
+    struct mesh** mesh_table;
+    size_t num_meshes;
+    struct cluster_node* nodes;
+    size_t num_nodes;
+    vec3 bounds_min;
+    vec3 bounds_max;
+    vec3 bounds_centre;
+    float bounds_radius;
+    void* mapping;
+    size_t mapping_size;
+    struct loader* loader;
+    uint32_t num_objects;
+    bool cpu_needed;
+    bool cpu_released;
+    bool occluder;
+    struct model* next;
+};
+
+// The part of a static batch page one mesh of one object was copied into: a range of indices for each of the mesh's levels of detail.
+// The relative starts are within the level's section of the page, and the absolute starts within the page's whole index buffer.
+struct batch_range {
+    uint32_t relative_first_index[MODEL_FORMAT_MAX_LODS];
+    uint32_t first_index[MODEL_FORMAT_MAX_LODS];
+    uint32_t num_indices[MODEL_FORMAT_MAX_LODS];
+};
+
+// A page of static geometry: pre-transformed float vertices in world space shared by many objects, drawn through its mesh.
+// The index buffer holds one section per level of detail, and every range's indices for a level are kept in the level's section
+// in the order the ranges were added, so ranges drawn next to each other at the same level merge into one draw call.
+// Pages are rebuilt on the GPU whenever objects are added to them.
+struct batch_page {
+    struct mesh* mesh;
+    struct model_file_vertex* vertices;
+    uint32_t num_vertices;
+    uint16_t* indices[MODEL_FORMAT_MAX_LODS];
+    uint32_t num_indices[MODEL_FORMAT_MAX_LODS];
+    uint32_t indices_capacity[MODEL_FORMAT_MAX_LODS];
+    struct batch_range* ranges;
+    uint32_t num_ranges;
+    uint32_t ranges_capacity;
+    bool dirty;
+    struct batch_page* next;
+};
+
+// Where one of a static object's meshes was batched: its page and the index of its range there.
+struct batch_slot {
+    struct batch_page* page;
+    uint32_t range;
+};
+
+// Instances copied into world space so a run of them can be drawn with one call when instancing is unavailable.
+// The mesh's buffers are refilled from the vertices and indices for every draw, and the mesh is NULL with instancing.
+struct dynamic_batch {
+    struct mesh* mesh;
+    struct model_file_vertex* vertices;
+    uint16_t* indices;
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint32_t indices_capacity;
+};
+
+// A template to create objects.
+// An object places an instance of a shared model in the world with its own tint, at the transform of its entry in the scene.
+// It remembers the level of detail it last drew each of the model's meshes at, so levels switch with hysteresis per instance.
+// Static objects never move, and once their model has loaded small opaque ones are copied into batch pages,
+// with a slot for each of the model's meshes. Static objects that cannot be batched are drawn like any other.
+// The large opaque meshes of occluder objects, such as terrain, hide what is behind them from the rest of the scene.
+struct object {
+    struct model* model;
+    uint8_t* lods;
+    bool is_static;
+    bool is_occluder;
+    bool batch_checked;
+    struct batch_slot* batch_slots;
+    vec4 tint;
+    uint32_t handle;
+};
+
+// Every object in the world, stored as contiguous arrays indexed alike, with the transform split into one array per component.
+// Objects are referred to by handles, which stay valid while objects are added and removed; removing an object
+// moves the last one into its place, so slots maps handles to array indices and handles maps them back.
+// The world matrices and world bounding spheres are rebuilt by scene_update() for the objects marked dirty since the last update,
+// four at a time with SIMD. The arrays always hold a multiple of four entries, padded with identity transforms.
+// Rotations are unit quaternions, and the bounds are a bounding sphere in model space.
+// The scene's arena holds its models, their meshes and cluster trees, and its objects' levels of detail and batch slots,
+// all freed together when the scene is unloaded. Vertex and index arrays are allocated on their own, so they can be released early.
+struct scene {
+    struct object* objects;
+    float* position_x;
+    float* position_y;
+    float* position_z;
+    float* scale_x;
+    float* scale_y;
+    float* scale_z;
+    float* rotation_x;
+    float* rotation_y;
+    float* rotation_z;
+    float* rotation_w;
+    float* bounds_x;
+    float* bounds_y;
+    float* bounds_z;
+    float* bounds_radius;
+    float* world_x;
+    float* world_y;
+    float* world_z;
+    float* world_radius;
+    float* world_scale;
+    mat4* world;
+    uint8_t* dirty;
+    uint8_t* visible;
+    uint32_t* handles;
+    size_t count;
+    size_t capacity;
+    size_t num_dirty;
+    uint32_t* slots;
+    size_t num_slots;
+    size_t slots_capacity;
+    uint32_t free_slot;
+    struct arena arena;
+};
+
+// The per instance attributes streamed to the GPU for every draw: the model matrix, column by column, and the tint.
+struct instance {
+    mat4 model;
+    vec4 tint;
+};
+
+// One mesh of one object to draw this frame, at the given level of detail, with the features of the shader variant that suits it.
+// instance indexes the frame's instance array, and the key orders the packet in the render queue.
+// For a batch page's mesh, instance is instead the index of the range to draw in the page.
+struct render_packet {
+    uint64_t key;
+    uint32_t features;
+    struct mesh* mesh;
+    uint32_t lod;
+    uint32_t instance;
+};
+
+// Everything drawn in a frame, gathered while culling and then sorted by key, with the instances copied into packet order.
+// Runs of packets sharing a mesh and level of detail become one instanced draw, reading their per instance
+// attributes from the instance buffer, which is refilled every frame.
+struct render_queue {
+    struct instance* instances;
+    size_t num_instances;
+    size_t instances_capacity;
+    struct render_packet* packets;
+    struct render_packet* scratch;
+    size_t num_packets;
+    size_t packets_capacity;
+    struct instance* ordered;
+    size_t ordered_capacity;
+};
+
+// The OpenGL state last set through the render_state_*() functions, so binds that would not change anything are skipped.
+// Everything starts out unknown, so the first call always reaches OpenGL.
+struct render_state {
+    GLuint shader;
+    GLuint vertex_array;
+    int blend;
+    int depth_write;
+};
+
+// The offscreen render target the scene is drawn into, and the controller that picks its resolution.
+// The target is allocated at the window's framebuffer size, and each frame draws into its bottom left corner, scale times
+// the size of the window, which is then stretched over the window. The scale follows the cost of frames: their GPU time
+// where timer queries can measure it, and otherwise the CPU time spent drawing them, leaving out waiting for the swap.
+// Without framebuffer objects the scene is drawn straight to the window at full size.
+struct dynamic_resolution {
+    bool supported;
+    bool enabled;
+    bool key;
+    GLuint framebuffer;
+    GLuint color;
+    GLuint depth;
+    int width;
+    int height;
+    int render_width;
+    int render_height;
+    float scale;
+    double target_time;
+    double cost;
+    unsigned int frames;
+    GLuint upscale_shader;
+    GLint upscale_region;
+    GLint upscale_scene;
+    GLuint upscale_buffer;
+    GLuint upscale_vertex_array;
+    GLuint window_framebuffer;
+    GLuint window_color;
+    GLuint window_depth;
+};
+
+// Counters from the last frame, showing how much work frustum and occlusion culling saved and how much was drawn and uploaded.
+// Nodes and meshes hidden by occluders are counted as occluded rather than culled.
+struct render_stats {
+    unsigned int objects_culled;
+    unsigned int nodes_tested;
+    unsigned int nodes_culled;
+    unsigned int meshes_culled;
+    unsigned int nodes_occluded;
+    unsigned int meshes_occluded;
+    unsigned int occluder_triangles;
+    unsigned int meshes_drawn;
+    unsigned int triangles_drawn;
+    unsigned int draw_calls;
+    unsigned int state_changes;
+    unsigned int state_changes_skipped;
+    unsigned int lights;
+    unsigned int light_indices;
+    unsigned int lights_dropped;
+    size_t bytes_uploaded;
+};
+
+// Bytes held in CPU memory, including memory mapped model files, and in GPU buffers.
+struct memory_usage {
+    size_t cpu_bytes;
+    size_t gpu_bytes;
+};
+
+// A GPU buffer left over from a freed mesh, kept to be reused by a new mesh that fits in it.
+// WebGL never lets a buffer bound as an index buffer hold vertices or the other way round, so each remembers its target.
+struct pooled_buffer {
+    GLuint buffer;
+    GLenum target;
+    size_t size;
+};
+
+// The GPU buffers of freed meshes, waiting to be reused while the next scene loads, and how many were reused and created since the last switch.
+struct buffer_pool {
+    struct pooled_buffer* buffers;
+    size_t count;
+    size_t capacity;
+    uint32_t reused;
+    uint32_t created;
+};
+
+// The scenes that can be switched between, each a model file drawn as one static occluder object, and the switch in progress.
+struct scene_list {
+    char** filenames;
+    size_t count;
+    size_t current;
+    bool keys[2];
+    bool switching;
+    double switch_start;
+    double unload_time;
+};
+
+// What picking a mesh's level of detail needs to know about the camera and the object being drawn:
+// the camera position, how many pixels a unit covers at a distance of one unit, and the largest scale of the object.
+struct lod_view {
+    vec3 camera_position;
+    float pixels_per_unit;
+    float scale;
+};
+
+// Scratch space for walking a cluster tree.
+// Sibling nodes are tested as one batch, with their world space box centres and half extents kept in
+// separate arrays so the plane tests vectorise. The stack holds ranges of sibling nodes still to test.
+struct cull_batch {
+    float* centre_x;
+    float* centre_y;
+    float* centre_z;
+    float* extent_x;
+    float* extent_y;
+    float* extent_z;
+    uint8_t* visible;
+    uint8_t* inside;
+    size_t capacity;
+    uint32_t* stack;
+    size_t stack_capacity;
+};
+
+// A piece of the scene for a culling job to walk: the subtree of one node of an object's cluster tree.
+struct cull_item {
+    uint32_t object;
+    uint32_t node;
+};
+
+// Everything one frame's draw submission needs, prepared by the jobs: the camera it was culled from, the sorted render queue,
+// the range the point lights were packed across and the counters from preparing it.
+// There are two, so the jobs can prepare the next frame while the main thread submits the last one to OpenGL.
+struct frame {
+    mat4 view;
+    mat4 projection;
+    mat4 view_projection;
+    vec4 planes[6];
+    struct lod_view lod_view;
+    vec4 light_offset;
+    vec4 light_scale;
+    bool lights_updated;
+    bool prepared;
+    struct render_queue queue;
+    struct render_stats stats;
+};
+
+// A culling job: a range of the frame's cull items, and the scratch space, render queue and counters it fills,
+// which are merged into the frame's once every job has finished.
+struct cull_job {
+    struct frame* frame;
+    size_t first_item;
+    size_t num_items;
+    struct cull_batch batch;
+    struct render_queue queue;
+    struct render_stats stats;
 };
 
 // The global program state.
@@ -119,11 +765,61 @@ struct program {
     struct camera camera;
     struct timing timing;
     int status;
-    struct object* objects;
+    struct model* models;
+    struct scene scene;
     struct light light;
+    struct point_light* lights;
+    uint32_t num_lights;
+    bool lights_placed;
+    float* light_view;
+    uint8_t* light_texels;
+    vec4 cluster_parameters;
+    struct light_cluster_grid light_grid;
+    GLuint light_texture;
+    GLuint light_cluster_texture;
+    GLuint light_index_texture;
     struct shader* shaders;
-    GLuint shader;
+    uint32_t num_shaders;
+    uint32_t shading_features;
+    bool shading_keys[3];
+    char* vertex_source;
+    char* fragment_source;
+    bool program_binary_supported;
     bool opengl_initialised;
+    int framebuffer_width;
+    int framebuffer_height;
+    struct dynamic_resolution dynamic_resolution;
+    bool profiler_overlay;
+    bool profiler_overlay_key;
+    bool profiler_export_key;
+    bool occlusion_culling;
+    bool occlusion_key;
+    struct occlusion_buffer occlusion;
+    float* occluder_positions;
+    size_t occluder_positions_capacity;
+    FILE* camera_record;
+    bool index_uint_supported;
+    bool instancing_supported;
+    struct render_stats render_stats;
+    struct job_system jobs;
+    struct frame frames[2];
+    uint32_t frame_index;
+    bool pipelined;
+    struct cull_item* cull_items;
+    size_t num_cull_items;
+    size_t cull_items_capacity;
+    struct cull_job* cull_jobs;
+    size_t num_cull_jobs;
+    GLuint instance_buffer;
+    struct render_state render_state;
+    struct batch_page* batch_pages;
+    struct dynamic_batch dynamic_batch;
+    uint32_t next_mesh_id;
+    double stats_time;
+    bool release_cpu_meshes;
+    bool memory_report_key;
+    struct buffer_pool buffer_pool;
+    struct scene_list scenes;
 };
 
 // A pointer to the globla state on the heap.
@@ -225,28 +921,18 @@ void helper_opengl_print_log(GLuint object) {
     return;
 }
 
-// Read a shader file and compile a shader.
-// Free resources and return 0 on failure.
-GLuint helper_opengl_create_shader(char* filename, GLenum type) {
-    // Load the source to the shader
-    const GLchar* source = helper_file_to_string(filename);
-    if (source == NULL) {
-        printf("helper_opengl_print_log(): Failed to read shader file from file_to_string(). Returning.\n");
-        return 0;
-    }
-
+// Compile a shader from its source, with a variant's #define lines.
+// Return 0 on failure.
+GLuint helper_opengl_create_shader(const char* filename, const char* source, const char* defines, GLenum type) {
     // Create the shader
     GLuint shader = glCreateShader(type);
 
-    // Configure and load shader source code.
+    // Configure and load shader source code, with the variant's defines after the version.
     const GLchar* sources[] = {
-        "#version 100\n", source
+        "#version 100\n", defines, source
     };
 
-    glShaderSource(shader, 2, sources, NULL);
-
-    // Free opened shader source file
-    free((void*) source);
+    glShaderSource(shader, 3, sources, NULL);
 
     // Compile shader.
     glCompileShader(shader);
@@ -265,396 +951,3914 @@ GLuint helper_opengl_create_shader(char* filename, GLenum type) {
     return shader;
 }
 
-// Create an object instance by loading a mesh and initialising the VBO and VAO and vertex information.
-struct object* object_new(char* object_filename) {
-    // Allocate memory for the object. 
-    struct object* object = malloc(sizeof(struct object));
-    if (object == NULL) {
-        printf("object_new(): Failed to allocate memory for object. Exiting.\n");
-        exit(-1);
-    }
-    // Store the name of the object.
-    object->name = strdup(object_filename);
-    if (object->name == NULL) {
-        printf("object_new(): Failed to allocate memory for object name. Exiting.\n");
-        exit(-1);
-    }
+// Set how often a vertex attribute advances per instance, through whichever instancing entry point the context provides.
+// WebGL 1 exposes ANGLE_instanced_arrays, which Emscripten maps onto the core names.
+void helper_opengl_vertex_attrib_divisor(GLuint index, GLuint divisor) {
+    #ifdef __EMSCRIPTEN__
+    glVertexAttribDivisor(index, divisor);
+    #else
+    if (GLEW_VERSION_3_3) glVertexAttribDivisor(index, divisor);
+    else glVertexAttribDivisorARB(index, divisor);
+    #endif
+}
 
-    // Initialise the mesh
-    object->meshes = malloc(sizeof(struct mesh));
-    if (object->meshes == NULL) {
-        exit(-1);
-    }
-    struct mesh* mesh = object->meshes;
+// Draw several instances of an indexed triangle list, through whichever instancing entry point the context provides.
+void helper_opengl_draw_elements_instanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instances) {
+    #ifdef __EMSCRIPTEN__
+    glDrawElementsInstanced(mode, count, type, indices, instances);
+    #else
+    if (GLEW_VERSION_3_3) glDrawElementsInstanced(mode, count, type, indices, instances);
+    else glDrawElementsInstancedARB(mode, count, type, indices, instances);
+    #endif
+}
 
-    // Open the file and calculate how many bytes to allocate for the mesh.
-    // Do this by counting how many vertices and indices there are.
-    // Vertices are denoted by a v before the line, and indicie faces start with an f.
-    FILE* obj_file = fopen(object_filename, "r");
-    if (obj_file == NULL) {
-        printf("object_new(): Failed to open file '%s'. Exiting.\n", object_filename);
-        exit(-1);
+// Forget the OpenGL state the render_state_*() functions have set, so the next call of each reaches OpenGL.
+// Uniforms remembered for a shader are forgotten too.
+void render_state_reset() {
+    program->render_state.shader = (GLuint)-1;
+    program->render_state.vertex_array = (GLuint)-1;
+    program->render_state.blend = -1;
+    program->render_state.depth_write = -1;
+    for (struct shader* shader = program->shaders; shader != NULL; shader = shader->next) {
+        memset(&shader->values, 0xFF, sizeof(struct uniform_values));
     }
-    size_t num_vertices = 0;
-    size_t num_indices = 0;
+}
 
-    char* buffer = malloc(sizeof(char) * 4096);
-    if (buffer == NULL) exit(-1);
-    strcpy(buffer, "");
+// Count a state change that was made or skipped.
+bool render_state_changed(bool changed) {
+    if (changed == true) program->render_stats.state_changes++;
+    else program->render_stats.state_changes_skipped++;
+    return changed;
+}
 
-    while (fgets(buffer, 4096, obj_file) != NULL) {
-        if (buffer[0] == 'v' && buffer[1] == ' ') num_vertices++;
-        if (buffer[0] == 'f') num_indices++;
-    }
+// Use an OpenGL shader program, unless it is already in use.
+void render_state_use_program(GLuint shader) {
+    if (render_state_changed(program->render_state.shader != shader) == false) return;
+    glUseProgram(shader);
+    program->render_state.shader = shader;
+}
 
-    mesh->num_vertices = num_vertices;
-    mesh->num_indices = num_indices;
+// Use a shader variant, unless it is already in use.
+void render_state_use_shader(struct shader* shader) {
+    render_state_use_program(shader->shader);
+}
 
-    if (num_vertices < 1 || num_indices < 1) {
-        printf("object_new(): There are no verticies and/or faces detected. Returning.");
-        exit(-1);
-    }
+// Bind a vertex array object, unless it is already bound.
+void render_state_bind_vertex_array(GLuint vertex_array) {
+    if (render_state_changed(program->render_state.vertex_array != vertex_array) == false) return;
+    glBindVertexArray(vertex_array);
+    program->render_state.vertex_array = vertex_array;
+}
 
-    rewind(obj_file);
-    strcpy(buffer, "");
+// Turn blending on or off, unless it already is.
+void render_state_set_blend(bool enabled) {
+    if (render_state_changed(program->render_state.blend != (int)enabled) == false) return;
+    if (enabled == true) glEnable(GL_BLEND);
+    else glDisable(GL_BLEND);
+    program->render_state.blend = enabled;
+}
 
-    // Allocate the vertex and index array:
-    mesh->vertices = malloc(sizeof(struct vertex) * num_vertices);
-    if (mesh->vertices == NULL) exit(-1);
-
-    mesh->indices = malloc(sizeof(unsigned int) * num_indices);
-    if (mesh->indices == NULL) exit(-1);
-
-    size_t vertices_index = 0;
-    size_t indices_index = 0;
-
-    // Copy the indicies and verticies into their arrays
-    while (fgets(buffer, 4096, obj_file) != NULL) {
-        // Load vertex positions and colors
-        if (buffer[0] == 'v' && buffer[1] == ' ') {
-            sscanf(buffer, "v %f %f %f %f %f %f %f %f %f %f", 
-            &mesh->vertices[vertices_index].position[0],
-            &mesh->vertices[vertices_index].position[1],
-            &mesh->vertices[vertices_index].position[2],
-            &mesh->vertices[vertices_index].vertex_color[0],
-            &mesh->vertices[vertices_index].vertex_color[1],
-            &mesh->vertices[vertices_index].vertex_color[2],
-            &mesh->vertices[vertices_index].vertex_color[3],
-            &mesh->vertices[vertices_index].normal[0],
-            &mesh->vertices[vertices_index].normal[1],
-            &mesh->vertices[vertices_index].normal[2]);
-            vertices_index++;
-        }
-
-        // Load list of faces
-        if (buffer[0] == 'f') {
-            sscanf(buffer, "f %hd", &mesh->indices[indices_index]);
-            indices_index++;
-        }
-    }
-    // Close the mesh data file
-    fclose(obj_file);
-    free(buffer);
-    mesh->next = NULL;
+// Turn depth writes on or off, unless they already are.
+void render_state_set_depth_write(bool enabled) {
+    if (render_state_changed(program->render_state.depth_write != (int)enabled) == false) return;
+    glDepthMask(enabled == true ? GL_TRUE : GL_FALSE);
+    program->render_state.depth_write = enabled;
+}
 
-    // Load the mesh into the GPU and store a vertex array object pointer for future access to the mesh
-    while (mesh != NULL) {
-        // Initialise the VAO which will be used later to tell the GPU where the mesh is.
-        glBindVertexArray(mesh->VAO);
-        glGenVertexArrays(1, &mesh->VAO);
+// Upload a uniform of the shader in use, unless it already holds the value.
+// The value is compared bit for bit with the last one uploaded, which is stored in current.
+void render_state_uniform3fv(GLint location, float* current, const float* value) {
+    if (render_state_changed(memcmp(current, value, sizeof(vec3)) != 0) == false) return;
+    memcpy(current, value, sizeof(vec3));
+    glUniform3fv(location, 1, value);
+}
 
-        // LOad the mesh into the GPU
-        glGenBuffers(1, &mesh->VBO);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-        glBindVertexArray(mesh->VAO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(struct vertex) * mesh->num_vertices, mesh->vertices, GL_STATIC_DRAW);
-
-        // Load the vertex positions into GPU and into the positions attribute
-        glEnableVertexAttribArray(program->shaders->attributes.position);
-        glVertexAttribPointer(program->shaders->attributes.position, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
-
-        // Load the vertex colors into GPU and into the colors attribute
-        glEnableVertexAttribArray(program->shaders->attributes.vertex_color);
-        glVertexAttribPointer(program->shaders->attributes.vertex_color, 4, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)offsetof(struct vertex, vertex_color));
-
-        // Load the vertex normals into GPU and into the colors attribute
-        glEnableVertexAttribArray(program->shaders->attributes.vertex_normal);
-        glVertexAttribPointer(program->shaders->attributes.vertex_normal, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)offsetof(struct vertex, normal));
-        
-        // Load the indices to form the triangle faces.
-        glGenBuffers(1, &mesh->EBO);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * mesh->num_indices, mesh->indices, GL_STATIC_DRAW);
-        glBindVertexArray(0);
+void render_state_uniform_matrix4fv(GLint location, float* current, const float* value) {
+    if (render_state_changed(memcmp(current, value, sizeof(mat4)) != 0) == false) return;
+    memcpy(current, value, sizeof(mat4));
+    glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
 
-        // Load the next mesh if applicable
-        mesh = mesh->next;
-    }
-    
+void render_state_uniform4fv(GLint location, float* current, const float* value) {
+    if (render_state_changed(memcmp(current, value, sizeof(vec4)) != 0) == false) return;
+    memcpy(current, value, sizeof(vec4));
+    glUniform4fv(location, 1, value);
+}
 
-    // Set object position, scale and rotation
-    glm_vec3_copy((vec3){0.0, 0.0, 0.0}, object->position);
-    glm_vec3_copy((vec3){1.0, 1.0, 1.0}, object->scale);
-    object->rotation = glm_rad(90.0);
+// Write the #define lines for a shader variant's features.
+// Clustered lighting also needs the layout of the cluster grid and its textures, and a constant bound for its light loop.
+void shader_defines(uint32_t features, char* defines, size_t size) {
+    const char* names[SHADER_FEATURE_COUNT] = {"FLAT_SHADING", "QUANTISED", "INSTANCED", "SPECULAR", "CLUSTERED_LIGHTS"};
+    size_t length = 0;
+    defines[0] = '\0';
+    for (int i=0; i < SHADER_FEATURE_COUNT; i++) {
+        if ((features & (1u << i)) == 0) continue;
+        length = length + snprintf(defines + length, size - length, "#define %s 1\n", names[i]);
+    }
+    if ((features & SHADER_FEATURE_CLUSTERED_LIGHTS) != 0) {
+        snprintf(defines + length, size - length,
+            "#define CLUSTERS_X %d.0\n#define CLUSTERS_Y %d.0\n#define CLUSTERS_Z %d.0\n#define CLUSTER_MAX_LIGHTS %d\n"
+            "#define LIGHT_TEXTURE_SIZE vec2(%d.0, %d.0)\n#define LIGHT_INDEX_TEXTURE_SIZE vec2(%d.0, %d.0)\n",
+            LIGHT_CLUSTER_X, LIGHT_CLUSTER_Y, LIGHT_CLUSTER_Z, LIGHT_CLUSTER_MAX_PER_CLUSTER,
+            LIGHT_TEXTURE_WIDTH, LIGHT_TEXTURE_HEIGHT, LIGHT_CLUSTER_INDEX_WIDTH, LIGHT_CLUSTER_INDEX_HEIGHT);
+    }
+}
 
-    object->next = NULL;
-    return object;
+// Hash text into a 64 bit FNV-1a hash, continuing from a previous hash.
+uint64_t shader_hash(uint64_t hash, const char* text) {
+    for (const char* c = text; c != NULL && *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+    }
+    return hash;
 }
 
-// Resize the scene when window is resized
-void program_resize_callback(GLFWwindow* window, int width, int height) {
-    (void)window;
-    glfwSetInputMode(program->window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glViewport(0, 0, width, height);
+// Build the path a variant's program binary is cached at. A binary only suits the driver that produced it
+// and the sources it was built from, so all of them are part of the name.
+void shader_cache_path(const char* defines, char* path, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = shader_hash(hash, (const char*)glGetString(GL_VENDOR));
+    hash = shader_hash(hash, (const char*)glGetString(GL_RENDERER));
+    hash = shader_hash(hash, (const char*)glGetString(GL_VERSION));
+    hash = shader_hash(hash, defines);
+    hash = shader_hash(hash, program->vertex_source);
+    hash = shader_hash(hash, program->fragment_source);
+    snprintf(path, size, "%s/%016llx.bin", SHADER_CACHE_DIRECTORY, (unsigned long long)hash);
 }
 
-// Move camera when mouse to point at a new location when mouse is moved.
-void program_mouse_callback(GLFWwindow* window, double x, double y) {
-    (void)window;
-    // Set the last x and y mouse positions
-    if (program->camera.mouse.used_before == false) {
-        program->camera.mouse.used_before = true;
-        program->camera.mouse.last_x = x;
-        program->camera.mouse.last_y = y;
+// Load a cached program binary into a shader program. Returns false if there is none or the driver rejects it.
+bool shader_cache_load(GLuint shader, const char* path) {
+    #ifdef __EMSCRIPTEN__
+    (void)shader;
+    (void)path;
+    return false;
+    #else
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    uint32_t header[3];
+    void* binary = NULL;
+    bool loaded = fread(header, sizeof(header), 1, file) == 1 && header[0] == SHADER_CACHE_MAGIC;
+    if (loaded == true) {
+        binary = malloc(header[2] + 1);
+        loaded = binary != NULL && fread(binary, 1, header[2], file) == header[2];
     }
+    fclose(file);
 
-    // Get the difference between the last mouse position and current
-    float x_offset = x - program->camera.mouse.last_x;
-    float y_offset = y - program->camera.mouse.last_y;
+    if (loaded == true) {
+        glProgramBinary(shader, header[1], binary, header[2]);
+        GLint link_status = GL_FALSE;
+        glGetProgramiv(shader, GL_LINK_STATUS, &link_status);
+        loaded = link_status == GL_TRUE;
+    }
+    free(binary);
+    return loaded;
+    #endif
+}
 
-    // Store the current mouse positions to be the last
-    program->camera.mouse.last_x = x;
-    program->camera.mouse.last_y = y;
+// Save a linked shader program's binary to the cache. Failing to is not an error, as the variant is simply compiled again next time.
+void shader_cache_store(GLuint shader, const char* path) {
+    #ifdef __EMSCRIPTEN__
+    (void)shader;
+    (void)path;
+    #else
+    GLint length = 0;
+    glGetProgramiv(shader, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    void* binary = malloc(length);
+    if (binary == NULL) return;
 
-    // Multiply the difference in mouse position with sensitivty
-    x_offset = x_offset * program->camera.mouse.sensitivity;
-    y_offset = y_offset * program->camera.mouse.sensitivity;
+    GLenum format = 0;
+    glGetProgramBinary(shader, length, NULL, &format, binary);
+    mkdir(SHADER_CACHE_DIRECTORY, 0755);
+    FILE* file = fopen(path, "wb");
+    if (file != NULL) {
+        uint32_t header[3] = {SHADER_CACHE_MAGIC, format, (uint32_t)length};
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(binary, 1, length, file);
+        fclose(file);
+    }
+    free(binary);
+    #endif
+}
 
-    // Add the movement difference to the camera's viewing angles.
-    program->camera.yaw = program->camera.yaw + x_offset;
-    program->camera.pitch = program->camera.pitch - y_offset;
+// Compile and link the shader variant with the given features, or load it from the program binary cache,
+// and add it to the program's list of shaders.
+struct shader* shader_new(uint32_t features) {
+    PROFILE_BEGIN("compile shader");
+    double start_time = glfwGetTime();
+    struct shader* shader = malloc(sizeof(struct shader));
+    if (shader == NULL) {
+        printf("shader_new(): Failed to allocate memory for shader. Exiting.\n");
+        exit(-1);
+    }
+    shader->id = program->num_shaders;
+    shader->features = features;
+    memset(&shader->values, 0xFF, sizeof(struct uniform_values));
+    shader->shader = glCreateProgram();
 
-    // Lock the camera's pitch so it does not go too far up or down
-    if (program->camera.pitch > 89.0) {
-        program->camera.pitch = 89.0;
+    char defines[512];
+    char path[256];
+    shader_defines(features, defines, sizeof(defines));
+    shader_cache_path(defines, path, sizeof(path));
+    bool cached = program->program_binary_supported == true && shader_cache_load(shader->shader, path) == true;
+    if (cached == false) {
+        GLuint vertex_shader = helper_opengl_create_shader("vertex.glsl", program->vertex_source, defines, GL_VERTEX_SHADER);
+        GLuint fragment_shader = helper_opengl_create_shader("fragment.glsl", program->fragment_source, defines, GL_FRAGMENT_SHADER);
+        if (vertex_shader == 0 || fragment_shader == 0) {
+            printf("shader_new(): Failed to compile shader variant 0x%x. Exiting.\n", features);
+            exit(-1);
+        }
+        glAttachShader(shader->shader, vertex_shader);
+        glAttachShader(shader->shader, fragment_shader);
+
+        // Bind every attribute to its fixed location, keeping a per vertex attribute at location 0, which some drivers need to be enabled as an array.
+        glBindAttribLocation(shader->shader, ATTRIBUTE_POSITION, "position");
+        glBindAttribLocation(shader->shader, ATTRIBUTE_VERTEX_COLOR, "vertex_color");
+        glBindAttribLocation(shader->shader, ATTRIBUTE_VERTEX_NORMAL, "vertex_normal");
+        glBindAttribLocation(shader->shader, ATTRIBUTE_INSTANCE_MODEL, "instance_model");
+        glBindAttribLocation(shader->shader, ATTRIBUTE_INSTANCE_TINT, "instance_tint");
+        #ifndef __EMSCRIPTEN__
+        if (program->program_binary_supported == true) {
+            glProgramParameteri(shader->shader, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+        #endif
+        glLinkProgram(shader->shader);
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+
+        GLint link_status = GL_FALSE;
+        glGetProgramiv(shader->shader, GL_LINK_STATUS, &link_status);
+        if (link_status == GL_FALSE) {
+            printf("shader_new(): Failed to link shader variant 0x%x. Exiting.\n", features);
+            helper_opengl_print_log(shader->shader);
+            exit(-1);
+        }
+        if (program->program_binary_supported == true) {
+            shader_cache_store(shader->shader, path);
+        }
     }
 
-    if (program->camera.pitch < -89.0) {
-        program->camera.pitch = -89.0;
+    // Initialise attributes:
+    shader->attributes.position = glGetAttribLocation(shader->shader, "position");
+    shader->attributes.fragment_position = glGetAttribLocation(shader->shader, "fragment_position");
+    shader->attributes.vertex_color = glGetAttribLocation(shader->shader, "vertex_color");
+    shader->attributes.fragment_color = glGetAttribLocation(shader->shader, "fragment_color");
+    shader->attributes.vertex_normal = glGetAttribLocation(shader->shader, "vertex_normal");
+    shader->attributes.fragment_normal = glGetAttribLocation(shader->shader, "fragment_normal");
+    shader->attributes.instance_model = glGetAttribLocation(shader->shader, "instance_model");
+    shader->attributes.instance_tint = glGetAttribLocation(shader->shader, "instance_tint");
+
+    // Initialise uniforms:
+    shader->uniforms.view = glGetUniformLocation(shader->shader, "view");
+    shader->uniforms.projection = glGetUniformLocation(shader->shader, "projection");
+    shader->uniforms.light_color = glGetUniformLocation(shader->shader, "light_color");
+    shader->uniforms.light_position = glGetUniformLocation(shader->shader, "light_position");
+    shader->uniforms.camera_position = glGetUniformLocation(shader->shader, "camera_position");
+    shader->uniforms.position_offset = glGetUniformLocation(shader->shader, "position_offset");
+    shader->uniforms.position_scale = glGetUniformLocation(shader->shader, "position_scale");
+    shader->uniforms.model = glGetUniformLocation(shader->shader, "model");
+    shader->uniforms.tint = glGetUniformLocation(shader->shader, "tint");
+    shader->uniforms.light_texture = glGetUniformLocation(shader->shader, "light_texture");
+    shader->uniforms.cluster_texture = glGetUniformLocation(shader->shader, "cluster_texture");
+    shader->uniforms.light_index_texture = glGetUniformLocation(shader->shader, "light_index_texture");
+    shader->uniforms.cluster_parameters = glGetUniformLocation(shader->shader, "cluster_parameters");
+    shader->uniforms.light_offset = glGetUniformLocation(shader->shader, "light_offset");
+    shader->uniforms.light_scale = glGetUniformLocation(shader->shader, "light_scale");
+
+    // Point the samplers at the units the clustered lighting textures stay bound to.
+    if (shader->uniforms.light_texture != -1) {
+        render_state_use_shader(shader);
+        glUniform1i(shader->uniforms.light_texture, LIGHT_TEXTURE_UNIT);
+        glUniform1i(shader->uniforms.cluster_texture, LIGHT_CLUSTER_TEXTURE_UNIT);
+        glUniform1i(shader->uniforms.light_index_texture, LIGHT_INDEX_TEXTURE_UNIT);
     }
 
-    // Calculate the angles that the vector the camera is looking at needs to change with.
-    vec3 direction = {0.0, 0.0, 0.0};
-    direction[0] = cos(glm_rad(program->camera.yaw)) * cos(glm_rad(program->camera.pitch));
-    direction[1] = sin(glm_rad(program->camera.pitch));
-    direction[2] = sin(glm_rad(program->camera.yaw)) * cos(glm_rad(program->camera.pitch));
+    shader->next = program->shaders;
+    program->shaders = shader;
+    program->num_shaders++;
+    fprintf(stderr, "%s shader variant 0x%x in %.1f ms.\n", cached == true ? "Loaded cached" : "Compiled", features, (glfwGetTime() - start_time) * 1000.0);
+    PROFILE_END();
+    return shader;
+}
 
-    // Add the movement difference to the vector the camera is looking at.
-    glm_vec3_normalize_to(direction, program->camera.front);
+// Return the shader variant with the given features, compiling it the first time it is asked for.
+struct shader* shader_get(uint32_t features) {
+    for (struct shader* shader = program->shaders; shader != NULL; shader = shader->next) {
+        if (shader->features == features) return shader;
+    }
+    return shader_new(features);
 }
 
-// Initialise the program state
-void program_init() {
-    // Initialise the global program state
-    program = malloc(sizeof(struct program));
-    if (program == NULL) exit(-1);
+// Return the features of the shader variant a mesh is drawn with: the scene's shading, decoding the mesh's vertices,
+// and instancing unless it is unavailable or the mesh is a batch page, which is drawn once in world space.
+// Culling jobs call this, so the variant itself is only looked up, and compiled the first time, on the main thread as it draws.
+uint32_t shader_features_for_mesh(struct mesh* mesh) {
+    uint32_t features = program->shading_features;
+    if (mesh->vertex_format == MODEL_FORMAT_VERTEX_PACKED) features = features | SHADER_FEATURE_QUANTISED;
+    if (program->instancing_supported == true && mesh->page == NULL) features = features | SHADER_FEATURE_INSTANCED;
+    return features;
+}
 
-    // Initialise GLFW
-    if (glfwInit() == GLFW_FALSE) {
-        printf("program_init(): Failed to initialise GLFW. Exit.\n");
-        exit(-1);
+// Upload the uniforms every draw in a frame shares to the shader in use, skipping those it already holds.
+void shader_set_frame_uniforms(struct shader* shader, struct frame* frame) {
+    render_state_uniform3fv(shader->uniforms.light_color, shader->values.light_color, program->light.light_color);
+    render_state_uniform3fv(shader->uniforms.light_position, shader->values.light_position, program->light.light_position);
+    render_state_uniform3fv(shader->uniforms.camera_position, shader->values.camera_position, frame->lod_view.camera_position);
+    render_state_uniform_matrix4fv(shader->uniforms.view, shader->values.view[0], frame->view[0]);
+    render_state_uniform_matrix4fv(shader->uniforms.projection, shader->values.projection[0], frame->projection[0]);
+    if ((shader->features & SHADER_FEATURE_CLUSTERED_LIGHTS) != 0) {
+        render_state_uniform4fv(shader->uniforms.cluster_parameters, shader->values.cluster_parameters, program->cluster_parameters);
+        render_state_uniform4fv(shader->uniforms.light_offset, shader->values.light_offset, frame->light_offset);
+        render_state_uniform4fv(shader->uniforms.light_scale, shader->values.light_scale, frame->light_scale);
     }
+}
 
-    // Create GLFW context.
-    program->window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Window", NULL, NULL);
-    glfwMakeContextCurrent(program->window);
-    if (program->window == NULL) {
-        printf("program_init(): Failed to create GLFW window. Exit.\n");
+// Create a mesh for vertex and index arrays, taking ownership of them. The mesh itself is allocated from an arena,
+// or on its own if the arena is NULL. Meshes start out with float vertices; packed meshes set their format, scale and offset afterwards.
+struct mesh* mesh_new(struct arena* arena, void* vertices, unsigned int num_vertices, void* indices, unsigned int num_indices, GLenum index_type) {
+    struct mesh* mesh = arena != NULL ? arena_alloc(arena, sizeof(struct mesh)) : malloc(sizeof(struct mesh));
+    if (mesh == NULL) {
+        printf("mesh_new(): Failed to allocate memory for mesh. Exiting.\n");
         exit(-1);
     }
+    mesh->vertices = vertices;
+    mesh->num_vertices = num_vertices;
+    mesh->vertex_format = MODEL_FORMAT_VERTEX_FLOAT;
+    glm_vec3_copy((vec3){0.0, 0.0, 0.0}, mesh->position_offset);
+    glm_vec3_copy((vec3){1.0, 1.0, 1.0}, mesh->position_scale);
+    mesh->indices = indices;
+    mesh->num_indices = num_indices;
+    mesh->index_type = index_type;
+    mesh->lods[0] = (struct mesh_lod){0, num_indices, 0.0, num_vertices};
+    mesh->num_lods = 1;
+    mesh->available_vertices = num_vertices;
+    mesh->available_indices = num_indices;
+    mesh->ready_lod = 1;
+    mesh->uploaded = false;
+    mesh->translucent = false;
+    mesh->mapped = false;
+    mesh->id = 0;
+    mesh->page = NULL;
+    mesh->VBO = 0;
+    mesh->EBO = 0;
+    mesh->VAO = 0;
+    mesh->vertex_buffer_size = 0;
+    mesh->index_buffer_size = 0;
+    mesh->occluder_positions = NULL;
+    mesh->occluder_indices = NULL;
+    mesh->occluder_num_vertices = 0;
+    mesh->occluder_num_indices = 0;
+    mesh->next = NULL;
+    glm_vec3_zero(mesh->bounds_min);
+    glm_vec3_zero(mesh->bounds_max);
+    glm_vec3_zero(mesh->bounds_centre);
+    mesh->bounds_radius = 0.0;
+    return mesh;
+}
 
-    // Set OpenGL hints.
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
-    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+// Measure the bounds of a mesh with float vertices. Binary models store their bounds instead.
+void mesh_compute_bounds(struct mesh* mesh) {
+    model_format_compute_bounds(mesh->vertices, mesh->num_vertices, mesh->bounds_min, mesh->bounds_max, mesh->bounds_centre, &mesh->bounds_radius);
+}
 
-    // Initialise GLEW
-    GLenum glew_status = glewInit();
-    if (glew_status != GLEW_OK) {
-        printf("program_init(): glewInit() failed to initailise. glewGetErrorString(): %s. Exiting.\n", glewGetErrorString(glew_status));
-        exit(-1);
+// Find whether any of a mesh's vertex colours are less than fully opaque.
+void mesh_compute_translucent(struct mesh* mesh) {
+    mesh->translucent = false;
+    for (unsigned int i=0; i < mesh->num_vertices && mesh->translucent == false; i++) {
+        if (mesh->vertex_format == MODEL_FORMAT_VERTEX_PACKED) {
+            mesh->translucent = ((struct model_file_packed_vertex*)mesh->vertices)[i].vertex_color[3] < 255;
+        }
+        else {
+            mesh->translucent = ((struct model_file_vertex*)mesh->vertices)[i].vertex_color[3] < 1.0;
+        }
     }
+}
 
-    // Ensure the VAO is available as this program relies on it.
-    if (!GL_ARB_vertex_array_object) {
-        printf("program_init(): glewInit() failed to initailise. glewGetErrorString(): %s. Exiting.\n", glewGetErrorString(glew_status));
-        exit(-1);
+// Read one of a mesh's vertices as a float vertex in model space, decoding it if the mesh is packed.
+void mesh_read_vertex(struct mesh* mesh, unsigned int index, struct model_file_vertex* vertex) {
+    if (mesh->vertex_format == MODEL_FORMAT_VERTEX_FLOAT) {
+        *vertex = ((struct model_file_vertex*)mesh->vertices)[index];
+        return;
     }
 
-    // Initialise the shader program.
-    program->shaders = malloc(sizeof(struct shader));
-    if (program->shaders == NULL) {
-        printf("program_init(): Failed to initialise shader program. Exit.\n");
-        exit(-1);
+    struct model_file_packed_vertex* packed = &((struct model_file_packed_vertex*)mesh->vertices)[index];
+    for (int k=0; k < 3; k++) {
+        vertex->position[k] = packed->position[k] / 65535.0 * mesh->position_scale[k] + mesh->position_offset[k];
     }
-    program->shaders->next = NULL;
-
-    GLuint vertex_shader = helper_opengl_create_shader("vertex.glsl", GL_VERTEX_SHADER);
-    GLuint fragment_shader = helper_opengl_create_shader("fragment.glsl", GL_FRAGMENT_SHADER);
+    for (int k=0; k < 4; k++) {
+        vertex->vertex_color[k] = packed->vertex_color[k] / 255.0;
+    }
+    float encoded[2] = {glm_max(packed->normal[0] / 32767.0, -1.0), glm_max(packed->normal[1] / 32767.0, -1.0)};
+    model_format_decode_octahedral(encoded, vertex->normal);
+}
 
-    program->shaders->shader = glCreateProgram();
-    glAttachShader(program->shaders->shader, vertex_shader);
-    glAttachShader(program->shaders->shader, fragment_shader);
-    glLinkProgram(program->shaders->shader);
-    if (program->shaders->shader == (GLuint)-1) {
-        printf("program_init(): Failed to create valid shader. Exit.\n");
-        exit(-1);
+// Read the model space position of one of a mesh's vertices, decoding it if the mesh is packed.
+void mesh_read_position(struct mesh* mesh, unsigned int index, float position[3]) {
+    if (mesh->vertex_format == MODEL_FORMAT_VERTEX_FLOAT) {
+        memcpy(position, ((struct model_file_vertex*)mesh->vertices)[index].position, sizeof(float) * 3);
+        return;
     }
 
-    // Initialise attributes:
-    program->shaders->attributes.position = glGetAttribLocation(program->shaders->shader, "position");
-    program->shaders->attributes.fragment_position = glGetAttribLocation(program->shaders->shader, "fragment_position");
-    program->shaders->attributes.vertex_color = glGetAttribLocation(program->shaders->shader, "vertex_color");
-    program->shaders->attributes.fragment_color = glGetAttribLocation(program->shaders->shader, "fragment_color");
-    program->shaders->attributes.vertex_normal = glGetAttribLocation(program->shaders->shader, "vertex_normal");
-    program->shaders->attributes.fragment_normal = glGetAttribLocation(program->shaders->shader, "fragment_normal");
+    struct model_file_packed_vertex* packed = &((struct model_file_packed_vertex*)mesh->vertices)[index];
+    for (int k=0; k < 3; k++) {
+        position[k] = packed->position[k] / 65535.0 * mesh->position_scale[k] + mesh->position_offset[k];
+    }
+}
+
+// Return the size in bytes of one of a mesh's vertices.
+size_t mesh_vertex_size(struct mesh* mesh) {
+    return model_format_vertex_size(mesh->vertex_format);
+}
+
+// Return the size in bytes of one of a mesh's indices.
+size_t mesh_index_size(struct mesh* mesh) {
+    return mesh->index_type == GL_UNSIGNED_INT ? sizeof(GLuint) : sizeof(GLushort);
+}
+
+// Turn the 16 bit indexable chunks of a split mesh into a mesh list allocated from an arena, taking ownership of their arrays.
+struct mesh* mesh_list_from_chunks(struct arena* arena, struct mesh_chunk* chunks, size_t num_chunks) {
+    struct mesh* meshes = NULL;
+    struct mesh** tail = &meshes;
+    for (size_t i=0; i < num_chunks; i++) {
+        *tail = mesh_new(arena, chunks[i].vertices, chunks[i].num_vertices, chunks[i].indices, chunks[i].num_indices, GL_UNSIGNED_SHORT);
+        mesh_compute_bounds(*tail);
+        tail = &(*tail)->next;
+    }
+    free(chunks);
+    return meshes;
+}
+
+// Split a mesh with 32 bit indices into a list of 16 bit indexable meshes. The source arrays are not freed.
+struct mesh* mesh_split_to_list(struct arena* arena, const struct model_file_vertex* vertices, size_t num_vertices, const uint32_t* indices, size_t num_indices) {
+    struct mesh_chunk* chunks = NULL;
+    size_t num_chunks = 0;
+    if (mesh_split(vertices, num_vertices, indices, num_indices, &chunks, &num_chunks) == false) {
+        printf("mesh_split_to_list(): Failed to allocate memory to split mesh. Exiting.\n");
+        exit(-1);
+    }
+    fprintf(stderr, "mesh_split_to_list(): Split mesh with %zu vertices into %zu meshes.\n", num_vertices, num_chunks);
+    return mesh_list_from_chunks(arena, chunks, num_chunks);
+}
+
+// Create meshes for a vertex array and 32 bit triangle indices, taking ownership of both.
+// Meshes with more than 65,536 vertices are drawn with 32 bit indices when supported, and are otherwise split into several meshes.
+struct mesh* mesh_list_from_arrays(struct arena* arena, struct model_file_vertex* vertices, size_t num_vertices, uint32_t* indices, size_t num_indices) {
+    // Use the 32 bit indices as they are when the mesh needs them and the GPU supports them.
+    if (num_vertices > MESH_SPLIT_MAX_VERTICES && program->index_uint_supported == true) {
+        struct mesh* mesh = mesh_new(arena, vertices, num_vertices, indices, num_indices, GL_UNSIGNED_INT);
+        mesh_compute_bounds(mesh);
+        return mesh;
+    }
+
+    // Otherwise split the mesh into pieces 16 bit indices can address.
+    if (num_vertices > MESH_SPLIT_MAX_VERTICES) {
+        struct mesh* meshes = mesh_split_to_list(arena, vertices, num_vertices, indices, num_indices);
+        free(vertices);
+        free(indices);
+        return meshes;
+    }
+
+    // Narrow the indices to the 16 bits the renderer prefers.
+    GLushort* short_indices = malloc(sizeof(GLushort) * (num_indices + 1));
+    if (short_indices == NULL) {
+        printf("mesh_list_from_arrays(): Failed to allocate memory for indices. Exiting.\n");
+        exit(-1);
+    }
+    for (size_t i=0; i < num_indices; i++) {
+        short_indices[i] = (GLushort)indices[i];
+    }
+    free(indices);
+
+    struct mesh* mesh = mesh_new(arena, vertices, num_vertices, short_indices, num_indices, GL_UNSIGNED_SHORT);
+    mesh_compute_bounds(mesh);
+    return mesh;
+}
+
+// Turn a cluster's subtree into meshes appended at *tail, depth first so every subtree's meshes are contiguous,
+// and fill in the matching node of the renderer's cluster tree.
+void mesh_cluster_to_list(struct arena* arena, struct text_model* model, struct mesh_cluster_node* clusters, uint32_t index, uint32_t* remap, struct cluster_node* nodes, struct mesh*** tail, uint32_t* num_meshes) {
+    struct mesh_cluster_node* cluster = &clusters[index];
+    struct cluster_node* node = &nodes[index];
+    glm_vec3_copy(cluster->bounds_min, node->bounds_min);
+    glm_vec3_copy(cluster->bounds_max, node->bounds_max);
+    node->first_child = cluster->first_child;
+    node->num_children = cluster->num_children;
+    node->first_mesh = *num_meshes;
+
+    for (uint32_t i=cluster->first_child; i < cluster->first_child + cluster->num_children; i++) {
+        mesh_cluster_to_list(arena, model, clusters, i, remap, nodes, tail, num_meshes);
+    }
+
+    if (cluster->num_children == 0 && cluster->num_triangles > 0) {
+        struct model_file_vertex* vertices = NULL;
+        uint32_t* indices = NULL;
+        size_t num_vertices = 0;
+        size_t num_indices = 0;
+        if (mesh_cluster_extract(model->vertices, model->indices, cluster, remap, &vertices, &num_vertices, &indices, &num_indices) == false) {
+            printf("mesh_cluster_to_list(): Failed to allocate memory for cluster. Exiting.\n");
+            exit(-1);
+        }
+
+        **tail = mesh_list_from_arrays(arena, vertices, num_vertices, indices, num_indices);
+        while (**tail != NULL) {
+            *tail = &(**tail)->next;
+            (*num_meshes)++;
+        }
+    }
+
+    node->num_meshes = *num_meshes - node->first_mesh;
+}
+
+// Load the meshes of a model in the plain text format using the parallel parser in text_model_parser.h.
+// Vertices are lines starting with 'v ' and face indices are lines starting with 'f'.
+// The model is partitioned into a cluster tree as it loads, and each leaf becomes its own mesh.
+// The meshes and cluster tree are allocated from an arena.
+struct mesh* mesh_load_text(struct arena* arena, char* object_filename, struct cluster_node** nodes_out, size_t* num_nodes_out) {
+    // Parse the whole file, using one thread per core.
+    struct text_model model;
+    if (text_model_parse(object_filename, 0, &model) == false) {
+        printf("mesh_load_text(): Failed to parse file '%s'. Exiting.\n", object_filename);
+        exit(-1);
+    }
+
+    if (model.num_vertices < 1 || model.num_indices < 1) {
+        printf("mesh_load_text(): There are no verticies and/or faces detected. Returning.");
+        exit(-1);
+    }
+
+    // Partition the model into clusters.
+    struct mesh_cluster_node* clusters = NULL;
+    size_t num_clusters = 0;
+    if (mesh_cluster_build(model.vertices, model.num_vertices, model.indices, &model.num_indices, &clusters, &num_clusters) == false) {
+        printf("mesh_load_text(): Failed to allocate memory to cluster '%s'. Exiting.\n", object_filename);
+        exit(-1);
+    }
+
+    struct cluster_node* nodes = arena_alloc(arena, sizeof(struct cluster_node) * num_clusters);
+    uint32_t* remap = malloc(sizeof(uint32_t) * (model.num_vertices + 1));
+    if (nodes == NULL || remap == NULL) {
+        printf("mesh_load_text(): Failed to allocate memory for cluster tree. Exiting.\n");
+        exit(-1);
+    }
+    memset(remap, 0xff, sizeof(uint32_t) * (model.num_vertices + 1));
+
+    // Copy every leaf out into its own mesh.
+    struct mesh* meshes = NULL;
+    struct mesh** tail = &meshes;
+    uint32_t num_meshes = 0;
+    mesh_cluster_to_list(arena, &model, clusters, 0, remap, nodes, &tail, &num_meshes);
+
+    free(remap);
+    free(clusters);
+    text_model_free(&model);
+
+    *nodes_out = nodes;
+    *num_nodes_out = num_clusters;
+    return meshes;
+}
+
+// Load the meshes of a binary model by memory mapping it.
+// The mesh vertex and index pointers point directly into the mapping, so nothing is parsed or copied.
+// The mapping is returned to the caller, which must keep it alive as long as the meshes, along with a copy of the cluster tree.
+// The meshes and cluster tree are allocated from an arena. Returns NULL if the file is not a valid binary model.
+struct mesh* mesh_load_binary(struct arena* arena, char* object_filename, void** mapping_out, size_t* mapping_size_out, struct cluster_node** nodes_out, size_t* num_nodes_out) {
+    int fd = open(object_filename, O_RDONLY);
+    if (fd < 0) {
+        printf("mesh_load_binary(): Failed to open file '%s'.\n", object_filename);
+        return NULL;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size < sizeof(struct model_file_header)) {
+        printf("mesh_load_binary(): '%s' is too small to be a binary model.\n", object_filename);
+        close(fd);
+        return NULL;
+    }
+
+    size_t mapping_size = file_stat.st_size;
+    void* mapping = mmap(NULL, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("mesh_load_binary(): Failed to map '%s'.\n", object_filename);
+        return NULL;
+    }
+
+    // Validate the header, mesh table and node table before trusting any offsets in them.
+    const struct model_file_header* header = mapping;
+    const struct model_file_mesh* table = NULL;
+    const struct model_file_node* file_nodes = NULL;
+    const struct model_file_lod* lods = NULL;
+    bool valid = model_format_has_magic(mapping, mapping_size)
+        && header->version == MODEL_FORMAT_VERSION
+        && header->vertex_size == sizeof(struct model_file_vertex)
+        && header->file_size <= mapping_size
+        && header->num_meshes > 0
+        && header->mesh_table_offset % MODEL_FORMAT_ALIGNMENT == 0
+        && header->mesh_table_offset + (uint64_t)header->num_meshes * sizeof(struct model_file_mesh) <= mapping_size
+        && header->num_nodes > 0
+        && header->node_table_offset % MODEL_FORMAT_ALIGNMENT == 0
+        && header->node_table_offset + (uint64_t)header->num_nodes * sizeof(struct model_file_node) <= mapping_size
+        && header->lod_table_offset % MODEL_FORMAT_ALIGNMENT == 0
+        && header->lod_table_offset + (uint64_t)header->num_lods * sizeof(struct model_file_lod) <= mapping_size;
+
+    if (valid == true) {
+        table = (const struct model_file_mesh*)((const char*)mapping + header->mesh_table_offset);
+        lods = (const struct model_file_lod*)((const char*)mapping + header->lod_table_offset);
+        for (uint32_t i=0; i < header->num_meshes && valid == true; i++) {
+            valid = table[i].num_vertices > 0 && table[i].num_indices > 0
+                && (table[i].index_size == sizeof(GLushort) || table[i].index_size == sizeof(GLuint))
+                && (table[i].index_size == sizeof(GLuint) || table[i].num_vertices <= MESH_SPLIT_MAX_VERTICES)
+                && (table[i].index_size == sizeof(GLushort) || table[i].vertex_format == MODEL_FORMAT_VERTEX_FLOAT)
+                && table[i].vertex_size != 0
+                && table[i].vertex_size == model_format_vertex_size(table[i].vertex_format)
+                && table[i].vertex_offset % MODEL_FORMAT_ALIGNMENT == 0
+                && table[i].index_offset % MODEL_FORMAT_ALIGNMENT == 0
+                && table[i].vertex_offset + (uint64_t)table[i].num_vertices * table[i].vertex_size <= mapping_size
+                && table[i].index_offset + (uint64_t)table[i].num_indices * table[i].index_size <= mapping_size
+                && table[i].num_lods > 0 && table[i].num_lods <= MODEL_FORMAT_MAX_LODS
+                && (uint64_t)table[i].first_lod + table[i].num_lods <= header->num_lods;
+            for (uint32_t j=0; j < table[i].num_lods && valid == true; j++) {
+                const struct model_file_lod* lod = &lods[table[i].first_lod + j];
+                valid = lod->num_indices > 0 && (uint64_t)lod->first_index + lod->num_indices <= table[i].num_indices;
+            }
+        }
+
+        // Children must come after their parent, which also rules out cycles.
+        file_nodes = (const struct model_file_node*)((const char*)mapping + header->node_table_offset);
+        for (uint32_t i=0; i < header->num_nodes && valid == true; i++) {
+            valid = (file_nodes[i].num_children == 0 || file_nodes[i].first_child > i)
+                && (uint64_t)file_nodes[i].first_child + file_nodes[i].num_children <= header->num_nodes
+                && (uint64_t)file_nodes[i].first_mesh + file_nodes[i].num_meshes <= header->num_meshes;
+        }
+    }
+
+    if (valid == false) {
+        printf("mesh_load_binary(): '%s' is not a valid version %d binary model.\n", object_filename, MODEL_FORMAT_VERSION);
+        munmap(mapping, mapping_size);
+        return NULL;
+    }
+
+    // Build the mesh list in file order, pointing each mesh at its blobs in the mapping.
+    // Meshes stored with 32 bit indices are split into copies if the GPU cannot draw them directly,
+    // so remember where each table entry's meshes start to translate the node mesh ranges.
+    uint32_t* mesh_starts = malloc(sizeof(uint32_t) * (header->num_meshes + 1));
+    struct cluster_node* nodes = arena_alloc(arena, sizeof(struct cluster_node) * header->num_nodes);
+    if (mesh_starts == NULL || nodes == NULL) {
+        printf("mesh_load_binary(): Failed to allocate memory for cluster tree. Exiting.\n");
+        exit(-1);
+    }
+    struct mesh* meshes = NULL;
+    struct mesh** tail = &meshes;
+    uint32_t num_meshes = 0;
+    for (uint32_t i=0; i < header->num_meshes; i++) {
+        mesh_starts[i] = num_meshes;
+        void* vertices = (char*)mapping + table[i].vertex_offset;
+        void* indices = (char*)mapping + table[i].index_offset;
+        GLenum index_type = table[i].index_size == sizeof(GLuint) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+
+        // Only the full detail level survives splitting.
+        if (index_type == GL_UNSIGNED_INT && program->index_uint_supported == false) {
+            const struct model_file_lod* lod = &lods[table[i].first_lod];
+            *tail = mesh_split_to_list(arena, vertices, table[i].num_vertices, (uint32_t*)indices + lod->first_index, lod->num_indices);
+        }
+        else {
+            *tail = mesh_new(arena, vertices, table[i].num_vertices, indices, table[i].num_indices, index_type);
+            (*tail)->vertex_format = table[i].vertex_format;
+            glm_vec3_copy((float*)table[i].position_offset, (*tail)->position_offset);
+            glm_vec3_copy((float*)table[i].position_scale, (*tail)->position_scale);
+            glm_vec3_copy((float*)table[i].bounds_min, (*tail)->bounds_min);
+            glm_vec3_copy((float*)table[i].bounds_max, (*tail)->bounds_max);
+            glm_vec3_copy((float*)table[i].bounds_centre, (*tail)->bounds_centre);
+            (*tail)->bounds_radius = table[i].bounds_radius;
+            for (uint32_t j=0; j < table[i].num_lods; j++) {
+                const struct model_file_lod* lod = &lods[table[i].first_lod + j];
+                (*tail)->lods[j] = (struct mesh_lod){lod->first_index, lod->num_indices, lod->error, table[i].num_vertices};
+            }
+            (*tail)->num_lods = table[i].num_lods;
+            (*tail)->mapped = true;
+        }
+
+        while (*tail != NULL) {
+            tail = &(*tail)->next;
+            num_meshes++;
+        }
+    }
+    mesh_starts[header->num_meshes] = num_meshes;
+
+    for (uint32_t i=0; i < header->num_nodes; i++) {
+        glm_vec3_copy((float*)file_nodes[i].bounds_min, nodes[i].bounds_min);
+        glm_vec3_copy((float*)file_nodes[i].bounds_max, nodes[i].bounds_max);
+        nodes[i].first_child = file_nodes[i].first_child;
+        nodes[i].num_children = file_nodes[i].num_children;
+        nodes[i].first_mesh = mesh_starts[file_nodes[i].first_mesh];
+        nodes[i].num_meshes = mesh_starts[file_nodes[i].first_mesh + file_nodes[i].num_meshes] - nodes[i].first_mesh;
+    }
+    free(mesh_starts);
+
+    *mapping_out = mapping;
+    *mapping_size_out = mapping_size;
+    *nodes_out = nodes;
+    *num_nodes_out = header->num_nodes;
+    return meshes;
+}
+
+// Bind a GPU buffer of at least size bytes to a target, reusing the smallest pooled buffer it fills at least half of,
+// or creating one of exactly that size. A reused buffer keeps its old contents until they are overwritten.
+GLuint buffer_pool_acquire(GLenum target, size_t size, size_t* buffer_size) {
+    struct buffer_pool* pool = &program->buffer_pool;
+    size_t best = pool->count;
+    for (size_t i=0; i < pool->count; i++) {
+        struct pooled_buffer* pooled = &pool->buffers[i];
+        if (pooled->target != target || pooled->size < size || pooled->size * BUFFER_POOL_MIN_FILL > size) continue;
+        if (best == pool->count || pooled->size < pool->buffers[best].size) best = i;
+    }
+
+    GLuint buffer = 0;
+    if (best < pool->count) {
+        buffer = pool->buffers[best].buffer;
+        *buffer_size = pool->buffers[best].size;
+        pool->buffers[best] = pool->buffers[pool->count - 1];
+        pool->count--;
+        pool->reused++;
+        glBindBuffer(target, buffer);
+    }
+    else {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+        glBufferData(target, size, NULL, GL_STATIC_DRAW);
+        *buffer_size = size;
+        pool->created++;
+    }
+    return buffer;
+}
+
+// Keep a freed mesh's GPU buffer for reuse, or delete it if the pool cannot grow.
+void buffer_pool_release(GLenum target, GLuint buffer, size_t size) {
+    struct buffer_pool* pool = &program->buffer_pool;
+    if (pool->count == pool->capacity) {
+        size_t capacity = pool->capacity == 0 ? 256 : pool->capacity * 2;
+        struct pooled_buffer* buffers = realloc(pool->buffers, sizeof(struct pooled_buffer) * capacity);
+        if (buffers == NULL) {
+            glDeleteBuffers(1, &buffer);
+            return;
+        }
+        pool->buffers = buffers;
+        pool->capacity = capacity;
+    }
+    pool->buffers[pool->count] = (struct pooled_buffer){buffer, target, size};
+    pool->count++;
+}
+
+// Delete every pooled buffer, once nothing is loading that could reuse them.
+void buffer_pool_trim() {
+    struct buffer_pool* pool = &program->buffer_pool;
+    for (size_t i=0; i < pool->count; i++) {
+        glDeleteBuffers(1, &pool->buffers[i].buffer);
+    }
+    pool->count = 0;
+}
+
+// Create the GPU buffers for a mesh and store a vertex array object for future access to the mesh.
+// The buffers are allocated but left empty, or recycled from a freed mesh; mesh_upload_step() fills them over one or more frames.
+void mesh_upload_begin(struct mesh* mesh) {
+    // Initialise the VAO which will be used later to tell the GPU where the mesh is.
+    glGenVertexArrays(1, &mesh->VAO);
+    render_state_bind_vertex_array(mesh->VAO);
+    mesh->id = program->next_mesh_id;
+    program->next_mesh_id++;
+
+    // Allocate space for the mesh in the GPU
+    mesh->VBO = buffer_pool_acquire(GL_ARRAY_BUFFER, mesh_vertex_size(mesh) * mesh->num_vertices, &mesh->vertex_buffer_size);
+
+    // Point the position, colour and normal attributes at the vertex data, at the locations every shader variant uses.
+    glEnableVertexAttribArray(ATTRIBUTE_POSITION);
+    glEnableVertexAttribArray(ATTRIBUTE_VERTEX_COLOR);
+    glEnableVertexAttribArray(ATTRIBUTE_VERTEX_NORMAL);
+    if (mesh->vertex_format == MODEL_FORMAT_VERTEX_PACKED) {
+        // Packed vertices are normalised by the GPU: positions to 0..1, colours to 0..1 and octahedral normals to -1..1.
+        GLsizei stride = sizeof(struct model_file_packed_vertex);
+        glVertexAttribPointer(ATTRIBUTE_POSITION, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)offsetof(struct model_file_packed_vertex, position));
+        glVertexAttribPointer(ATTRIBUTE_VERTEX_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(struct model_file_packed_vertex, vertex_color));
+        glVertexAttribPointer(ATTRIBUTE_VERTEX_NORMAL, 2, GL_SHORT, GL_TRUE, stride, (void*)offsetof(struct model_file_packed_vertex, normal));
+    }
+    else {
+        glVertexAttribPointer(ATTRIBUTE_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(struct model_file_vertex), (void*)offsetof(struct model_file_vertex, position));
+        glVertexAttribPointer(ATTRIBUTE_VERTEX_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(struct model_file_vertex), (void*)offsetof(struct model_file_vertex, vertex_color));
+        glVertexAttribPointer(ATTRIBUTE_VERTEX_NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(struct model_file_vertex), (void*)offsetof(struct model_file_vertex, normal));
+    }
+
+    // The per instance model matrix columns and tint advance once per instance, from the instance buffer bound at draw time.
+    // Without instancing they stay disabled, and shaders without the INSTANCED feature read the model matrix and tint from uniforms.
+    // Batch pages hold world space vertices, and are drawn with an identity model matrix and a white tint.
+    if (program->instancing_supported == true && mesh->page == NULL) {
+        for (GLuint i=0; i < 5; i++) {
+            GLuint location = i < 4 ? ATTRIBUTE_INSTANCE_MODEL + i : ATTRIBUTE_INSTANCE_TINT;
+            glEnableVertexAttribArray(location);
+            helper_opengl_vertex_attrib_divisor(location, 1);
+        }
+    }
+    
+    // Allocate space for the indices to form the triangle faces.
+    mesh->EBO = buffer_pool_acquire(GL_ELEMENT_ARRAY_BUFFER, mesh_index_size(mesh) * mesh->num_indices, &mesh->index_buffer_size);
+    render_state_bind_vertex_array(0);
+
+    mesh->uploaded_vertex_bytes = 0;
+    mesh->uploaded_index_bytes = 0;
+    mesh->ready_lod = mesh->num_lods;
+    mesh->uploaded = false;
+}
+
+// Upload up to budget bytes of a mesh's available vertices and then indices into its GPU buffers.
+// Levels of detail become ready as soon as their vertices and indices are on the GPU, coarsest first for streamed meshes,
+// and the mesh is marked as uploaded once both buffers are complete. Returns the number of bytes used.
+size_t mesh_upload_step(struct mesh* mesh, size_t budget) {
+    size_t vertex_bytes = mesh_vertex_size(mesh) * mesh->available_vertices;
+    size_t index_bytes = mesh_index_size(mesh) * mesh->available_indices;
+    size_t used = 0;
+
+    // Make sure no VAO is bound so binding the EBO does not change a drawable mesh.
+    render_state_bind_vertex_array(0);
+
+    if (mesh->uploaded_vertex_bytes < vertex_bytes && used < budget) {
+        size_t size = vertex_bytes - mesh->uploaded_vertex_bytes;
+        if (size > budget - used) size = budget - used;
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, mesh->uploaded_vertex_bytes, size, (char*)mesh->vertices + mesh->uploaded_vertex_bytes);
+        mesh->uploaded_vertex_bytes = mesh->uploaded_vertex_bytes + size;
+        used = used + size;
+    }
+
+    if (mesh->uploaded_index_bytes < index_bytes && used < budget) {
+        size_t size = index_bytes - mesh->uploaded_index_bytes;
+        if (size > budget - used) size = budget - used;
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh->uploaded_index_bytes, size, (char*)mesh->indices + mesh->uploaded_index_bytes);
+        mesh->uploaded_index_bytes = mesh->uploaded_index_bytes + size;
+        used = used + size;
+    }
+
+    // Levels are ready from the coarsest down to the finest whose vertices and indices have all been uploaded.
+    while (mesh->ready_lod > 0) {
+        struct mesh_lod* lod = &mesh->lods[mesh->ready_lod - 1];
+        if (mesh_vertex_size(mesh) * lod->num_vertices > mesh->uploaded_vertex_bytes) break;
+        if (mesh_index_size(mesh) * (lod->first_index + lod->num_indices) > mesh->uploaded_index_bytes) break;
+        mesh->ready_lod--;
+    }
+
+    mesh->uploaded = mesh->uploaded_vertex_bytes == mesh_vertex_size(mesh) * mesh->num_vertices
+        && mesh->uploaded_index_bytes == mesh_index_size(mesh) * mesh->num_indices;
+    return used;
+}
+
+// Create the meshes of a streamed model from its mesh table, taking ownership of the vertex and index arrays
+// the decoder is filling in, along with a copy of its cluster tree. Each mesh is also stored in the table given.
+// The meshes start out with nothing available, and the loader reports how much of each has been decoded as it goes.
+// The meshes and cluster tree are allocated from an arena.
+struct mesh* mesh_list_from_stream(struct arena* arena, struct model_stream_decoder* stream, struct mesh** table, struct cluster_node** nodes_out) {
+    struct cluster_node* nodes = arena_alloc(arena, sizeof(struct cluster_node) * stream->header.num_nodes);
+    if (nodes == NULL) {
+        printf("mesh_list_from_stream(): Failed to allocate memory for cluster tree. Exiting.\n");
+        exit(-1);
+    }
+
+    struct mesh* meshes = NULL;
+    struct mesh** tail = &meshes;
+    for (uint32_t i=0; i < stream->header.num_meshes; i++) {
+        const struct model_stream_mesh* entry = &stream->meshes[i];
+        struct mesh* mesh = mesh_new(arena, stream->vertices[i], entry->num_vertices, stream->indices[i], entry->num_indices, GL_UNSIGNED_SHORT);
+        mesh->vertex_format = MODEL_FORMAT_VERTEX_PACKED;
+        glm_vec3_copy((float*)entry->position_offset, mesh->position_offset);
+        glm_vec3_copy((float*)entry->position_scale, mesh->position_scale);
+        glm_vec3_copy((float*)entry->bounds_min, mesh->bounds_min);
+        glm_vec3_copy((float*)entry->bounds_max, mesh->bounds_max);
+        glm_vec3_copy((float*)entry->bounds_centre, mesh->bounds_centre);
+        mesh->bounds_radius = entry->bounds_radius;
+        for (uint32_t j=0; j < entry->num_lods; j++) {
+            const struct model_stream_lod* lod = &stream->lods[entry->first_lod + j];
+            mesh->lods[j] = (struct mesh_lod){lod->first_index, lod->num_indices, lod->error, lod->num_vertices};
+        }
+        mesh->num_lods = entry->num_lods;
+        mesh->translucent = entry->translucent != 0;
+        mesh->available_vertices = 0;
+        mesh->available_indices = 0;
+        table[i] = mesh;
+        *tail = mesh;
+        tail = &mesh->next;
+    }
+
+    for (uint32_t i=0; i < stream->header.num_nodes; i++) {
+        glm_vec3_copy((float*)stream->nodes[i].bounds_min, nodes[i].bounds_min);
+        glm_vec3_copy((float*)stream->nodes[i].bounds_max, nodes[i].bounds_max);
+        nodes[i].first_child = stream->nodes[i].first_child;
+        nodes[i].num_children = stream->nodes[i].num_children;
+        nodes[i].first_mesh = stream->nodes[i].first_mesh;
+        nodes[i].num_meshes = stream->nodes[i].num_meshes;
+    }
+    *nodes_out = nodes;
+    return meshes;
+}
+
+// Decode the next piece of a streamed model, and tell the main thread how far each mesh has got.
+// The meshes and cluster tree are published, still empty, as soon as the tables have been decoded.
+// An empty piece marks the end of the stream.
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void loader_stream_receive(struct loader* loader, const void* data, size_t size) {
+    struct model_stream_decoder* stream = &loader->stream;
+    double start = glfwGetTime();
+    int status = model_stream_feed(stream, data, size);
+    loader->decode_time = loader->decode_time + glfwGetTime() - start;
+    if (status == MODEL_STREAM_ERROR || (size == 0 && status != MODEL_STREAM_DONE)) {
+        printf("loader_stream_receive(): '%s' is not a valid version %d streamed model. Exiting.\n", loader->filename, MODEL_STREAM_VERSION);
+        exit(-1);
+    }
+
+    // Create the meshes once the tables are in.
+    struct mesh* meshes = NULL;
+    struct cluster_node* nodes = NULL;
+    size_t num_meshes = stream->header.num_meshes;
+    if (loader->stream_meshes == NULL && status >= MODEL_STREAM_CHUNKS) {
+        loader->stream_meshes = malloc(sizeof(struct mesh*) * num_meshes);
+        loader->available_vertices = calloc(num_meshes, sizeof(unsigned int));
+        loader->available_indices = calloc(num_meshes, sizeof(unsigned int));
+        if (loader->stream_meshes == NULL || loader->available_vertices == NULL || loader->available_indices == NULL) {
+            printf("loader_stream_receive(): Failed to allocate memory for streamed meshes. Exiting.\n");
+            exit(-1);
+        }
+        meshes = mesh_list_from_stream(&loader->arena, stream, loader->stream_meshes, &nodes);
+    }
+
+    // Publish the new meshes and how much of every mesh is ready to upload.
+    #if THREADS_AVAILABLE
+    pthread_mutex_lock(&loader->mutex);
+    #endif
+    if (meshes != NULL) {
+        *loader->pending_tail = meshes;
+        while (*loader->pending_tail != NULL) {
+            loader->pending_tail = &(*loader->pending_tail)->next;
+        }
+        loader->nodes = nodes;
+        loader->num_nodes = stream->header.num_nodes;
+        loader->num_stream_meshes = num_meshes;
+    }
+    for (size_t i=0; i < loader->num_stream_meshes; i++) {
+        loader->available_vertices[i] = stream->decoded_vertices[i];
+        loader->available_indices[i] = stream->decoded_indices[i];
+    }
+    loader->bytes_received = stream->bytes_received;
+    loader->bytes_decoded = stream->bytes_decoded;
+    loader->finished = status == MODEL_STREAM_DONE;
+    #if THREADS_AVAILABLE
+    pthread_mutex_unlock(&loader->mutex);
+    #endif
+
+    // The decoder's tables are no longer needed once everything is in. The meshes own the vertices and indices,
+    // and the main thread waits for the loader thread to exit before releasing the loader.
+    if (status == MODEL_STREAM_DONE) {
+        model_stream_free(stream);
+    }
+}
+
+// Read a streamed model from disk a piece at a time, decoding each piece as it is read.
+void loader_stream_file(struct loader* loader) {
+    FILE* file = fopen(loader->filename, "rb");
+    unsigned char* piece = malloc(MODEL_STREAM_READ_SIZE);
+    if (file == NULL || piece == NULL) {
+        printf("loader_stream_file(): Failed to open file '%s'. Exiting.\n", loader->filename);
+        exit(-1);
+    }
+    size_t size = fread(piece, 1, MODEL_STREAM_READ_SIZE, file);
+    while (size > 0) {
+        loader_stream_receive(loader, piece, size);
+        size = fread(piece, 1, MODEL_STREAM_READ_SIZE, file);
+    }
+    fclose(file);
+    free(piece);
+    loader_stream_receive(loader, NULL, 0);
+}
+
+#if MODEL_STREAM_FETCH
+// Finish a loader whose download failed, marking it failed for program_stream_meshes() to report.
+EMSCRIPTEN_KEEPALIVE
+void loader_fetch_failed(struct loader* loader) {
+    loader->failed = true;
+    loader->finished = true;
+}
+
+// Download a streamed model with the Fetch API, handing each piece to loader_stream_receive() as it arrives
+// and an empty piece at the end. The page keeps drawing in between, so meshes appear as their levels come in.
+// Each download is remembered by its loader's address until it finishes, so it can be cancelled.
+// A failed or rejected download is handed back to loader_fetch_failed().
+EM_JS(void, loader_fetch, (const char* filename, struct loader* loader), {
+    var url = UTF8ToString(filename);
+    var download = {cancelled: false, reader: null};
+    Module.loaderDownloads = Module.loaderDownloads || {};
+    Module.loaderDownloads[loader] = download;
+    fetch(url).then(function(response) {
+        if (download.cancelled) return;
+        if (!response.ok || !response.body) throw new Error("HTTP status " + response.status);
+        var reader = response.body.getReader();
+        download.reader = reader;
+        function pump() {
+            return reader.read().then(function(result) {
+                if (download.cancelled) return;
+                if (result.done) {
+                    delete Module.loaderDownloads[loader];
+                    _loader_stream_receive(loader, 0, 0);
+                    return;
+                }
+                var piece = _malloc(result.value.length);
+                HEAPU8.set(result.value, piece);
+                _loader_stream_receive(loader, piece, result.value.length);
+                _free(piece);
+                return pump();
+            });
+        }
+        return pump();
+    }).catch(function(error) {
+        if (download.cancelled) return;
+        console.error("loader_fetch(): Failed to download '" + url + "': " + error);
+        delete Module.loaderDownloads[loader];
+        _loader_fetch_failed(loader);
+    });
+});
+
+// Stop a download, so nothing more is handed to its loader and the loader can be freed.
+EM_JS(void, loader_fetch_cancel, (struct loader* loader), {
+    var download = Module.loaderDownloads && Module.loaderDownloads[loader];
+    if (!download) return;
+    download.cancelled = true;
+    if (download.reader) download.reader.cancel();
+    delete Module.loaderDownloads[loader];
+});
+#endif
+
+// Copy the positions and indices of a mesh's coarsest level of detail aside for occlusion culling, before its CPU copies are released.
+// Positions are decoded to floats, and the indices keep the mesh's index type. Translucent meshes never occlude, and are skipped.
+void mesh_keep_occluder(struct mesh* mesh) {
+    if (mesh->translucent == true || mesh->occluder_positions != NULL || mesh->vertices == NULL || mesh->indices == NULL) return;
+
+    struct mesh_lod* lod = &mesh->lods[mesh->num_lods - 1];
+    size_t index_bytes = mesh_index_size(mesh) * lod->num_indices;
+    mesh->occluder_positions = malloc(sizeof(float) * 3 * lod->num_vertices);
+    mesh->occluder_indices = malloc(index_bytes);
+    if (mesh->occluder_positions == NULL || mesh->occluder_indices == NULL) {
+        printf("mesh_keep_occluder(): Failed to allocate memory for occluder copy. Exiting.\n");
+        exit(-1);
+    }
+    for (unsigned int i=0; i < lod->num_vertices; i++) {
+        mesh_read_position(mesh, i, &mesh->occluder_positions[i * 3]);
+    }
+    memcpy(mesh->occluder_indices, (uint8_t*)mesh->indices + lod->first_index * mesh_index_size(mesh), index_bytes);
+    mesh->occluder_num_vertices = lod->num_vertices;
+    mesh->occluder_num_indices = lod->num_indices;
+}
+
+// Free a mesh's CPU copies of its vertices and indices, keeping its GPU buffers and bounds.
+// Mapped meshes just forget their pointers, and their model unmaps the file.
+void mesh_release_cpu_data(struct mesh* mesh) {
+    if (mesh->mapped == false) {
+        free(mesh->vertices);
+        free(mesh->indices);
+    }
+    mesh->vertices = NULL;
+    mesh->indices = NULL;
+}
+
+// Free a mesh's CPU copies and vertex array, and hand its GPU buffers to the pool for reuse.
+// The mesh itself is left to the arena it was allocated from.
+void mesh_destroy(struct mesh* mesh) {
+    // Unbind the vertex array first, so its name is not mistaken for still bound if it is reused.
+    render_state_bind_vertex_array(0);
+    if (mesh->VAO != 0) glDeleteVertexArrays(1, &mesh->VAO);
+    if (mesh->VBO != 0) buffer_pool_release(GL_ARRAY_BUFFER, mesh->VBO, mesh->vertex_buffer_size);
+    if (mesh->EBO != 0) buffer_pool_release(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO, mesh->index_buffer_size);
+    mesh->VAO = 0;
+    mesh->VBO = 0;
+    mesh->EBO = 0;
+    mesh_release_cpu_data(mesh);
+    free(mesh->occluder_positions);
+    free(mesh->occluder_indices);
+    mesh->occluder_positions = NULL;
+    mesh->occluder_indices = NULL;
+}
+
+// Destroy a mesh allocated on its own, and free it.
+void mesh_free(struct mesh* mesh) {
+    mesh_destroy(mesh);
+    free(mesh);
+}
+
+// Add up the memory a mesh holds: the mesh itself and its own CPU copies, and its GPU buffers once they are created.
+// Recycled buffers count at their full size.
+void mesh_memory_usage(struct mesh* mesh, struct memory_usage* usage) {
+    size_t vertex_bytes = mesh_vertex_size(mesh) * mesh->num_vertices;
+    size_t index_bytes = mesh_index_size(mesh) * mesh->num_indices;
+    usage->cpu_bytes = usage->cpu_bytes + sizeof(struct mesh);
+    if (mesh->mapped == false && mesh->vertices != NULL) usage->cpu_bytes = usage->cpu_bytes + vertex_bytes;
+    if (mesh->mapped == false && mesh->indices != NULL) usage->cpu_bytes = usage->cpu_bytes + index_bytes;
+    if (mesh->occluder_positions != NULL) {
+        usage->cpu_bytes = usage->cpu_bytes + sizeof(float) * 3 * mesh->occluder_num_vertices + mesh_index_size(mesh) * mesh->occluder_num_indices;
+    }
+    if (mesh->VBO != 0) usage->gpu_bytes = usage->gpu_bytes + mesh->vertex_buffer_size;
+    if (mesh->EBO != 0) usage->gpu_bytes = usage->gpu_bytes + mesh->index_buffer_size;
+}
+
+// Load every mesh of a model's file and hand them to the main thread through the pending list.
+// Binary models written by 'object_converter_tool --binary' are memory mapped, streamed models written by
+// 'object_converter_tool --stream' are decoded as they are read, and anything else is parsed as the text format.
+void* loader_run(void* argument) {
+    struct loader* loader = argument;
+
+    PROFILE_BEGIN("load model");
+
+    // Web builds that stream their model download it in the background, and are not embedded to check for a magic.
+    #if MODEL_STREAM_FETCH
+    loader->streaming = true;
+    loader_fetch(loader->filename, loader);
+    PROFILE_END();
+    return NULL;
+    #endif
+
+    // Check the start of the file for the binary model magic to pick a loader.
+    char magic[MODEL_FORMAT_MAGIC_SIZE] = {0};
+    FILE* obj_file = fopen(loader->filename, "rb");
+    if (obj_file == NULL) {
+        printf("loader_run(): Failed to open file '%s'. Exiting.\n", loader->filename);
+        exit(-1);
+    }
+    size_t magic_size = fread(magic, 1, MODEL_FORMAT_MAGIC_SIZE, obj_file);
+    fclose(obj_file);
+
+    // Streamed models publish their meshes piece by piece as they are decoded.
+    if (magic_size == MODEL_FORMAT_MAGIC_SIZE && memcmp(magic, MODEL_STREAM_MAGIC, MODEL_FORMAT_MAGIC_SIZE) == 0) {
+        loader->streaming = true;
+        loader_stream_file(loader);
+        PROFILE_END();
+        return NULL;
+    }
+
+    // Load the meshes
+    void* mapping = NULL;
+    size_t mapping_size = 0;
+    struct cluster_node* nodes = NULL;
+    size_t num_nodes = 0;
+    struct mesh* meshes = NULL;
+    if (model_format_has_magic(magic, magic_size)) {
+        meshes = mesh_load_binary(&loader->arena, loader->filename, &mapping, &mapping_size, &nodes, &num_nodes);
+        if (meshes == NULL) {
+            printf("loader_run(): Failed to load binary model '%s'. Exiting.\n", loader->filename);
+            exit(-1);
+        }
+    }
+    else {
+        meshes = mesh_load_text(&loader->arena, loader->filename, &nodes, &num_nodes);
+    }
+    for (struct mesh* mesh = meshes; mesh != NULL; mesh = mesh->next) {
+        mesh_compute_translucent(mesh);
+    }
+
+    // Publish the meshes and their cluster tree so the main thread can start uploading them.
+    #if THREADS_AVAILABLE
+    pthread_mutex_lock(&loader->mutex);
+    #endif
+    *loader->pending_tail = meshes;
+    while (*loader->pending_tail != NULL) {
+        loader->pending_tail = &(*loader->pending_tail)->next;
+    }
+    loader->nodes = nodes;
+    loader->num_nodes = num_nodes;
+    loader->mapping = mapping;
+    loader->mapping_size = mapping_size;
+    loader->finished = true;
+    #if THREADS_AVAILABLE
+    pthread_mutex_unlock(&loader->mutex);
+    #endif
+
+    PROFILE_END();
+    return NULL;
+}
+
+// Create a model in the scene's arena and start loading its meshes in the background.
+// The model is returned straight away with no meshes; program_stream_meshes() adds them as they finish uploading.
+struct model* model_new(char* model_filename) {
+    // Allocate memory for the model.
+    struct model* model = arena_alloc(&program->scene.arena, sizeof(struct model));
+    if (model == NULL) {
+        printf("model_new(): Failed to allocate memory for model. Exiting.\n");
+        exit(-1);
+    }
+    // Store the name of the model.
+    model->name = arena_strdup(&program->scene.arena, model_filename);
+    if (model->name == NULL) {
+        printf("model_new(): Failed to allocate memory for model name. Exiting.\n");
+        exit(-1);
+    }
+    model->meshes = NULL;
+    model->mesh_table = NULL;
+    model->num_meshes = 0;
+    model->nodes = NULL;
+    model->num_nodes = 0;
+    model->mapping = NULL;
+    model->mapping_size = 0;
+    model->num_objects = 0;
+    model->cpu_needed = true;
+    model->cpu_released = false;
+    model->occluder = false;
+    glm_vec3_zero(model->bounds_min);
+    glm_vec3_zero(model->bounds_max);
+    glm_vec3_zero(model->bounds_centre);
+    model->bounds_radius = 0.0;
+
+    // Initialise the loader.
+    model->loader = malloc(sizeof(struct loader));
+    if (model->loader == NULL) {
+        printf("model_new(): Failed to allocate memory for loader. Exiting.\n");
+        exit(-1);
+    }
+    model->loader->filename = model->name;
+    arena_init(&model->loader->arena, 0);
+    model->loader->pending = NULL;
+    model->loader->pending_tail = &model->loader->pending;
+    model->loader->nodes = NULL;
+    model->loader->num_nodes = 0;
+    model->loader->mapping = NULL;
+    model->loader->mapping_size = 0;
+    model->loader->started = false;
+    model->loader->finished = false;
+    model->loader->failed = false;
+    model->loader->start_time = glfwGetTime();
+    model->loader->streaming = false;
+    model_stream_init(&model->loader->stream);
+    model->loader->stream_meshes = NULL;
+    model->loader->available_vertices = NULL;
+    model->loader->available_indices = NULL;
+    model->loader->num_stream_meshes = 0;
+    model->loader->bytes_received = 0;
+    model->loader->bytes_decoded = 0;
+    model->loader->bytes_taken = 0;
+    model->loader->decode_time = 0.0;
+    model->loader->first_draw_time = 0.0;
+    model->loader->first_draw_bytes = 0;
+
+    // Start loading on a background thread. Without threads, the first call to program_stream_meshes() loads the model.
+    // Loaders are not jobs: they spend most of their time blocked on the file, and a job waiting on the main thread could pick one up.
+    #if THREADS_AVAILABLE
+    pthread_mutex_init(&model->loader->mutex, NULL);
+    if (pthread_create(&model->loader->thread, NULL, loader_run, model->loader) != 0) {
+        printf("model_new(): Failed to start loader thread. Exiting.\n");
+        exit(-1);
+    }
+    model->loader->started = true;
+    #endif
+
+    model->next = NULL;
+    return model;
+}
+
+// Find the model loaded from a file, or start loading it if no object has used it yet.
+struct model* model_get(char* model_filename) {
+    for (struct model* model = program->models; model != NULL; model = model->next) {
+        if (strcmp(model->name, model_filename) == 0) return model;
+    }
+
+    struct model* model = model_new(model_filename);
+    model->next = program->models;
+    program->models = model;
+    return model;
+}
+
+// Wait for a loader to finish and free it, along with whatever it loaded that the model never took.
+// Web builds that download their model cannot wait, and cancel an unfinished download instead.
+// The loader's arena moves to the scene, since the meshes the model took were allocated from it.
+void loader_free(struct loader* loader) {
+    #if MODEL_STREAM_FETCH
+    if (loader->started == true && loader->finished == false) loader_fetch_cancel(loader);
+    #endif
+    #if THREADS_AVAILABLE
+    if (loader->started == true) pthread_join(loader->thread, NULL);
+    pthread_mutex_destroy(&loader->mutex);
+    #endif
+
+    for (struct mesh* mesh = loader->pending; mesh != NULL; mesh = mesh->next) {
+        mesh_destroy(mesh);
+    }
+    if (loader->mapping != NULL) munmap(loader->mapping, loader->mapping_size);
+    if (loader->stream.status != MODEL_STREAM_DONE) model_stream_free(&loader->stream);
+    free(loader->stream_meshes);
+    free(loader->available_vertices);
+    free(loader->available_indices);
+    arena_adopt(&program->scene.arena, &loader->arena);
+    free(loader);
+}
+
+// Add up the memory a model holds: its meshes, its cluster tree and mesh table, and its memory mapped file.
+void model_memory_usage(struct model* model, struct memory_usage* usage) {
+    for (struct mesh* mesh = model->meshes; mesh != NULL; mesh = mesh->next) {
+        mesh_memory_usage(mesh, usage);
+    }
+    usage->cpu_bytes = usage->cpu_bytes + sizeof(struct model) + strlen(model->name) + 1;
+    usage->cpu_bytes = usage->cpu_bytes + sizeof(struct cluster_node) * model->num_nodes + sizeof(struct mesh*) * (model->num_meshes + 1);
+    usage->cpu_bytes = usage->cpu_bytes + model->mapping_size;
+}
+
+// Free the CPU copies of a model's meshes, and unmap its file, once they are all on the GPU.
+// Models of occluders first copy aside the coarsest level of detail of each mesh for occlusion culling.
+void model_release_cpu_data(struct model* model) {
+    struct memory_usage before = {0, 0};
+    struct memory_usage after = {0, 0};
+    model_memory_usage(model, &before);
+    for (struct mesh* mesh = model->meshes; mesh != NULL; mesh = mesh->next) {
+        if (model->occluder == true) mesh_keep_occluder(mesh);
+        mesh_release_cpu_data(mesh);
+    }
+    if (model->mapping != NULL) munmap(model->mapping, model->mapping_size);
+    model->mapping = NULL;
+    model->mapping_size = 0;
+    model->cpu_released = true;
+    model_memory_usage(model, &after);
+    fprintf(stderr, "Released %.2f MB of CPU mesh data for '%s', keeping %.2f MB on the GPU.\n", (before.cpu_bytes - after.cpu_bytes) / 1048576.0, model->name, after.gpu_bytes / 1048576.0);
+}
+
+// Free a model's mesh data, pool its GPU buffers and unmap its file, waiting for its loader first if it is still loading.
+// The model, its meshes and its cluster tree stay in the scene's arena until the scene is unloaded.
+void model_free(struct model* model) {
+    if (model->loader != NULL) loader_free(model->loader);
+    model->loader = NULL;
+    for (struct mesh* mesh = model->meshes; mesh != NULL; mesh = mesh->next) {
+        mesh_destroy(mesh);
+    }
+    if (model->mapping != NULL) munmap(model->mapping, model->mapping_size);
+    model->mapping = NULL;
+}
+
+// Remove a model from the program's list and free it.
+void model_delete(struct model* model) {
+    struct model** link = &program->models;
+    while (*link != model) {
+        link = &(*link)->next;
+    }
+    *link = model->next;
+    model_free(model);
+}
+
+
+// Grow every array of the scene to hold at least count objects, rounded up to a multiple of four for the SIMD update.
+void scene_reserve(struct scene* scene, size_t count) {
+    if (count <= scene->capacity) return;
+    size_t capacity = scene->capacity == 0 ? 64 : scene->capacity;
+    while (capacity < count) {
+        capacity = capacity * 2;
+    }
+    capacity = (capacity + 3) & ~(size_t)3;
+
+    float** arrays[] = {
+        &scene->position_x, &scene->position_y, &scene->position_z,
+        &scene->scale_x, &scene->scale_y, &scene->scale_z,
+        &scene->rotation_x, &scene->rotation_y, &scene->rotation_z, &scene->rotation_w,
+        &scene->bounds_x, &scene->bounds_y, &scene->bounds_z, &scene->bounds_radius,
+        &scene->world_x, &scene->world_y, &scene->world_z, &scene->world_radius, &scene->world_scale
+    };
+    bool failed = false;
+    for (size_t i=0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        float* array = realloc(*arrays[i], sizeof(float) * capacity);
+        if (array == NULL) failed = true;
+        else *arrays[i] = array;
+    }
+    struct object* objects = realloc(scene->objects, sizeof(struct object) * capacity);
+    if (objects != NULL) scene->objects = objects;
+    mat4* world = realloc(scene->world, sizeof(mat4) * capacity);
+    if (world != NULL) scene->world = world;
+    uint8_t* dirty = realloc(scene->dirty, sizeof(uint8_t) * capacity);
+    if (dirty != NULL) scene->dirty = dirty;
+    uint8_t* visible = realloc(scene->visible, sizeof(uint8_t) * capacity);
+    if (visible != NULL) scene->visible = visible;
+    uint32_t* handles = realloc(scene->handles, sizeof(uint32_t) * capacity);
+    if (handles != NULL) scene->handles = handles;
+    if (failed == true || objects == NULL || world == NULL || dirty == NULL || visible == NULL || handles == NULL) {
+        printf("scene_reserve(): Failed to allocate memory for the scene. Exiting.\n");
+        exit(-1);
+    }
+
+    // Fill the new entries with identity transforms, so the padding past the last object is harmless to update.
+    for (size_t i=scene->capacity; i < capacity; i++) {
+        scene->position_x[i] = 0.0;
+        scene->position_y[i] = 0.0;
+        scene->position_z[i] = 0.0;
+        scene->scale_x[i] = 1.0;
+        scene->scale_y[i] = 1.0;
+        scene->scale_z[i] = 1.0;
+        scene->rotation_x[i] = 0.0;
+        scene->rotation_y[i] = 0.0;
+        scene->rotation_z[i] = 0.0;
+        scene->rotation_w[i] = 1.0;
+        scene->bounds_x[i] = 0.0;
+        scene->bounds_y[i] = 0.0;
+        scene->bounds_z[i] = 0.0;
+        scene->bounds_radius[i] = 0.0;
+        scene->dirty[i] = 0;
+    }
+    scene->capacity = capacity;
+}
+
+// Return the array index of the object a handle refers to.
+size_t scene_index(struct scene* scene, uint32_t handle) {
+    return scene->slots[handle];
+}
+
+// Mark an object's world matrix and bounds as needing to be rebuilt by the next scene_update().
+void scene_mark_dirty(struct scene* scene, size_t index) {
+    if (scene->dirty[index] == 0) scene->num_dirty++;
+    scene->dirty[index] = 1;
+}
+
+// Add an object to the scene with an identity transform and no bounds, and return its handle.
+// The object itself is left for the caller to fill in.
+uint32_t scene_add(struct scene* scene) {
+    scene_reserve(scene, scene->count + 1);
+
+    // Reuse a removed object's handle, or make a new one.
+    uint32_t handle = scene->free_slot;
+    if (handle != UINT32_MAX) {
+        scene->free_slot = scene->slots[handle];
+    }
+    else {
+        if (scene->num_slots == scene->slots_capacity) {
+            scene->slots_capacity = scene->slots_capacity == 0 ? 64 : scene->slots_capacity * 2;
+            scene->slots = realloc(scene->slots, sizeof(uint32_t) * scene->slots_capacity);
+            if (scene->slots == NULL) {
+                printf("scene_add(): Failed to allocate memory for scene handles. Exiting.\n");
+                exit(-1);
+            }
+        }
+        handle = (uint32_t)scene->num_slots;
+        scene->num_slots++;
+    }
+
+    size_t index = scene->count;
+    scene->count++;
+    scene->slots[handle] = (uint32_t)index;
+    scene->handles[index] = handle;
+    memset(&scene->objects[index], 0, sizeof(struct object));
+    scene->objects[index].handle = handle;
+    scene_mark_dirty(scene, index);
+    return handle;
+}
+
+// Remove an object from the scene, moving the last object into its place. Its handle may be reused by the next object added.
+// Freeing what the object owns is left to the caller.
+void scene_remove(struct scene* scene, uint32_t handle) {
+    size_t index = scene_index(scene, handle);
+    size_t last = scene->count - 1;
+    if (scene->dirty[index] != 0) scene->num_dirty--;
+
+    if (index != last) {
+        float* arrays[] = {
+            scene->position_x, scene->position_y, scene->position_z,
+            scene->scale_x, scene->scale_y, scene->scale_z,
+            scene->rotation_x, scene->rotation_y, scene->rotation_z, scene->rotation_w,
+            scene->bounds_x, scene->bounds_y, scene->bounds_z, scene->bounds_radius,
+            scene->world_x, scene->world_y, scene->world_z, scene->world_radius, scene->world_scale
+        };
+        for (size_t i=0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+            arrays[i][index] = arrays[i][last];
+        }
+        scene->objects[index] = scene->objects[last];
+        glm_mat4_copy(scene->world[last], scene->world[index]);
+        scene->dirty[index] = scene->dirty[last];
+        scene->handles[index] = scene->handles[last];
+        scene->slots[scene->handles[index]] = (uint32_t)index;
+    }
+
+    // Return the last entry to padding, and the handle to the free list.
+    scene->position_x[last] = 0.0;
+    scene->position_y[last] = 0.0;
+    scene->position_z[last] = 0.0;
+    scene->scale_x[last] = 1.0;
+    scene->scale_y[last] = 1.0;
+    scene->scale_z[last] = 1.0;
+    scene->rotation_x[last] = 0.0;
+    scene->rotation_y[last] = 0.0;
+    scene->rotation_z[last] = 0.0;
+    scene->rotation_w[last] = 1.0;
+    scene->bounds_x[last] = 0.0;
+    scene->bounds_y[last] = 0.0;
+    scene->bounds_z[last] = 0.0;
+    scene->bounds_radius[last] = 0.0;
+    scene->dirty[last] = 0;
+    scene->count--;
+    scene->slots[handle] = scene->free_slot;
+    scene->free_slot = handle;
+}
+
+// Set an object's position, scale and model space bounding sphere. Rotations start at the identity, and scene_update() applies them.
+void scene_set_position(struct scene* scene, uint32_t handle, vec3 position) {
+    size_t index = scene_index(scene, handle);
+    scene->position_x[index] = position[0];
+    scene->position_y[index] = position[1];
+    scene->position_z[index] = position[2];
+    scene_mark_dirty(scene, index);
+}
+
+void scene_set_scale(struct scene* scene, uint32_t handle, vec3 scale) {
+    size_t index = scene_index(scene, handle);
+    scene->scale_x[index] = scale[0];
+    scene->scale_y[index] = scale[1];
+    scene->scale_z[index] = scale[2];
+    scene_mark_dirty(scene, index);
+}
+
+void scene_set_bounds(struct scene* scene, uint32_t handle, vec3 centre, float radius) {
+    size_t index = scene_index(scene, handle);
+    scene->bounds_x[index] = centre[0];
+    scene->bounds_y[index] = centre[1];
+    scene->bounds_z[index] = centre[2];
+    scene->bounds_radius[index] = radius;
+    scene_mark_dirty(scene, index);
+}
+
+// Rebuild the world matrices and bounds of four objects from index onwards, as translation * rotation * scale.
+// The columns of the rotation matrix come from the quaternion, scaled by the scale along each axis.
+// Each of the four SIMD lanes is one object, so every column is computed for all four at once and then transposed into their matrices.
+// The bounding sphere's centre is transformed by the matrix, and its radius grows by the largest scale.
+void scene_update_four(struct scene* scene, size_t index) {
+    lanes x = lanes_load(&scene->rotation_x[index]);
+    lanes y = lanes_load(&scene->rotation_y[index]);
+    lanes z = lanes_load(&scene->rotation_z[index]);
+    lanes w = lanes_load(&scene->rotation_w[index]);
+    lanes sx = lanes_load(&scene->scale_x[index]);
+    lanes sy = lanes_load(&scene->scale_y[index]);
+    lanes sz = lanes_load(&scene->scale_z[index]);
+    lanes one = lanes_splat(1.0f);
+    lanes two = lanes_splat(2.0f);
+
+    lanes xx = lanes_mul(x, x);
+    lanes yy = lanes_mul(y, y);
+    lanes zz = lanes_mul(z, z);
+    lanes xy = lanes_mul(x, y);
+    lanes xz = lanes_mul(x, z);
+    lanes yz = lanes_mul(y, z);
+    lanes wx = lanes_mul(w, x);
+    lanes wy = lanes_mul(w, y);
+    lanes wz = lanes_mul(w, z);
+
+    lanes columns[4][4];
+    columns[0][0] = lanes_mul(lanes_sub(one, lanes_mul(two, lanes_add(yy, zz))), sx);
+    columns[0][1] = lanes_mul(lanes_mul(two, lanes_add(xy, wz)), sx);
+    columns[0][2] = lanes_mul(lanes_mul(two, lanes_sub(xz, wy)), sx);
+    columns[1][0] = lanes_mul(lanes_mul(two, lanes_sub(xy, wz)), sy);
+    columns[1][1] = lanes_mul(lanes_sub(one, lanes_mul(two, lanes_add(xx, zz))), sy);
+    columns[1][2] = lanes_mul(lanes_mul(two, lanes_add(yz, wx)), sy);
+    columns[2][0] = lanes_mul(lanes_mul(two, lanes_add(xz, wy)), sz);
+    columns[2][1] = lanes_mul(lanes_mul(two, lanes_sub(yz, wx)), sz);
+    columns[2][2] = lanes_mul(lanes_sub(one, lanes_mul(two, lanes_add(xx, yy))), sz);
+    columns[3][0] = lanes_load(&scene->position_x[index]);
+    columns[3][1] = lanes_load(&scene->position_y[index]);
+    columns[3][2] = lanes_load(&scene->position_z[index]);
+    columns[0][3] = lanes_splat(0.0f);
+    columns[1][3] = columns[0][3];
+    columns[2][3] = columns[0][3];
+    columns[3][3] = one;
+
+    // Transform the bounding spheres while the columns are still split by component.
+    lanes bx = lanes_load(&scene->bounds_x[index]);
+    lanes by = lanes_load(&scene->bounds_y[index]);
+    lanes bz = lanes_load(&scene->bounds_z[index]);
+    for (int k=0; k < 3; k++) {
+        lanes centre = lanes_add(lanes_add(lanes_mul(columns[0][k], bx), lanes_mul(columns[1][k], by)), lanes_add(lanes_mul(columns[2][k], bz), columns[3][k]));
+        float* world = k == 0 ? scene->world_x : (k == 1 ? scene->world_y : scene->world_z);
+        lanes_store(&world[index], centre);
+    }
+    lanes largest = lanes_max(lanes_max(lanes_abs(sx), lanes_abs(sy)), lanes_abs(sz));
+    lanes_store(&scene->world_scale[index], largest);
+    lanes_store(&scene->world_radius[index], lanes_mul(lanes_load(&scene->bounds_radius[index]), largest));
+
+    for (int c=0; c < 4; c++) {
+        lanes_transpose(&columns[c][0], &columns[c][1], &columns[c][2], &columns[c][3]);
+        for (int j=0; j < 4; j++) {
+            lanes_store(scene->world[index + j][c], columns[c][j]);
+        }
+    }
+}
+
+// Rebuild the world matrices and bounds of every object marked dirty, skipping groups of four where none are.
+void scene_update(struct scene* scene) {
+    if (scene->num_dirty == 0) return;
+    for (size_t i=0; i < scene->count; i += 4) {
+        uint32_t dirty;
+        memcpy(&dirty, &scene->dirty[i], sizeof(uint32_t));
+        if (dirty == 0) continue;
+        scene_update_four(scene, i);
+        memset(&scene->dirty[i], 0, sizeof(uint32_t));
+    }
+    scene->num_dirty = 0;
+}
+
+// Test every object's world bounding sphere against the frustum planes, setting visible[i] to 1 for objects that may be visible.
+// The loop is branch free over contiguous arrays, so compilers turn it into SIMD code.
+void scene_test_spheres(struct scene* scene, vec4 planes[6]) {
+    for (size_t i=0; i < scene->count; i++) {
+        scene->visible[i] = 1;
+    }
+    for (int p=0; p < 6; p++) {
+        const float nx = planes[p][0];
+        const float ny = planes[p][1];
+        const float nz = planes[p][2];
+        const float d = planes[p][3];
+        const float* restrict cx = scene->world_x;
+        const float* restrict cy = scene->world_y;
+        const float* restrict cz = scene->world_z;
+        const float* restrict radius = scene->world_radius;
+        uint8_t* restrict visible = scene->visible;
+        for (size_t i=0; i < scene->count; i++) {
+            float distance = nx * cx[i] + ny * cy[i] + nz * cz[i] + d;
+            visible[i] = visible[i] & (distance + radius[i] >= 0.0f);
+        }
+    }
+}
+
+// Return the object a handle refers to. The pointer is only valid until objects are next added or removed.
+struct object* object_get(uint32_t handle) {
+    return &program->scene.objects[scene_index(&program->scene, handle)];
+}
+
+// Create an object instance of the model in a file, sharing the model with every other object that uses the file,
+// and return its handle. The model loads in the background the first time it is used, and the object is drawn once it arrives.
+// The object starts at the origin with no rotation and a scale of one.
+uint32_t object_new(char* object_filename) {
+    uint32_t handle = scene_add(&program->scene);
+    struct object* object = object_get(handle);
+    object->model = model_get(object_filename);
+    object->model->num_objects++;
+    object->lods = NULL;
+    object->is_static = false;
+    object->is_occluder = false;
+    object->batch_checked = false;
+    object->batch_slots = NULL;
+    glm_vec4_copy((vec4){1.0, 1.0, 1.0, 1.0}, object->tint);
+    return handle;
+}
+
+// Remove an object from the scene. Its copies in batch pages stay there, undrawn, and what it owns stays in the scene's arena.
+// The object's model is freed with it if no other object uses it, or once it has loaded if it is still loading.
+void object_delete(uint32_t handle) {
+    struct model* model = object_get(handle)->model;
+    scene_remove(&program->scene, handle);
+
+    model->num_objects--;
+    if (model->num_objects == 0 && model->loader == NULL) {
+        model_delete(model);
+    }
+}
+
+// Return the memory an object holds, counting an equal share of its model's with the other objects using it,
+// so adding up every object gives the memory of every model and object.
+struct memory_usage object_memory_usage(uint32_t handle) {
+    struct object* object = object_get(handle);
+    struct memory_usage model_usage = {0, 0};
+    model_memory_usage(object->model, &model_usage);
+
+    struct memory_usage usage;
+    usage.cpu_bytes = model_usage.cpu_bytes / object->model->num_objects + sizeof(struct object);
+    usage.gpu_bytes = model_usage.gpu_bytes / object->model->num_objects;
+    if (object->lods != NULL) usage.cpu_bytes = usage.cpu_bytes + object->model->num_meshes + 1;
+    if (object->batch_slots != NULL) usage.cpu_bytes = usage.cpu_bytes + sizeof(struct batch_slot) * (object->model->num_meshes + 1);
+    return usage;
+}
+
+// Free the arrays and arena of a scene whose objects and models have been deleted.
+void scene_free(struct scene* scene) {
+    float* arrays[] = {
+        scene->position_x, scene->position_y, scene->position_z,
+        scene->scale_x, scene->scale_y, scene->scale_z,
+        scene->rotation_x, scene->rotation_y, scene->rotation_z, scene->rotation_w,
+        scene->bounds_x, scene->bounds_y, scene->bounds_z, scene->bounds_radius,
+        scene->world_x, scene->world_y, scene->world_z, scene->world_radius, scene->world_scale
+    };
+    for (size_t i=0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        free(arrays[i]);
+    }
+    free(scene->objects);
+    free(scene->world);
+    free(scene->dirty);
+    free(scene->visible);
+    free(scene->handles);
+    free(scene->slots);
+    arena_free(&scene->arena);
+    memset(scene, 0, sizeof(struct scene));
+    scene->free_slot = UINT32_MAX;
+}
+
+// Take the cluster tree from a model's finished loader, index the model's meshes for it, and set the model's bounds from its root.
+void model_take_cluster_tree(struct model* model, struct cluster_node* nodes, size_t num_nodes) {
+    model->num_meshes = 0;
+    for (struct mesh* mesh = model->meshes; mesh != NULL; mesh = mesh->next) {
+        model->num_meshes++;
+    }
+
+    model->mesh_table = arena_alloc(&program->scene.arena, sizeof(struct mesh*) * (model->num_meshes + 1));
+    if (model->mesh_table == NULL) {
+        printf("model_take_cluster_tree(): Failed to allocate memory for mesh table. Exiting.\n");
+        exit(-1);
+    }
+    size_t index = 0;
+    for (struct mesh* mesh = model->meshes; mesh != NULL; mesh = mesh->next) {
+        model->mesh_table[index] = mesh;
+        index++;
+    }
+
+    model->nodes = nodes;
+    model->num_nodes = num_nodes;
+    glm_vec3_copy(nodes[0].bounds_min, model->bounds_min);
+    glm_vec3_copy(nodes[0].bounds_max, model->bounds_max);
+    glm_vec3_add(model->bounds_min, model->bounds_max, model->bounds_centre);
+    glm_vec3_scale(model->bounds_centre, 0.5, model->bounds_centre);
+    model->bounds_radius = glm_vec3_distance(model->bounds_centre, model->bounds_max);
+}
+
+// Move a model's newly loaded meshes from its loader into the model's mesh list.
+// Returns true when the loader has finished and every mesh has been taken.
+bool model_take_loaded_meshes(struct model* model) {
+    struct loader* loader = model->loader;
+
+    #if THREADS_AVAILABLE
+    pthread_mutex_lock(&loader->mutex);
+    #else
+    if (loader->started == false) {
+        loader->started = true;
+        loader_run(loader);
+    }
+    #endif
+    struct mesh* pending = loader->pending;
+    bool finished = loader->finished;
+    struct cluster_node* nodes = loader->nodes;
+    size_t num_nodes = loader->num_nodes;
+    loader->pending = NULL;
+    loader->pending_tail = &loader->pending;
+    loader->nodes = NULL;
+
+    // Streamed meshes can upload as much as has been decoded so far.
+    for (size_t i=0; i < loader->num_stream_meshes; i++) {
+        loader->stream_meshes[i]->available_vertices = loader->available_vertices[i];
+        loader->stream_meshes[i]->available_indices = loader->available_indices[i];
+    }
+    loader->bytes_taken = loader->bytes_received;
+    #if THREADS_AVAILABLE
+    pthread_mutex_unlock(&loader->mutex);
+    #endif
+
+    // Append to the end of the model's mesh list, creating GPU buffers for each new mesh.
+    struct mesh** tail = &model->meshes;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = pending;
+    while (pending != NULL) {
+        mesh_upload_begin(pending);
+        pending = pending->next;
+    }
+
+    // The cluster tree arrives with the last of the meshes.
+    if (nodes != NULL) {
+        model_take_cluster_tree(model, nodes, num_nodes);
+    }
+    return finished;
+}
+
+// Upload streaming models to the GPU, spending at most UPLOAD_BUDGET_BYTES per frame.
+// Meshes are drawn as soon as their own buffers are complete, or for streamed models, as soon as their coarsest level is.
+// Once a model has fully loaded and uploaded, its loader is released.
+void program_stream_meshes() {
+    size_t budget = UPLOAD_BUDGET_BYTES;
+
+    struct model* model = program->models;
+    while (model != NULL) {
+        if (model->loader == NULL) {
+            model = model->next;
+            continue;
+        }
+
+        bool finished = model_take_loaded_meshes(model);
+        if (model->loader->failed == true) {
+            printf("program_stream_meshes(): Failed to download '%s'. Exiting.\n", model->loader->filename);
+            exit(-1);
+        }
+
+        // Upload meshes in order until the frame's budget runs out.
+        bool uploaded = true;
+        bool drawable = false;
+        struct mesh* mesh = model->meshes;
+        while (mesh != NULL) {
+            if (mesh->uploaded == false && budget > 0) {
+                size_t used = mesh_upload_step(mesh, budget);
+                budget = budget - used;
+                program->render_stats.bytes_uploaded = program->render_stats.bytes_uploaded + used;
+            }
+            uploaded = uploaded && mesh->uploaded;
+            drawable = drawable || mesh->ready_lod < mesh->num_lods;
+            mesh = mesh->next;
+        }
+
+        // Remember how long a streamed model took to draw anything, and how much of it had arrived by then.
+        if (drawable == true && model->loader->first_draw_time == 0.0) {
+            model->loader->first_draw_time = glfwGetTime() - model->loader->start_time;
+            model->loader->first_draw_bytes = model->loader->bytes_taken;
+        }
+
+        // Release the loader once everything it produced is on the GPU.
+        if (finished == true && uploaded == true) {
+            #if THREADS_AVAILABLE
+            pthread_join(model->loader->thread, NULL);
+            pthread_mutex_destroy(&model->loader->mutex);
+            #endif
+            model->mapping = model->loader->mapping;
+            model->mapping_size = model->loader->mapping_size;
+            size_t vertex_bytes = 0;
+            size_t index_bytes = 0;
+            for (mesh = model->meshes; mesh != NULL; mesh = mesh->next) {
+                vertex_bytes = vertex_bytes + mesh_vertex_size(mesh) * mesh->num_vertices;
+                index_bytes = index_bytes + mesh_index_size(mesh) * mesh->num_indices;
+            }
+            fprintf(stderr, "Loaded '%s' in %.1f ms: %.2f MB of vertices, %.2f MB of indices.\n", model->name, (glfwGetTime() - model->loader->start_time) * 1000.0, vertex_bytes / 1048576.0, index_bytes / 1048576.0);
+            struct loader* loader = model->loader;
+            if (loader->streaming == true) {
+                double file_size = loader->bytes_received > 0 ? (double)loader->bytes_received : 1.0;
+                double decode_time = loader->decode_time > 0.0 ? loader->decode_time : 1e-9;
+                fprintf(stderr, "Streamed %.2f MB, decoded at %.1f MB/s of geometry. First drawn after %.1f ms and %.1f KB (%.0f%% of the file).\n",
+                    loader->bytes_received / 1048576.0, loader->bytes_decoded / 1048576.0 / decode_time,
+                    loader->first_draw_time * 1000.0, loader->first_draw_bytes / 1024.0, loader->first_draw_bytes * 100.0 / file_size);
+            }
+            free(loader->stream_meshes);
+            free(loader->available_vertices);
+            free(loader->available_indices);
+            arena_adopt(&program->scene.arena, &loader->arena);
+            free(model->loader);
+            model->loader = NULL;
+
+            // Free the model now if every object using it was deleted while it loaded.
+            if (model->num_objects == 0) {
+                struct model* next = model->next;
+                model_delete(model);
+                model = next;
+                continue;
+            }
+        }
+
+        model = model->next;
+    }
+}
+
+// Return true if a static object can be copied into batch pages: its model is small and everything about it is opaque.
+// Batching reads the model's vertices, so models whose CPU copies were released are drawn like any other.
+bool object_can_batch(struct object* object) {
+    struct model* model = object->model;
+    if (object->tint[3] < 1.0 || model->cpu_released == true) return false;
+
+    size_t num_vertices = 0;
+    for (size_t i=0; i < model->num_meshes; i++) {
+        if (model->mesh_table[i]->translucent == true) return false;
+        num_vertices = num_vertices + model->mesh_table[i]->num_vertices;
+    }
+    return num_vertices <= STATIC_BATCH_MAX_VERTICES;
+}
+
+// Return the newest batch page if it has room for a number of vertices, or start a new page.
+struct batch_page* batch_page_reserve(uint32_t num_vertices) {
+    struct batch_page* page = program->batch_pages;
+    if (page != NULL && page->num_vertices + num_vertices <= STATIC_BATCH_PAGE_VERTICES) return page;
+
+    page = calloc(1, sizeof(struct batch_page));
+    struct model_file_vertex* vertices = malloc(sizeof(struct model_file_vertex) * STATIC_BATCH_PAGE_VERTICES);
+    if (page == NULL || vertices == NULL) {
+        printf("batch_page_reserve(): Failed to allocate memory for batch page. Exiting.\n");
+        exit(-1);
+    }
+    page->vertices = vertices;
+    page->mesh = mesh_new(NULL, vertices, 0, NULL, 0, GL_UNSIGNED_SHORT);
+    page->mesh->page = page;
+    mesh_upload_begin(page->mesh);
+
+    page->next = program->batch_pages;
+    program->batch_pages = page;
+    return page;
+}
+
+// Append a level of detail of a mesh to a level's section of a batch page, offsetting the indices to where the mesh's vertices start in the page.
+void batch_page_add_indices(struct batch_page* page, uint32_t level, struct mesh* mesh, struct mesh_lod* lod, uint32_t base) {
+    uint32_t needed = page->num_indices[level] + lod->num_indices;
+    if (needed > page->indices_capacity[level]) {
+        page->indices_capacity[level] = page->indices_capacity[level] * 2 > needed ? page->indices_capacity[level] * 2 : needed;
+        page->indices[level] = realloc(page->indices[level], sizeof(uint16_t) * page->indices_capacity[level]);
+        if (page->indices[level] == NULL) {
+            printf("batch_page_add_indices(): Failed to allocate memory for batch indices. Exiting.\n");
+            exit(-1);
+        }
+    }
+
+    uint16_t* destination = &page->indices[level][page->num_indices[level]];
+    for (uint32_t i=0; i < lod->num_indices; i++) {
+        uint32_t index = mesh->index_type == GL_UNSIGNED_INT ? ((uint32_t*)mesh->indices)[lod->first_index + i] : ((uint16_t*)mesh->indices)[lod->first_index + i];
+        destination[i] = base + index;
+    }
+    page->num_indices[level] = needed;
+}
+
+// Copy every mesh of a static object into batch pages, transformed into world space with its tint baked into the vertex colours.
+// Each mesh keeps all its levels of detail, as a range in each level's section of its page.
+void static_batch_add_object(struct object* object) {
+    struct model* model = object->model;
+    object->batch_slots = arena_alloc(&program->scene.arena, sizeof(struct batch_slot) * (model->num_meshes + 1));
+    if (object->batch_slots == NULL) {
+        printf("static_batch_add_object(): Failed to allocate memory for batch slots. Exiting.\n");
+        exit(-1);
+    }
+
+    // Normals are transformed by the inverse transpose, which keeps them perpendicular under non uniform scales.
+    mat4 world;
+    mat3 normal_matrix;
+    glm_mat4_copy(program->scene.world[scene_index(&program->scene, object->handle)], world);
+    glm_mat4_pick3(world, normal_matrix);
+    glm_mat3_inv(normal_matrix, normal_matrix);
+    glm_mat3_transpose(normal_matrix);
+
+    for (size_t i=0; i < model->num_meshes; i++) {
+        struct mesh* mesh = model->mesh_table[i];
+        struct batch_page* page = batch_page_reserve(mesh->num_vertices);
+        uint32_t base = page->num_vertices;
+        for (unsigned int j=0; j < mesh->num_vertices; j++) {
+            struct model_file_vertex vertex;
+            struct model_file_vertex* batched = &page->vertices[base + j];
+            mesh_read_vertex(mesh, j, &vertex);
+            glm_mat4_mulv3(world, vertex.position, 1.0, batched->position);
+            glm_mat3_mulv(normal_matrix, vertex.normal, batched->normal);
+            glm_vec3_normalize(batched->normal);
+            // Vertex colours are not 16 byte aligned within a vertex, so they are multiplied without cglm's aligned SIMD loads.
+            for (int k=0; k < 4; k++) {
+                batched->vertex_color[k] = vertex.vertex_color[k] * object->tint[k];
+            }
+        }
+        page->num_vertices = page->num_vertices + mesh->num_vertices;
+
+        if (page->num_ranges == page->ranges_capacity) {
+            page->ranges_capacity = page->ranges_capacity == 0 ? 64 : page->ranges_capacity * 2;
+            page->ranges = realloc(page->ranges, sizeof(struct batch_range) * page->ranges_capacity);
+            if (page->ranges == NULL) {
+                printf("static_batch_add_object(): Failed to allocate memory for batch ranges. Exiting.\n");
+                exit(-1);
+            }
+        }
+        struct batch_range* range = &page->ranges[page->num_ranges];
+        memset(range, 0, sizeof(struct batch_range));
+        for (uint32_t k=0; k < mesh->num_lods; k++) {
+            range->relative_first_index[k] = page->num_indices[k];
+            range->num_indices[k] = mesh->lods[k].num_indices;
+            batch_page_add_indices(page, k, mesh, &mesh->lods[k], base);
+        }
+
+        object->batch_slots[i] = (struct batch_slot){page, page->num_ranges};
+        page->num_ranges++;
+        page->dirty = true;
+    }
+}
+
+// Upload a batch page's vertices and its index sections one after another,
+// then point the page mesh's levels of detail at the sections and the ranges at where their indices landed.
+void batch_page_upload(struct batch_page* page) {
+    struct mesh* mesh = page->mesh;
+    uint32_t num_indices = 0;
+    for (uint32_t k=0; k < MODEL_FORMAT_MAX_LODS; k++) {
+        num_indices = num_indices + page->num_indices[k];
+    }
+    uint16_t* indices = malloc(sizeof(uint16_t) * (num_indices + 1));
+    if (indices == NULL) {
+        printf("batch_page_upload(): Failed to allocate memory for batch indices. Exiting.\n");
+        exit(-1);
+    }
+
+    uint32_t start = 0;
+    for (uint32_t k=0; k < MODEL_FORMAT_MAX_LODS; k++) {
+        memcpy(&indices[start], page->indices[k], sizeof(uint16_t) * page->num_indices[k]);
+        mesh->lods[k] = (struct mesh_lod){start, page->num_indices[k], 0.0, page->num_vertices};
+        start = start + page->num_indices[k];
+    }
+    for (uint32_t i=0; i < page->num_ranges; i++) {
+        for (uint32_t k=0; k < MODEL_FORMAT_MAX_LODS; k++) {
+            page->ranges[i].first_index[k] = mesh->lods[k].first_index + page->ranges[i].relative_first_index[k];
+        }
+    }
+    free(mesh->indices);
+    mesh->indices = indices;
+    mesh->num_indices = num_indices;
+    mesh->num_vertices = page->num_vertices;
+    mesh->num_lods = MODEL_FORMAT_MAX_LODS;
+    mesh->available_vertices = mesh->num_vertices;
+    mesh->available_indices = mesh->num_indices;
+
+    // Make sure no VAO is bound so binding the EBO does not change a drawable mesh.
+    render_state_bind_vertex_array(0);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(struct model_file_vertex) * page->num_vertices, page->vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices, indices, GL_STATIC_DRAW);
+    mesh->uploaded_vertex_bytes = sizeof(struct model_file_vertex) * page->num_vertices;
+    mesh->uploaded_index_bytes = sizeof(uint16_t) * num_indices;
+    mesh->vertex_buffer_size = mesh->uploaded_vertex_bytes;
+    mesh->index_buffer_size = mesh->uploaded_index_bytes;
+    program->render_stats.bytes_uploaded = program->render_stats.bytes_uploaded + mesh->uploaded_vertex_bytes + mesh->uploaded_index_bytes;
+    mesh->ready_lod = 0;
+    mesh->uploaded = true;
+    page->dirty = false;
+}
+
+// Free a batch page, its mesh, which owns the page's vertices and combined indices, and each level's section.
+void batch_page_free(struct batch_page* page) {
+    mesh_free(page->mesh);
+    for (uint32_t k=0; k < MODEL_FORMAT_MAX_LODS; k++) {
+        free(page->indices[k]);
+    }
+    free(page->ranges);
+    free(page);
+}
+
+// Copy static objects into batch pages once their models have loaded, and upload the pages that changed.
+// Objects are drawn from their pages from the next frame on, and until then like any other object.
+// Batched vertices are transformed by the objects' world matrices, so those are brought up to date first.
+void program_build_static_batches() {
+    scene_update(&program->scene);
+    for (size_t i=0; i < program->scene.count; i++) {
+        struct object* object = &program->scene.objects[i];
+        if (object->is_static == false || object->batch_checked == true) continue;
+        if (object->model->loader != NULL || object->model->nodes == NULL) continue;
+        object->batch_checked = true;
+        if (object_can_batch(object) == true) {
+            static_batch_add_object(object);
+        }
+    }
+
+    for (struct batch_page* page = program->batch_pages; page != NULL; page = page->next) {
+        if (page->dirty == true) batch_page_upload(page);
+    }
+}
+
+// Create the mesh runs of instances are drawn through when instancing is unavailable, with room for DYNAMIC_BATCH_VERTICES vertices.
+void dynamic_batch_init(struct dynamic_batch* batch) {
+    memset(batch, 0, sizeof(struct dynamic_batch));
+    if (program->instancing_supported == true) return;
+    batch->vertices = malloc(sizeof(struct model_file_vertex) * DYNAMIC_BATCH_VERTICES);
+    if (batch->vertices == NULL) {
+        printf("dynamic_batch_init(): Failed to allocate memory for the dynamic batch. Exiting.\n");
+        exit(-1);
+    }
+    batch->mesh = mesh_new(NULL, NULL, 0, NULL, 0, GL_UNSIGNED_SHORT);
+    mesh_upload_begin(batch->mesh);
+}
+
+// Free the dynamic batch's mesh and its vertices and indices.
+void dynamic_batch_free(struct dynamic_batch* batch) {
+    if (batch->mesh != NULL) mesh_free(batch->mesh);
+    free(batch->vertices);
+    free(batch->indices);
+    memset(batch, 0, sizeof(struct dynamic_batch));
+}
+
+// Return true if a model keeps its CPU copies for the dynamic batch: instancing is unavailable,
+// more than one object shares the model, and at least one of its meshes is small enough to copy every frame.
+bool model_can_batch_dynamically(struct model* model) {
+    if (program->instancing_supported == true || model->num_objects < 2) return false;
+    for (size_t i=0; i < model->num_meshes; i++) {
+        if (model->mesh_table[i]->num_vertices <= DYNAMIC_BATCH_MAX_VERTICES) return true;
+    }
+    return false;
+}
+
+// Return true if a run of instances of a mesh's level of detail can be drawn through the dynamic batch:
+// the level is small and the mesh still has its CPU copies to read.
+bool dynamic_batch_accepts(struct mesh* mesh, struct mesh_lod* lod) {
+    return mesh->vertices != NULL && mesh->indices != NULL && lod->num_vertices <= DYNAMIC_BATCH_MAX_VERTICES;
+}
+
+// Copy an instance of a mesh's level of detail into the dynamic batch, transformed into world space with its tint baked into
+// the vertex colours, and append the level's indices offset to where the copied vertices start.
+void dynamic_batch_add_instance(struct dynamic_batch* batch, struct mesh* mesh, struct mesh_lod* lod, struct instance* instance) {
+    // Normals are transformed by the inverse transpose, which keeps them perpendicular under non uniform scales.
+    mat3 normal_matrix;
+    glm_mat4_pick3(instance->model, normal_matrix);
+    glm_mat3_inv(normal_matrix, normal_matrix);
+    glm_mat3_transpose(normal_matrix);
+
+    uint32_t base = batch->num_vertices;
+    for (unsigned int j=0; j < lod->num_vertices; j++) {
+        struct model_file_vertex vertex;
+        struct model_file_vertex* batched = &batch->vertices[base + j];
+        mesh_read_vertex(mesh, j, &vertex);
+        glm_mat4_mulv3(instance->model, vertex.position, 1.0, batched->position);
+        glm_mat3_mulv(normal_matrix, vertex.normal, batched->normal);
+        glm_vec3_normalize(batched->normal);
+        // Vertex colours are not 16 byte aligned within a vertex, so they are multiplied without cglm's aligned SIMD loads.
+        for (int k=0; k < 4; k++) {
+            batched->vertex_color[k] = vertex.vertex_color[k] * instance->tint[k];
+        }
+    }
+    batch->num_vertices = batch->num_vertices + lod->num_vertices;
+
+    uint32_t needed = batch->num_indices + lod->num_indices;
+    if (needed > batch->indices_capacity) {
+        batch->indices_capacity = batch->indices_capacity * 2 > needed ? batch->indices_capacity * 2 : needed;
+        batch->indices = realloc(batch->indices, sizeof(uint16_t) * batch->indices_capacity);
+        if (batch->indices == NULL) {
+            printf("dynamic_batch_add_instance(): Failed to allocate memory for batch indices. Exiting.\n");
+            exit(-1);
+        }
+    }
+    uint16_t* destination = &batch->indices[batch->num_indices];
+    for (uint32_t i=0; i < lod->num_indices; i++) {
+        uint32_t index = mesh->index_type == GL_UNSIGNED_INT ? ((uint32_t*)mesh->indices)[lod->first_index + i] : ((uint16_t*)mesh->indices)[lod->first_index + i];
+        destination[i] = base + index;
+    }
+    batch->num_indices = needed;
+}
+
+// Draw a run of instances of a mesh's level of detail through the dynamic batch, with as many instances in each draw call
+// as fit in its vertices. The batch's vertex array must be bound, and the shader given an identity model matrix and a white tint.
+void dynamic_batch_draw(struct dynamic_batch* batch, struct mesh* mesh, struct mesh_lod* lod, struct instance* instances, size_t count) {
+    size_t i = 0;
+    while (i < count) {
+        batch->num_vertices = 0;
+        batch->num_indices = 0;
+        while (i < count && batch->num_vertices + lod->num_vertices <= DYNAMIC_BATCH_VERTICES) {
+            dynamic_batch_add_instance(batch, mesh, lod, &instances[i]);
+            i++;
+        }
+
+        // Orphan the previous draw's buffers rather than waiting for the GPU to finish reading them.
+        size_t vertex_bytes = sizeof(struct model_file_vertex) * batch->num_vertices;
+        size_t index_bytes = sizeof(uint16_t) * batch->num_indices;
+        glBindBuffer(GL_ARRAY_BUFFER, batch->mesh->VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertex_bytes, batch->vertices, GL_STREAM_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, batch->indices, GL_STREAM_DRAW);
+        batch->mesh->vertex_buffer_size = vertex_bytes;
+        batch->mesh->index_buffer_size = index_bytes;
+        glDrawElements(GL_TRIANGLES, batch->num_indices, GL_UNSIGNED_SHORT, (void*)0);
+        program->render_stats.draw_calls++;
+        program->render_stats.triangles_drawn = program->render_stats.triangles_drawn + batch->num_indices / 3;
+        program->render_stats.bytes_uploaded = program->render_stats.bytes_uploaded + vertex_bytes + index_bytes;
+    }
+}
+
+// Free the CPU copies of every model that has finished uploading and that nothing needs to read again.
+// Static objects not yet checked for batching may still be copied into batch pages, so their models keep their copies,
+// as do models shared by several objects that the dynamic batch copies instances of every frame.
+// Occluders are rasterised every frame, so their models keep a compact copy of each mesh's coarsest level of detail instead.
+// Culling only needs the bounds, which every mesh keeps.
+void program_release_cpu_meshes() {
+    if (program->release_cpu_meshes == false) return;
+
+    for (struct model* model = program->models; model != NULL; model = model->next) {
+        model->cpu_needed = model->loader != NULL;
+        model->occluder = false;
+        for (struct mesh* mesh = model->meshes; mesh != NULL; mesh = mesh->next) {
+            if (mesh->uploaded == false) model->cpu_needed = true;
+        }
+    }
+    for (size_t i=0; i < program->scene.count; i++) {
+        struct object* object = &program->scene.objects[i];
+        if (object->is_occluder == true) object->model->occluder = true;
+        if (object->is_static == true && object->batch_checked == false) object->model->cpu_needed = true;
+    }
+    for (struct model* model = program->models; model != NULL; model = model->next) {
+        if (model_can_batch_dynamically(model) == true) model->cpu_needed = true;
+        if (model->cpu_needed == false && model->cpu_released == false) model_release_cpu_data(model);
+    }
+}
+
+// Print the memory each object holds on the CPU and in GPU buffers, with totals for the models, objects and batch pages.
+// Each object is counted with an equal share of its model, and each model once in the totals.
+void program_memory_report() {
+    struct memory_usage models = {0, 0};
+    struct memory_usage objects = {0, 0};
+    struct memory_usage pages = {0, 0};
+
+    printf("Memory by object:\n");
+    for (size_t i=0; i < program->scene.count; i++) {
+        struct object* object = &program->scene.objects[i];
+        struct memory_usage usage = object_memory_usage(object->handle);
+        printf("  %6u  %-32s  CPU %9.2f KB  GPU %9.2f KB  shared by %u objects\n", object->handle, object->model->name,
+            usage.cpu_bytes / 1024.0, usage.gpu_bytes / 1024.0, object->model->num_objects);
+        objects.cpu_bytes = objects.cpu_bytes + sizeof(struct object);
+        if (object->lods != NULL) objects.cpu_bytes = objects.cpu_bytes + object->model->num_meshes + 1;
+        if (object->batch_slots != NULL) objects.cpu_bytes = objects.cpu_bytes + sizeof(struct batch_slot) * (object->model->num_meshes + 1);
+    }
+    for (struct model* model = program->models; model != NULL; model = model->next) {
+        model_memory_usage(model, &models);
+    }
+    for (struct batch_page* page = program->batch_pages; page != NULL; page = page->next) {
+        pages.cpu_bytes = pages.cpu_bytes + sizeof(struct batch_page) + sizeof(struct model_file_vertex) * STATIC_BATCH_PAGE_VERTICES + sizeof(struct batch_range) * page->ranges_capacity;
+        for (uint32_t k=0; k < MODEL_FORMAT_MAX_LODS; k++) {
+            pages.cpu_bytes = pages.cpu_bytes + sizeof(uint16_t) * page->indices_capacity[k];
+        }
+        pages.cpu_bytes = pages.cpu_bytes + sizeof(struct mesh) + sizeof(uint16_t) * page->mesh->num_indices;
+        if (page->mesh->VBO != 0) pages.gpu_bytes = pages.gpu_bytes + page->mesh->uploaded_vertex_bytes;
+        if (page->mesh->EBO != 0) pages.gpu_bytes = pages.gpu_bytes + page->mesh->uploaded_index_bytes;
+    }
+    printf("Models:        CPU %9.2f MB  GPU %9.2f MB\n", models.cpu_bytes / 1048576.0, models.gpu_bytes / 1048576.0);
+    printf("Objects:       CPU %9.2f MB\n", objects.cpu_bytes / 1048576.0);
+    printf("Batch pages:   CPU %9.2f MB  GPU %9.2f MB\n", pages.cpu_bytes / 1048576.0, pages.gpu_bytes / 1048576.0);
+    printf("Total:         CPU %9.2f MB  GPU %9.2f MB\n", (models.cpu_bytes + objects.cpu_bytes + pages.cpu_bytes) / 1048576.0,
+        (models.gpu_bytes + pages.gpu_bytes) / 1048576.0);
+
+    // The arena holds the models' and objects' small structures counted above, and the pool holds buffers no mesh uses yet.
+    size_t pooled_bytes = 0;
+    for (size_t i=0; i < program->buffer_pool.count; i++) {
+        pooled_bytes = pooled_bytes + program->buffer_pool.buffers[i].size;
+    }
+    struct arena* arena = &program->scene.arena;
+    printf("Scene arena:   %.2f MB used of %.2f MB in %zu blocks\n", arena->used / 1048576.0, arena->reserved / 1048576.0, arena->num_blocks);
+    printf("Buffer pool:   %zu buffers, GPU %9.2f MB\n", program->buffer_pool.count, pooled_bytes / 1048576.0);
+}
+
+// Calculate the vector the camera is looking along from its yaw and pitch.
+void camera_update_front() {
+    vec3 direction = {0.0, 0.0, 0.0};
+    direction[0] = cos(glm_rad(program->camera.yaw)) * cos(glm_rad(program->camera.pitch));
+    direction[1] = sin(glm_rad(program->camera.pitch));
+    direction[2] = sin(glm_rad(program->camera.yaw)) * cos(glm_rad(program->camera.pitch));
+    glm_vec3_normalize_to(direction, program->camera.front);
+}
+
+// Place the camera a fraction of the way from where the last simulation step started to where it ended, for drawing.
+// Turning is applied straight away by the mouse callback, so only the position is interpolated.
+void camera_interpolate(float alpha) {
+    glm_vec3_lerp(program->camera.previous_position, program->camera.position, alpha, program->camera.render_position);
+}
+
+// Measure the time since the last frame, record it for the jitter statistics, and add it to the time the simulation has to catch up on.
+void program_update_timing() {
+    struct timing* timing = &program->timing;
+    double current_time = glfwGetTime();
+    double elapsed = current_time - timing->last_time;
+    if (timing->last_time > 0.0) {
+        timing->frame_durations[timing->next_frame_duration] = elapsed;
+        timing->next_frame_duration = (timing->next_frame_duration + 1) % FRAME_HISTORY;
+        if (timing->num_frame_durations < FRAME_HISTORY) timing->num_frame_durations++;
+    }
+    timing->last_time = current_time;
+    timing->accumulator = fmin(timing->accumulator + elapsed, timing->delta_time * SIMULATION_MAX_STEPS);
+}
+
+// Work out the mean frame time and its jitter, the standard deviation of the frame times, in milliseconds.
+void timing_frame_statistics(double* mean, double* jitter) {
+    struct timing* timing = &program->timing;
+    *mean = 0.0;
+    *jitter = 0.0;
+    if (timing->num_frame_durations == 0) return;
+    for (unsigned int i=0; i < timing->num_frame_durations; i++) {
+        *mean = *mean + timing->frame_durations[i];
+    }
+    *mean = *mean / timing->num_frame_durations;
+    for (unsigned int i=0; i < timing->num_frame_durations; i++) {
+        *jitter = *jitter + (timing->frame_durations[i] - *mean) * (timing->frame_durations[i] - *mean);
+    }
+    *jitter = sqrt(*jitter / timing->num_frame_durations) * 1000.0;
+    *mean = *mean * 1000.0;
+}
+
+// Wait until a moment, sleeping while it is far off and spinning for the last FRAME_SPIN_SECONDS, which a sleep could overshoot.
+void timing_wait_until(double deadline) {
+    while (true) {
+        double remaining = deadline - glfwGetTime();
+        if (remaining <= 0.0) return;
+        if (remaining > FRAME_SPIN_SECONDS) usleep((useconds_t)((remaining - FRAME_SPIN_SECONDS) * 1000000.0));
+    }
+}
+
+// Wait for the next frame to be due under the frame rate cap, if there is one.
+// Frames are due at a steady rhythm rather than a set time after the last one finished, so the odd slow frame does not shift the rest.
+// On the web the browser paces frames itself, through the main loop's frame rate.
+void program_pace_frame() {
+    #ifndef __EMSCRIPTEN__
+    struct timing* timing = &program->timing;
+    if (timing->frame_cap == 0) return;
+    double period = 1.0 / timing->frame_cap;
+    // Start the rhythm again from now after falling more than a frame behind, rather than rushing frames out to catch up.
+    double now = glfwGetTime();
+    if (timing->next_frame < now - period) timing->next_frame = now;
+    timing_wait_until(timing->next_frame);
+    timing->next_frame = timing->next_frame + period;
+    #endif
+}
+
+// Set how many screen refreshes each swap waits for: 0 for no vsync, 1 for vsync.
+void program_set_swap_interval(int interval) {
+    program->timing.swap_interval = interval;
+    glfwSwapInterval(interval);
+}
+
+// Create the dynamic resolution render target's shader and the triangle it is stretched over the window with.
+// The colour and depth buffers are allocated on the first frame, at the window's framebuffer size.
+void dynamic_resolution_init(struct dynamic_resolution* resolution) {
+    memset(resolution, 0, sizeof(struct dynamic_resolution));
+    resolution->scale = DYNAMIC_RESOLUTION_MAX_SCALE;
+    resolution->target_time = DYNAMIC_RESOLUTION_TARGET_MS;
+    #ifdef __EMSCRIPTEN__
+    resolution->supported = true;
+    #else
+    resolution->supported = GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object;
+    #endif
+    resolution->enabled = resolution->supported;
+    if (resolution->supported == false) return;
+
+    char* vertex_source = helper_file_to_string("upscale_vertex.glsl");
+    char* fragment_source = helper_file_to_string("upscale_fragment.glsl");
+    if (vertex_source == NULL || fragment_source == NULL) {
+        printf("dynamic_resolution_init(): Failed to read the upscale shader sources. Exiting.\n");
+        exit(-1);
+    }
+    GLuint vertex_shader = helper_opengl_create_shader("upscale_vertex.glsl", vertex_source, "", GL_VERTEX_SHADER);
+    GLuint fragment_shader = helper_opengl_create_shader("upscale_fragment.glsl", fragment_source, "", GL_FRAGMENT_SHADER);
+    free(vertex_source);
+    free(fragment_source);
+    if (vertex_shader == 0 || fragment_shader == 0) {
+        printf("dynamic_resolution_init(): Failed to compile the upscale shader. Exiting.\n");
+        exit(-1);
+    }
+    resolution->upscale_shader = glCreateProgram();
+    glAttachShader(resolution->upscale_shader, vertex_shader);
+    glAttachShader(resolution->upscale_shader, fragment_shader);
+    glBindAttribLocation(resolution->upscale_shader, ATTRIBUTE_POSITION, "position");
+    glLinkProgram(resolution->upscale_shader);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    GLint link_status = GL_FALSE;
+    glGetProgramiv(resolution->upscale_shader, GL_LINK_STATUS, &link_status);
+    if (link_status == GL_FALSE) {
+        printf("dynamic_resolution_init(): Failed to link the upscale shader. Exiting.\n");
+        helper_opengl_print_log(resolution->upscale_shader);
+        exit(-1);
+    }
+    resolution->upscale_region = glGetUniformLocation(resolution->upscale_shader, "region");
+    resolution->upscale_scene = glGetUniformLocation(resolution->upscale_shader, "scene");
+    glUseProgram(resolution->upscale_shader);
+    glUniform1i(resolution->upscale_scene, DYNAMIC_RESOLUTION_TEXTURE_UNIT);
+    glUseProgram(0);
+
+    // One triangle twice the size of the screen covers all of it, without the seam along a quad's diagonal.
+    GLfloat triangle[6] = {-1.0, -1.0, 3.0, -1.0, -1.0, 3.0};
+    glGenVertexArrays(1, &resolution->upscale_vertex_array);
+    glBindVertexArray(resolution->upscale_vertex_array);
+    glGenBuffers(1, &resolution->upscale_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, resolution->upscale_buffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(triangle), triangle, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIBUTE_POSITION);
+    glVertexAttribPointer(ATTRIBUTE_POSITION, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), (void*)0);
+    glBindVertexArray(0);
+}
+
+// Headless programs have a surfaceless context with no framebuffer of its own, so they draw into a render target standing in for the window.
+// It stays bound, and the dynamic resolution render target hands frames back to it rather than to framebuffer 0.
+#if !defined(__EMSCRIPTEN__)
+void dynamic_resolution_offscreen_window(struct dynamic_resolution* resolution, int width, int height) {
+    if (resolution->supported == false) {
+        fprintf(stderr, "dynamic_resolution_offscreen_window(): Rendering headless needs framebuffer objects. Exiting.\n");
+        exit(-1);
+    }
+    glGenFramebuffers(1, &resolution->window_framebuffer);
+    glGenRenderbuffers(1, &resolution->window_color);
+    glGenRenderbuffers(1, &resolution->window_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, resolution->window_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, resolution->window_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, resolution->window_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolution->window_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, resolution->window_depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "dynamic_resolution_offscreen_window(): The %dx%d offscreen window is incomplete. Exiting.\n", width, height);
+        exit(-1);
+    }
+}
+#endif
+
+// Delete the dynamic resolution render target, its shader and its triangle, and the offscreen window of headless programs.
+void dynamic_resolution_free(struct dynamic_resolution* resolution) {
+    if (resolution->window_framebuffer != 0) {
+        glDeleteFramebuffers(1, &resolution->window_framebuffer);
+        glDeleteRenderbuffers(1, &resolution->window_color);
+        glDeleteRenderbuffers(1, &resolution->window_depth);
+    }
+    if (resolution->framebuffer != 0) {
+        glDeleteFramebuffers(1, &resolution->framebuffer);
+        glDeleteTextures(1, &resolution->color);
+        glDeleteRenderbuffers(1, &resolution->depth);
+    }
+    if (resolution->supported == false) return;
+    glDeleteProgram(resolution->upscale_shader);
+    glDeleteVertexArrays(1, &resolution->upscale_vertex_array);
+    glDeleteBuffers(1, &resolution->upscale_buffer);
+}
+
+// Make sure the render target matches the window's framebuffer size, reallocating its buffers when the window was resized.
+// Returns false if a framebuffer of that size cannot be made, in which case the scene is drawn straight to the window.
+bool dynamic_resolution_allocate(struct dynamic_resolution* resolution, int width, int height) {
+    if (resolution->framebuffer != 0 && resolution->width == width && resolution->height == height) return true;
+    if (resolution->framebuffer == 0) {
+        glGenFramebuffers(1, &resolution->framebuffer);
+        glGenTextures(1, &resolution->color);
+        glGenRenderbuffers(1, &resolution->depth);
+    }
+    resolution->width = width;
+    resolution->height = height;
+
+    // Stretching the target over the window filters it bilinearly, and never repeats it past its edges.
+    glActiveTexture(GL_TEXTURE0 + DYNAMIC_RESOLUTION_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, resolution->color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, resolution->depth);
+    glBindFramebuffer(GL_FRAMEBUFFER, resolution->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, resolution->color, 0);
+    #ifdef __EMSCRIPTEN__
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_STENCIL, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, resolution->depth);
+    #else
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, resolution->depth);
+    #endif
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, resolution->window_framebuffer);
+    if (complete == false) {
+        fprintf(stderr, "dynamic_resolution_allocate(): The %dx%d render target is incomplete, drawing at full resolution.\n", width, height);
+        resolution->supported = false;
+        resolution->enabled = false;
+    }
+    return complete;
+}
+
+// Pick where the frame is drawn: into the bottom left corner of the render target at the current scale,
+// or straight into the window when dynamic resolution is off. Sets the viewport to match.
+void dynamic_resolution_begin(struct dynamic_resolution* resolution, int width, int height) {
+    resolution->render_width = width;
+    resolution->render_height = height;
+    if (resolution->enabled == true && dynamic_resolution_allocate(resolution, width, height) == true) {
+        resolution->render_width = (int)(width * resolution->scale + 0.5f);
+        resolution->render_height = (int)(height * resolution->scale + 0.5f);
+        if (resolution->render_width < 1) resolution->render_width = 1;
+        if (resolution->render_height < 1) resolution->render_height = 1;
+        glBindFramebuffer(GL_FRAMEBUFFER, resolution->framebuffer);
+    }
+    glViewport(0, 0, resolution->render_width, resolution->render_height);
+}
+
+// Stretch the part of the render target drawn this frame over the window.
+void dynamic_resolution_upscale(struct dynamic_resolution* resolution) {
+    if (resolution->enabled == false) return;
+    glBindFramebuffer(GL_FRAMEBUFFER, resolution->window_framebuffer);
+    glViewport(0, 0, resolution->width, resolution->height);
+
+    PROFILE_GPU_BEGIN("upscale");
+    glDisable(GL_DEPTH_TEST);
+    render_state_use_program(resolution->upscale_shader);
+    glUniform4f(resolution->upscale_region,
+        (float)resolution->render_width / resolution->width, (float)resolution->render_height / resolution->height,
+        0.5f / resolution->width, 0.5f / resolution->height);
+    glActiveTexture(GL_TEXTURE0 + DYNAMIC_RESOLUTION_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, resolution->color);
+    glActiveTexture(GL_TEXTURE0);
+    render_state_bind_vertex_array(resolution->upscale_vertex_array);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    render_state_bind_vertex_array(0);
+    glEnable(GL_DEPTH_TEST);
+    PROFILE_GPU_END();
+}
+
+// Feed the cost of a frame, in milliseconds, to the controller, and every few frames move the scale towards where
+// the average cost would meet the target. Cost grows roughly with the pixels drawn, the square of the scale.
+void dynamic_resolution_update(struct dynamic_resolution* resolution, double cost) {
+    if (resolution->enabled == false) return;
+    resolution->cost = resolution->cost + cost;
+    resolution->frames++;
+    if (resolution->frames < DYNAMIC_RESOLUTION_INTERVAL) return;
+
+    double average = resolution->cost / resolution->frames;
+    resolution->cost = 0.0;
+    resolution->frames = 0;
+    if (average <= 0.0) return;
+
+    float scale = resolution->scale * sqrt(resolution->target_time * DYNAMIC_RESOLUTION_HEADROOM / average);
+    scale = glm_clamp(scale, resolution->scale * DYNAMIC_RESOLUTION_MAX_DECREASE, resolution->scale * DYNAMIC_RESOLUTION_MAX_INCREASE);
+    resolution->scale = glm_clamp(scale, DYNAMIC_RESOLUTION_MIN_SCALE, DYNAMIC_RESOLUTION_MAX_SCALE);
+}
+
+// Resize the scene when window is resized
+// The projection and the render target follow the new size from the next frame.
+void program_resize_callback(GLFWwindow* window, int width, int height) {
+    (void)window;
+    glfwSetInputMode(program->window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    glViewport(0, 0, width, height);
+    program->framebuffer_width = width;
+    program->framebuffer_height = height;
+}
+
+// Move camera when mouse to point at a new location when mouse is moved.
+void program_mouse_callback(GLFWwindow* window, double x, double y) {
+    (void)window;
+    // Set the last x and y mouse positions
+    if (program->camera.mouse.used_before == false) {
+        program->camera.mouse.used_before = true;
+        program->camera.mouse.last_x = x;
+        program->camera.mouse.last_y = y;
+    }
+
+    // Get the difference between the last mouse position and current
+    float x_offset = x - program->camera.mouse.last_x;
+    float y_offset = y - program->camera.mouse.last_y;
+
+    // Store the current mouse positions to be the last
+    program->camera.mouse.last_x = x;
+    program->camera.mouse.last_y = y;
+
+    // Multiply the difference in mouse position with sensitivty
+    x_offset = x_offset * program->camera.mouse.sensitivity;
+    y_offset = y_offset * program->camera.mouse.sensitivity;
+
+    // Add the movement difference to the camera's viewing angles.
+    program->camera.yaw = program->camera.yaw + x_offset;
+    program->camera.pitch = program->camera.pitch - y_offset;
+
+    // Lock the camera's pitch so it does not go too far up or down
+    if (program->camera.pitch > 89.0) {
+        program->camera.pitch = 89.0;
+    }
+
+    if (program->camera.pitch < -89.0) {
+        program->camera.pitch = -89.0;
+    }
+
+    // Point the camera along its new angles.
+    camera_update_front();
+}
+
+// Create an RGBA8 texture for clustered lighting data on a texture unit, where it stays bound.
+// It is sampled without filtering, so every texel reads back exactly, and has no mipmaps, so any size works on WebGL 1.
+GLuint light_texture_new(GLenum unit, GLsizei width, GLsizei height) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    return texture;
+}
+
+// Return the most memory the process has held at once, in megabytes: its peak resident set natively,
+// and on the web the size of the WebAssembly heap, which only ever grows.
+double program_peak_memory() {
+    #ifdef __EMSCRIPTEN__
+    return emscripten_get_heap_size() / 1048576.0;
+    #else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    return usage.ru_maxrss / 1024.0;
+    #endif
+}
+
+// Unload the current scene: delete its objects, free its models, waiting for any still loading, and its batch pages,
+// then free its arena in one go. The GPU buffers of its meshes are pooled for the next scene, and the scene's arrays are kept.
+// The point lights are scattered again once the next scene has loaded.
+void program_unload_scene() {
+    struct scene* scene = &program->scene;
+    while (scene->count > 0) {
+        object_delete(scene->objects[scene->count - 1].handle);
+    }
+    while (program->models != NULL) {
+        model_delete(program->models);
+    }
+    while (program->batch_pages != NULL) {
+        struct batch_page* next = program->batch_pages->next;
+        batch_page_free(program->batch_pages);
+        program->batch_pages = next;
+    }
+    arena_free(&scene->arena);
+    scene->num_slots = 0;
+    scene->free_slot = UINT32_MAX;
+
+    // Forget any frame prepared from the old scene, whose packets point at its meshes.
+    program->frames[0].prepared = false;
+    program->frames[1].prepared = false;
+
+    free(program->lights);
+    free(program->light_view);
+    program->lights = NULL;
+    program->light_view = NULL;
+    program->lights_placed = false;
+}
+
+// Start loading a scene from the list. Its model is placed as one static object, which is batched if it is small enough,
+// and whose terrain hides whatever is behind it. program_finish_scene_switch() reports once it has loaded.
+void program_load_scene(size_t index) {
+    struct scene_list* scenes = &program->scenes;
+    scenes->current = index;
+    scenes->switching = true;
+    program->buffer_pool.reused = 0;
+    program->buffer_pool.created = 0;
+
+    uint32_t object = object_new(scenes->filenames[index]);
+    object_get(object)->is_static = true;
+    object_get(object)->is_occluder = true;
+}
+
+// Unload the current scene and start loading another, without restarting.
+void program_switch_scene(size_t index) {
+    struct scene_list* scenes = &program->scenes;
+    double start = glfwGetTime();
+    program_unload_scene();
+    scenes->unload_time = glfwGetTime() - start;
+    program_load_scene(index);
+    scenes->switch_start = start;
+}
+
+// Initialise the program state
+// Headless programs render offscreen with no display through GLFW's null platform and a surfaceless EGL context,
+// which Mesa runs on llvmpipe without a GPU. The null platform needs GLFW 3.4; older versions use a hidden window instead.
+void program_init(bool headless, char** scene_filenames, size_t num_scenes) {
+    // Initialise the global program state
+    program = malloc(sizeof(struct program));
+    if (program == NULL) exit(-1);
+
+    // Initialise GLFW
+    #if defined(GLFW_PLATFORM_NULL)
+    if (headless == true) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+    #endif
+    if (glfwInit() == GLFW_FALSE) {
+        printf("program_init(): Failed to initialise GLFW. Exit.\n");
+        exit(-1);
+    }
+
+    // Create GLFW context.
+    if (headless == true) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        #if defined(GLFW_PLATFORM_NULL)
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+        #endif
+    }
+    program->window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Window", NULL, NULL);
+    glfwMakeContextCurrent(program->window);
+    if (program->window == NULL) {
+        printf("program_init(): Failed to create GLFW window. Exit.\n");
+        exit(-1);
+    }
+
+    // Set OpenGL hints.
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
+    glfwGetFramebufferSize(program->window, &program->framebuffer_width, &program->framebuffer_height);
+    glViewport(0, 0, program->framebuffer_width, program->framebuffer_height);
+
+    // Initialise GLEW
+    // A surfaceless context has no GLX display for glewInit() to set up, so only its OpenGL functions are loaded,
+    // which GLEW 2.0 and later can do on their own.
+    GLenum glew_status;
+    #if defined(GLFW_PLATFORM_NULL) && defined(GLEW_ERROR_NO_GLX_DISPLAY)
+    if (glfwGetPlatform() == GLFW_PLATFORM_NULL) glew_status = glewContextInit();
+    else glew_status = glewInit();
+    #else
+    glew_status = glewInit();
+    #endif
+    if (glew_status != GLEW_OK) {
+        printf("program_init(): glewInit() failed to initailise. glewGetErrorString(): %s. Exiting.\n", glewGetErrorString(glew_status));
+        exit(-1);
+    }
+
+    // Ensure the VAO is available as this program relies on it.
+    if (!GL_ARB_vertex_array_object) {
+        printf("program_init(): glewInit() failed to initailise. glewGetErrorString(): %s. Exiting.\n", glewGetErrorString(glew_status));
+        exit(-1);
+    }
+
+    // Check for 32 bit index support, which desktop OpenGL always has and WebGL 1 provides through OES_element_index_uint.
+    #ifdef __EMSCRIPTEN__
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    program->index_uint_supported = extensions != NULL && strstr(extensions, "OES_element_index_uint") != NULL;
+    #else
+    program->index_uint_supported = true;
+    #endif
+
+    // Check for instanced drawing: core in OpenGL 3.3, ARB_instanced_arrays with ARB_draw_instanced before that, and ANGLE_instanced_arrays on WebGL 1.
+    // Without it every instance is drawn with its own call.
+    #ifdef __EMSCRIPTEN__
+    program->instancing_supported = extensions != NULL && strstr(extensions, "ANGLE_instanced_arrays") != NULL;
+    #else
+    program->instancing_supported = GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced);
+    #endif
+
+    // Read the shader sources. Variants are compiled from them the first time they are drawn with,
+    // and on native builds their linked programs are cached when the driver can save program binaries.
+    program->shaders = NULL;
+    program->num_shaders = 0;
+    program->shading_features = 0;
+    program->shading_keys[0] = false;
+    program->shading_keys[1] = false;
+    program->shading_keys[2] = false;
+    program->vertex_source = helper_file_to_string("vertex.glsl");
+    program->fragment_source = helper_file_to_string("fragment.glsl");
+    if (program->vertex_source == NULL || program->fragment_source == NULL) {
+        printf("program_init(): Failed to read the shader sources. Exit.\n");
+        exit(-1);
+    }
+    #ifdef __EMSCRIPTEN__
+    program->program_binary_supported = false;
+    #else
+    GLint binary_formats = 0;
+    if (GLEW_ARB_get_program_binary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binary_formats);
+    program->program_binary_supported = binary_formats > 0;
+    #endif
+    
+    // Initialise light:
+    glm_vec3_copy((vec3){1.0, 1.0, 1.0}, program->light.light_color);
+    glm_vec3_copy((vec3){0.0, -3.0, 0.0}, program->light.light_position);
+
+    // Initialise the point lights, which are scattered once the scene has loaded, the cluster grid they are assigned to,
+    // and the textures the fragment shader reads them from.
+    program->lights = NULL;
+    program->num_lights = LIGHT_DEFAULT_COUNT;
+    program->lights_placed = false;
+    program->light_view = NULL;
+    program->light_texels = calloc(LIGHT_TEXTURE_WIDTH * LIGHT_TEXTURE_HEIGHT, 4);
+    if (program->light_texels == NULL || light_cluster_init(&program->light_grid) == false) {
+        printf("program_init(): Failed to initialise clustered lighting. Exiting.\n");
+        exit(-1);
+    }
+    glm_vec4_zero(program->cluster_parameters);
+    program->light_texture = light_texture_new(LIGHT_TEXTURE_UNIT, LIGHT_TEXTURE_WIDTH, LIGHT_TEXTURE_HEIGHT);
+    program->light_cluster_texture = light_texture_new(LIGHT_CLUSTER_TEXTURE_UNIT, LIGHT_CLUSTER_TILES, LIGHT_CLUSTER_Z);
+    program->light_index_texture = light_texture_new(LIGHT_INDEX_TEXTURE_UNIT, LIGHT_CLUSTER_INDEX_WIDTH, LIGHT_CLUSTER_INDEX_HEIGHT);
+
+    // Initialise dynamic resolution, which needs framebuffer objects: core in OpenGL 3.0, ARB_framebuffer_object before that, and always on WebGL.
+    dynamic_resolution_init(&program->dynamic_resolution);
+    #if defined(GLFW_PLATFORM_NULL) && !defined(__EMSCRIPTEN__)
+    if (glfwGetPlatform() == GLFW_PLATFORM_NULL) {
+        dynamic_resolution_offscreen_window(&program->dynamic_resolution, program->framebuffer_width, program->framebuffer_height);
+    }
+    #endif
+
+    // Initialise the two frames the jobs prepare and the main thread submits in turn, and the buffer their instance attributes are streamed through.
+    memset(program->frames, 0, sizeof(program->frames));
+    program->frame_index = 0;
+    program->instance_buffer = 0;
+    if (program->instancing_supported == true) {
+        glGenBuffers(1, &program->instance_buffer);
+    }
+    program->next_mesh_id = 0;
+    program->batch_pages = NULL;
+    render_state_reset();
+
+    // Without scenes given, load the default model, preferring the memory mapped binary model, then the streamed model,
+    // over the text model when they exist. Web builds that stream their model download it instead, so there is nothing on disk to look for.
+    char* model_filename = "output_model";
+    if (access(MODEL_FORMAT_DEFAULT_FILENAME, R_OK) == 0) {
+        model_filename = MODEL_FORMAT_DEFAULT_FILENAME;
+    }
+    else if (MODEL_STREAM_FETCH || access(MODEL_STREAM_DEFAULT_FILENAME, R_OK) == 0) {
+        model_filename = MODEL_STREAM_DEFAULT_FILENAME;
+    }
+    memset(&program->scenes, 0, sizeof(struct scene_list));
+    program->scenes.count = num_scenes > 0 ? num_scenes : 1;
+    program->scenes.filenames = malloc(sizeof(char*) * program->scenes.count);
+    if (program->scenes.filenames == NULL) {
+        printf("program_init(): Failed to allocate memory for the scene list. Exiting.\n");
+        exit(-1);
+    }
+    for (size_t i=0; i < program->scenes.count; i++) {
+        program->scenes.filenames[i] = num_scenes > 0 ? scene_filenames[i] : model_filename;
+    }
+    memset(&program->buffer_pool, 0, sizeof(struct buffer_pool));
+    dynamic_batch_init(&program->dynamic_batch);
+    program->models = NULL;
+    memset(&program->scene, 0, sizeof(struct scene));
+    program->scene.free_slot = UINT32_MAX;
+    arena_init(&program->scene.arena, 0);
+    program->scenes.switch_start = glfwGetTime();
+    program_load_scene(0);
+
+    // Initialise camera:
+    memcpy(program->camera.position, (vec3){180.0, -15.0, -64.0}, sizeof(vec3));
+    glm_vec3_copy(program->camera.position, program->camera.previous_position);
+    glm_vec3_copy(program->camera.position, program->camera.render_position);
+    memcpy(program->camera.front, (vec3){0.0, 0.0, -1.0}, sizeof(vec3));
+    memcpy(program->camera.up, (vec3){0.0, 1.0, 0.0}, sizeof(vec3));
+    program->camera.yaw = -90.0;
+    program->camera.pitch = 0.0;
+    program->camera.speed = 250;
+
+    program->camera.mouse.last_x = SCREEN_WIDTH/2;
+    program->camera.mouse.last_y = SCREEN_HEIGHT/2;
+    program->camera.mouse.used_before = false;
+    program->camera.mouse.sensitivity = 0.1;
+ 
+    // Initialise timings, with vsync on and no frame rate cap.
+    memset(&program->timing, 0, sizeof(struct timing));
+    program->timing.delta_time = 1.0 / SIMULATION_RATE;
+    program_set_swap_interval(1);
+
+    // Set program status:
+    program->status = RUNNING;
+    program->opengl_initialised = false;
+    program->profiler_overlay = false;
+    program->profiler_overlay_key = false;
+    program->profiler_export_key = false;
+    program->camera_record = NULL;
+    program->occlusion_culling = true;
+    program->occlusion_key = false;
+    program->occluder_positions = NULL;
+    program->occluder_positions_capacity = 0;
+    if (occlusion_init(&program->occlusion) == false) {
+        printf("program_init(): Failed to initialise occlusion culling. Exiting.\n");
+        exit(-1);
+    }
+    memset(&program->render_stats, 0, sizeof(struct render_stats));
+    program->stats_time = 0.0;
+
+    // Start a worker for every core but the main thread's, and give each thread a few culling jobs to share out.
+    // Frames are prepared a frame ahead whenever there are workers to prepare them while the main thread draws.
+    if (job_system_init(&program->jobs, job_system_default_workers()) == false) {
+        printf("program_init(): Failed to start the job system. Exiting.\n");
+        exit(-1);
+    }
+    program->pipelined = program->jobs.num_workers > 0;
+    program->num_cull_jobs = (program->jobs.num_workers + 1) * CULL_JOBS_PER_THREAD;
+    program->cull_jobs = calloc(program->num_cull_jobs, sizeof(struct cull_job));
+    program->cull_items = NULL;
+    program->num_cull_items = 0;
+    program->cull_items_capacity = 0;
+    if (program->cull_jobs == NULL) {
+        printf("program_init(): Failed to allocate memory for culling jobs. Exiting.\n");
+        exit(-1);
+    }
+    fprintf(stderr, "Started %u job worker threads.\n", program->jobs.num_workers);
+    program->release_cpu_meshes = RELEASE_CPU_MESHES;
+    program->memory_report_key = false;
+
+    // Set resize callback:
+    glfwSetFramebufferSizeCallback(program->window, program_resize_callback);
+
+    // Set mouse callback:
+    glfwSetCursorPosCallback(program->window, program_mouse_callback);
+    glfwSetInputMode(program->window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    // Rotate camera:
+    program->camera.yaw += -120.0;
+    camera_update_front();
+}
+
+// Transform a model space box by a model matrix into a world space box, given as a centre and half extents.
+// Taking the absolute value of the matrix keeps the box enclosing its contents under rotation and negative scales.
+void bounds_transform(mat4 model, vec3 minimum, vec3 maximum, vec3 centre, vec3 extent) {
+    vec3 local_centre;
+    vec3 local_extent;
+    glm_vec3_add(minimum, maximum, local_centre);
+    glm_vec3_scale(local_centre, 0.5, local_centre);
+    glm_vec3_sub(maximum, local_centre, local_extent);
+
+    glm_mat4_mulv3(model, local_centre, 1.0, centre);
+    for (int row=0; row < 3; row++) {
+        extent[row] = fabsf(model[0][row]) * local_extent[0] + fabsf(model[1][row]) * local_extent[1] + fabsf(model[2][row]) * local_extent[2];
+    }
+}
+
+// Test a batch of world space boxes against the frustum planes, setting visible[i] to 1 for boxes that may be visible
+// and inside[i] to 1 for boxes entirely inside the frustum.
+// Each plane is tested against every box in a branch free loop, which compilers turn into SIMD code.
+void frustum_test_boxes(vec4 planes[6], struct cull_batch* batch, size_t count) {
+    for (size_t i=0; i < count; i++) {
+        batch->visible[i] = 1;
+        batch->inside[i] = 1;
+    }
+
+    for (int p=0; p < 6; p++) {
+        const float nx = planes[p][0];
+        const float ny = planes[p][1];
+        const float nz = planes[p][2];
+        const float d = planes[p][3];
+        const float ax = fabsf(nx);
+        const float ay = fabsf(ny);
+        const float az = fabsf(nz);
+        const float* restrict cx = batch->centre_x;
+        const float* restrict cy = batch->centre_y;
+        const float* restrict cz = batch->centre_z;
+        const float* restrict ex = batch->extent_x;
+        const float* restrict ey = batch->extent_y;
+        const float* restrict ez = batch->extent_z;
+        uint8_t* restrict visible = batch->visible;
+        uint8_t* restrict inside = batch->inside;
+        for (size_t i=0; i < count; i++) {
+            float distance = nx * cx[i] + ny * cy[i] + nz * cz[i] + d;
+            float radius = ax * ex[i] + ay * ey[i] + az * ez[i];
+            visible[i] = visible[i] & (distance + radius >= 0.0f);
+            inside[i] = inside[i] & (distance - radius >= 0.0f);
+        }
+    }
+}
+
+// Make sure the cull batch can hold count boxes.
+void cull_batch_reserve(struct cull_batch* batch, size_t count) {
+    if (count <= batch->capacity) return;
+
+    size_t capacity = batch->capacity == 0 ? 64 : batch->capacity;
+    while (capacity < count) capacity = capacity * 2;
+
+    float** arrays[6] = {&batch->centre_x, &batch->centre_y, &batch->centre_z, &batch->extent_x, &batch->extent_y, &batch->extent_z};
+    for (int i=0; i < 6; i++) {
+        *arrays[i] = realloc(*arrays[i], sizeof(float) * capacity);
+        if (*arrays[i] == NULL) {
+            printf("cull_batch_reserve(): Failed to allocate memory for culling. Exiting.\n");
+            exit(-1);
+        }
+    }
+    batch->visible = realloc(batch->visible, sizeof(uint8_t) * capacity);
+    batch->inside = realloc(batch->inside, sizeof(uint8_t) * capacity);
+    if (batch->visible == NULL || batch->inside == NULL) {
+        printf("cull_batch_reserve(): Failed to allocate memory for culling. Exiting.\n");
+        exit(-1);
+    }
+    batch->capacity = capacity;
+}
+
+// Make sure the cull stack can hold the sibling ranges of a tree with num_nodes nodes.
+// Every range pushed is a distinct node's children, so there are never more ranges than nodes.
+void cull_batch_reserve_stack(struct cull_batch* batch, size_t num_nodes) {
+    if (num_nodes * 2 <= batch->stack_capacity) return;
+    batch->stack = realloc(batch->stack, sizeof(uint32_t) * num_nodes * 2);
+    if (batch->stack == NULL) {
+        printf("cull_batch_reserve_stack(): Failed to allocate memory for culling. Exiting.\n");
+        exit(-1);
+    }
+    batch->stack_capacity = num_nodes * 2;
+}
+
+// Pick the coarsest level of detail of a mesh whose error covers at most LOD_PIXEL_ERROR pixels on screen, starting from the level it was last drawn at.
+// The error is projected from the nearest point of the mesh's bounding sphere, whose centre is the given distance from the camera.
+// Coarser levels are only taken with a margin below the threshold, and the current level is kept until it is a margin above it.
+unsigned int mesh_select_lod(struct mesh* mesh, unsigned int lod, float centre_distance, struct lod_view* view) {
+    if (mesh->num_lods == 1) return 0;
+    if (lod >= mesh->num_lods) lod = mesh->num_lods - 1;
+
+    float distance = centre_distance - mesh->bounds_radius * view->scale;
+    if (distance < CAMERA_NEAR) distance = CAMERA_NEAR;
+    float pixels = view->pixels_per_unit * view->scale / distance;
+
+    // Refine as far as needed when the current level's error has grown too visible.
+    if (mesh->lods[lod].error * pixels > LOD_PIXEL_ERROR * (1.0 + LOD_HYSTERESIS)) {
+        while (lod > 0 && mesh->lods[lod].error * pixels > LOD_PIXEL_ERROR) {
+            lod--;
+        }
+        return lod;
+    }
+
+    // Otherwise coarsen while the next level's error stays well below the threshold.
+    while (lod + 1 < mesh->num_lods && mesh->lods[lod + 1].error * pixels <= LOD_PIXEL_ERROR * (1.0 - LOD_HYSTERESIS)) {
+        lod++;
+    }
+    return lod;
+}
+
+// Build the sort key of a render packet.
+// From the most significant bit down, opaque packets sort by pass (2 bits), shader features (6 bits), mesh (24 bits),
+// level of detail (3 bits) and then depth (29 bits), so state changes are rare and each mesh's instances are drawn front to back.
+// Translucent packets sort by pass and then depth reversed, so they are drawn back to front, with the state bits after it.
+// Batch page packets use the range index as their depth instead, so ranges that follow each other in the page sort next to each other.
+uint64_t render_key(uint32_t pass, uint32_t features, struct mesh* mesh, uint32_t lod, uint32_t depth_bits) {
+    uint64_t depth = depth_bits & 0x1FFFFFFF;
+    uint64_t state = ((uint64_t)(features & 0x3F) << 27) | ((uint64_t)(mesh->id & 0xFFFFFF) << 3) | (lod & 0x7);
+
+    if (pass == RENDER_PASS_OPAQUE) {
+        return ((uint64_t)pass << 62) | (state << 29) | depth;
+    }
+    return ((uint64_t)pass << 62) | ((~depth & 0x1FFFFFFF) << 33) | state;
+}
+
+// Quantise a distance from the camera to the 29 bits of depth in a render key.
+// Distances are never negative, so the bits of the float sort the same way as its value.
+uint32_t render_depth(float distance) {
+    uint32_t distance_bits;
+    memcpy(&distance_bits, &distance, sizeof(float));
+    return distance_bits >> 2;
+}
+
+// Make sure the render queue can hold count more packets.
+void render_queue_reserve_packets(struct render_queue* queue, size_t count) {
+    if (queue->num_packets + count <= queue->packets_capacity) return;
+
+    size_t capacity = queue->packets_capacity == 0 ? 256 : queue->packets_capacity;
+    while (capacity < queue->num_packets + count) capacity = capacity * 2;
+    queue->packets = realloc(queue->packets, sizeof(struct render_packet) * capacity);
+    queue->scratch = realloc(queue->scratch, sizeof(struct render_packet) * capacity);
+    if (queue->packets == NULL || queue->scratch == NULL) {
+        printf("render_queue_reserve_packets(): Failed to allocate memory for render packets. Exiting.\n");
+        exit(-1);
+    }
+    queue->packets_capacity = capacity;
+}
+
+// Make sure the render queue can hold count more instances.
+void render_queue_reserve_instances(struct render_queue* queue, size_t count) {
+    if (queue->num_instances + count <= queue->instances_capacity) return;
+
+    size_t capacity = queue->instances_capacity == 0 ? 64 : queue->instances_capacity;
+    while (capacity < queue->num_instances + count) capacity = capacity * 2;
+    queue->instances = realloc(queue->instances, sizeof(struct instance) * capacity);
+    if (queue->instances == NULL) {
+        printf("render_queue_reserve_instances(): Failed to allocate memory for instances. Exiting.\n");
+        exit(-1);
+    }
+    queue->instances_capacity = capacity;
+}
+
+// Add an object's instance attributes to the queue's instance array, returning its index.
+uint32_t render_queue_add_instance(struct render_queue* queue, mat4 model, vec4 tint) {
+    render_queue_reserve_instances(queue, 1);
+    struct instance* instance = &queue->instances[queue->num_instances];
+    glm_mat4_copy(model, instance->model);
+    glm_vec4_copy(tint, instance->tint);
+    queue->num_instances++;
+    return queue->num_instances - 1;
+}
+
+// Queue one of an object's meshes to be drawn, once any of its levels have uploaded, at the level of detail its distance calls for.
+// Until the level it calls for has arrived, the finest level that has is drawn instead.
+void render_queue_add_mesh(struct render_queue* queue, struct object* object, uint32_t mesh_index, uint32_t instance, mat4 model, struct lod_view* view) {
+    struct mesh* mesh = object->model->mesh_table[mesh_index];
+    if (mesh->ready_lod >= mesh->num_lods) return;
+
+    vec3 centre;
+    glm_mat4_mulv3(model, mesh->bounds_centre, 1.0, centre);
+    float distance = glm_vec3_distance(centre, view->camera_position);
+    object->lods[mesh_index] = mesh_select_lod(mesh, object->lods[mesh_index], distance, view);
+    if (object->lods[mesh_index] < mesh->ready_lod) object->lods[mesh_index] = mesh->ready_lod;
+
+    render_queue_reserve_packets(queue, 1);
+    uint32_t lod = object->lods[mesh_index];
+    struct batch_slot* slot = object->batch_slots != NULL ? &object->batch_slots[mesh_index] : NULL;
+    if (slot != NULL && slot->page->mesh->uploaded == true) {
+        struct mesh* page_mesh = slot->page->mesh;
+        uint32_t features = shader_features_for_mesh(page_mesh);
+        queue->packets[queue->num_packets] = (struct render_packet){render_key(RENDER_PASS_OPAQUE, features, page_mesh, lod, slot->range), features, page_mesh, lod, slot->range};
+    }
+    else {
+        uint32_t pass = mesh->translucent == true || object->tint[3] < 1.0 ? RENDER_PASS_TRANSLUCENT : RENDER_PASS_OPAQUE;
+        uint32_t features = shader_features_for_mesh(mesh);
+        queue->packets[queue->num_packets] = (struct render_packet){render_key(pass, features, mesh, lod, render_depth(distance)), features, mesh, lod, instance};
+    }
+    queue->num_packets++;
+}
+
+// Append another queue's packets and instances to a render queue, pointing the packets at where their instances landed.
+void render_queue_append(struct render_queue* queue, struct render_queue* other) {
+    render_queue_reserve_packets(queue, other->num_packets);
+    render_queue_reserve_instances(queue, other->num_instances);
+    memcpy(&queue->instances[queue->num_instances], other->instances, sizeof(struct instance) * other->num_instances);
+    for (size_t i=0; i < other->num_packets; i++) {
+        struct render_packet packet = other->packets[i];
+        if (packet.mesh->page == NULL) packet.instance = packet.instance + (uint32_t)queue->num_instances;
+        queue->packets[queue->num_packets + i] = packet;
+    }
+    queue->num_packets = queue->num_packets + other->num_packets;
+    queue->num_instances = queue->num_instances + other->num_instances;
+}
+
+// Free a render queue's arrays.
+void render_queue_free(struct render_queue* queue) {
+    free(queue->instances);
+    free(queue->packets);
+    free(queue->scratch);
+    free(queue->ordered);
+    memset(queue, 0, sizeof(struct render_queue));
+}
+
+// Add one set of render counters to another.
+void render_stats_add(struct render_stats* total, struct render_stats* stats) {
+    total->objects_culled = total->objects_culled + stats->objects_culled;
+    total->nodes_tested = total->nodes_tested + stats->nodes_tested;
+    total->nodes_culled = total->nodes_culled + stats->nodes_culled;
+    total->meshes_culled = total->meshes_culled + stats->meshes_culled;
+    total->nodes_occluded = total->nodes_occluded + stats->nodes_occluded;
+    total->meshes_occluded = total->meshes_occluded + stats->meshes_occluded;
+    total->occluder_triangles = total->occluder_triangles + stats->occluder_triangles;
+    total->meshes_drawn = total->meshes_drawn + stats->meshes_drawn;
+    total->triangles_drawn = total->triangles_drawn + stats->triangles_drawn;
+    total->draw_calls = total->draw_calls + stats->draw_calls;
+    total->state_changes = total->state_changes + stats->state_changes;
+    total->state_changes_skipped = total->state_changes_skipped + stats->state_changes_skipped;
+    total->lights = total->lights + stats->lights;
+    total->light_indices = total->light_indices + stats->light_indices;
+    total->lights_dropped = total->lights_dropped + stats->lights_dropped;
+    total->bytes_uploaded = total->bytes_uploaded + stats->bytes_uploaded;
+}
+
+// Return true if a model space box is hidden behind this frame's occluders.
+bool program_occluded(mat4 model, vec3 minimum, vec3 maximum) {
+    if (program->occlusion_culling == false) return false;
+    vec3 centre;
+    vec3 extent;
+    bounds_transform(model, minimum, maximum, centre, extent);
+    return occlusion_test_box(&program->occlusion, centre, extent);
+}
+
+// Queue every mesh in a cluster node's subtree into a culling job's queue without testing it against the frustum any further.
+// When the subtree holds more than one mesh, each is still tested against the occluders, which the node as a whole was not hidden by.
+void render_queue_add_node(struct cull_job* job, struct object* object, struct cluster_node* node, uint32_t instance, mat4 model, struct lod_view* view) {
+    for (uint32_t i=node->first_mesh; i < node->first_mesh + node->num_meshes; i++) {
+        struct mesh* mesh = object->model->mesh_table[i];
+        if (node->num_meshes > 1 && program_occluded(model, mesh->bounds_min, mesh->bounds_max) == true) {
+            job->stats.meshes_occluded++;
+            continue;
+        }
+        render_queue_add_mesh(&job->queue, object, i, instance, model, view);
+    }
+}
+
+// Walk the subtree of one node of an object's cluster tree and queue the meshes inside the frustum and not hidden by occluders
+// into a culling job's queue, drawn with the given instance. Siblings are tested together as one batch.
+// Subtrees outside the frustum or behind the occluders are skipped as a whole,
+// and subtrees entirely inside the frustum are queued without testing any of their nodes against it.
+void program_cull_object(struct cull_job* job, struct object* object, uint32_t root, uint32_t instance, mat4 model, vec4 planes[6], struct lod_view* view) {
+    struct cull_batch* batch = &job->batch;
+    struct render_stats* stats = &job->stats;
+    struct model* resource = object->model;
+    cull_batch_reserve_stack(batch, resource->num_nodes);
+
+    // Start from the subtree's root, which is a range of one node.
+    size_t stack_size = 0;
+    batch->stack[stack_size++] = root;
+    batch->stack[stack_size++] = 1;
+    while (stack_size > 0) {
+        uint32_t count = batch->stack[--stack_size];
+        uint32_t first = batch->stack[--stack_size];
+
+        // Test the range of siblings as one batch.
+        cull_batch_reserve(batch, count);
+        for (uint32_t i=0; i < count; i++) {
+            vec3 centre;
+            vec3 extent;
+            bounds_transform(model, resource->nodes[first + i].bounds_min, resource->nodes[first + i].bounds_max, centre, extent);
+            batch->centre_x[i] = centre[0];
+            batch->centre_y[i] = centre[1];
+            batch->centre_z[i] = centre[2];
+            batch->extent_x[i] = extent[0];
+            batch->extent_y[i] = extent[1];
+            batch->extent_z[i] = extent[2];
+        }
+        frustum_test_boxes(planes, batch, count);
+        stats->nodes_tested = stats->nodes_tested + count;
+
+        for (uint32_t i=0; i < count; i++) {
+            struct cluster_node* node = &resource->nodes[first + i];
+            if (batch->visible[i] == 0) {
+                if (first == 0) stats->objects_culled++;
+                stats->nodes_culled++;
+                stats->meshes_culled = stats->meshes_culled + node->num_meshes;
+            }
+            else if (program->occlusion_culling == true && occlusion_test_box(&program->occlusion,
+                (vec3){batch->centre_x[i], batch->centre_y[i], batch->centre_z[i]}, (vec3){batch->extent_x[i], batch->extent_y[i], batch->extent_z[i]}) == true) {
+                stats->nodes_occluded++;
+                stats->meshes_occluded = stats->meshes_occluded + node->num_meshes;
+            }
+            else if (batch->inside[i] != 0 || node->num_children == 0) {
+                render_queue_add_node(job, object, node, instance, model, view);
+            }
+            else {
+                batch->stack[stack_size++] = node->first_child;
+                batch->stack[stack_size++] = node->num_children;
+            }
+        }
+    }
+}
+
+// Sort the queued packets by key with a least significant digit radix sort, one byte per pass.
+// Passes where every key has the same byte are skipped, which is most of them when few shaders and meshes are in use.
+void render_queue_sort(struct render_queue* queue) {
+    size_t counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i=0; i < queue->num_packets; i++) {
+        uint64_t key = queue->packets[i].key;
+        for (int digit=0; digit < 8; digit++) {
+            counts[digit][(key >> (digit * 8)) & 0xFF]++;
+        }
+    }
+
+    struct render_packet* source = queue->packets;
+    struct render_packet* destination = queue->scratch;
+    for (int digit=0; digit < 8 && queue->num_packets > 0; digit++) {
+        if (counts[digit][(source[0].key >> (digit * 8)) & 0xFF] == queue->num_packets) continue;
+
+        size_t offsets[256];
+        size_t offset = 0;
+        for (int i=0; i < 256; i++) {
+            offsets[i] = offset;
+            offset = offset + counts[digit][i];
+        }
+        for (size_t i=0; i < queue->num_packets; i++) {
+            destination[offsets[(source[i].key >> (digit * 8)) & 0xFF]++] = source[i];
+        }
+        struct render_packet* swap = source;
+        source = destination;
+        destination = swap;
+    }
+    queue->packets = source;
+    queue->scratch = destination;
+}
+
+// Copy the instance attributes of the sorted packets into packet order, so each run's instances follow each other in the instance buffer.
+void render_queue_order_instances(struct render_queue* queue) {
+    if (queue->num_packets > queue->ordered_capacity) {
+        queue->ordered_capacity = queue->num_packets * 2;
+        queue->ordered = realloc(queue->ordered, sizeof(struct instance) * queue->ordered_capacity);
+        if (queue->ordered == NULL) {
+            printf("render_queue_order_instances(): Failed to allocate memory for instances. Exiting.\n");
+            exit(-1);
+        }
+    }
+    for (size_t i=0; i < queue->num_packets; i++) {
+        if (queue->packets[i].mesh->page == NULL) queue->ordered[i] = queue->instances[queue->packets[i].instance];
+    }
+}
+
+// Draw every packet a frame queued in key order, one draw call per run of instances sharing a mesh and level of detail.
+// The instances' attributes, already in run order, are streamed to the GPU in one upload.
+// Without instancing, runs of small meshes are copied into world space and drawn together through the dynamic batch,
+// and any other instance has its model matrix and tint set as uniforms and is drawn on its own.
+// Opaque runs are drawn without blending, and translucent runs with blending and without writing depth.
+// Whenever the shader variant changes, it is looked up, compiled the first time it is needed, and given the frame's uniforms.
+void program_draw_frame(struct frame* frame) {
+    struct render_queue* queue = &frame->queue;
+    struct shader* shader = NULL;
+    if (program->instancing_supported == true && queue->num_packets > 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, program->instance_buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(struct instance) * queue->num_packets, queue->ordered, GL_STREAM_DRAW);
+    }
+
+    size_t start = 0;
+    while (start < queue->num_packets) {
+        struct render_packet* packet = &queue->packets[start];
+        struct mesh* mesh = packet->mesh;
+        struct mesh_lod* lod = &mesh->lods[packet->lod];
+        uint32_t pass = packet->key >> 62;
+        size_t end = start + 1;
+        while (end < queue->num_packets && queue->packets[end].mesh == mesh && queue->packets[end].lod == packet->lod && queue->packets[end].key >> 62 == pass) {
+            end++;
+        }
+        GLsizei count = end - start;
 
-    // Initialise uniforms:
-    program->shaders->uniforms.view = glGetUniformLocation(program->shaders->shader, "view");
-    program->shaders->uniforms.model = glGetUniformLocation(program->shaders->shader, "model");
-    program->shaders->uniforms.projection = glGetUniformLocation(program->shaders->shader, "projection");
-    program->shaders->uniforms.light_color = glGetUniformLocation(program->shaders->shader, "light_color");
-    program->shaders->uniforms.light_position = glGetUniformLocation(program->shaders->shader, "light_position");
-    program->shaders->uniforms.camera_position = glGetUniformLocation(program->shaders->shader, "camera_position");
-    
-    // Initialise light:
-    glm_vec3((vec3){1.0, 1.0, 1.0}, program->light.light_color);
-    glm_vec3((vec3){0.0, -3.0, 0.0}, program->light.light_position);
-    
+        // Runs drawn through the dynamic batch are in world space with float vertices, whatever the mesh's own format.
+        bool batched = program->instancing_supported == false && mesh->page == NULL && count > 1 && dynamic_batch_accepts(mesh, lod) == true;
+        struct mesh* source = batched == true ? program->dynamic_batch.mesh : mesh;
+        uint32_t features = batched == true ? packet->features & ~SHADER_FEATURE_QUANTISED : packet->features;
+
+        // Time each pass on the GPU.
+        if (start == 0 || queue->packets[start - 1].key >> 62 != pass) {
+            PROFILE_GPU_END();
+            PROFILE_GPU_BEGIN(pass == RENDER_PASS_OPAQUE ? "opaque pass" : "translucent pass");
+        }
+
+        // Set the pass's blending, the shader, and how the shader decodes this mesh's vertices.
+        if (shader == NULL || shader->features != features) {
+            shader = shader_get(features);
+            render_state_use_shader(shader);
+            shader_set_frame_uniforms(shader, frame);
+        }
+        render_state_set_blend(pass == RENDER_PASS_TRANSLUCENT);
+        render_state_set_depth_write(pass == RENDER_PASS_OPAQUE);
+        render_state_uniform3fv(shader->uniforms.position_offset, shader->values.position_offset, source->position_offset);
+        render_state_uniform3fv(shader->uniforms.position_scale, shader->values.position_scale, source->position_scale);
+        render_state_bind_vertex_array(source->VAO);
+
+        // Batch pages and the dynamic batch are already in world space, so they are drawn with an identity model matrix and a white tint.
+        if (mesh->page != NULL || batched == true) {
+            mat4 identity = GLM_MAT4_IDENTITY_INIT;
+            render_state_uniform_matrix4fv(shader->uniforms.model, shader->values.model[0], identity[0]);
+            render_state_uniform4fv(shader->uniforms.tint, shader->values.tint, (vec4){1.0, 1.0, 1.0, 1.0});
+        }
+
+        void* offset = (void*)(lod->first_index * mesh_index_size(mesh));
+        if (mesh->page != NULL) {
+            // Draw the run's ranges of the batch page, merging ranges that follow each other in the index buffer into one draw call.
+            uint32_t first_index = 0;
+            uint32_t num_indices = 0;
+            for (size_t i=start; i <= end; i++) {
+                struct batch_range* range = i < end ? &mesh->page->ranges[queue->packets[i].instance] : NULL;
+                if (range != NULL && num_indices > 0 && range->first_index[packet->lod] == first_index + num_indices) {
+                    num_indices = num_indices + range->num_indices[packet->lod];
+                    continue;
+                }
+                if (num_indices > 0) {
+                    glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT, (void*)(first_index * sizeof(GLushort)));
+                    program->render_stats.draw_calls++;
+                    program->render_stats.triangles_drawn = program->render_stats.triangles_drawn + num_indices / 3;
+                }
+                if (range != NULL) {
+                    first_index = range->first_index[packet->lod];
+                    num_indices = range->num_indices[packet->lod];
+                }
+            }
+        }
+        else if (program->instancing_supported == true) {
+            // Point the instance attributes at this run's part of the instance buffer.
+            GLsizei stride = sizeof(struct instance);
+            size_t base = start * sizeof(struct instance);
+            for (GLuint i=0; i < 4; i++) {
+                glVertexAttribPointer(ATTRIBUTE_INSTANCE_MODEL + i, 4, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(struct instance, model) + sizeof(vec4) * i));
+            }
+            glVertexAttribPointer(ATTRIBUTE_INSTANCE_TINT, 4, GL_FLOAT, GL_FALSE, stride, (void*)(base + offsetof(struct instance, tint)));
+            helper_opengl_draw_elements_instanced(GL_TRIANGLES, lod->num_indices, mesh->index_type, offset, count);
+            program->render_stats.draw_calls++;
+            program->render_stats.triangles_drawn = program->render_stats.triangles_drawn + lod->num_indices / 3 * count;
+        }
+        else if (batched == true) {
+            dynamic_batch_draw(&program->dynamic_batch, mesh, lod, &queue->ordered[start], count);
+        }
+        else {
+            for (size_t i=start; i < end; i++) {
+                render_state_uniform_matrix4fv(shader->uniforms.model, shader->values.model[0], queue->ordered[i].model[0]);
+                render_state_uniform4fv(shader->uniforms.tint, shader->values.tint, queue->ordered[i].tint);
+                glDrawElements(GL_TRIANGLES, lod->num_indices, mesh->index_type, offset);
+                program->render_stats.draw_calls++;
+            }
+            program->render_stats.triangles_drawn = program->render_stats.triangles_drawn + lod->num_indices / 3 * count;
+        }
+
+        program->render_stats.meshes_drawn = program->render_stats.meshes_drawn + count;
+        start = end;
+    }
+
+    PROFILE_GPU_END();
+
+    // Leave depth writes on so the next frame's clear reaches the depth buffer.
+    render_state_set_depth_write(true);
+    frame->prepared = false;
+}
+
+// Show the culling and state change counters in the window title twice a second.
+void program_show_render_stats() {
+    double current_time = glfwGetTime();
+    if (current_time - program->stats_time < 0.5) return;
+    program->stats_time = current_time;
+
+    double frame_mean = 0.0;
+    double frame_jitter = 0.0;
+    timing_frame_statistics(&frame_mean, &frame_jitter);
+
+    char title[512];
+    snprintf(title, sizeof(title), "Window - triangles drawn %u - draw calls %u - state changes %u, skipped %u - meshes drawn %u, culled %u, occluded %u - nodes tested %u, culled %u, occluded %u - objects culled %u - occluder triangles %u - lights %u, in clusters %u, dropped %u - resolution %dx%d - frame %.2f ms, jitter %.2f ms",
+        program->render_stats.triangles_drawn, program->render_stats.draw_calls, program->render_stats.state_changes, program->render_stats.state_changes_skipped,
+        program->render_stats.meshes_drawn, program->render_stats.meshes_culled, program->render_stats.meshes_occluded,
+        program->render_stats.nodes_tested, program->render_stats.nodes_culled, program->render_stats.nodes_occluded, program->render_stats.objects_culled,
+        program->render_stats.occluder_triangles, program->render_stats.lights, program->render_stats.light_indices, program->render_stats.lights_dropped,
+        program->dynamic_resolution.render_width, program->dynamic_resolution.render_height, frame_mean, frame_jitter);
+    glfwSetWindowTitle(program->window, title);
+}
+
+// Rasterise the meshes of visible occluder objects that cover enough of the screen into the occlusion buffer,
+// at the level of detail each was last drawn at, until the frame's triangle budget runs out.
+// Translucent meshes hide nothing, and are never occluders.
+void program_rasterise_occluders(struct frame* frame) {
+    struct occlusion_buffer* occlusion = &program->occlusion;
+    vec4* planes = frame->planes;
+    struct lod_view* view = &frame->lod_view;
+    occlusion_begin(occlusion, (const float*)frame->view_projection, CAMERA_NEAR);
+    if (program->occlusion_culling == false) return;
+
+    struct scene* scene = &program->scene;
+    for (size_t i=0; i < scene->count; i++) {
+        struct object* object = &scene->objects[i];
+        if (object->is_occluder == false || object->lods == NULL || scene->visible[i] == 0) continue;
+
+        struct model* model = object->model;
+        for (size_t j=0; j < model->num_meshes; j++) {
+            struct mesh* mesh = model->mesh_table[j];
+            if (mesh->translucent == true || mesh->ready_lod >= mesh->num_lods) continue;
+            bool released = mesh->vertices == NULL || mesh->indices == NULL;
+            if (released == true && mesh->occluder_positions == NULL) continue;
+
+            // Skip meshes outside the frustum or too small on screen to hide much.
+            vec3 centre;
+            glm_mat4_mulv3(scene->world[i], mesh->bounds_centre, 1.0, centre);
+            float radius = mesh->bounds_radius * scene->world_scale[i];
+            bool inside = true;
+            for (int p=0; p < 6 && inside == true; p++) {
+                inside = glm_vec3_dot(planes[p], centre) + planes[p][3] >= -radius;
+            }
+            float distance = glm_vec3_distance(centre, view->camera_position);
+            if (inside == false || (distance > radius && 2.0 * radius * view->pixels_per_unit / distance < OCCLUSION_OCCLUDER_PIXELS)) continue;
+
+            // Meshes whose CPU copies were released only have their coarsest level of detail, already decoded.
+            unsigned int num_vertices = mesh->occluder_num_vertices;
+            unsigned int num_indices = mesh->occluder_num_indices;
+            const float* positions = mesh->occluder_positions;
+            const uint8_t* indices = mesh->occluder_indices;
+            if (released == false) {
+                struct mesh_lod* lod = &mesh->lods[object->lods[j] > mesh->ready_lod ? object->lods[j] : mesh->ready_lod];
+                num_vertices = lod->num_vertices;
+                num_indices = lod->num_indices;
+                indices = (const uint8_t*)mesh->indices + lod->first_index * mesh_index_size(mesh);
+            }
+            if (frame->stats.occluder_triangles + num_indices / 3 > OCCLUSION_MAX_TRIANGLES) continue;
+
+            // Otherwise decode the positions the level of detail uses, and hand them over with its triangles.
+            if (released == false) {
+                if (num_vertices * 3 > program->occluder_positions_capacity) {
+                    program->occluder_positions_capacity = num_vertices * 3;
+                    program->occluder_positions = realloc(program->occluder_positions, sizeof(float) * program->occluder_positions_capacity);
+                    if (program->occluder_positions == NULL) {
+                        printf("program_rasterise_occluders(): Failed to allocate memory for occluder positions. Exiting.\n");
+                        exit(-1);
+                    }
+                }
+                for (unsigned int k=0; k < num_vertices; k++) {
+                    mesh_read_position(mesh, k, &program->occluder_positions[k * 3]);
+                }
+                positions = program->occluder_positions;
+            }
+            mat4 world_view_projection;
+            glm_mat4_mul(frame->view_projection, scene->world[i], world_view_projection);
+            uint32_t base = occlusion_add_vertices(occlusion, (const float*)world_view_projection, positions, num_vertices);
+            bool wide = mesh->index_type == GL_UNSIGNED_INT;
+            if (base == UINT32_MAX || occlusion_add_triangles(occlusion, base, indices, num_indices, wide) == false) {
+                printf("program_rasterise_occluders(): Failed to allocate memory for occluders. Exiting.\n");
+                exit(-1);
+            }
+            frame->stats.occluder_triangles = frame->stats.occluder_triangles + num_indices / 3;
+        }
+    }
+
+    occlusion_rasterise(occlusion, &program->jobs);
+}
+
+// Give objects whose models have arrived since the last frame somewhere to remember their levels of detail,
+// and the bounds of their model to cull them with.
+void program_prepare_objects() {
+    for (size_t i=0; i < program->scene.count; i++) {
+        struct object* object = &program->scene.objects[i];
+        struct model* model = object->model;
+        if (model->nodes == NULL || object->lods != NULL) continue;
+
+        object->lods = arena_calloc(&program->scene.arena, model->num_meshes + 1, sizeof(uint8_t));
+        if (object->lods == NULL) {
+            printf("program_prepare_objects(): Failed to allocate memory for levels of detail. Exiting.\n");
+            exit(-1);
+        }
+        scene_set_bounds(&program->scene, object->handle, model->bounds_centre, model->bounds_radius);
+    }
+}
 
-    // Load object mesh:
-    program->objects = object_new("output_model");
-    if (program->objects == NULL) {
-        printf("program_init(): Failed to load object. Returning.\n");
+// Return true while any model is still loading or uploading.
+bool program_loading() {
+    for (struct model* model = program->models; model != NULL; model = model->next) {
+        if (model->loader != NULL) return true;
+    }
+    return false;
+}
+
+// Scatter the point lights through the lower half of the box around every object, with random colours and orbits,
+// once the scene has loaded. The same lights are placed on every run, so benchmarks are repeatable.
+void program_place_lights() {
+    struct scene* scene = &program->scene;
+    if (program->lights_placed == true || program_loading() == true || scene->count == 0) return;
+    program->lights_placed = true;
+    if (program->num_lights == 0) return;
+
+    program->lights = malloc(sizeof(struct point_light) * program->num_lights);
+    program->light_view = malloc(sizeof(float) * 4 * program->num_lights);
+    if (program->lights == NULL || program->light_view == NULL) {
+        printf("program_place_lights(): Failed to allocate memory for lights. Exiting.\n");
         exit(-1);
     }
 
-    // Initialise camera:
-    memcpy(program->camera.position, (vec3){180.0, -15.0, -64.0}, sizeof(vec3));
-    memcpy(program->camera.front, (vec3){0.0, 0.0, -1.0}, sizeof(vec3));
-    memcpy(program->camera.up, (vec3){0.0, 1.0, 0.0}, sizeof(vec3));
-    program->camera.yaw = -90.0;
-    program->camera.pitch = 0.0;
-    program->camera.speed = 250;
+    vec3 minimum = {INFINITY, INFINITY, INFINITY};
+    vec3 maximum = {-INFINITY, -INFINITY, -INFINITY};
+    for (size_t i=0; i < scene->count; i++) {
+        vec3 centre = {scene->world_x[i], scene->world_y[i], scene->world_z[i]};
+        for (int k=0; k < 3; k++) {
+            minimum[k] = fminf(minimum[k], centre[k] - scene->world_radius[i]);
+            maximum[k] = fmaxf(maximum[k], centre[k] + scene->world_radius[i]);
+        }
+    }
+    maximum[1] = (minimum[1] + maximum[1]) * 0.5;
+    float radius = glm_vec3_distance(minimum, maximum) * LIGHT_RADIUS_FRACTION;
 
-    program->camera.mouse.last_x = SCREEN_WIDTH/2;
-    program->camera.mouse.last_y = SCREEN_HEIGHT/2;
-    program->camera.mouse.used_before = false;
-    program->camera.mouse.sensitivity = 0.1;
- 
-    // Initialise timings
-    program->timing.delta_time = 0.0;
-    program->timing.last_time = 0.0;
+    srand(1);
+    for (uint32_t i=0; i < program->num_lights; i++) {
+        struct point_light* light = &program->lights[i];
+        for (int k=0; k < 3; k++) {
+            light->anchor[k] = minimum[k] + (maximum[k] - minimum[k]) * ((float)rand() / RAND_MAX);
+            light->color[k] = (float)rand() / RAND_MAX;
+        }
+        // Keep the colours bright by scaling the strongest channel up to one.
+        glm_vec3_scale(light->color, 1.0 / fmaxf(glm_vec3_max(light->color), 0.001), light->color);
+        glm_vec3_copy(light->anchor, light->position);
+        light->radius = radius * (0.5 + (float)rand() / RAND_MAX);
+        light->phase = 2.0 * GLM_PI * ((float)rand() / RAND_MAX);
+        light->speed = 0.2 + 0.8 * ((float)rand() / RAND_MAX);
+    }
+    program->shading_features = program->shading_features | SHADER_FEATURE_CLUSTERED_LIGHTS;
+    fprintf(stderr, "Placed %u point lights.\n", program->num_lights);
+}
 
-    // Set program status:
-    program->status = RUNNING;
-    program->opengl_initialised = false;
+// Move the point lights along their orbits, assign them to the clusters of a frame's view frustum, and pack the lights,
+// the clusters and their light indices into texels for program_upload_lights(). Nothing is done while clustered lighting is off.
+void program_update_lights(struct frame* frame) {
+    frame->lights_updated = false;
+    if (program->lights == NULL || (program->shading_features & SHADER_FEATURE_CLUSTERED_LIGHTS) == 0) return;
+    struct light_cluster_grid* grid = &program->light_grid;
+    uint32_t count = program->num_lights;
+    float time = program->timing.last_time;
 
-    // Set resize callback:
-    glfwSetFramebufferSizeCallback(program->window, program_resize_callback);
+    // Move the lights, and find the bounds their positions and radii are stored across.
+    vec3 minimum = {INFINITY, INFINITY, INFINITY};
+    vec3 maximum = {-INFINITY, -INFINITY, -INFINITY};
+    float largest_radius = 0.0;
+    for (uint32_t i=0; i < count; i++) {
+        struct point_light* light = &program->lights[i];
+        float angle = light->phase + time * light->speed;
+        glm_vec3_add(light->anchor, (vec3){cos(angle) * light->radius, 0.0, sin(angle) * light->radius}, light->position);
+        glm_vec3_minv(minimum, light->position, minimum);
+        glm_vec3_maxv(maximum, light->position, maximum);
+        largest_radius = fmaxf(largest_radius, light->radius);
+    }
 
-    // Set mouse callback:
-    glfwSetCursorPosCallback(program->window, program_mouse_callback);
-    glfwSetInputMode(program->window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // Assign the lights to clusters as view space spheres.
+    float* x = program->light_view;
+    float* y = x + count;
+    float* z = y + count;
+    float* radius = z + count;
+    for (uint32_t i=0; i < count; i++) {
+        vec3 position;
+        glm_mat4_mulv3(frame->view, program->lights[i].position, 1.0, position);
+        x[i] = position[0];
+        y[i] = position[1];
+        z[i] = position[2];
+        radius[i] = program->lights[i].radius;
+    }
+    PROFILE_BEGIN("assign");
+    light_cluster_set_projection(grid, glm_rad(CAMERA_FOV), (float)program->framebuffer_width/(float)program->framebuffer_height, CAMERA_NEAR, CAMERA_FAR);
+    light_cluster_assign(grid, &program->jobs, x, y, z, radius, count);
+    PROFILE_END();
 
-    // Rotate camera:
-    program->camera.yaw += -120.0;
-    vec3 direction = {0.0, 0.0, 0.0};
-    direction[0] = cos(glm_rad(program->camera.yaw)) * cos(glm_rad(program->camera.pitch));
-    direction[1] = sin(glm_rad(program->camera.pitch));
-    direction[2] = sin(glm_rad(program->camera.yaw)) * cos(glm_rad(program->camera.pitch));
-    glm_vec3_normalize_to(direction, program->camera.front);
+    // Pack the lights into their texels.
+    if (count > LIGHT_CLUSTER_MAX_LIGHTS) count = LIGHT_CLUSTER_MAX_LIGHTS;
+    for (int k=0; k < 3; k++) {
+        frame->light_offset[k] = minimum[k];
+        frame->light_scale[k] = maximum[k] > minimum[k] ? maximum[k] - minimum[k] : 1.0;
+    }
+    frame->light_offset[3] = 0.0;
+    frame->light_scale[3] = largest_radius;
+    for (uint32_t i=0; i < count; i++) {
+        struct point_light* light = &program->lights[i];
+        uint8_t* texel = &program->light_texels[((i / LIGHT_TEXTURE_WIDTH) * 3 * LIGHT_TEXTURE_WIDTH + i % LIGHT_TEXTURE_WIDTH) * 4];
+        float values[4] = {light->position[0], light->position[1], light->position[2], light->radius};
+        for (int k=0; k < 4; k++) {
+            uint16_t value = model_format_quantise_unorm16((values[k] - frame->light_offset[k]) / frame->light_scale[k]);
+            uint8_t* bytes = &texel[(k / 2) * LIGHT_TEXTURE_WIDTH * 4 + (k % 2) * 2];
+            bytes[0] = value & 0xFF;
+            bytes[1] = value >> 8;
+        }
+        uint8_t* color = &texel[2 * LIGHT_TEXTURE_WIDTH * 4];
+        for (int k=0; k < 3; k++) {
+            color[k] = (uint8_t)(light->color[k] * 255.0 + 0.5);
+        }
+        color[3] = 255;
+    }
+
+    frame->lights_updated = true;
+    frame->stats.lights = count;
+    frame->stats.light_indices = grid->num_indices;
+    frame->stats.lights_dropped = grid->num_dropped;
+}
+
+// Upload the lights, clusters and light indices packed for a frame to the textures the fragment shader reads,
+// and tell it how to find a fragment's cluster at the resolution the frame is drawn at.
+// The texels are shared between frames, so this runs before the jobs start packing the next frame's.
+void program_upload_lights(struct frame* frame) {
+    if (frame->lights_updated == false) return;
+    struct light_cluster_grid* grid = &program->light_grid;
+    uint32_t count = frame->stats.lights;
+
+    // Upload the rows in use.
+    GLsizei light_rows = (count + LIGHT_TEXTURE_WIDTH - 1) / LIGHT_TEXTURE_WIDTH * 3;
+    GLsizei index_rows = (grid->num_indices + LIGHT_CLUSTER_INDEX_WIDTH - 1) / LIGHT_CLUSTER_INDEX_WIDTH;
+    glActiveTexture(GL_TEXTURE0 + LIGHT_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, program->light_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_TEXTURE_WIDTH, light_rows, GL_RGBA, GL_UNSIGNED_BYTE, program->light_texels);
+    glActiveTexture(GL_TEXTURE0 + LIGHT_CLUSTER_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, program->light_cluster_texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_CLUSTER_TILES, LIGHT_CLUSTER_Z, GL_RGBA, GL_UNSIGNED_BYTE, grid->cluster_texels);
+    if (index_rows > 0) {
+        glActiveTexture(GL_TEXTURE0 + LIGHT_INDEX_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, program->light_index_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, LIGHT_CLUSTER_INDEX_WIDTH, index_rows, GL_RGBA, GL_UNSIGNED_BYTE, grid->index_texels);
+    }
+    size_t uploaded = ((size_t)light_rows * LIGHT_TEXTURE_WIDTH + LIGHT_CLUSTER_COUNT + (size_t)index_rows * LIGHT_CLUSTER_INDEX_WIDTH) * 4;
+    program->render_stats.bytes_uploaded = program->render_stats.bytes_uploaded + uploaded;
+
+    // Tell the fragment shader how to find a fragment's cluster: tiles per pixel across the screen,
+    // and slice = log(depth) * z + w, the inverse of the exponential spacing of the slices.
+    float slices_per_log = LIGHT_CLUSTER_Z / log(CAMERA_FAR / CAMERA_NEAR);
+    program->cluster_parameters[0] = (float)LIGHT_CLUSTER_X / program->dynamic_resolution.render_width;
+    program->cluster_parameters[1] = (float)LIGHT_CLUSTER_Y / program->dynamic_resolution.render_height;
+    program->cluster_parameters[2] = slices_per_log;
+    program->cluster_parameters[3] = -log(CAMERA_NEAR) * slices_per_log;
+}
+
+// Add a piece of the scene for the culling jobs to walk.
+void program_add_cull_item(uint32_t object, uint32_t node) {
+    if (program->num_cull_items == program->cull_items_capacity) {
+        program->cull_items_capacity = program->cull_items_capacity == 0 ? 256 : program->cull_items_capacity * 2;
+        program->cull_items = realloc(program->cull_items, sizeof(struct cull_item) * program->cull_items_capacity);
+        if (program->cull_items == NULL) {
+            printf("program_add_cull_item(): Failed to allocate memory for culling. Exiting.\n");
+            exit(-1);
+        }
+    }
+    program->cull_items[program->num_cull_items++] = (struct cull_item){object, node};
+}
+
+// Order cull items by object and then by node, so each job meets an object's subtrees one after another.
+int cull_item_compare(const void* a, const void* b) {
+    const struct cull_item* item_a = a;
+    const struct cull_item* item_b = b;
+    if (item_a->object != item_b->object) return item_a->object < item_b->object ? -1 : 1;
+    return (item_a->node > item_b->node) - (item_a->node < item_b->node);
+}
+
+// Walk a culling job's run of cull items, queueing what the camera can see into the job's own render queue.
+// Each object gets one instance in each job that walks any of it. No two items share a mesh,
+// so an object's levels of detail are each picked by only one job.
+void program_cull_job(void* data) {
+    struct cull_job* job = data;
+    struct frame* frame = job->frame;
+    struct scene* scene = &program->scene;
+    struct lod_view view = frame->lod_view;
+    job->queue.num_packets = 0;
+    job->queue.num_instances = 0;
+    memset(&job->stats, 0, sizeof(struct render_stats));
+
+    uint32_t previous = UINT32_MAX;
+    uint32_t instance = 0;
+    for (size_t i=job->first_item; i < job->first_item + job->num_items; i++) {
+        struct cull_item* item = &program->cull_items[i];
+        struct object* object = &scene->objects[item->object];
+        if (item->object != previous) {
+            instance = render_queue_add_instance(&job->queue, scene->world[item->object], object->tint);
+            previous = item->object;
+        }
+        view.scale = scene->world_scale[item->object];
+        program_cull_object(job, object, item->node, instance, scene->world[item->object], frame->planes, &view);
+    }
+}
+
+// Walk the cluster trees of the objects that may be visible across the culling jobs, and gather what they queued into the frame.
+// Large trees are split into the subtrees of their nodes, breadth first, until there are enough pieces for every job.
+// The pieces are dealt out in runs, which the threads steal from each other as they finish.
+void program_cull_scene(struct frame* frame) {
+    struct scene* scene = &program->scene;
+    program->num_cull_items = 0;
+    for (size_t i=0; i < scene->count; i++) {
+        // Nothing to draw until the loader has handed over the meshes and their cluster tree.
+        struct object* object = &scene->objects[i];
+        if (object->lods == NULL) continue;
+        if (scene->visible[i] == 0) {
+            frame->stats.objects_culled++;
+            frame->stats.meshes_culled = frame->stats.meshes_culled + object->model->num_meshes;
+            continue;
+        }
+        program_add_cull_item(i, 0);
+    }
+
+    for (size_t i=0; i < program->num_cull_items && program->num_cull_items < program->num_cull_jobs; i++) {
+        struct cull_item item = program->cull_items[i];
+        struct model* model = scene->objects[item.object].model;
+        struct cluster_node* node = &model->nodes[item.node];
+        if (model->num_nodes < CULL_SPLIT_NODES || node->num_children == 0) continue;
+        program->cull_items[i].node = node->first_child;
+        for (uint32_t j=1; j < node->num_children; j++) {
+            program_add_cull_item(item.object, node->first_child + j);
+        }
+    }
+    qsort(program->cull_items, program->num_cull_items, sizeof(struct cull_item), cull_item_compare);
+
+    size_t num_jobs = program->num_cull_items < program->num_cull_jobs ? program->num_cull_items : program->num_cull_jobs;
+    for (size_t i=0; i < num_jobs; i++) {
+        struct cull_job* job = &program->cull_jobs[i];
+        job->frame = frame;
+        job->first_item = program->num_cull_items * i / num_jobs;
+        job->num_items = program->num_cull_items * (i + 1) / num_jobs - job->first_item;
+    }
+    struct job_counter counter = {0};
+    job_submit(&program->jobs, program_cull_job, program->cull_jobs, sizeof(struct cull_job), num_jobs, &counter);
+    job_wait(&program->jobs, &counter);
+
+    for (size_t i=0; i < num_jobs; i++) {
+        render_queue_append(&frame->queue, &program->cull_jobs[i].queue);
+        render_stats_add(&frame->stats, &program->cull_jobs[i].stats);
+    }
+}
+
+// Set a frame up to be prepared from where the camera is now: its view and projection matrices, its frustum planes,
+// and how large a unit appears on screen, to project level of detail errors.
+void program_setup_frame(struct frame* frame) {
+    // View moves objects in front of a camera.
+    // Projection defines how objects appear to the camera to create proper depth and perspective.
+    glm_mat4_identity(frame->view);
+    glm_mat4_identity(frame->projection);
+
+    // Create the view and camera matrix.
+    // Make sure the view takes data from the current camera position and what it is looking at to know how to draw things
+    vec3 lookingat = {0.0, 0.0, 0.0};
+    glm_vec3_add(program->camera.render_position, program->camera.front, lookingat);
+    glm_lookat(program->camera.render_position, lookingat, program->camera.up, frame->view);
+
+    // Create the camera perspective, with the window's shape whatever resolution it is drawn at.
+    glm_perspective(glm_rad(CAMERA_FOV), (float)program->framebuffer_width/(float)program->framebuffer_height, CAMERA_NEAR, CAMERA_FAR, frame->projection);
+
+    // Extract the frustum planes from the combined view and projection, to cull what the camera cannot see.
+    glm_mat4_mul(frame->projection, frame->view, frame->view_projection);
+    glm_frustum_planes(frame->view_projection, frame->planes);
+
+    // Work out how large a unit appears on screen at a distance of one unit, to project level of detail errors.
+    glm_vec3_copy(program->camera.render_position, frame->lod_view.camera_position);
+    frame->lod_view.pixels_per_unit = (float)program->dynamic_resolution.render_height / (2.0 * tan(glm_rad(CAMERA_FOV) * 0.5));
+    frame->lod_view.scale = 1.0;
+}
+
+// Prepare a frame for the main thread to draw: assign the point lights to the clusters they reach, test every object's bounding sphere,
+// rasterise the occluders among those that may be visible, walk the cluster trees of the objects that may be visible across the culling jobs,
+// and sort what they queued. Runs as a job while the main thread draws the other frame, so it only touches what drawing leaves alone.
+void program_prepare_frame(struct frame* frame) {
+    frame->queue.num_packets = 0;
+    frame->queue.num_instances = 0;
+    memset(&frame->stats, 0, sizeof(struct render_stats));
+
+    PROFILE_BEGIN("lights");
+    program_update_lights(frame);
+    PROFILE_END();
+
+    PROFILE_BEGIN("cull");
+    scene_test_spheres(&program->scene, frame->planes);
+    PROFILE_BEGIN("occluders");
+    program_rasterise_occluders(frame);
+    PROFILE_END();
+    program_cull_scene(frame);
+    PROFILE_END();
+
+    PROFILE_BEGIN("sort");
+    render_queue_sort(&frame->queue);
+    render_queue_order_instances(&frame->queue);
+    PROFILE_END();
+    frame->prepared = true;
+}
+
+// Prepare a frame as a job.
+void program_prepare_frame_job(void* data) {
+    program_prepare_frame(data);
 }
 
 // Render the objects in the program.
+// The scene is drawn into the dynamic resolution render target, at a size picked from the cost of recent frames,
+// and stretched over the window before the profiler overlay is drawn on top at the window's size.
+// When pipelined, the jobs prepare this frame while the main thread draws the one they prepared during the last,
+// so frames are shown a frame later. Low latency mode prepares and draws each frame in turn instead.
 void program_render() {
+    // Nothing can be drawn while the window is minimised.
+    if (program->framebuffer_width <= 0 || program->framebuffer_height <= 0) return;
+    double start_time = glfwGetTime();
+
     // Initialise OpenGL elements
     if (program->opengl_initialised == false) {
         glClearColor(0.52, 0.80, 0.92, 0.0);
         glEnable(GL_DEPTH_TEST);
         glEnable(GL_CULL_FACE);
-        glEnable(GL_BLEND);
+        // Blending is only turned on for translucent geometry, by the render queue.
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glCullFace(GL_BACK);
         glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-        // Load program shader
-        glUseProgram(program->shaders->shader);
         program->opengl_initialised = true;
     }
+    struct dynamic_resolution* resolution = &program->dynamic_resolution;
+    dynamic_resolution_begin(resolution, program->framebuffer_width, program->framebuffer_height);
+    PROFILE_GPU_BEGIN("clear");
     glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+    PROFILE_GPU_END();
 
-    // Go through the list of objects to render
-    struct object* object = program->objects;
-    while (object != NULL) {
-        // Initialise world transformation matricies.
-        // Model moves/translates objects to the correct location in the world.
-        // View moves objects in front of a camera.
-        // Projection defines how objects appear to the camera to create proper depth and perspective.
-        mat4 model = GLM_MAT4_IDENTITY_INIT;
-        mat4 view = GLM_MAT4_IDENTITY_INIT;
-        mat4 projection = GLM_MAT4_IDENTITY_INIT;
-
-        // Set object's scale and position to the model matrix.
-        glm_translate(model, object->position);
-        glm_scale(model, object->scale);
-
-        // Create the view and camera matrix.
-        // Make sure the view takes data from the current camera position and what it is looking at to know how to draw things
-        vec3 lookingat = {0.0, 0.0, 0.0};
-        glm_vec3_add(program->camera.position, program->camera.front, lookingat);
-        glm_lookat(program->camera.position, lookingat, program->camera.up, view);
-
-        // Create the world light position to pass into the shader.
-        //glm_vec3_copy(program->camera.position, program->light.light_position);
-        glm_vec3_copy((vec3){0.0, 1000.0, 1000.0}, program->light.light_position);
-
-        // Create the camera perspective
-        glm_perspective(glm_rad(45.0f), (float)SCREEN_WIDTH/(float)SCREEN_HEIGHT, 0.1f, 1000000.f, projection);
-        
-        // Copy information on light, camera position and uniforms to the shader
-        // Also copy transformation matricies for vertex positions to the shader for processing.
-        // This ensures that vertices then appear on the screen from our camera's perspective correctly.
-        glUniform3fv(program->shaders->uniforms.light_color, 1, program->light.light_color);
-        glUniform3fv(program->shaders->uniforms.light_position, 1, program->light.light_position);
-        glUniform3fv(program->shaders->uniforms.camera_position, 1, program->camera.position);
-        glUniformMatrix4fv(program->shaders->uniforms.model, 1, GL_FALSE, model[0]);
-        glUniformMatrix4fv(program->shaders->uniforms.view, 1, GL_FALSE, view[0]);
-        glUniformMatrix4fv(program->shaders->uniforms.projection, 1, GL_FALSE, projection[0]);
-
-        // Go through the object's mesh list and draw the mesh
-        struct mesh* mesh = object->meshes;
-        while (mesh != NULL) {
-            glBindVertexArray(mesh->VAO);
-            glDrawElements(GL_TRIANGLES, mesh->num_indices, GL_UNSIGNED_SHORT, 0);
-            mesh = mesh->next;
+    // Initialise the camera's transformation matricies for the frame. The frame keeps them, and the render queue copies them,
+    // along with the light and camera position, into each shader variant it draws with, so that vertices appear on the screen
+    // from our camera's perspective correctly.
+    PROFILE_BEGIN("matrices");
+    struct frame* frame = &program->frames[program->frame_index];
+    program_setup_frame(frame);
+
+    // Create the world light position to pass into the shader.
+    //glm_vec3_copy(program->camera.position, program->light.light_position);
+    glm_vec3_copy((vec3){0.0, 1000.0, 1000.0}, program->light.light_position);
+    PROFILE_END();
+
+    // Bring the world matrices and bounds of objects that moved or arrived up to date, and scatter the point lights once the scene has loaded.
+    PROFILE_BEGIN("transforms");
+    program_prepare_objects();
+    scene_update(&program->scene);
+    program_place_lights();
+    PROFILE_END();
+
+    // Pipelined, hand this frame to the jobs and draw the one they prepared last time, once its lights are uploaded,
+    // which has to happen before the jobs pack this frame's. With nothing prepared, as after starting or switching scenes,
+    // one is prepared from the same camera first. Otherwise prepare this frame on the main thread, helped by the jobs, and draw it.
+    bool pipelined = program->pipelined == true && program->timing.low_latency == false;
+    struct frame* drawn = frame;
+    struct job_counter prepared = {0};
+    if (pipelined == true) {
+        drawn = &program->frames[program->frame_index ^ 1];
+        if (drawn->prepared == false) {
+            PROFILE_BEGIN("prepare");
+            program_setup_frame(drawn);
+            program_prepare_frame(drawn);
+            PROFILE_END();
         }
-        
-        // Go to the next object if applicable
-        object = object->next;
+        program_upload_lights(drawn);
+        job_submit(&program->jobs, program_prepare_frame_job, frame, sizeof(struct frame), 1, &prepared);
+        program->frame_index = program->frame_index ^ 1;
+    }
+    else {
+        PROFILE_BEGIN("prepare");
+        program_prepare_frame(frame);
+        PROFILE_END();
+        program_upload_lights(frame);
+    }
+
+    // Draw every queued mesh in sorted order, batching the instances of each one together.
+    PROFILE_BEGIN("draw submission");
+    program_draw_frame(drawn);
+    PROFILE_END();
+
+    // Stretch the scene over the window.
+    dynamic_resolution_upscale(resolution);
+
+    #if PROFILER_ENABLED
+    if (program->profiler_overlay == true) {
+        profiler_draw_overlay(program->framebuffer_width);
     }
+    #endif
+
+    // Pick the next frames' resolution from what this one cost: its GPU time where timer queries can measure it,
+    // and otherwise the CPU time spent drawing it, which leaves out waiting for the swap.
+    uint64_t gpu_time = PROFILE_GPU_FRAME_TIME();
+    double cost = gpu_time != 0 ? gpu_time / 1000.0 : (glfwGetTime() - start_time) * 1000.0;
+    dynamic_resolution_update(resolution, cost);
+
     // Show the result on screen.
+    // In low latency mode, wait for the GPU to finish the frame, so the driver cannot queue frames ahead of the one
+    // on screen and add their time to the delay between reading input and showing its result.
+    PROFILE_BEGIN("swap");
     glfwSwapBuffers(program->window);
+    if (program->timing.low_latency == true) glFinish();
+    PROFILE_END();
+
+    // Wait for the jobs to finish preparing the next frame, helping with what is left, before streaming can change what they read.
+    PROFILE_BEGIN("wait for jobs");
+    job_wait(&program->jobs, &prepared);
+    render_stats_add(&program->render_stats, &frame->stats);
+    PROFILE_END();
 }
 
-// Calculate time between frames to get smooth movement
-void program_update_timing() {
-    float current_time = glfwGetTime();
-    program->timing.delta_time = current_time - program->timing.last_time;
-    program->timing.last_time = current_time;
+// Report how long the scene switch took once everything has loaded and uploaded, along with how many GPU buffers were reused,
+// the size of the scene's arena and the peak memory use, and delete the pooled buffers nothing reused.
+void program_finish_scene_switch() {
+    struct scene_list* scenes = &program->scenes;
+    if (scenes->switching == false || program_loading() == true) return;
+    scenes->switching = false;
+
+    struct buffer_pool* pool = &program->buffer_pool;
+    struct arena* arena = &program->scene.arena;
+    fprintf(stderr, "Scene %zu ('%s') ready in %.1f ms, %.1f ms of it unloading the last. Reused %u GPU buffers and created %u.\n",
+        scenes->current + 1, scenes->filenames[scenes->current], (glfwGetTime() - scenes->switch_start) * 1000.0, scenes->unload_time * 1000.0,
+        pool->reused, pool->created);
+    fprintf(stderr, "Scene arena %.2f MB used of %.2f MB in %zu blocks, peak memory %.1f MB.\n",
+        arena->used / 1048576.0, arena->reserved / 1048576.0, arena->num_blocks, program_peak_memory());
+    buffer_pool_trim();
 }
 
-// Updates the camera's position in a direction based on what key is hit to move it and the speed it should move at
+// Read the keys that change the camera's speed and toggle settings, once a frame.
+// Moving the camera is left to the fixed simulation steps.
 void program_input() {
     // Change camera speed:
     if (glfwGetKey(program->window, GLFW_KEY_1) == GLFW_PRESS) {
@@ -693,7 +4897,95 @@ void program_input() {
         program->camera.speed = 1000000;
     }
 
-    float speed = program->camera.speed * program->timing.delta_time;
+    // Toggle the profiler overlay with F3, and export a Chrome trace with F4, once per key press.
+    #if PROFILER_ENABLED
+    bool overlay_key = glfwGetKey(program->window, GLFW_KEY_F3) == GLFW_PRESS;
+    if (overlay_key == true && program->profiler_overlay_key == false) {
+        program->profiler_overlay = !program->profiler_overlay;
+    }
+    program->profiler_overlay_key = overlay_key;
+
+    bool export_key = glfwGetKey(program->window, GLFW_KEY_F4) == GLFW_PRESS;
+    if (export_key == true && program->profiler_export_key == false) {
+        if (profiler_export_chrome_trace(PROFILER_TRACE_FILENAME) == true) {
+            printf("Exported profile to '%s'.\n", PROFILER_TRACE_FILENAME);
+        }
+        else {
+            printf("program_input(): Failed to export profile to '%s'.\n", PROFILER_TRACE_FILENAME);
+        }
+    }
+    program->profiler_export_key = export_key;
+    #endif
+
+    // Toggle dynamic resolution with F2, drawing at the window's full resolution while it is off.
+    bool resolution_key = glfwGetKey(program->window, GLFW_KEY_F2) == GLFW_PRESS;
+    struct dynamic_resolution* resolution = &program->dynamic_resolution;
+    if (resolution_key == true && resolution->key == false && resolution->supported == true) {
+        resolution->enabled = !resolution->enabled;
+        resolution->scale = DYNAMIC_RESOLUTION_MAX_SCALE;
+        printf("Dynamic resolution %s.\n", resolution->enabled == true ? "on" : "off");
+    }
+    resolution->key = resolution_key;
+
+    // Toggle occlusion culling with F5, to compare what it saves.
+    bool occlusion_key = glfwGetKey(program->window, GLFW_KEY_F5) == GLFW_PRESS;
+    if (occlusion_key == true && program->occlusion_key == false) {
+        program->occlusion_culling = !program->occlusion_culling;
+        printf("Occlusion culling %s.\n", program->occlusion_culling == true ? "on" : "off");
+    }
+    program->occlusion_key = occlusion_key;
+
+    // Toggle flat shading with F6, specular highlights with F7 and the point lights with F8.
+    // The shader variant is compiled the first time it is needed.
+    int shading_keys[3] = {GLFW_KEY_F6, GLFW_KEY_F7, GLFW_KEY_F8};
+    uint32_t shading_features[3] = {SHADER_FEATURE_FLAT_SHADING, SHADER_FEATURE_SPECULAR, SHADER_FEATURE_CLUSTERED_LIGHTS};
+    for (size_t i=0; i < 3; i++) {
+        bool shading_key = glfwGetKey(program->window, shading_keys[i]) == GLFW_PRESS;
+        if (shading_key == true && program->shading_keys[i] == false) {
+            program->shading_features ^= shading_features[i];
+        }
+        program->shading_keys[i] = shading_key;
+    }
+
+    // Toggle low latency mode with F9, and vsync with F10.
+    bool low_latency_key = glfwGetKey(program->window, GLFW_KEY_F9) == GLFW_PRESS;
+    if (low_latency_key == true && program->timing.low_latency_key == false) {
+        program->timing.low_latency = !program->timing.low_latency;
+        printf("Low latency mode %s.\n", program->timing.low_latency == true ? "on" : "off");
+    }
+    program->timing.low_latency_key = low_latency_key;
+
+    bool vsync_key = glfwGetKey(program->window, GLFW_KEY_F10) == GLFW_PRESS;
+    if (vsync_key == true && program->timing.vsync_key == false) {
+        program_set_swap_interval(program->timing.swap_interval == 0 ? 1 : 0);
+        printf("Vsync %s.\n", program->timing.swap_interval != 0 ? "on" : "off");
+    }
+    program->timing.vsync_key = vsync_key;
+
+    // Print the memory report with F11.
+    bool memory_report_key = glfwGetKey(program->window, GLFW_KEY_F11) == GLFW_PRESS;
+    if (memory_report_key == true && program->memory_report_key == false) {
+        program_memory_report();
+    }
+    program->memory_report_key = memory_report_key;
+
+    // Switch to the next scene with Page Down, and the previous one with Page Up.
+    int scene_keys[2] = {GLFW_KEY_PAGE_DOWN, GLFW_KEY_PAGE_UP};
+    struct scene_list* scenes = &program->scenes;
+    for (size_t i=0; i < 2; i++) {
+        bool scene_key = glfwGetKey(program->window, scene_keys[i]) == GLFW_PRESS;
+        if (scene_key == true && scenes->keys[i] == false && scenes->count > 1) {
+            program_switch_scene((scenes->current + (i == 0 ? 1 : scenes->count - 1)) % scenes->count);
+        }
+        scenes->keys[i] = scene_key;
+    }
+}
+
+// Advance the simulation by one fixed step: move the camera in a direction based on which keys are held,
+// at its speed, remembering where it started so frames can be drawn between steps.
+void program_step(float step) {
+    glm_vec3_copy(program->camera.position, program->camera.previous_position);
+    float speed = program->camera.speed * step;
     vec3 updated_position = {0.0, 0.0, 0.0};
 
     // Transform the position the camera exists at by using speed as a factor 
@@ -725,25 +5017,429 @@ void program_input() {
     }
 }
 
+// Run as many fixed simulation steps as the time built up allows, then place the camera for drawing
+// between the last two steps by the fraction of a step left over.
+void program_simulate() {
+    struct timing* timing = &program->timing;
+    while (timing->accumulator >= timing->delta_time) {
+        program_step(timing->delta_time);
+        timing->accumulator = timing->accumulator - timing->delta_time;
+    }
+    timing->alpha = timing->accumulator / timing->delta_time;
+    camera_interpolate(timing->alpha);
+}
+
 // This function is the main program loop function.
 // It checks whether the program should close, and it scans for input and draws/updates the program and calls OpenGL to draw objects on the screen.
 void program_loop() {
     if (glfwWindowShouldClose(program->window)) {
         program->status = QUIT;
     }
+    PROFILE_FRAME();
+    memset(&program->render_stats, 0, sizeof(struct render_stats));
+
+    // In low latency mode, wait for the frame to be due before reading input rather than after drawing,
+    // so the input is as fresh as possible when the frame is drawn.
+    if (program->timing.low_latency == true) {
+        PROFILE_BEGIN("pace");
+        program_pace_frame();
+        PROFILE_END();
+
+        PROFILE_BEGIN("poll events");
+        glfwPollEvents();
+        PROFILE_END();
+    }
+
+    PROFILE_BEGIN("input");
     program_update_timing();
     program_input();
+    program_simulate();
+    PROFILE_END();
+
+    PROFILE_BEGIN("render");
     program_render();
-    glfwPollEvents();
+    PROFILE_END();
+
+    PROFILE_BEGIN("stream meshes");
+    program_stream_meshes();
+    program_build_static_batches();
+    program_release_cpu_meshes();
+    program_finish_scene_switch();
+    PROFILE_END();
+
+    if (program->timing.low_latency == false) {
+        PROFILE_BEGIN("poll events");
+        glfwPollEvents();
+        PROFILE_END();
+
+        PROFILE_BEGIN("pace");
+        program_pace_frame();
+        PROFILE_END();
+    }
+
+    PROFILE_COUNTER("draw calls", program->render_stats.draw_calls);
+    PROFILE_COUNTER("triangles drawn", program->render_stats.triangles_drawn);
+    PROFILE_COUNTER("bytes uploaded", program->render_stats.bytes_uploaded);
+    PROFILE_COUNTER("state changes", program->render_stats.state_changes);
+    PROFILE_COUNTER("light indices", program->render_stats.light_indices);
+    program_show_render_stats();
+
+    // Record the camera for the benchmark to play back.
+    if (program->camera_record != NULL) {
+        fprintf(program->camera_record, "%f %f %f %f %f\n", program->camera.position[0], program->camera.position[1], program->camera.position[2], program->camera.yaw, program->camera.pitch);
+    }
+}
+
+// Read a camera path recorded with --record-camera-path: one keyframe per line, as position x, y and z, yaw and pitch.
+// Returns NULL if the file cannot be read or holds no keyframes.
+struct camera_keyframe* camera_path_load(char* filename, size_t* num_keyframes) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) return NULL;
+
+    struct camera_keyframe* keyframes = NULL;
+    size_t capacity = 0;
+    *num_keyframes = 0;
+    struct camera_keyframe keyframe;
+    while (fscanf(file, "%f %f %f %f %f", &keyframe.position[0], &keyframe.position[1], &keyframe.position[2], &keyframe.yaw, &keyframe.pitch) == 5) {
+        if (*num_keyframes == capacity) {
+            capacity = capacity == 0 ? 256 : capacity * 2;
+            keyframes = realloc(keyframes, sizeof(struct camera_keyframe) * capacity);
+            if (keyframes == NULL) {
+                printf("camera_path_load(): Failed to allocate memory for camera path. Exiting.\n");
+                exit(-1);
+            }
+        }
+        keyframes[*num_keyframes] = keyframe;
+        (*num_keyframes)++;
+    }
+    fclose(file);
+
+    if (*num_keyframes == 0) {
+        free(keyframes);
+        return NULL;
+    }
+    return keyframes;
+}
+
+// Place the camera for a frame of the benchmark.
+// A camera path is stretched over the benchmark's frames, interpolating between keyframes.
+// Without one, the camera orbits the first object's bounds once, looking at their centre.
+void benchmark_place_camera(struct camera_keyframe* keyframes, size_t num_keyframes, unsigned int frame, unsigned int frames) {
+    float t = frames > 1 ? (float)frame / (frames - 1) : 0.0;
+    if (keyframes != NULL) {
+        float position = t * (num_keyframes - 1);
+        size_t index = (size_t)position;
+        if (index >= num_keyframes - 1) index = num_keyframes > 1 ? num_keyframes - 2 : 0;
+        struct camera_keyframe* a = &keyframes[index];
+        struct camera_keyframe* b = &keyframes[num_keyframes > 1 ? index + 1 : index];
+        float blend = position - index;
+        glm_vec3_lerp(a->position, b->position, blend, program->camera.position);
+        program->camera.yaw = a->yaw + (b->yaw - a->yaw) * blend;
+        program->camera.pitch = a->pitch + (b->pitch - a->pitch) * blend;
+        camera_update_front();
+        return;
+    }
+
+    struct scene* scene = &program->scene;
+    vec3 centre = {scene->world_x[0], scene->world_y[0], scene->world_z[0]};
+    float radius = scene->world_radius[0] * BENCHMARK_ORBIT_RADIUS;
+    float angle = t * 2.0 * GLM_PI;
+    program->camera.position[0] = centre[0] + cos(angle) * radius;
+    program->camera.position[1] = centre[1] + radius * 0.25;
+    program->camera.position[2] = centre[2] + sin(angle) * radius;
+
+    vec3 front;
+    glm_vec3_sub(centre, program->camera.position, front);
+    glm_vec3_normalize(front);
+    program->camera.yaw = glm_deg(atan2(front[2], front[0]));
+    program->camera.pitch = glm_deg(asin(front[1]));
+    camera_update_front();
+}
+
+// Order frame times for the percentiles.
+int benchmark_compare(const void* a, const void* b) {
+    double time_a = *(const double*)a;
+    double time_b = *(const double*)b;
+    return (time_a > time_b) - (time_a < time_b);
+}
+
+// Return the nearest rank percentile of sorted values.
+double benchmark_percentile(double* sorted, size_t count, double percentile) {
+    size_t rank = (size_t)ceil(percentile / 100.0 * count);
+    if (rank < 1) rank = 1;
+    return sorted[rank - 1];
+}
+
+// Run the benchmark: load and upload every model, then draw a fixed number of frames along the camera path with a fixed time step,
+// waiting for the GPU to finish each frame so its time is counted. Reports the load time and frame time percentiles as JSON.
+void program_benchmark(struct benchmark* benchmark) {
+    glfwSwapInterval(0);
+
+    // Load and upload everything before timing anything.
+    while (program_loading() == true) {
+        program_stream_meshes();
+        usleep(1000);
+    }
+    program_prepare_objects();
+    program_build_static_batches();
+    program_release_cpu_meshes();
+    program_finish_scene_switch();
+    glFinish();
+    double load_time = glfwGetTime();
+
+    size_t num_keyframes = 0;
+    struct camera_keyframe* keyframes = NULL;
+    if (benchmark->camera_path != NULL) {
+        keyframes = camera_path_load(benchmark->camera_path, &num_keyframes);
+        if (keyframes == NULL) {
+            fprintf(stderr, "program_benchmark(): Failed to read camera path '%s'. Exiting.\n", benchmark->camera_path);
+            exit(-1);
+        }
+    }
+    unsigned int frames = benchmark->frames;
+    if (frames == 0) frames = keyframes != NULL ? num_keyframes : BENCHMARK_FRAMES;
+
+    double* frame_times = malloc(sizeof(double) * frames);
+    if (frame_times == NULL) {
+        fprintf(stderr, "program_benchmark(): Failed to allocate memory for frame times. Exiting.\n");
+        exit(-1);
+    }
+    double total_time = 0.0;
+    double triangles = 0.0;
+    double draw_calls = 0.0;
+    for (unsigned int i=0; i < BENCHMARK_WARMUP_FRAMES + frames; i++) {
+        bool timed = i >= BENCHMARK_WARMUP_FRAMES;
+        unsigned int frame = timed == true ? i - BENCHMARK_WARMUP_FRAMES : 0;
+        benchmark_place_camera(keyframes, num_keyframes, frame, frames);
+        camera_interpolate(1.0);
+
+        double start = glfwGetTime();
+        PROFILE_FRAME();
+        memset(&program->render_stats, 0, sizeof(struct render_stats));
+        program_render();
+        glFinish();
+        double time = (glfwGetTime() - start) * 1000.0;
+
+        if (timed == true) {
+            frame_times[frame] = time;
+            total_time = total_time + time;
+            triangles = triangles + program->render_stats.triangles_drawn;
+            draw_calls = draw_calls + program->render_stats.draw_calls;
+        }
+    }
+    qsort(frame_times, frames, sizeof(double), benchmark_compare);
+
+    FILE* output = stdout;
+    if (benchmark->output != NULL) {
+        output = fopen(benchmark->output, "w");
+        if (output == NULL) {
+            fprintf(stderr, "program_benchmark(): Failed to open '%s' for the results. Exiting.\n", benchmark->output);
+            exit(-1);
+        }
+    }
+    fprintf(output, "{\"renderer\": \"%s\", \"model\": \"%s\", \"camera_path\": \"%s\", \"width\": %d, \"height\": %d, \"frames\": %u, "
+        "\"load_ms\": %.3f, \"frame_ms\": {\"mean\": %.3f, \"min\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+        "\"triangles_per_frame\": %.0f, \"draw_calls_per_frame\": %.1f, \"occlusion_culling\": %s, \"lights\": %u, \"peak_memory_mb\": %.1f, "
+        "\"workers\": %u, \"pipelined\": %s}\n",
+        (const char*)glGetString(GL_RENDERER), program->scene.objects[0].model->name, benchmark->camera_path != NULL ? benchmark->camera_path : "orbit",
+        program->framebuffer_width, program->framebuffer_height, frames, load_time * 1000.0, total_time / frames, frame_times[0],
+        benchmark_percentile(frame_times, frames, 50.0), benchmark_percentile(frame_times, frames, 95.0), benchmark_percentile(frame_times, frames, 99.0),
+        frame_times[frames - 1], triangles / frames, draw_calls / frames, program->occlusion_culling == true ? "true" : "false", program->num_lights,
+        program_peak_memory(), program->jobs.num_workers, program->pipelined == true ? "true" : "false");
+    if (output != stdout) fclose(output);
+
+    free(frame_times);
+    free(keyframes);
+}
+
+// Free everything the program holds: the scene and its models, the batch pages and buffer pool, the shaders, the lights,
+// the job system's workers, the culling jobs and frames and the dynamic resolution render target, then the program itself.
+void program_free() {
+    program_unload_scene();
+    scene_free(&program->scene);
+    dynamic_batch_free(&program->dynamic_batch);
+    buffer_pool_trim();
+    free(program->buffer_pool.buffers);
+    free(program->scenes.filenames);
+
+    glUseProgram(0);
+    while (program->shaders != NULL) {
+        struct shader* next = program->shaders->next;
+        glDeleteProgram(program->shaders->shader);
+        free(program->shaders);
+        program->shaders = next;
+    }
+    free(program->vertex_source);
+    free(program->fragment_source);
+
+    free(program->lights);
+    free(program->light_view);
+    free(program->light_texels);
+    light_cluster_free(&program->light_grid);
+    GLuint light_textures[3] = {program->light_texture, program->light_cluster_texture, program->light_index_texture};
+    glDeleteTextures(3, light_textures);
+
+    occlusion_free(&program->occlusion);
+    free(program->occluder_positions);
+    job_system_free(&program->jobs);
+    for (size_t i=0; i < program->num_cull_jobs; i++) {
+        struct cull_batch* batch = &program->cull_jobs[i].batch;
+        float* arrays[6] = {batch->centre_x, batch->centre_y, batch->centre_z, batch->extent_x, batch->extent_y, batch->extent_z};
+        for (int k=0; k < 6; k++) {
+            free(arrays[k]);
+        }
+        free(batch->visible);
+        free(batch->inside);
+        free(batch->stack);
+        render_queue_free(&program->cull_jobs[i].queue);
+    }
+    free(program->cull_jobs);
+    free(program->cull_items);
+
+    render_queue_free(&program->frames[0].queue);
+    render_queue_free(&program->frames[1].queue);
+    if (program->instance_buffer != 0) glDeleteBuffers(1, &program->instance_buffer);
+    dynamic_resolution_free(&program->dynamic_resolution);
+
+    if (program->camera_record != NULL) fclose(program->camera_record);
+    free(program);
+    program = NULL;
+}
+
+// Print the command line options.
+void program_usage(char* name) {
+    printf("Usage: %s [--benchmark] [--frames N] [--camera-path FILE] [--output FILE] [--no-occlusion] [--lights N] [--no-vsync] [--fps-cap N] [--low-latency] [--no-dynamic-resolution] [--target-frame-ms N] [--record-camera-path FILE] [--release-cpu-meshes] [--keep-cpu-meshes] [--scene FILE]... [--no-pipelining]\n", name);
+    printf("  --benchmark                Render headless along a camera path and report load and frame times as JSON.\n");
+    printf("  --frames N                 Frames to time, %d by default, or one per keyframe of the camera path.\n", BENCHMARK_FRAMES);
+    printf("  --camera-path FILE         Play back a recorded camera path instead of orbiting the scene.\n");
+    printf("  --output FILE              Write the benchmark results to a file instead of the standard output.\n");
+    printf("  --no-occlusion             Start with occlusion culling off.\n");
+    printf("  --lights N                 Point lights to scatter over the scene, %d by default and at most %d.\n", LIGHT_DEFAULT_COUNT, LIGHT_CLUSTER_MAX_LIGHTS);
+    printf("  --no-vsync                 Swap buffers without waiting for the display to refresh.\n");
+    printf("  --fps-cap N                Draw at most N frames a second.\n");
+    printf("  --low-latency              Read input as late as possible before drawing, and keep the GPU from queueing frames.\n");
+    printf("  --no-dynamic-resolution    Always draw at the window's full resolution.\n");
+    printf("  --target-frame-ms N        Frame time dynamic resolution aims for, %.0f milliseconds by default.\n", DYNAMIC_RESOLUTION_TARGET_MS);
+    printf("  --record-camera-path FILE  Record the camera every frame while flying around, for the benchmark to play back.\n");
+    printf("  --release-cpu-meshes       Free the CPU copies of meshes once they are on the GPU and nothing needs to read them, the default on the web.\n");
+    printf("  --keep-cpu-meshes          Keep the CPU copies of every mesh.\n");
+    printf("  --scene FILE               Add a model file to the scenes Page Down and Page Up switch between, instead of the default model.\n");
+    printf("  --no-pipelining            Prepare each frame before drawing it, rather than on the workers while the last one is drawn.\n");
 }
 
-int main(void) {
+int main(int argc, char** argv) {
+    // Read the command line.
+    struct benchmark benchmark = {BENCHMARK_BUILD, 0, NULL, NULL, true, LIGHT_DEFAULT_COUNT};
+    char* record_path = NULL;
+    bool vsync = true;
+    unsigned int frame_cap = 0;
+    bool low_latency = false;
+    bool dynamic_resolution = true;
+    double target_frame_time = DYNAMIC_RESOLUTION_TARGET_MS;
+    bool release_cpu_meshes = RELEASE_CPU_MESHES;
+    char** scene_filenames = malloc(sizeof(char*) * argc);
+    size_t num_scenes = 0;
+    bool pipelined = true;
+    if (scene_filenames == NULL) {
+        printf("main(): Failed to allocate memory for the scene list. Exiting.\n");
+        exit(-1);
+    }
+    for (int i=1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--benchmark") == 0) {
+            benchmark.enabled = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && has_value == true) {
+            benchmark.frames = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--camera-path") == 0 && has_value == true) {
+            benchmark.camera_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--output") == 0 && has_value == true) {
+            benchmark.output = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-occlusion") == 0) {
+            benchmark.occlusion_culling = false;
+        }
+        else if (strcmp(argv[i], "--lights") == 0 && has_value == true) {
+            benchmark.lights = strtoul(argv[++i], NULL, 10);
+            if (benchmark.lights > LIGHT_CLUSTER_MAX_LIGHTS) benchmark.lights = LIGHT_CLUSTER_MAX_LIGHTS;
+        }
+        else if (strcmp(argv[i], "--no-vsync") == 0) {
+            vsync = false;
+        }
+        else if (strcmp(argv[i], "--fps-cap") == 0 && has_value == true) {
+            frame_cap = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--low-latency") == 0) {
+            low_latency = true;
+        }
+        else if (strcmp(argv[i], "--no-dynamic-resolution") == 0) {
+            dynamic_resolution = false;
+        }
+        else if (strcmp(argv[i], "--target-frame-ms") == 0 && has_value == true) {
+            target_frame_time = strtod(argv[++i], NULL);
+            if (target_frame_time <= 0.0) target_frame_time = DYNAMIC_RESOLUTION_TARGET_MS;
+        }
+        else if (strcmp(argv[i], "--record-camera-path") == 0 && has_value == true) {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--release-cpu-meshes") == 0) {
+            release_cpu_meshes = true;
+        }
+        else if (strcmp(argv[i], "--keep-cpu-meshes") == 0) {
+            release_cpu_meshes = false;
+        }
+        else if (strcmp(argv[i], "--scene") == 0 && has_value == true) {
+            scene_filenames[num_scenes++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-pipelining") == 0) {
+            pipelined = false;
+        }
+        else {
+            program_usage(argv[0]);
+            return -1;
+        }
+    }
+
     // Initialise the global state
-    program_init();
+    program_init(benchmark.enabled, scene_filenames, num_scenes);
+    free(scene_filenames);
+    program->occlusion_culling = benchmark.occlusion_culling;
+    program->num_lights = benchmark.lights;
+    program->timing.frame_cap = frame_cap;
+    program->timing.low_latency = low_latency;
+    program->dynamic_resolution.enabled = program->dynamic_resolution.supported == true && dynamic_resolution == true;
+    program->dynamic_resolution.target_time = target_frame_time;
+    program->release_cpu_meshes = release_cpu_meshes;
+    program->pipelined = program->pipelined == true && pipelined == true;
+
+    // The benchmark times frames as fast as they can be drawn, always at full resolution so runs compare.
+    if (benchmark.enabled == true) {
+        program->dynamic_resolution.enabled = false;
+        program_set_swap_interval(0);
+        program_benchmark(&benchmark);
+        program_free();
+        glfwTerminate();
+        return 0;
+    }
+
+    if (record_path != NULL) {
+        program->camera_record = fopen(record_path, "w");
+        if (program->camera_record == NULL) {
+            printf("main(): Failed to open '%s' to record the camera path. Exiting.\n", record_path);
+            exit(-1);
+        }
+    }
+    
+    if (vsync == false) {
+        program_set_swap_interval(0);
+    }
     
     // Set the main loop for the web if using emscripten platform.
+    // Without a frame rate cap the browser draws a frame every display refresh.
     #ifdef __EMSCRIPTEN__
-        emscripten_set_main_loop(program_loop, 60, 1);
+        emscripten_set_main_loop(program_loop, program->timing.frame_cap, 1);
     #endif
 
     // Start the program main loop.
@@ -752,6 +5448,7 @@ int main(void) {
     }
     
     // Close resources on exit.
+    program_free();
     glfwTerminate();
     return 0;
 }
@@ -0,0 +1,234 @@
+// Partitions a triangle mesh into an octree of spatial clusters with tight bounds.
+// Triangles are sorted into the octant of their centroid, recursively, until a node holds at most
+// MESH_CLUSTER_MAX_TRIANGLES triangles. Each leaf then becomes its own small mesh, so the renderer
+// can reject whole subtrees of the scene with a single bounds test.
+//
+// Nodes are stored in breadth first order, so a node's children are contiguous in the node array
+// and always come after it. The triangles are reordered so every node's subtree covers one
+// contiguous range of them, in the same order as the leaves are met walking the tree depth first.
+//
+// Shared by object_converter_tool.c, which writes the tree into binary models,
+// and main.c, which clusters text models as it loads them.
+
+#ifndef MESH_CLUSTER_H
+#define MESH_CLUSTER_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "model_format.h"
+
+// Leaves hold at most this many triangles, unless their triangles cannot be separated any further.
+#define MESH_CLUSTER_MAX_TRIANGLES 4096
+
+// Stop subdividing at this depth, which guards against piles of triangles sharing one centroid.
+#define MESH_CLUSTER_MAX_DEPTH 16
+
+// One node of the cluster tree. The bounds enclose every triangle in the node's subtree.
+// Leaves have no children, and own the triangles in their range.
+struct mesh_cluster_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t first_child;
+    uint32_t num_children;
+    uint32_t first_triangle;
+    uint32_t num_triangles;
+    uint32_t depth;
+};
+
+// Grow the node array to hold at least one more node. Returns false on allocation failure.
+static bool mesh_cluster_reserve(struct mesh_cluster_node** nodes, size_t num_nodes, size_t* capacity) {
+    if (num_nodes < *capacity) return true;
+    size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+    struct mesh_cluster_node* new_nodes = realloc(*nodes, sizeof(struct mesh_cluster_node) * new_capacity);
+    if (new_nodes == NULL) return false;
+    *nodes = new_nodes;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Grow a box to include a point.
+static void mesh_cluster_extend(float minimum[3], float maximum[3], const float point[3]) {
+    for (int k=0; k < 3; k++) {
+        if (point[k] < minimum[k]) minimum[k] = point[k];
+        if (point[k] > maximum[k]) maximum[k] = point[k];
+    }
+}
+
+// Build the cluster tree for a triangle list, reordering the indices in place to match it.
+// Triangles that reference vertices outside the vertex array and trailing indices that do not make up
+// a whole triangle are dropped, so *num_indices may shrink.
+// Returns false and frees everything on allocation failure.
+static bool mesh_cluster_build(const struct model_file_vertex* vertices, size_t num_vertices, uint32_t* indices, size_t* num_indices, struct mesh_cluster_node** nodes_out, size_t* num_nodes_out) {
+    *nodes_out = NULL;
+    *num_nodes_out = 0;
+
+    // Keep only valid triangles.
+    size_t num_triangles = 0;
+    for (size_t i=0; i < *num_indices / 3; i++) {
+        const uint32_t* triangle = &indices[i * 3];
+        if (triangle[0] >= num_vertices || triangle[1] >= num_vertices || triangle[2] >= num_vertices) continue;
+        memmove(&indices[num_triangles * 3], triangle, sizeof(uint32_t) * 3);
+        num_triangles++;
+    }
+    *num_indices = num_triangles * 3;
+
+    // Work on a permutation of triangle numbers, sorting them by the centroids of the triangles.
+    float* centroids = malloc(sizeof(float) * 3 * (num_triangles + 1));
+    uint32_t* order = malloc(sizeof(uint32_t) * (num_triangles + 1));
+    uint32_t* scratch = malloc(sizeof(uint32_t) * (num_triangles + 1));
+    uint8_t* octants = malloc(sizeof(uint8_t) * (num_triangles + 1));
+    struct mesh_cluster_node* nodes = NULL;
+    size_t num_nodes = 0;
+    size_t capacity = 0;
+    bool success = centroids != NULL && order != NULL && scratch != NULL && octants != NULL && mesh_cluster_reserve(&nodes, num_nodes, &capacity);
+
+    for (size_t i=0; success == true && i < num_triangles; i++) {
+        order[i] = (uint32_t)i;
+        for (int k=0; k < 3; k++) {
+            centroids[i * 3 + k] = (vertices[indices[i * 3]].position[k] + vertices[indices[i * 3 + 1]].position[k] + vertices[indices[i * 3 + 2]].position[k]) / 3.0f;
+        }
+    }
+
+    if (success == true) {
+        nodes[0] = (struct mesh_cluster_node){{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 0, 0, 0, (uint32_t)num_triangles, 0};
+        num_nodes = 1;
+    }
+
+    // Subdivide nodes in breadth first order. Children are appended to the end of the array, so they end up contiguous.
+    for (size_t n=0; success == true && n < num_nodes; n++) {
+        struct mesh_cluster_node node = nodes[n];
+        if (node.num_triangles <= MESH_CLUSTER_MAX_TRIANGLES || node.depth >= MESH_CLUSTER_MAX_DEPTH) continue;
+
+        // Split at the centre of the box around the node's centroids.
+        float minimum[3] = {INFINITY, INFINITY, INFINITY};
+        float maximum[3] = {-INFINITY, -INFINITY, -INFINITY};
+        for (uint32_t i=node.first_triangle; i < node.first_triangle + node.num_triangles; i++) {
+            mesh_cluster_extend(minimum, maximum, &centroids[order[i] * 3]);
+        }
+        if (minimum[0] == maximum[0] && minimum[1] == maximum[1] && minimum[2] == maximum[2]) continue;
+        float centre[3] = {(minimum[0] + maximum[0]) * 0.5f, (minimum[1] + maximum[1]) * 0.5f, (minimum[2] + maximum[2]) * 0.5f};
+
+        // Counting sort the node's triangles by octant.
+        uint32_t counts[8] = {0};
+        for (uint32_t i=node.first_triangle; i < node.first_triangle + node.num_triangles; i++) {
+            const float* centroid = &centroids[order[i] * 3];
+            uint8_t octant = (centroid[0] > centre[0] ? 1 : 0) | (centroid[1] > centre[1] ? 2 : 0) | (centroid[2] > centre[2] ? 4 : 0);
+            octants[i] = octant;
+            counts[octant]++;
+        }
+        uint32_t starts[8];
+        uint32_t start = node.first_triangle;
+        for (int j=0; j < 8; j++) {
+            starts[j] = start;
+            start = start + counts[j];
+        }
+        for (uint32_t i=node.first_triangle; i < node.first_triangle + node.num_triangles; i++) {
+            scratch[starts[octants[i]]++] = order[i];
+        }
+        memcpy(&order[node.first_triangle], &scratch[node.first_triangle], sizeof(uint32_t) * node.num_triangles);
+
+        // Add a child for every octant that has triangles.
+        nodes[n].first_child = (uint32_t)num_nodes;
+        start = node.first_triangle;
+        for (int j=0; j < 8 && success == true; j++) {
+            if (counts[j] == 0) continue;
+            success = mesh_cluster_reserve(&nodes, num_nodes, &capacity);
+            if (success == false) break;
+            nodes[num_nodes] = (struct mesh_cluster_node){{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}, 0, 0, start, counts[j], node.depth + 1};
+            nodes[n].num_children++;
+            num_nodes++;
+            start = start + counts[j];
+        }
+    }
+
+    // Reorder the triangles to match the tree.
+    if (success == true && num_triangles > 0) {
+        uint32_t* reordered = malloc(sizeof(uint32_t) * num_triangles * 3);
+        success = reordered != NULL;
+        for (size_t i=0; success == true && i < num_triangles; i++) {
+            memcpy(&reordered[i * 3], &indices[order[i] * 3], sizeof(uint32_t) * 3);
+        }
+        if (success == true) {
+            memcpy(indices, reordered, sizeof(uint32_t) * num_triangles * 3);
+        }
+        free(reordered);
+    }
+
+    // Fit the bounds tightly: leaves around their triangles' vertices, and parents around their children.
+    // Children always come after their parent, so walking backwards finishes every child before its parent.
+    for (size_t n=num_nodes; success == true && n-- > 0;) {
+        struct mesh_cluster_node* node = &nodes[n];
+        float minimum[3] = {INFINITY, INFINITY, INFINITY};
+        float maximum[3] = {-INFINITY, -INFINITY, -INFINITY};
+        if (node->num_children == 0) {
+            for (size_t i=(size_t)node->first_triangle * 3; i < ((size_t)node->first_triangle + node->num_triangles) * 3; i++) {
+                mesh_cluster_extend(minimum, maximum, vertices[indices[i]].position);
+            }
+        }
+        for (uint32_t j=node->first_child; j < node->first_child + node->num_children; j++) {
+            mesh_cluster_extend(minimum, maximum, nodes[j].bounds_min);
+            mesh_cluster_extend(minimum, maximum, nodes[j].bounds_max);
+        }
+        for (int k=0; k < 3; k++) {
+            node->bounds_min[k] = minimum[k] <= maximum[k] ? minimum[k] : 0.0f;
+            node->bounds_max[k] = minimum[k] <= maximum[k] ? maximum[k] : 0.0f;
+        }
+    }
+
+    free(centroids);
+    free(order);
+    free(scratch);
+    free(octants);
+
+    if (success == false) {
+        free(nodes);
+        return false;
+    }
+
+    *nodes_out = nodes;
+    *num_nodes_out = num_nodes;
+    return true;
+}
+
+// Copy a leaf's triangles into their own vertex and index arrays, keeping only the vertices they use.
+// remap must have one entry per source vertex, all set to UINT32_MAX, and is left that way on return
+// so it can be reused for the next leaf.
+// Returns false on allocation failure.
+static bool mesh_cluster_extract(const struct model_file_vertex* vertices, const uint32_t* indices, const struct mesh_cluster_node* node, uint32_t* remap, struct model_file_vertex** vertices_out, size_t* num_vertices_out, uint32_t** indices_out, size_t* num_indices_out) {
+    size_t num_indices = (size_t)node->num_triangles * 3;
+    const uint32_t* source = &indices[(size_t)node->first_triangle * 3];
+    struct model_file_vertex* leaf_vertices = malloc(sizeof(struct model_file_vertex) * (num_indices + 1));
+    uint32_t* leaf_indices = malloc(sizeof(uint32_t) * (num_indices + 1));
+    if (leaf_vertices == NULL || leaf_indices == NULL) {
+        free(leaf_vertices);
+        free(leaf_indices);
+        return false;
+    }
+
+    size_t num_vertices = 0;
+    for (size_t i=0; i < num_indices; i++) {
+        if (remap[source[i]] == UINT32_MAX) {
+            remap[source[i]] = (uint32_t)num_vertices;
+            leaf_vertices[num_vertices] = vertices[source[i]];
+            num_vertices++;
+        }
+        leaf_indices[i] = remap[source[i]];
+    }
+    for (size_t i=0; i < num_indices; i++) {
+        remap[source[i]] = UINT32_MAX;
+    }
+
+    struct model_file_vertex* trimmed = realloc(leaf_vertices, sizeof(struct model_file_vertex) * (num_vertices + 1));
+    if (trimmed != NULL) leaf_vertices = trimmed;
+
+    *vertices_out = leaf_vertices;
+    *num_vertices_out = num_vertices;
+    *indices_out = leaf_indices;
+    *num_indices_out = num_indices;
+    return true;
+}
+
+#endif
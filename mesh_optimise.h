@@ -0,0 +1,384 @@
+// Reorders triangle meshes so the GPU does less work drawing them.
+// - mesh_optimise_vertex_cache() orders triangles for post-transform vertex cache hits (Tom Forsyth's algorithm).
+// - mesh_optimise_overdraw() then reorders clusters of those triangles so outward facing ones draw first,
+//   without giving up much of the cache efficiency (in the style of Tipsify by Sander, Nehab and Barczak).
+// - mesh_optimise_vertex_fetch() finally renumbers vertices in the order they are first used.
+// mesh_analyse_vertex_cache() measures the result as ACMR and ATVR with a simulated FIFO cache.
+//
+// Used by object_converter_tool.c. All functions work on triangle lists with 32 bit indices.
+
+#ifndef MESH_OPTIMISE_H
+#define MESH_OPTIMISE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "model_format.h"
+
+// The cache size the triangle order is tuned for, and the FIFO cache size used to report results.
+#define MESH_OPTIMISE_CACHE_SIZE 32
+#define MESH_OPTIMISE_ANALYSE_CACHE_SIZE 16
+
+// How close to the whole mesh's ACMR an overdraw cluster must get before it may be closed.
+#define MESH_OPTIMISE_OVERDRAW_THRESHOLD 1.05f
+
+// Clusters are never cut shorter than this many triangles, since every cut costs some cache hits.
+#define MESH_OPTIMISE_MIN_CLUSTER_SIZE 128
+
+// Vertex cache statistics for an index list.
+// ACMR is cache misses per triangle (0.5 is ideal for large grids, 3.0 is worst).
+// ATVR is cache misses per referenced vertex (1.0 is ideal).
+struct mesh_cache_stats {
+    float acmr;
+    float atvr;
+};
+
+// Simulate a FIFO vertex cache over a triangle list and return its ACMR and ATVR.
+static struct mesh_cache_stats mesh_analyse_vertex_cache(const uint32_t* indices, size_t num_indices, size_t num_vertices, unsigned int cache_size) {
+    struct mesh_cache_stats stats = {0.0, 0.0};
+    size_t num_triangles = num_indices / 3;
+    if (num_triangles == 0 || num_vertices == 0) return stats;
+
+    // Each vertex remembers the miss count at which it entered the cache; it is cached while fewer than cache_size misses have happened since.
+    size_t* timestamps = calloc(num_vertices, sizeof(size_t));
+    bool* referenced = calloc(num_vertices, sizeof(bool));
+    if (timestamps == NULL || referenced == NULL) {
+        free(timestamps);
+        free(referenced);
+        return stats;
+    }
+
+    size_t misses = 0;
+    size_t unique = 0;
+    for (size_t i=0; i < num_triangles * 3; i++) {
+        uint32_t vertex = indices[i];
+        if (vertex >= num_vertices) continue;
+        if (referenced[vertex] == false) {
+            referenced[vertex] = true;
+            unique++;
+        }
+        if (timestamps[vertex] == 0 || misses + 1 - timestamps[vertex] > cache_size) {
+            misses++;
+            timestamps[vertex] = misses;
+        }
+    }
+
+    stats.acmr = (float)misses / (float)num_triangles;
+    stats.atvr = unique > 0 ? (float)misses / (float)unique : 0.0f;
+    free(timestamps);
+    free(referenced);
+    return stats;
+}
+
+// Forsyth's vertex score: vertices recently used score highly, and so do vertices with few triangles left, so they get finished off.
+static float mesh_optimise_vertex_score(int cache_position, unsigned int remaining_triangles) {
+    if (remaining_triangles == 0) return -1.0f;
+
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        // The last triangle's vertices get a fixed score so the next triangle is not always a strip neighbour.
+        if (cache_position < 3) score = 0.75f;
+        else score = powf(1.0f - (float)(cache_position - 3) / (float)(MESH_OPTIMISE_CACHE_SIZE - 3), 1.5f);
+    }
+    return score + 2.0f * powf((float)remaining_triangles, -0.5f);
+}
+
+// Reorder triangles in place for vertex cache locality using Forsyth's linear speed algorithm.
+// Returns false on allocation failure, leaving the indices untouched.
+static bool mesh_optimise_vertex_cache(uint32_t* indices, size_t num_indices, size_t num_vertices) {
+    size_t num_triangles = num_indices / 3;
+    if (num_triangles == 0 || num_vertices == 0) return true;
+
+    unsigned int* remaining = calloc(num_vertices, sizeof(unsigned int));
+    size_t* adjacency_offsets = calloc(num_vertices + 1, sizeof(size_t));
+    uint32_t* adjacency = malloc(sizeof(uint32_t) * num_triangles * 3);
+    int* cache_positions = malloc(sizeof(int) * num_vertices);
+    float* vertex_scores = malloc(sizeof(float) * num_vertices);
+    float* triangle_scores = malloc(sizeof(float) * num_triangles);
+    bool* emitted = calloc(num_triangles, sizeof(bool));
+    uint32_t* output = malloc(sizeof(uint32_t) * num_triangles * 3);
+    if (remaining == NULL || adjacency_offsets == NULL || adjacency == NULL || cache_positions == NULL || vertex_scores == NULL || triangle_scores == NULL || emitted == NULL || output == NULL) {
+        free(remaining); free(adjacency_offsets); free(adjacency); free(cache_positions);
+        free(vertex_scores); free(triangle_scores); free(emitted); free(output);
+        return false;
+    }
+
+    // Build the list of triangles using each vertex. Out of range indices are treated as vertex 0.
+    for (size_t i=0; i < num_triangles * 3; i++) {
+        if (indices[i] >= num_vertices) indices[i] = 0;
+        remaining[indices[i]]++;
+    }
+    for (size_t i=0; i < num_vertices; i++) {
+        adjacency_offsets[i + 1] = adjacency_offsets[i] + remaining[i];
+    }
+    size_t* fill = calloc(num_vertices, sizeof(size_t));
+    if (fill == NULL) {
+        free(remaining); free(adjacency_offsets); free(adjacency); free(cache_positions);
+        free(vertex_scores); free(triangle_scores); free(emitted); free(output);
+        return false;
+    }
+    for (size_t i=0; i < num_triangles * 3; i++) {
+        uint32_t vertex = indices[i];
+        adjacency[adjacency_offsets[vertex] + fill[vertex]] = (uint32_t)(i / 3);
+        fill[vertex]++;
+    }
+    free(fill);
+
+    // Score every vertex and triangle.
+    for (size_t i=0; i < num_vertices; i++) {
+        cache_positions[i] = -1;
+        vertex_scores[i] = mesh_optimise_vertex_score(-1, remaining[i]);
+    }
+    for (size_t i=0; i < num_triangles; i++) {
+        triangle_scores[i] = vertex_scores[indices[i * 3]] + vertex_scores[indices[i * 3 + 1]] + vertex_scores[indices[i * 3 + 2]];
+    }
+
+    // The simulated LRU cache, with room for the three vertices pushed in by each triangle.
+    uint32_t cache[MESH_OPTIMISE_CACHE_SIZE + 3];
+    unsigned int cache_count = 0;
+
+    size_t best_triangle = 0;
+    float best_score = -1.0f;
+    for (size_t i=0; i < num_triangles; i++) {
+        if (triangle_scores[i] > best_score) {
+            best_score = triangle_scores[i];
+            best_triangle = i;
+        }
+    }
+
+    size_t scan_position = 0;
+    for (size_t emitted_count=0; emitted_count < num_triangles; emitted_count++) {
+        // With no candidate from the cache, fall back to the next triangle that has not been emitted.
+        if (best_score < 0.0f) {
+            while (emitted[scan_position] == true) scan_position++;
+            best_triangle = scan_position;
+        }
+
+        size_t triangle = best_triangle;
+        emitted[triangle] = true;
+        memcpy(&output[emitted_count * 3], &indices[triangle * 3], sizeof(uint32_t) * 3);
+
+        // Remove the triangle from its vertices' adjacency lists.
+        for (int j=0; j < 3; j++) {
+            uint32_t vertex = indices[triangle * 3 + j];
+            uint32_t* list = &adjacency[adjacency_offsets[vertex]];
+            for (unsigned int k=0; k < remaining[vertex]; k++) {
+                if (list[k] == triangle) {
+                    list[k] = list[remaining[vertex] - 1];
+                    break;
+                }
+            }
+            remaining[vertex]--;
+        }
+
+        // Move the triangle's vertices to the front of the cache, keeping the others in order.
+        uint32_t new_cache[MESH_OPTIMISE_CACHE_SIZE + 3];
+        unsigned int new_count = 0;
+        for (int j=0; j < 3; j++) {
+            uint32_t vertex = indices[triangle * 3 + j];
+            bool duplicate = false;
+            for (unsigned int k=0; k < new_count; k++) duplicate = duplicate || new_cache[k] == vertex;
+            if (duplicate == false) new_cache[new_count++] = vertex;
+        }
+        for (unsigned int k=0; k < cache_count; k++) {
+            uint32_t vertex = cache[k];
+            if (vertex != new_cache[0] && (new_count < 2 || vertex != new_cache[1]) && (new_count < 3 || vertex != new_cache[2])) {
+                new_cache[new_count++] = vertex;
+            }
+        }
+
+        // Rescore vertices in the cache, and any pushed out of it, then their triangles.
+        for (unsigned int k=0; k < new_count; k++) {
+            uint32_t vertex = new_cache[k];
+            cache_positions[vertex] = k < MESH_OPTIMISE_CACHE_SIZE ? (int)k : -1;
+            vertex_scores[vertex] = mesh_optimise_vertex_score(cache_positions[vertex], remaining[vertex]);
+        }
+
+        best_score = -1.0f;
+        for (unsigned int k=0; k < new_count; k++) {
+            uint32_t vertex = new_cache[k];
+            for (unsigned int t=0; t < remaining[vertex]; t++) {
+                uint32_t other = adjacency[adjacency_offsets[vertex] + t];
+                float score = vertex_scores[indices[other * 3]] + vertex_scores[indices[other * 3 + 1]] + vertex_scores[indices[other * 3 + 2]];
+                triangle_scores[other] = score;
+                if (score > best_score) {
+                    best_score = score;
+                    best_triangle = other;
+                }
+            }
+        }
+
+        cache_count = new_count < MESH_OPTIMISE_CACHE_SIZE ? new_count : MESH_OPTIMISE_CACHE_SIZE;
+        memcpy(cache, new_cache, sizeof(uint32_t) * cache_count);
+    }
+
+    memcpy(indices, output, sizeof(uint32_t) * num_triangles * 3);
+    free(remaining); free(adjacency_offsets); free(adjacency); free(cache_positions);
+    free(vertex_scores); free(triangle_scores); free(emitted); free(output);
+    return true;
+}
+
+// A run of consecutive triangles that is moved as a unit by the overdraw pass.
+struct mesh_optimise_cluster {
+    size_t start;
+    size_t count;
+    float sort_key;
+};
+
+// Sort clusters by descending key, keeping the original order for equal keys.
+static int mesh_optimise_compare_clusters(const void* a, const void* b) {
+    const struct mesh_optimise_cluster* first = a;
+    const struct mesh_optimise_cluster* second = b;
+    if (first->sort_key > second->sort_key) return -1;
+    if (first->sort_key < second->sort_key) return 1;
+    return first->start < second->start ? -1 : (first->start > second->start ? 1 : 0);
+}
+
+// Reorder a cache optimised triangle list to reduce overdraw.
+// The list is cut into clusters where the cache would be flushed anyway, or where a cluster's own ACMR
+// is already close to the whole mesh's. Clusters are then drawn in order of how far they face outwards
+// from the mesh centre, so near, outward facing surfaces tend to fill the depth buffer first.
+// Returns false on allocation failure, leaving the indices untouched.
+static bool mesh_optimise_overdraw(const struct model_file_vertex* vertices, size_t num_vertices, uint32_t* indices, size_t num_indices) {
+    size_t num_triangles = num_indices / 3;
+    if (num_triangles < 2 || num_vertices == 0) return true;
+
+    struct mesh_optimise_cluster* clusters = malloc(sizeof(struct mesh_optimise_cluster) * num_triangles);
+    size_t* timestamps = calloc(num_vertices, sizeof(size_t));
+    uint32_t* output = malloc(sizeof(uint32_t) * num_triangles * 3);
+    if (clusters == NULL || timestamps == NULL || output == NULL) {
+        free(clusters);
+        free(timestamps);
+        free(output);
+        return false;
+    }
+
+    float mesh_acmr = mesh_analyse_vertex_cache(indices, num_indices, num_vertices, MESH_OPTIMISE_ANALYSE_CACHE_SIZE).acmr;
+
+    // Split the list into clusters with a simulated FIFO cache.
+    size_t num_clusters = 0;
+    size_t misses = 0;
+    size_t cluster_misses = 0;
+    for (size_t i=0; i < num_triangles; i++) {
+        unsigned int triangle_misses = 0;
+        for (int j=0; j < 3; j++) {
+            uint32_t vertex = indices[i * 3 + j];
+            if (vertex >= num_vertices) continue;
+            if (timestamps[vertex] == 0 || misses + 1 - timestamps[vertex] > MESH_OPTIMISE_ANALYSE_CACHE_SIZE) {
+                misses++;
+                timestamps[vertex] = misses;
+                triangle_misses++;
+            }
+        }
+
+        // A triangle missing on all three vertices starts a hard boundary. A cluster which has
+        // reached the mesh's ACMR can be cut without hurting cache efficiency much.
+        bool start_cluster = num_clusters == 0 || triangle_misses == 3;
+        if (start_cluster == false) {
+            struct mesh_optimise_cluster* cluster = &clusters[num_clusters - 1];
+            float cluster_acmr = (float)cluster_misses / (float)cluster->count;
+            start_cluster = cluster->count >= MESH_OPTIMISE_MIN_CLUSTER_SIZE && cluster_acmr <= mesh_acmr * MESH_OPTIMISE_OVERDRAW_THRESHOLD;
+        }
+
+        if (start_cluster == true) {
+            clusters[num_clusters].start = i;
+            clusters[num_clusters].count = 0;
+            num_clusters++;
+            cluster_misses = 0;
+        }
+        clusters[num_clusters - 1].count++;
+        cluster_misses = cluster_misses + triangle_misses;
+    }
+
+    // Find the centre of the whole mesh as the average of its triangle corners.
+    double mesh_centre[3] = {0.0, 0.0, 0.0};
+    double num_corners = 0.0;
+    for (size_t i=0; i < num_triangles * 3; i++) {
+        if (indices[i] >= num_vertices) continue;
+        for (int k=0; k < 3; k++) mesh_centre[k] = mesh_centre[k] + vertices[indices[i]].position[k];
+        num_corners = num_corners + 1.0;
+    }
+    for (int k=0; k < 3; k++) mesh_centre[k] = num_corners > 0.0 ? mesh_centre[k] / num_corners : 0.0;
+
+    // Score each cluster by how far its average normal points away from the mesh centre.
+    for (size_t c=0; c < num_clusters; c++) {
+        double centre[3] = {0.0, 0.0, 0.0};
+        double normal[3] = {0.0, 0.0, 0.0};
+        double area = 0.0;
+        for (size_t t=clusters[c].start; t < clusters[c].start + clusters[c].count; t++) {
+            const uint32_t* triangle = &indices[t * 3];
+            if (triangle[0] >= num_vertices || triangle[1] >= num_vertices || triangle[2] >= num_vertices) continue;
+            const float* a = vertices[triangle[0]].position;
+            const float* b = vertices[triangle[1]].position;
+            const float* p = vertices[triangle[2]].position;
+            double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+            double ac[3] = {p[0] - a[0], p[1] - a[1], p[2] - a[2]};
+            double cross[3] = {ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0]};
+            double triangle_area = sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+            for (int k=0; k < 3; k++) {
+                centre[k] = centre[k] + (a[k] + b[k] + p[k]) / 3.0 * triangle_area;
+                normal[k] = normal[k] + cross[k];
+            }
+            area = area + triangle_area;
+        }
+
+        double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        float key = 0.0f;
+        if (area > 0.0 && length > 0.0) {
+            for (int k=0; k < 3; k++) {
+                key = key + (float)((centre[k] / area - mesh_centre[k]) * normal[k] / length);
+            }
+        }
+        clusters[c].sort_key = key;
+    }
+
+    qsort(clusters, num_clusters, sizeof(struct mesh_optimise_cluster), mesh_optimise_compare_clusters);
+
+    size_t written = 0;
+    for (size_t c=0; c < num_clusters; c++) {
+        memcpy(&output[written * 3], &indices[clusters[c].start * 3], sizeof(uint32_t) * 3 * clusters[c].count);
+        written = written + clusters[c].count;
+    }
+    memcpy(indices, output, sizeof(uint32_t) * num_triangles * 3);
+
+    free(clusters);
+    free(timestamps);
+    free(output);
+    return true;
+}
+
+// Renumber vertices in the order the triangles first use them, so vertex fetches walk memory forwards.
+// Vertices that no triangle uses are dropped. Returns the new vertex count, or 0 on allocation failure
+// in which case nothing is changed.
+static size_t mesh_optimise_vertex_fetch(struct model_file_vertex* vertices, size_t num_vertices, uint32_t* indices, size_t num_indices) {
+    uint32_t* remap = malloc(sizeof(uint32_t) * (num_vertices + 1));
+    struct model_file_vertex* reordered = malloc(sizeof(struct model_file_vertex) * (num_vertices + 1));
+    if (remap == NULL || reordered == NULL) {
+        free(remap);
+        free(reordered);
+        return 0;
+    }
+    memset(remap, 0xff, sizeof(uint32_t) * num_vertices);
+
+    size_t count = 0;
+    for (size_t i=0; i < num_indices; i++) {
+        uint32_t vertex = indices[i];
+        if (vertex >= num_vertices) vertex = 0;
+        if (remap[vertex] == UINT32_MAX) {
+            remap[vertex] = (uint32_t)count;
+            reordered[count] = vertices[vertex];
+            count++;
+        }
+        indices[i] = remap[vertex];
+    }
+
+    memcpy(vertices, reordered, sizeof(struct model_file_vertex) * count);
+    free(remap);
+    free(reordered);
+    return count;
+}
+
+#endif
@@ -0,0 +1,264 @@
+// Simplifies triangle meshes by quadric error edge collapse, for generating levels of detail.
+// Each collapse moves one end of an edge onto the other, so a simplified mesh only needs new indices
+// and every level can share the original vertex array.
+//
+// The error of a collapse is measured with the quadrics of Garland and Heckbert: every vertex
+// accumulates the planes of the original triangles around it, weighted by their area, and the cost of
+// moving it is the mean squared distance from the new position to those planes.
+// Vertices on open edges are never moved, which keeps the seams between neighbouring clusters and
+// along attribute discontinuities closed at every level.
+//
+// Used by object_converter_tool.c.
+
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "model_format.h"
+
+// The most collapse passes to run before giving up on reaching the target.
+#define MESH_SIMPLIFY_MAX_PASSES 64
+
+// A collapse is rejected if it turns any surviving triangle's normal by more than the angle whose cosine this is, about 75 degrees.
+#define MESH_SIMPLIFY_MIN_NORMAL_COS 0.25
+
+// A symmetric 4x4 error quadric, stored as its ten unique values, and the area of triangles it holds.
+struct mesh_quadric {
+    double a2, b2, c2, ab, ac, bc, ad, bd, cd, d2;
+    double weight;
+};
+
+// One possible collapse, moving vertex 'from' onto vertex 'to'.
+struct mesh_collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+// Add a quadric to another.
+static void mesh_quadric_add(struct mesh_quadric* q, const struct mesh_quadric* other) {
+    q->a2 += other->a2; q->b2 += other->b2; q->c2 += other->c2;
+    q->ab += other->ab; q->ac += other->ac; q->bc += other->bc;
+    q->ad += other->ad; q->bd += other->bd; q->cd += other->cd;
+    q->d2 += other->d2;
+    q->weight += other->weight;
+}
+
+// Return the mean squared distance from a point to the planes a quadric holds.
+static double mesh_quadric_error(const struct mesh_quadric* q, const float p[3]) {
+    double x = p[0];
+    double y = p[1];
+    double z = p[2];
+    double error = q->a2 * x * x + q->b2 * y * y + q->c2 * z * z
+        + 2.0 * (q->ab * x * y + q->ac * x * z + q->bc * y * z)
+        + 2.0 * (q->ad * x + q->bd * y + q->cd * z)
+        + q->d2;
+    if (error < 0.0 || q->weight <= 0.0) return 0.0;
+    return error / q->weight;
+}
+
+// Return the unnormalised normal of a triangle, whose length is twice its area.
+static void mesh_simplify_normal(const float p0[3], const float p1[3], const float p2[3], double normal[3]) {
+    double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// Order collapses from cheapest to most expensive.
+static int mesh_simplify_compare(const void* a, const void* b) {
+    double cost_a = ((const struct mesh_collapse*)a)->cost;
+    double cost_b = ((const struct mesh_collapse*)b)->cost;
+    return (cost_a > cost_b) - (cost_a < cost_b);
+}
+
+// Build, for every vertex, the list of triangles that use it, in compressed row form.
+static void mesh_simplify_adjacency(const uint32_t* indices, size_t num_indices, size_t num_vertices, uint32_t* offsets, uint32_t* triangles) {
+    memset(offsets, 0, sizeof(uint32_t) * (num_vertices + 1));
+    for (size_t i=0; i < num_indices; i++) {
+        offsets[indices[i] + 1]++;
+    }
+    for (size_t i=0; i < num_vertices; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+    for (size_t i=0; i < num_indices; i++) {
+        uint32_t vertex = indices[i];
+        triangles[offsets[vertex]] = (uint32_t)(i / 3);
+        offsets[vertex]++;
+    }
+    for (size_t i=num_vertices; i > 0; i--) {
+        offsets[i] = offsets[i - 1];
+    }
+    offsets[0] = 0;
+}
+
+// Return true if moving vertex 'from' onto vertex 'to' would flip, flatten or sharply turn any triangle around 'from' that survives the collapse.
+static bool mesh_simplify_flips(const struct model_file_vertex* vertices, const uint32_t* indices, const uint32_t* offsets, const uint32_t* triangles, uint32_t from, uint32_t to) {
+    for (uint32_t i=offsets[from]; i < offsets[from + 1]; i++) {
+        const uint32_t* triangle = &indices[triangles[i] * 3];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to) continue;
+
+        const float* before[3];
+        const float* after[3];
+        for (int j=0; j < 3; j++) {
+            before[j] = vertices[triangle[j]].position;
+            after[j] = triangle[j] == from ? vertices[to].position : before[j];
+        }
+        double normal_before[3];
+        double normal_after[3];
+        mesh_simplify_normal(before[0], before[1], before[2], normal_before);
+        mesh_simplify_normal(after[0], after[1], after[2], normal_after);
+        double dot = normal_before[0] * normal_after[0] + normal_before[1] * normal_after[1] + normal_before[2] * normal_after[2];
+        double length_before = sqrt(normal_before[0] * normal_before[0] + normal_before[1] * normal_before[1] + normal_before[2] * normal_before[2]);
+        double length_after = sqrt(normal_after[0] * normal_after[0] + normal_after[1] * normal_after[1] + normal_after[2] * normal_after[2]);
+        if (dot <= 0.0 || dot < MESH_SIMPLIFY_MIN_NORMAL_COS * length_before * length_after) return true;
+    }
+    return false;
+}
+
+// Simplify a triangle list towards target_indices indices, writing the result to destination, which must hold num_indices indices.
+// The number of indices written is stored in *num_indices_out, and the largest error of any collapse, as a distance in model units, in *error_out.
+// The result may have more indices than the target when the open edges or the flip checks leave nothing more to collapse.
+// Returns false on allocation failure.
+static bool mesh_simplify(const struct model_file_vertex* vertices, size_t num_vertices, const uint32_t* indices, size_t num_indices, size_t target_indices, uint32_t* destination, size_t* num_indices_out, float* error_out) {
+    num_indices = num_indices / 3 * 3;
+    memcpy(destination, indices, sizeof(uint32_t) * num_indices);
+    *num_indices_out = num_indices;
+    *error_out = 0.0f;
+    if (num_indices <= target_indices) return true;
+
+    struct mesh_quadric* quadrics = calloc(num_vertices + 1, sizeof(struct mesh_quadric));
+    uint32_t* offsets = malloc(sizeof(uint32_t) * (num_vertices + 1));
+    uint32_t* triangles = malloc(sizeof(uint32_t) * (num_indices + 1));
+    uint32_t* remap = malloc(sizeof(uint32_t) * (num_vertices + 1));
+    uint8_t* locked = calloc(num_vertices + 1, sizeof(uint8_t));
+    uint8_t* touched = malloc(sizeof(uint8_t) * (num_vertices + 1));
+    struct mesh_collapse* collapses = malloc(sizeof(struct mesh_collapse) * (num_indices + 1));
+    if (quadrics == NULL || offsets == NULL || triangles == NULL || remap == NULL || locked == NULL || touched == NULL || collapses == NULL) {
+        free(quadrics);
+        free(offsets);
+        free(triangles);
+        free(remap);
+        free(locked);
+        free(touched);
+        free(collapses);
+        return false;
+    }
+
+    // Give every vertex the area weighted planes of the triangles around it.
+    for (size_t i=0; i < num_indices; i += 3) {
+        const float* p0 = vertices[destination[i]].position;
+        double normal[3];
+        mesh_simplify_normal(p0, vertices[destination[i + 1]].position, vertices[destination[i + 2]].position, normal);
+        double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length == 0.0) continue;
+
+        double a = normal[0] / length;
+        double b = normal[1] / length;
+        double c = normal[2] / length;
+        double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+        double area = length * 0.5;
+        struct mesh_quadric plane = {a * a * area, b * b * area, c * c * area, a * b * area, a * c * area, b * c * area, a * d * area, b * d * area, c * d * area, d * d * area, area};
+        for (int j=0; j < 3; j++) {
+            mesh_quadric_add(&quadrics[destination[i + j]], &plane);
+        }
+    }
+
+    // Lock the vertices on open edges: an edge is open when no triangle uses it in the opposite direction.
+    mesh_simplify_adjacency(destination, num_indices, num_vertices, offsets, triangles);
+    for (size_t i=0; i < num_indices; i++) {
+        uint32_t a = destination[i];
+        uint32_t b = destination[i % 3 == 2 ? i - 2 : i + 1];
+        bool opposite = false;
+        for (uint32_t j=offsets[b]; j < offsets[b + 1] && opposite == false; j++) {
+            const uint32_t* triangle = &destination[triangles[j] * 3];
+            for (int k=0; k < 3; k++) {
+                if (triangle[k] == b && triangle[(k + 1) % 3] == a) opposite = true;
+            }
+        }
+        if (opposite == false) {
+            locked[a] = 1;
+            locked[b] = 1;
+        }
+    }
+
+    double max_cost = 0.0;
+    for (int pass=0; pass < MESH_SIMPLIFY_MAX_PASSES && num_indices > target_indices; pass++) {
+        mesh_simplify_adjacency(destination, num_indices, num_vertices, offsets, triangles);
+
+        // Cost every collapse along a triangle edge that moves an unlocked vertex.
+        size_t num_collapses = 0;
+        for (size_t i=0; i < num_indices; i++) {
+            uint32_t from = destination[i];
+            uint32_t to = destination[i % 3 == 2 ? i - 2 : i + 1];
+            if (locked[from] != 0) continue;
+            struct mesh_quadric merged = quadrics[from];
+            mesh_quadric_add(&merged, &quadrics[to]);
+            collapses[num_collapses] = (struct mesh_collapse){from, to, mesh_quadric_error(&merged, vertices[to].position)};
+            num_collapses++;
+        }
+        qsort(collapses, num_collapses, sizeof(struct mesh_collapse), mesh_simplify_compare);
+
+        // Collapse the cheapest edges first. Vertices around a collapse are not touched again this pass,
+        // so every flip check sees the geometry the collapse will really produce.
+        for (size_t i=0; i < num_vertices; i++) {
+            remap[i] = (uint32_t)i;
+        }
+        memset(touched, 0, sizeof(uint8_t) * num_vertices);
+        size_t remaining_triangles = num_indices / 3;
+        size_t collapsed = 0;
+        for (size_t i=0; i < num_collapses && remaining_triangles * 3 > target_indices; i++) {
+            uint32_t from = collapses[i].from;
+            uint32_t to = collapses[i].to;
+            if (touched[from] != 0 || touched[to] != 0) continue;
+            if (mesh_simplify_flips(vertices, destination, offsets, triangles, from, to) == true) continue;
+
+            for (uint32_t j=offsets[from]; j < offsets[from + 1]; j++) {
+                const uint32_t* triangle = &destination[triangles[j] * 3];
+                for (int k=0; k < 3; k++) {
+                    touched[triangle[k]] = 1;
+                }
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to) remaining_triangles--;
+            }
+            remap[from] = to;
+            mesh_quadric_add(&quadrics[to], &quadrics[from]);
+            if (collapses[i].cost > max_cost) max_cost = collapses[i].cost;
+            collapsed++;
+        }
+        if (collapsed == 0) break;
+
+        // Apply the collapses and drop the triangles that became degenerate.
+        size_t write = 0;
+        for (size_t i=0; i < num_indices; i += 3) {
+            uint32_t a = remap[destination[i]];
+            uint32_t b = remap[destination[i + 1]];
+            uint32_t c = remap[destination[i + 2]];
+            if (a == b || b == c || a == c) continue;
+            destination[write] = a;
+            destination[write + 1] = b;
+            destination[write + 2] = c;
+            write += 3;
+        }
+        num_indices = write;
+    }
+
+    free(quadrics);
+    free(offsets);
+    free(triangles);
+    free(remap);
+    free(locked);
+    free(touched);
+    free(collapses);
+
+    *num_indices_out = num_indices;
+    *error_out = (float)sqrt(max_cost);
+    return true;
+}
+
+#endif
@@ -0,0 +1,170 @@
+// Splits a triangle mesh with 32 bit indices into chunks that can each be drawn with 16 bit indices.
+// Triangles are kept in their original order, and each chunk holds only the vertices its triangles use.
+//
+// Shared by object_converter_tool.c, which splits large meshes before writing binary models,
+// and main.c, which splits large text models when 32 bit indices are not available.
+
+#ifndef MESH_SPLIT_H
+#define MESH_SPLIT_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "model_format.h"
+
+// The most vertices a 16 bit index can address.
+#define MESH_SPLIT_MAX_VERTICES 65536
+
+// The indices a new chunk has room for, enough for a typical full chunk of two triangles per vertex. Chunks grow past it as needed.
+#define MESH_SPLIT_INITIAL_INDICES (MESH_SPLIT_MAX_VERTICES * 6)
+
+// One 16 bit indexable piece of a split mesh.
+struct mesh_chunk {
+    struct model_file_vertex* vertices;
+    uint32_t num_vertices;
+    uint16_t* indices;
+    uint32_t num_indices;
+};
+
+// Free the arrays of every chunk as well as the chunk array itself.
+static void mesh_split_free(struct mesh_chunk* chunks, size_t num_chunks) {
+    if (chunks == NULL) return;
+    for (size_t i=0; i < num_chunks; i++) {
+        free(chunks[i].vertices);
+        free(chunks[i].indices);
+    }
+    free(chunks);
+}
+
+// Start a new, empty chunk at the end of the chunk array, with room for index_capacity indices. Returns false on allocation failure.
+static bool mesh_split_add_chunk(struct mesh_chunk** chunks, size_t* num_chunks, size_t* capacity, size_t index_capacity) {
+    if (*num_chunks == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 4 : *capacity * 2;
+        struct mesh_chunk* new_chunks = realloc(*chunks, sizeof(struct mesh_chunk) * new_capacity);
+        if (new_chunks == NULL) return false;
+        *chunks = new_chunks;
+        *capacity = new_capacity;
+    }
+
+    struct mesh_chunk* chunk = &(*chunks)[*num_chunks];
+    chunk->num_vertices = 0;
+    chunk->num_indices = 0;
+    chunk->vertices = malloc(sizeof(struct model_file_vertex) * MESH_SPLIT_MAX_VERTICES);
+    chunk->indices = malloc(sizeof(uint16_t) * (index_capacity + 1));
+    (*num_chunks)++;
+    return chunk->vertices != NULL && chunk->indices != NULL;
+}
+
+// Make room for a chunk's indices to grow to count, doubling its index capacity as often as needed. Returns false on allocation failure.
+static bool mesh_split_reserve_indices(struct mesh_chunk* chunk, size_t* index_capacity, size_t count) {
+    if (count <= *index_capacity) return true;
+    size_t new_capacity = *index_capacity;
+    while (new_capacity < count) {
+        new_capacity = new_capacity * 2;
+    }
+    uint16_t* indices = realloc(chunk->indices, sizeof(uint16_t) * (new_capacity + 1));
+    if (indices == NULL) return false;
+    chunk->indices = indices;
+    *index_capacity = new_capacity;
+    return true;
+}
+
+// Shrink a finished chunk's arrays to the space it actually uses.
+static void mesh_split_trim_chunk(struct mesh_chunk* chunk) {
+    struct model_file_vertex* vertices = realloc(chunk->vertices, sizeof(struct model_file_vertex) * (chunk->num_vertices + 1));
+    if (vertices != NULL) chunk->vertices = vertices;
+    uint16_t* indices = realloc(chunk->indices, sizeof(uint16_t) * (chunk->num_indices + 1));
+    if (indices != NULL) chunk->indices = indices;
+}
+
+// Split a triangle list into 16 bit indexable chunks.
+// Triangles that reference vertices outside the vertex array are dropped, as are trailing indices
+// that do not make up a whole triangle.
+// Returns false and frees everything on allocation failure.
+static bool mesh_split(const struct model_file_vertex* vertices, size_t num_vertices, const uint32_t* indices, size_t num_indices, struct mesh_chunk** chunks_out, size_t* num_chunks_out) {
+    *chunks_out = NULL;
+    *num_chunks_out = 0;
+
+    // For every source vertex, remember which chunk it was last copied into and its index there.
+    // Chunk numbers are stored plus one so zero means the vertex has not been used yet.
+    uint32_t* remap_chunk = calloc(num_vertices + 1, sizeof(uint32_t));
+    uint16_t* remap_index = malloc(sizeof(uint16_t) * (num_vertices + 1));
+    if (remap_chunk == NULL || remap_index == NULL) {
+        free(remap_chunk);
+        free(remap_index);
+        return false;
+    }
+
+    struct mesh_chunk* chunks = NULL;
+    size_t num_chunks = 0;
+    size_t capacity = 0;
+    size_t num_triangles = num_indices / 3;
+
+    // Each chunk starts with room for the indices a typical chunk needs, or all those left if there are fewer, and grows from there.
+    size_t index_capacity = num_triangles * 3 < MESH_SPLIT_INITIAL_INDICES ? num_triangles * 3 : MESH_SPLIT_INITIAL_INDICES;
+    if (index_capacity == 0) index_capacity = 3;
+    bool success = mesh_split_add_chunk(&chunks, &num_chunks, &capacity, index_capacity);
+
+    for (size_t i=0; success == true && i < num_triangles; i++) {
+        const uint32_t* triangle = &indices[i * 3];
+        if (triangle[0] >= num_vertices || triangle[1] >= num_vertices || triangle[2] >= num_vertices) continue;
+
+        // Count how many of the triangle's vertices are not in the current chunk yet.
+        uint32_t chunk_id = (uint32_t)num_chunks;
+        uint32_t new_vertices = 0;
+        for (int j=0; j < 3; j++) {
+            bool repeated = (j > 0 && triangle[j] == triangle[0]) || (j > 1 && triangle[j] == triangle[1]);
+            if (remap_chunk[triangle[j]] != chunk_id && repeated == false) new_vertices++;
+        }
+
+        // Close the chunk when the triangle would not fit, and start the next one.
+        struct mesh_chunk* chunk = &chunks[num_chunks - 1];
+        if (chunk->num_vertices + new_vertices > MESH_SPLIT_MAX_VERTICES) {
+            mesh_split_trim_chunk(chunk);
+            index_capacity = (num_triangles - i) * 3 < MESH_SPLIT_INITIAL_INDICES ? (num_triangles - i) * 3 : MESH_SPLIT_INITIAL_INDICES;
+            success = mesh_split_add_chunk(&chunks, &num_chunks, &capacity, index_capacity);
+            if (success == false) break;
+            chunk = &chunks[num_chunks - 1];
+            chunk_id = (uint32_t)num_chunks;
+        }
+
+        // Copy the triangle into the chunk, copying vertices the chunk has not seen yet.
+        success = mesh_split_reserve_indices(chunk, &index_capacity, chunk->num_indices + 3);
+        if (success == false) break;
+        for (int j=0; j < 3; j++) {
+            uint32_t vertex = triangle[j];
+            if (remap_chunk[vertex] != chunk_id) {
+                remap_chunk[vertex] = chunk_id;
+                remap_index[vertex] = (uint16_t)chunk->num_vertices;
+                chunk->vertices[chunk->num_vertices] = vertices[vertex];
+                chunk->num_vertices++;
+            }
+            chunk->indices[chunk->num_indices] = remap_index[vertex];
+            chunk->num_indices++;
+        }
+    }
+
+    free(remap_chunk);
+    free(remap_index);
+
+    if (success == false) {
+        mesh_split_free(chunks, num_chunks);
+        return false;
+    }
+
+    // Drop the last chunk if it ended up empty.
+    mesh_split_trim_chunk(&chunks[num_chunks - 1]);
+    if (chunks[num_chunks - 1].num_indices == 0) {
+        free(chunks[num_chunks - 1].vertices);
+        free(chunks[num_chunks - 1].indices);
+        num_chunks--;
+    }
+
+    *chunks_out = chunks;
+    *num_chunks_out = num_chunks;
+    return true;
+}
+
+#endif
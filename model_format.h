@@ -0,0 +1,249 @@
+// The binary model container shared by object_converter_tool.c (writer) and main.c (loader).
+// Unlike the text 'output_model' format, this file is laid out so it can be memory mapped
+// and handed to the GPU as-is without any parsing.
+//
+// Layout (all values little endian):
+// - struct model_file_header at offset 0.
+// - An array of header.num_meshes struct model_file_mesh entries at header.mesh_table_offset.
+// - An array of header.num_nodes struct model_file_node entries at header.node_table_offset,
+//   the cluster tree the meshes were partitioned into. Node 0 is the root.
+// - An array of header.num_lods struct model_file_lod entries at header.lod_table_offset,
+//   the levels of detail of every mesh.
+// - Per mesh, a vertex blob and an index blob, each starting on a MODEL_FORMAT_ALIGNMENT boundary.
+
+#ifndef MODEL_FORMAT_H
+#define MODEL_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// Identifies the file as a binary model, and the version of the layout below.
+// The version must be increased whenever any of the structs below change.
+#define MODEL_FORMAT_MAGIC "CYBRMDL"
+#define MODEL_FORMAT_MAGIC_SIZE 8
+#define MODEL_FORMAT_VERSION 5
+
+// All blobs start on this boundary so mapped pointers are suitably aligned for the GPU upload.
+#define MODEL_FORMAT_ALIGNMENT 16
+
+// The default file name the converter writes and the renderer looks for first.
+#define MODEL_FORMAT_DEFAULT_FILENAME "output_model.bin"
+
+// The most levels of detail a mesh can have, including the full detail level.
+#define MODEL_FORMAT_MAX_LODS 8
+
+// The vertex layouts a mesh can be stored in.
+#define MODEL_FORMAT_VERTEX_FLOAT 0
+#define MODEL_FORMAT_VERTEX_PACKED 1
+
+// A vertex as stored in the file. This must match struct vertex in main.c byte for byte.
+struct model_file_vertex {
+    float position[3];
+    float vertex_color[4];
+    float normal[3];
+};
+
+// A quantised vertex, 16 bytes instead of 40.
+// - position holds x, y and z as 16 bit unsigned normalised values across the mesh's bounds, plus padding.
+//   The mesh's position_scale and position_offset turn them back into model space.
+// - vertex_color holds 8 bit unsigned normalised RGBA.
+// - normal holds an octahedral encoded unit vector as two 16 bit signed normalised values.
+struct model_file_packed_vertex {
+    uint16_t position[4];
+    uint8_t vertex_color[4];
+    int16_t normal[2];
+};
+
+// The file header.
+struct model_file_header {
+    char magic[MODEL_FORMAT_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t vertex_size;
+    uint32_t num_meshes;
+    uint64_t mesh_table_offset;
+    uint64_t file_size;
+    uint32_t num_nodes;
+    uint32_t num_lods;
+    uint64_t node_table_offset;
+    uint64_t lod_table_offset;
+};
+
+// One entry in the mesh table, describing where a mesh's vertices and indices are stored.
+// Packed meshes are dequantised with position * position_scale + position_offset.
+// Float meshes store a scale of one and an offset of zero.
+// The bounds are an axis aligned box and a bounding sphere in model space, so the renderer can cull without reading vertices.
+// The index blob holds num_indices indices: every level of detail's triangles, one after another, over the same vertices.
+// The levels are the num_lods entries of the level of detail table starting at first_lod, from full detail to coarsest.
+struct model_file_mesh {
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint32_t index_size;
+    uint32_t vertex_format;
+    uint32_t vertex_size;
+    float position_offset[3];
+    float position_scale[3];
+    float bounds_min[3];
+    float bounds_max[3];
+    float bounds_centre[3];
+    float bounds_radius;
+    uint32_t first_lod;
+    uint32_t num_lods;
+    uint32_t reserved;
+};
+
+// One level of detail of a mesh: a range of its index blob, and the largest distance in model units
+// that simplifying the mesh moved its surface by.
+struct model_file_lod {
+    uint32_t first_index;
+    uint32_t num_indices;
+    float error;
+    uint32_t reserved;
+};
+
+// One node of the cluster tree, with bounds in model space that enclose its whole subtree.
+// A node's children are the num_children nodes starting at first_child, and always come after it.
+// The meshes of a subtree are the num_meshes entries starting at first_mesh; only leaves own meshes directly.
+struct model_file_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t first_child;
+    uint32_t num_children;
+    uint32_t first_mesh;
+    uint32_t num_meshes;
+};
+
+// Round an offset up to the next blob boundary.
+static inline uint64_t model_format_align(uint64_t offset) {
+    return (offset + MODEL_FORMAT_ALIGNMENT - 1) & ~(uint64_t)(MODEL_FORMAT_ALIGNMENT - 1);
+}
+
+// Return 1 if the first bytes of a buffer are the binary model magic, 0 otherwise.
+static inline int model_format_has_magic(const void* data, size_t size) {
+    if (data == NULL || size < MODEL_FORMAT_MAGIC_SIZE) return 0;
+    return memcmp(data, MODEL_FORMAT_MAGIC, MODEL_FORMAT_MAGIC_SIZE) == 0;
+}
+
+// Return the size in bytes of a vertex in the given layout, or 0 for an unknown layout.
+static inline uint32_t model_format_vertex_size(uint32_t vertex_format) {
+    if (vertex_format == MODEL_FORMAT_VERTEX_FLOAT) return sizeof(struct model_file_vertex);
+    if (vertex_format == MODEL_FORMAT_VERTEX_PACKED) return sizeof(struct model_file_packed_vertex);
+    return 0;
+}
+
+// Compute the axis aligned bounds of float vertices, and a bounding sphere around the centre of the box.
+static inline void model_format_compute_bounds(const struct model_file_vertex* vertices, size_t num_vertices, float minimum[3], float maximum[3], float centre[3], float* radius) {
+    for (int k=0; k < 3; k++) {
+        minimum[k] = num_vertices > 0 ? vertices[0].position[k] : 0.0f;
+        maximum[k] = minimum[k];
+    }
+    for (size_t i=1; i < num_vertices; i++) {
+        for (int k=0; k < 3; k++) {
+            if (vertices[i].position[k] < minimum[k]) minimum[k] = vertices[i].position[k];
+            if (vertices[i].position[k] > maximum[k]) maximum[k] = vertices[i].position[k];
+        }
+    }
+
+    float radius_squared = 0.0f;
+    for (int k=0; k < 3; k++) {
+        centre[k] = (minimum[k] + maximum[k]) * 0.5f;
+    }
+    for (size_t i=0; i < num_vertices; i++) {
+        float dx = vertices[i].position[0] - centre[0];
+        float dy = vertices[i].position[1] - centre[1];
+        float dz = vertices[i].position[2] - centre[2];
+        float distance_squared = dx * dx + dy * dy + dz * dz;
+        if (distance_squared > radius_squared) radius_squared = distance_squared;
+    }
+    *radius = sqrtf(radius_squared);
+}
+
+// Quantise a value in [0, 1] to 16 bits, and a value in [-1, 1] to a signed 16 bit value.
+static inline uint16_t model_format_quantise_unorm16(float value) {
+    value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+    return (uint16_t)(value * 65535.0f + 0.5f);
+}
+
+static inline int16_t model_format_quantise_snorm16(float value) {
+    value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+    return (int16_t)lroundf(value * 32767.0f);
+}
+
+// Encode a normal onto the octahedron, returning two values in [-1, 1].
+// Zero length normals encode as (0, 0), which decodes to (0, 0, 1).
+static inline void model_format_encode_octahedral(const float normal[3], float encoded[2]) {
+    float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+    if (length == 0.0f) {
+        encoded[0] = 0.0f;
+        encoded[1] = 0.0f;
+        return;
+    }
+
+    float x = normal[0] / length;
+    float y = normal[1] / length;
+    if (normal[2] < 0.0f) {
+        float folded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float folded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = folded_x;
+        y = folded_y;
+    }
+    encoded[0] = x;
+    encoded[1] = y;
+}
+
+// Decode an octahedral encoded normal back to a unit vector. This mirrors the decode in vertex.glsl.
+static inline void model_format_decode_octahedral(const float encoded[2], float normal[3]) {
+    float x = encoded[0];
+    float y = encoded[1];
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f) {
+        float unfolded_x = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float unfolded_y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = unfolded_x;
+        y = unfolded_y;
+    }
+    float length = sqrtf(x * x + y * y + z * z);
+    normal[0] = x / length;
+    normal[1] = y / length;
+    normal[2] = z / length;
+}
+
+// Quantise a mesh's vertices into the packed layout.
+// The position offset and scale that dequantise the positions are written to the mesh table entry.
+static inline void model_format_pack_vertices(const struct model_file_vertex* vertices, uint32_t num_vertices, struct model_file_packed_vertex* packed, struct model_file_mesh* entry) {
+    // Find the bounds the positions are quantised across.
+    float minimum[3] = {0.0f, 0.0f, 0.0f};
+    float maximum[3] = {0.0f, 0.0f, 0.0f};
+    for (uint32_t i=0; i < num_vertices; i++) {
+        for (int k=0; k < 3; k++) {
+            if (i == 0 || vertices[i].position[k] < minimum[k]) minimum[k] = vertices[i].position[k];
+            if (i == 0 || vertices[i].position[k] > maximum[k]) maximum[k] = vertices[i].position[k];
+        }
+    }
+    for (int k=0; k < 3; k++) {
+        entry->position_offset[k] = minimum[k];
+        entry->position_scale[k] = maximum[k] > minimum[k] ? maximum[k] - minimum[k] : 1.0f;
+    }
+
+    for (uint32_t i=0; i < num_vertices; i++) {
+        for (int k=0; k < 3; k++) {
+            packed[i].position[k] = model_format_quantise_unorm16((vertices[i].position[k] - entry->position_offset[k]) / entry->position_scale[k]);
+        }
+        packed[i].position[3] = 0;
+
+        for (int k=0; k < 4; k++) {
+            float color = vertices[i].vertex_color[k] < 0.0f ? 0.0f : (vertices[i].vertex_color[k] > 1.0f ? 1.0f : vertices[i].vertex_color[k]);
+            packed[i].vertex_color[k] = (uint8_t)(color * 255.0f + 0.5f);
+        }
+
+        float encoded[2];
+        model_format_encode_octahedral(vertices[i].normal, encoded);
+        packed[i].normal[0] = model_format_quantise_snorm16(encoded[0]);
+        packed[i].normal[1] = model_format_quantise_snorm16(encoded[1]);
+    }
+}
+
+#endif
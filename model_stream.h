@@ -0,0 +1,637 @@
+// The compressed, progressively streamed model format shared by object_converter_tool.c (writer) and main.c (reader).
+// It carries the same meshes, cluster tree and levels of detail as a quantised binary model, but is meant to be
+// downloaded rather than memory mapped: it is a fraction of the size, and it is decoded chunk by chunk as it arrives,
+// coarsest levels of detail first, so something can be drawn long before the whole file is in.
+//
+// Layout (all values little endian):
+// - struct model_stream_header at offset 0.
+// - header.num_meshes struct model_stream_mesh entries, header.num_nodes struct model_file_node entries
+//   and header.num_lods struct model_stream_lod entries, one table after another.
+// - header.num_chunks chunks, each a struct model_stream_chunk followed by its vertex block and its index block.
+//
+// Every mesh is stored with packed vertices and 16 bit indices. Its vertices are ordered by first use, starting from
+// its coarsest level of detail, and its index buffer holds the levels from coarsest to full detail. So each level
+// only adds vertices and indices to the end of what the levels before it used, and one chunk carries one level of
+// one mesh: the vertices that level uses first, and its triangles. Chunks are ordered in rounds, the coarsest level
+// of every mesh, then the next coarsest of every mesh that has one, down to full detail.
+//
+// Within a chunk:
+// - Vertices are stored as the difference from the vertex before them, one attribute component after another:
+//   positions and normals as zigzag encoded variable length integers, and colours as zigzag encoded bytes.
+// - Each index is stored as a variable length integer counting back from the next vertex no triangle has used yet,
+//   so a vertex used for the first time is 0, and vertices used recently are small numbers.
+// - Both byte streams are then entropy coded with an order 0 rANS coder, using a frequency table stored with them.
+//
+// model_stream_feed() decodes the format incrementally from pieces of any size.
+
+#ifndef MODEL_STREAM_H
+#define MODEL_STREAM_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "model_format.h"
+
+// Identifies the file as a streamed model, and the version of the layout below.
+#define MODEL_STREAM_MAGIC "CYBRSTM"
+#define MODEL_STREAM_VERSION 1
+
+// The default file name the converter writes and the renderer looks for after the binary model.
+#define MODEL_STREAM_DEFAULT_FILENAME "output_model.stream"
+
+// The rANS coder's probabilities are fractions of 1 << MODEL_STREAM_PROBABILITY_BITS, and its state is kept
+// between MODEL_STREAM_RANS_LOW and 256 times that, reading and writing a byte at a time.
+#define MODEL_STREAM_PROBABILITY_BITS 12
+#define MODEL_STREAM_PROBABILITY_SCALE (1 << MODEL_STREAM_PROBABILITY_BITS)
+#define MODEL_STREAM_RANS_LOW (1u << 23)
+
+// The state of a decoder, in the order the parts of the file arrive.
+#define MODEL_STREAM_HEADER 0
+#define MODEL_STREAM_TABLES 1
+#define MODEL_STREAM_CHUNKS 2
+#define MODEL_STREAM_DONE 3
+#define MODEL_STREAM_ERROR 4
+
+// The file header.
+struct model_stream_header {
+    char magic[MODEL_FORMAT_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t num_meshes;
+    uint32_t num_nodes;
+    uint32_t num_lods;
+    uint32_t num_chunks;
+    uint32_t reserved;
+    uint64_t file_size;
+};
+
+// One entry in the mesh table. Packed positions are dequantised with position * position_scale + position_offset,
+// and the bounds are in model space. Translucent meshes have a vertex colour that is not fully opaque.
+// The levels are the num_lods entries of the level of detail table starting at first_lod, from full detail to coarsest.
+struct model_stream_mesh {
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint32_t first_lod;
+    uint32_t num_lods;
+    uint32_t translucent;
+    float position_offset[3];
+    float position_scale[3];
+    float bounds_min[3];
+    float bounds_max[3];
+    float bounds_centre[3];
+    float bounds_radius;
+};
+
+// One level of detail of a mesh: a range of its index buffer, how many of its first vertices the range uses,
+// and the largest distance in model units that simplifying the mesh moved its surface by.
+struct model_stream_lod {
+    uint32_t first_index;
+    uint32_t num_indices;
+    uint32_t num_vertices;
+    float error;
+};
+
+// The header of a chunk: one level of detail of one mesh, adding num_vertices vertices after the first_vertex
+// already decoded and the level's num_indices indices. The vertex and index blocks that follow are vertex_size
+// and index_size bytes long.
+struct model_stream_chunk {
+    uint32_t mesh;
+    uint32_t lod;
+    uint32_t first_vertex;
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint32_t vertex_size;
+    uint32_t index_size;
+    uint32_t reserved;
+};
+
+// Decodes a streamed model from pieces fed to it as they arrive.
+// Once the tables have arrived, vertices and indices hold every mesh's arrays at full size, and decoded_vertices
+// and decoded_indices count how much of each has been filled in, always whole levels of detail.
+// The caller takes ownership of the vertex and index arrays; model_stream_free() leaves them alone.
+struct model_stream_decoder {
+    int status;
+    unsigned char* buffer;
+    size_t buffer_size;
+    size_t buffer_capacity;
+    unsigned char* scratch;
+    size_t scratch_capacity;
+    uint64_t bytes_received;
+    uint64_t bytes_decoded;
+    uint32_t num_chunks;
+    struct model_stream_header header;
+    struct model_stream_mesh* meshes;
+    struct model_file_node* nodes;
+    struct model_stream_lod* lods;
+    struct model_file_packed_vertex** vertices;
+    uint16_t** indices;
+    uint32_t* decoded_vertices;
+    uint32_t* decoded_indices;
+};
+
+// Byte streams are built up in a growable buffer. Returns false on allocation failure.
+struct model_stream_bytes {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+};
+
+static inline bool model_stream_bytes_reserve(struct model_stream_bytes* bytes, size_t size) {
+    if (bytes->size + size <= bytes->capacity) return true;
+    size_t capacity = bytes->capacity == 0 ? 1024 : bytes->capacity;
+    while (capacity < bytes->size + size) capacity = capacity * 2;
+    unsigned char* data = realloc(bytes->data, capacity);
+    if (data == NULL) return false;
+    bytes->data = data;
+    bytes->capacity = capacity;
+    return true;
+}
+
+static inline bool model_stream_bytes_append(struct model_stream_bytes* bytes, const void* data, size_t size) {
+    if (model_stream_bytes_reserve(bytes, size) == false) return false;
+    memcpy(bytes->data + bytes->size, data, size);
+    bytes->size = bytes->size + size;
+    return true;
+}
+
+// Write a variable length integer, seven bits a byte from the lowest, with the top bit set on all but the last byte.
+static inline bool model_stream_write_varint(struct model_stream_bytes* bytes, uint32_t value) {
+    if (model_stream_bytes_reserve(bytes, 5) == false) return false;
+    while (value >= 0x80) {
+        bytes->data[bytes->size] = (unsigned char)(value | 0x80);
+        bytes->size++;
+        value = value >> 7;
+    }
+    bytes->data[bytes->size] = (unsigned char)value;
+    bytes->size++;
+    return true;
+}
+
+// Read a variable length integer, returning the position after it, or NULL if it runs past the end or is too long.
+static inline const unsigned char* model_stream_read_varint(const unsigned char* p, const unsigned char* end, uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift=0; shift < 35; shift = shift + 7) {
+        if (p >= end) return NULL;
+        unsigned char byte = *p;
+        p++;
+        result = result | (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Map signed differences to unsigned values with the smallest magnitudes first: 0, -1, 1, -2, 2 and so on.
+static inline uint32_t model_stream_zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t model_stream_unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// Scale byte counts to frequencies that add up to MODEL_STREAM_PROBABILITY_SCALE, keeping every byte that occurs at least 1.
+static inline void model_stream_normalise(const uint32_t counts[256], size_t total, uint32_t frequencies[256]) {
+    uint32_t sum = 0;
+    int largest = 0;
+    for (int i=0; i < 256; i++) {
+        frequencies[i] = 0;
+        if (counts[i] == 0) continue;
+        frequencies[i] = (uint32_t)((uint64_t)counts[i] * MODEL_STREAM_PROBABILITY_SCALE / total);
+        if (frequencies[i] == 0) frequencies[i] = 1;
+        sum = sum + frequencies[i];
+        if (frequencies[i] > frequencies[largest]) largest = i;
+    }
+
+    // Give rounding errors to the most frequent byte, or take them from the most frequent bytes that can spare them.
+    if (sum < MODEL_STREAM_PROBABILITY_SCALE) {
+        frequencies[largest] = frequencies[largest] + (MODEL_STREAM_PROBABILITY_SCALE - sum);
+    }
+    while (sum > MODEL_STREAM_PROBABILITY_SCALE) {
+        int spare = 0;
+        for (int i=1; i < 256; i++) {
+            if (frequencies[i] > frequencies[spare]) spare = i;
+        }
+        frequencies[spare]--;
+        sum--;
+    }
+}
+
+// Entropy code a byte stream, appending a block to the output: the stream's size, its frequency table,
+// then the rANS coded bytes. An empty stream is just its size.
+// Returns false on allocation failure.
+static inline bool model_stream_encode_block(const unsigned char* data, size_t size, struct model_stream_bytes* output) {
+    if (model_stream_write_varint(output, (uint32_t)size) == false) return false;
+    if (size == 0) return true;
+
+    uint32_t counts[256] = {0};
+    for (size_t i=0; i < size; i++) {
+        counts[data[i]]++;
+    }
+    uint32_t frequencies[256];
+    uint32_t starts[256];
+    model_stream_normalise(counts, size, frequencies);
+
+    // The frequency table lists the bytes that occur, as the number of them less one, then each byte and its frequency.
+    uint32_t num_symbols = 0;
+    uint32_t start = 0;
+    for (int i=0; i < 256; i++) {
+        starts[i] = start;
+        start = start + frequencies[i];
+        if (frequencies[i] > 0) num_symbols++;
+    }
+    unsigned char symbols = (unsigned char)(num_symbols - 1);
+    if (model_stream_bytes_append(output, &symbols, 1) == false) return false;
+    for (int i=0; i < 256; i++) {
+        if (frequencies[i] == 0) continue;
+        unsigned char symbol = (unsigned char)i;
+        if (model_stream_bytes_append(output, &symbol, 1) == false || model_stream_write_varint(output, frequencies[i]) == false) return false;
+    }
+
+    // rANS codes backwards, so the decoder reads forwards. No byte costs more than 12 bits, plus the 4 byte final state.
+    size_t capacity = size * 2 + 8;
+    unsigned char* coded = malloc(capacity);
+    if (coded == NULL) return false;
+    unsigned char* p = coded + capacity;
+    uint32_t state = MODEL_STREAM_RANS_LOW;
+    for (size_t i=size; i > 0; i--) {
+        uint32_t frequency = frequencies[data[i - 1]];
+        uint32_t limit = ((MODEL_STREAM_RANS_LOW >> MODEL_STREAM_PROBABILITY_BITS) << 8) * frequency;
+        while (state >= limit) {
+            p--;
+            *p = (unsigned char)(state & 0xff);
+            state = state >> 8;
+        }
+        state = ((state / frequency) << MODEL_STREAM_PROBABILITY_BITS) + (state % frequency) + starts[data[i - 1]];
+    }
+    p = p - 4;
+    p[0] = (unsigned char)(state);
+    p[1] = (unsigned char)(state >> 8);
+    p[2] = (unsigned char)(state >> 16);
+    p[3] = (unsigned char)(state >> 24);
+
+    bool success = model_stream_bytes_append(output, p, coded + capacity - p);
+    free(coded);
+    return success;
+}
+
+// Decode a block written by model_stream_encode_block() into a buffer, which is grown as needed, and set *size to the stream's size.
+// A stream of one repeated byte codes to almost nothing, so streams longer than max_size are refused before allocating for them.
+// Returns false if the block is malformed or memory runs out.
+static inline bool model_stream_decode_block(const unsigned char* p, const unsigned char* end, size_t max_size, unsigned char** buffer, size_t* capacity, size_t* size) {
+    uint32_t raw_size = 0;
+    p = model_stream_read_varint(p, end, &raw_size);
+    if (p == NULL || raw_size > max_size) return false;
+    *size = raw_size;
+    if (raw_size == 0) return p == end;
+
+    if (*capacity < raw_size) {
+        unsigned char* grown = realloc(*buffer, raw_size);
+        if (grown == NULL) return false;
+        *buffer = grown;
+        *capacity = raw_size;
+    }
+
+    // Read the frequency table, and expand it into a table of which byte each probability slot belongs to.
+    if (p >= end) return false;
+    uint32_t num_symbols = (uint32_t)*p + 1;
+    p++;
+    uint32_t frequencies[256] = {0};
+    uint32_t starts[256] = {0};
+    unsigned char slots[MODEL_STREAM_PROBABILITY_SCALE];
+    uint32_t start = 0;
+    for (uint32_t i=0; i < num_symbols; i++) {
+        if (p >= end) return false;
+        unsigned char symbol = *p;
+        p++;
+        uint32_t frequency = 0;
+        p = model_stream_read_varint(p, end, &frequency);
+        if (p == NULL || frequency == 0 || frequencies[symbol] != 0 || start + frequency > MODEL_STREAM_PROBABILITY_SCALE) return false;
+        frequencies[symbol] = frequency;
+        starts[symbol] = start;
+        memset(&slots[start], symbol, frequency);
+        start = start + frequency;
+    }
+    if (start != MODEL_STREAM_PROBABILITY_SCALE || end - p < 4) return false;
+
+    uint32_t state = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    p = p + 4;
+    unsigned char* output = *buffer;
+    for (uint32_t i=0; i < raw_size; i++) {
+        uint32_t slot = state & (MODEL_STREAM_PROBABILITY_SCALE - 1);
+        unsigned char symbol = slots[slot];
+        output[i] = symbol;
+        state = frequencies[symbol] * (state >> MODEL_STREAM_PROBABILITY_BITS) + slot - starts[symbol];
+        while (state < MODEL_STREAM_RANS_LOW) {
+            if (p >= end) return false;
+            state = (state << 8) | *p;
+            p++;
+        }
+    }
+    return p == end && state == MODEL_STREAM_RANS_LOW;
+}
+
+// Write the vertex stream of a chunk: the differences between consecutive vertices, one component at a time,
+// starting from the vertex before first or from zero. Returns false on allocation failure.
+static inline bool model_stream_encode_vertices(const struct model_file_packed_vertex* vertices, uint32_t first, uint32_t count, struct model_stream_bytes* output) {
+    for (int k=0; k < 3; k++) {
+        uint16_t previous = first > 0 ? vertices[first - 1].position[k] : 0;
+        for (uint32_t i=first; i < first + count; i++) {
+            if (model_stream_write_varint(output, model_stream_zigzag((int16_t)(uint16_t)(vertices[i].position[k] - previous))) == false) return false;
+            previous = vertices[i].position[k];
+        }
+    }
+    for (int k=0; k < 2; k++) {
+        int16_t previous = first > 0 ? vertices[first - 1].normal[k] : 0;
+        for (uint32_t i=first; i < first + count; i++) {
+            if (model_stream_write_varint(output, model_stream_zigzag((int16_t)(uint16_t)(vertices[i].normal[k] - previous))) == false) return false;
+            previous = vertices[i].normal[k];
+        }
+    }
+    for (int k=0; k < 4; k++) {
+        uint8_t previous = first > 0 ? vertices[first - 1].vertex_color[k] : 0;
+        for (uint32_t i=first; i < first + count; i++) {
+            unsigned char byte = (unsigned char)model_stream_zigzag((int8_t)(uint8_t)(vertices[i].vertex_color[k] - previous));
+            if (model_stream_bytes_append(output, &byte, 1) == false) return false;
+            previous = vertices[i].vertex_color[k];
+        }
+    }
+    return true;
+}
+
+// Decode a chunk's vertex stream into vertices first to first + count. Returns false if the stream is malformed.
+static inline bool model_stream_decode_vertices(const unsigned char* p, const unsigned char* end, struct model_file_packed_vertex* vertices, uint32_t first, uint32_t count) {
+    for (int k=0; k < 3; k++) {
+        uint16_t previous = first > 0 ? vertices[first - 1].position[k] : 0;
+        for (uint32_t i=first; i < first + count; i++) {
+            uint32_t value = 0;
+            p = model_stream_read_varint(p, end, &value);
+            if (p == NULL) return false;
+            previous = (uint16_t)(previous + model_stream_unzigzag(value));
+            vertices[i].position[k] = previous;
+        }
+    }
+    for (int k=0; k < 2; k++) {
+        uint16_t previous = first > 0 ? (uint16_t)vertices[first - 1].normal[k] : 0;
+        for (uint32_t i=first; i < first + count; i++) {
+            uint32_t value = 0;
+            p = model_stream_read_varint(p, end, &value);
+            if (p == NULL) return false;
+            previous = (uint16_t)(previous + model_stream_unzigzag(value));
+            vertices[i].normal[k] = (int16_t)previous;
+        }
+    }
+    for (int k=0; k < 4; k++) {
+        uint8_t previous = first > 0 ? vertices[first - 1].vertex_color[k] : 0;
+        if (end - p < (ptrdiff_t)count) return false;
+        for (uint32_t i=first; i < first + count; i++) {
+            previous = (uint8_t)(previous + model_stream_unzigzag(*p));
+            vertices[i].vertex_color[k] = previous;
+            p++;
+        }
+    }
+    for (uint32_t i=first; i < first + count; i++) {
+        vertices[i].position[3] = 0;
+    }
+    return p == end;
+}
+
+// Write the index stream of a chunk, counting each index back from the next vertex not used yet, which starts at first_vertex.
+// Returns false on allocation failure.
+static inline bool model_stream_encode_indices(const uint16_t* indices, uint32_t count, uint32_t first_vertex, struct model_stream_bytes* output) {
+    uint32_t next = first_vertex;
+    for (uint32_t i=0; i < count; i++) {
+        if (model_stream_write_varint(output, next - indices[i]) == false) return false;
+        if (indices[i] == next) next++;
+    }
+    return true;
+}
+
+// Decode a chunk's index stream, where only the first num_vertices vertices exist.
+// Returns false if the stream is malformed or refers to a vertex that does not exist.
+static inline bool model_stream_decode_indices(const unsigned char* p, const unsigned char* end, uint16_t* indices, uint32_t count, uint32_t first_vertex, uint32_t num_vertices) {
+    uint32_t next = first_vertex;
+    for (uint32_t i=0; i < count; i++) {
+        uint32_t value = 0;
+        p = model_stream_read_varint(p, end, &value);
+        if (p == NULL || value > next || next - value >= num_vertices) return false;
+        indices[i] = (uint16_t)(next - value);
+        if (value == 0) next++;
+    }
+    return p == end;
+}
+
+// Release everything a decoder holds except the mesh arrays, which belong to the caller.
+static inline void model_stream_free(struct model_stream_decoder* decoder) {
+    free(decoder->buffer);
+    free(decoder->scratch);
+    free(decoder->meshes);
+    free(decoder->nodes);
+    free(decoder->lods);
+    free(decoder->vertices);
+    free(decoder->indices);
+    free(decoder->decoded_vertices);
+    free(decoder->decoded_indices);
+    memset(decoder, 0, sizeof(struct model_stream_decoder));
+    decoder->status = MODEL_STREAM_ERROR;
+}
+
+// Start a decoder, expecting the header first.
+static inline void model_stream_init(struct model_stream_decoder* decoder) {
+    memset(decoder, 0, sizeof(struct model_stream_decoder));
+    decoder->status = MODEL_STREAM_HEADER;
+}
+
+// Check the header, and that the tables will fit in the file, before allocating anything for them.
+static inline bool model_stream_check_header(const struct model_stream_header* header) {
+    uint64_t tables = (uint64_t)header->num_meshes * sizeof(struct model_stream_mesh)
+        + (uint64_t)header->num_nodes * sizeof(struct model_file_node)
+        + (uint64_t)header->num_lods * sizeof(struct model_stream_lod);
+    return memcmp(header->magic, MODEL_STREAM_MAGIC, MODEL_FORMAT_MAGIC_SIZE) == 0
+        && header->version == MODEL_STREAM_VERSION
+        && header->num_meshes > 0
+        && header->num_nodes > 0
+        && header->num_lods >= header->num_meshes
+        && header->num_chunks == header->num_lods
+        && sizeof(struct model_stream_header) + tables + (uint64_t)header->num_chunks * sizeof(struct model_stream_chunk) <= header->file_size;
+}
+
+// Check the tables, the same way main.c checks a binary model's, and allocate every mesh's arrays.
+static inline bool model_stream_check_tables(struct model_stream_decoder* decoder) {
+    const struct model_stream_header* header = &decoder->header;
+    uint32_t num_chunks = 0;
+    for (uint32_t i=0; i < header->num_meshes; i++) {
+        const struct model_stream_mesh* mesh = &decoder->meshes[i];
+        bool valid = mesh->num_vertices > 0 && mesh->num_vertices <= 65536 && mesh->num_indices > 0
+            && mesh->num_lods > 0 && mesh->num_lods <= MODEL_FORMAT_MAX_LODS
+            && (uint64_t)mesh->first_lod + mesh->num_lods <= header->num_lods;
+        for (uint32_t j=0; j < mesh->num_lods && valid == true; j++) {
+            const struct model_stream_lod* lod = &decoder->lods[mesh->first_lod + j];
+            valid = lod->num_indices > 0 && lod->num_vertices <= mesh->num_vertices
+                && (uint64_t)lod->first_index + lod->num_indices <= mesh->num_indices;
+        }
+        if (valid == false) return false;
+        num_chunks = num_chunks + mesh->num_lods;
+    }
+    if (num_chunks != header->num_chunks) return false;
+
+    // Children must come after their parent, which also rules out cycles.
+    for (uint32_t i=0; i < header->num_nodes; i++) {
+        const struct model_file_node* node = &decoder->nodes[i];
+        bool valid = (node->num_children == 0 || node->first_child > i)
+            && (uint64_t)node->first_child + node->num_children <= header->num_nodes
+            && (uint64_t)node->first_mesh + node->num_meshes <= header->num_meshes;
+        if (valid == false) return false;
+    }
+
+    decoder->vertices = calloc(header->num_meshes, sizeof(struct model_file_packed_vertex*));
+    decoder->indices = calloc(header->num_meshes, sizeof(uint16_t*));
+    decoder->decoded_vertices = calloc(header->num_meshes, sizeof(uint32_t));
+    decoder->decoded_indices = calloc(header->num_meshes, sizeof(uint32_t));
+    if (decoder->vertices == NULL || decoder->indices == NULL || decoder->decoded_vertices == NULL || decoder->decoded_indices == NULL) return false;
+    for (uint32_t i=0; i < header->num_meshes; i++) {
+        decoder->vertices[i] = malloc(sizeof(struct model_file_packed_vertex) * decoder->meshes[i].num_vertices);
+        decoder->indices[i] = malloc(sizeof(uint16_t) * decoder->meshes[i].num_indices);
+        if (decoder->vertices[i] == NULL || decoder->indices[i] == NULL) {
+            // The caller never sees arrays from tables that failed, so free the ones already allocated.
+            for (uint32_t j=0; j <= i; j++) {
+                free(decoder->vertices[j]);
+                free(decoder->indices[j]);
+                decoder->vertices[j] = NULL;
+                decoder->indices[j] = NULL;
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decode one chunk whose header and blocks are all in the buffer. Returns false if it is malformed.
+// Levels of each mesh must arrive from coarsest to full detail, each continuing where the last one stopped.
+static inline bool model_stream_decode_chunk(struct model_stream_decoder* decoder, const struct model_stream_chunk* chunk, const unsigned char* blocks) {
+    if (chunk->mesh >= decoder->header.num_meshes) return false;
+    const struct model_stream_mesh* mesh = &decoder->meshes[chunk->mesh];
+    if (chunk->lod >= mesh->num_lods) return false;
+    const struct model_stream_lod* lod = &decoder->lods[mesh->first_lod + chunk->lod];
+    uint32_t decoded_vertices = decoder->decoded_vertices[chunk->mesh];
+    bool valid = chunk->first_vertex == decoded_vertices
+        && (uint64_t)chunk->first_vertex + chunk->num_vertices == lod->num_vertices
+        && chunk->num_indices == lod->num_indices
+        && lod->first_index == decoder->decoded_indices[chunk->mesh];
+    if (valid == false) return false;
+
+    // A vertex takes at most five bytes a position or normal component and one a colour component, and an index five bytes.
+    size_t size = 0;
+    size_t max_vertex_size = (size_t)chunk->num_vertices * (5 * 5 + 4);
+    size_t max_index_size = (size_t)chunk->num_indices * 5;
+    if (model_stream_decode_block(blocks, blocks + chunk->vertex_size, max_vertex_size, &decoder->scratch, &decoder->scratch_capacity, &size) == false) return false;
+    if (model_stream_decode_vertices(decoder->scratch, decoder->scratch + size, decoder->vertices[chunk->mesh], chunk->first_vertex, chunk->num_vertices) == false) return false;
+
+    blocks = blocks + chunk->vertex_size;
+    if (model_stream_decode_block(blocks, blocks + chunk->index_size, max_index_size, &decoder->scratch, &decoder->scratch_capacity, &size) == false) return false;
+    uint16_t* indices = decoder->indices[chunk->mesh] + lod->first_index;
+    if (model_stream_decode_indices(decoder->scratch, decoder->scratch + size, indices, chunk->num_indices, chunk->first_vertex, lod->num_vertices) == false) return false;
+
+    decoder->decoded_vertices[chunk->mesh] = lod->num_vertices;
+    decoder->decoded_indices[chunk->mesh] = lod->first_index + lod->num_indices;
+    decoder->bytes_decoded = decoder->bytes_decoded + (uint64_t)chunk->num_vertices * sizeof(struct model_file_packed_vertex) + (uint64_t)chunk->num_indices * sizeof(uint16_t);
+    decoder->num_chunks++;
+    return true;
+}
+
+// Feed the next piece of the file to a decoder, and decode everything it completes.
+// Returns the decoder's status: MODEL_STREAM_DONE once every chunk has been decoded, MODEL_STREAM_ERROR if the file is
+// malformed or memory runs out, and otherwise the part of the file it is waiting for more of.
+static inline int model_stream_feed(struct model_stream_decoder* decoder, const void* data, size_t size) {
+    if (decoder->status == MODEL_STREAM_ERROR || decoder->status == MODEL_STREAM_DONE) {
+        if (size > 0) decoder->status = MODEL_STREAM_ERROR;
+        return decoder->status;
+    }
+    decoder->bytes_received = decoder->bytes_received + size;
+    if (decoder->buffer_size + size > decoder->buffer_capacity) {
+        size_t capacity = decoder->buffer_capacity == 0 ? 65536 : decoder->buffer_capacity;
+        while (capacity < decoder->buffer_size + size) capacity = capacity * 2;
+        unsigned char* grown = realloc(decoder->buffer, capacity);
+        if (grown == NULL) {
+            decoder->status = MODEL_STREAM_ERROR;
+            return decoder->status;
+        }
+        decoder->buffer = grown;
+        decoder->buffer_capacity = capacity;
+    }
+    if (size > 0) {
+        memcpy(decoder->buffer + decoder->buffer_size, data, size);
+        decoder->buffer_size = decoder->buffer_size + size;
+    }
+
+    // Take whole parts of the file off the front of the buffer until one is incomplete.
+    size_t consumed = 0;
+    bool progress = true;
+    while (progress == true && decoder->status != MODEL_STREAM_ERROR && decoder->status != MODEL_STREAM_DONE) {
+        const unsigned char* p = decoder->buffer + consumed;
+        size_t available = decoder->buffer_size - consumed;
+        progress = false;
+
+        if (decoder->status == MODEL_STREAM_HEADER && available >= sizeof(struct model_stream_header)) {
+            memcpy(&decoder->header, p, sizeof(struct model_stream_header));
+            decoder->status = model_stream_check_header(&decoder->header) == true ? MODEL_STREAM_TABLES : MODEL_STREAM_ERROR;
+            consumed = consumed + sizeof(struct model_stream_header);
+            progress = true;
+        }
+        else if (decoder->status == MODEL_STREAM_TABLES) {
+            size_t mesh_bytes = sizeof(struct model_stream_mesh) * decoder->header.num_meshes;
+            size_t node_bytes = sizeof(struct model_file_node) * decoder->header.num_nodes;
+            size_t lod_bytes = sizeof(struct model_stream_lod) * decoder->header.num_lods;
+            if (available < mesh_bytes + node_bytes + lod_bytes) break;
+            decoder->meshes = malloc(mesh_bytes);
+            decoder->nodes = malloc(node_bytes);
+            decoder->lods = malloc(lod_bytes);
+            if (decoder->meshes == NULL || decoder->nodes == NULL || decoder->lods == NULL) {
+                decoder->status = MODEL_STREAM_ERROR;
+                break;
+            }
+            memcpy(decoder->meshes, p, mesh_bytes);
+            memcpy(decoder->nodes, p + mesh_bytes, node_bytes);
+            memcpy(decoder->lods, p + mesh_bytes + node_bytes, lod_bytes);
+            decoder->status = model_stream_check_tables(decoder) == true ? MODEL_STREAM_CHUNKS : MODEL_STREAM_ERROR;
+            consumed = consumed + mesh_bytes + node_bytes + lod_bytes;
+            progress = true;
+        }
+        else if (decoder->status == MODEL_STREAM_CHUNKS && available >= sizeof(struct model_stream_chunk)) {
+            struct model_stream_chunk chunk;
+            memcpy(&chunk, p, sizeof(struct model_stream_chunk));
+            uint64_t chunk_size = sizeof(struct model_stream_chunk) + (uint64_t)chunk.vertex_size + chunk.index_size;
+            if (chunk_size > decoder->header.file_size) {
+                decoder->status = MODEL_STREAM_ERROR;
+                break;
+            }
+            if (available < chunk_size) break;
+            if (model_stream_decode_chunk(decoder, &chunk, p + sizeof(struct model_stream_chunk)) == false) {
+                decoder->status = MODEL_STREAM_ERROR;
+                break;
+            }
+            consumed = consumed + chunk_size;
+            if (decoder->num_chunks == decoder->header.num_chunks) {
+                bool complete = consumed == decoder->buffer_size && decoder->bytes_received == decoder->header.file_size;
+                for (uint32_t i=0; i < decoder->header.num_meshes && complete == true; i++) {
+                    complete = decoder->decoded_vertices[i] == decoder->meshes[i].num_vertices && decoder->decoded_indices[i] == decoder->meshes[i].num_indices;
+                }
+                decoder->status = complete == true ? MODEL_STREAM_DONE : MODEL_STREAM_ERROR;
+            }
+            progress = true;
+        }
+    }
+    if (decoder->bytes_received > decoder->header.file_size && decoder->status != MODEL_STREAM_HEADER) {
+        decoder->status = MODEL_STREAM_ERROR;
+    }
+
+    memmove(decoder->buffer, decoder->buffer + consumed, decoder->buffer_size - consumed);
+    decoder->buffer_size = decoder->buffer_size - consumed;
+    return decoder->status;
+}
+
+#endif
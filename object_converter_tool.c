@@ -4,88 +4,1445 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "model_format.h"
+#include "mesh_split.h"
+#include "mesh_optimise.h"
+#include "mesh_cluster.h"
+#include "mesh_simplify.h"
+#include "model_stream.h"
+
+// The streamed model is checked by decoding it in pieces of this size, as a download would arrive.
+#define OBJECT_STREAM_PIECE_SIZE 65536
+
+// The text model is formatted into a buffer of this size, which is written out whenever it fills.
+#define OBJECT_TEXT_BUFFER_SIZE (1 << 20)
+
+// Batch conversions remember a hash of each input's contents and the options it was converted with in this file
+// in the output directory, and skip inputs whose hash has not changed. Bump the version whenever the converter's
+// output changes, so that everything is converted again. At most this many files are converted at once.
+#define OBJECT_COOK_CACHE_FILENAME ".cook_cache"
+#define OBJECT_COOK_VERSION 1
+#define OBJECT_COOK_MAX_THREADS 64
+
+// Options chosen on the command line.
+struct converter_options {
+    bool binary;
+    bool optimise;
+    bool quantise;
+    bool lod;
+    bool stream;
+};
+
+// A buffered writer for the text model format, formatting numbers itself rather than with fprintf().
+// Callers reserve room for a line before appending to it.
+struct text_writer {
+    FILE* file;
+    char* buffer;
+    size_t size;
+    bool failed;
+};
+
+// Create a text model file to write to. Returns false if the file or its buffer could not be created.
+bool text_writer_open(struct text_writer* writer, const char* filename) {
+    writer->file = fopen(filename, "w");
+    writer->buffer = malloc(OBJECT_TEXT_BUFFER_SIZE);
+    writer->size = 0;
+    writer->failed = false;
+    if (writer->file == NULL || writer->buffer == NULL) {
+        if (writer->file != NULL) fclose(writer->file);
+        free(writer->buffer);
+        return false;
+    }
+    return true;
+}
+
+// Write out everything formatted so far.
+void text_writer_flush(struct text_writer* writer) {
+    if (writer->size > 0 && fwrite(writer->buffer, 1, writer->size, writer->file) != writer->size) {
+        writer->failed = true;
+    }
+    writer->size = 0;
+}
+
+// Make sure there is room for size more bytes in the buffer, writing it out if not.
+void text_writer_reserve(struct text_writer* writer, size_t size) {
+    if (writer->size + size > OBJECT_TEXT_BUFFER_SIZE) text_writer_flush(writer);
+}
+
+// Flush and close the file. Returns false if anything failed to write.
+bool text_writer_close(struct text_writer* writer) {
+    text_writer_flush(writer);
+    writer->failed = fclose(writer->file) != 0 || writer->failed;
+    free(writer->buffer);
+    return writer->failed == false;
+}
+
+void text_writer_char(struct text_writer* writer, char c) {
+    writer->buffer[writer->size] = c;
+    writer->size++;
+}
+
+void text_writer_uint(struct text_writer* writer, uint64_t value) {
+    char digits[20];
+    int num_digits = 0;
+    do {
+        digits[num_digits] = '0' + value % 10;
+        num_digits++;
+        value = value / 10;
+    } while (value > 0);
+    while (num_digits > 0) {
+        num_digits--;
+        text_writer_char(writer, digits[num_digits]);
+    }
+}
+
+// Format a float with six decimal places, exactly as printf("%f") would.
+// A float times a million is exact in a double, and llrint() rounds half to even as printf does.
+// Values too large for that, and infinities and NaNs, are left to snprintf(), and need up to 64 bytes.
+void text_writer_float(struct text_writer* writer, float value) {
+    double magnitude = fabs((double)value);
+    if (isfinite(value) == false || magnitude >= 1e12) {
+        writer->size = writer->size + snprintf(writer->buffer + writer->size, 64, "%f", value);
+        return;
+    }
+
+    if (signbit(value)) text_writer_char(writer, '-');
+    uint64_t scaled = (uint64_t)llrint(magnitude * 1e6);
+    text_writer_uint(writer, scaled / 1000000);
+    text_writer_char(writer, '.');
+    uint32_t fraction = scaled % 1000000;
+    for (int i=5; i >= 0; i--) {
+        writer->buffer[writer->size + i] = '0' + fraction % 10;
+        fraction = fraction / 10;
+    }
+    writer->size = writer->size + 6;
+}
+
+// Convert an assimp mesh to the binary vertex layout and a list of 32 bit triangle indices.
+// Returns false on allocation failure.
+bool object_mesh_to_arrays(struct aiMesh* mesh, struct model_file_vertex** vertices_out, uint32_t** indices_out, size_t* num_indices_out) {
+    struct model_file_vertex* vertices = malloc(sizeof(struct model_file_vertex) * (mesh->mNumVertices + 1));
+    uint32_t* indices = malloc(sizeof(uint32_t) * ((size_t)mesh->mNumFaces * 3 + 1));
+    if (vertices == NULL || indices == NULL) {
+        free(vertices);
+        free(indices);
+        return false;
+    }
+
+    if (mesh->mNormals == NULL) {
+        printf("No normal found\n");
+    }
 
-// Load the mesh from the scene nodes
-void object_load_mesh(FILE* output_file, struct aiMesh* mesh) {
-    // Initialise current mesh
-    // Iterate through the mesh poisitons
     for (unsigned int i=0; i < mesh->mNumVertices; i++) {
-        // Copy the vertex positions and print them to the new model file
-        fprintf(output_file, "v %f %f %f", mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        struct model_file_vertex vertex = {
+            {mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z},
+            {0.0, 0.0, 0.0, 1.0},
+            {0.0, 0.0, 0.0}
+        };
 
-        // Copy the vertex colours and print them to the new model file
         if (mesh->mColors[0] != NULL) {
-            fprintf(output_file, " %f %f %f %f", mesh->mColors[0][i].r, mesh->mColors[0][i].g, mesh->mColors[0][i].b, mesh->mColors[0][i].a);
-        }
-        else {
-            fprintf(output_file, " %f %f %f %f", 0.0, 0.0, 0.0, 1.0);
+            vertex.vertex_color[0] = mesh->mColors[0][i].r;
+            vertex.vertex_color[1] = mesh->mColors[0][i].g;
+            vertex.vertex_color[2] = mesh->mColors[0][i].b;
+            vertex.vertex_color[3] = mesh->mColors[0][i].a;
         }
 
-        // Copy the vertex normals and print them to the new model file
         if (mesh->mNormals != NULL) {
-            fprintf(output_file, " %f %f %f\n", mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
-        }
-        else {
-            printf("No normal found\n");
-            fprintf(output_file, " %f %f %f\n", 0.0, 0.0, 0.0);
+            vertex.normal[0] = mesh->mNormals[i].x;
+            vertex.normal[1] = mesh->mNormals[i].y;
+            vertex.normal[2] = mesh->mNormals[i].z;
         }
+        vertices[i] = vertex;
     }
 
-    // Copy the face indicies
+    // Only keep triangles, since the renderer draws triangles.
+    size_t num_indices = 0;
     for (unsigned int i=0; i < mesh->mNumFaces; i++) {
         struct aiFace face = mesh->mFaces[i];
-        for (unsigned int j=0; j < face.mNumIndices; j++) {
-            fprintf(output_file, "f %d\n", face.mIndices[j]);
+        if (face.mNumIndices != 3) continue;
+        for (unsigned int j=0; j < 3; j++) {
+            indices[num_indices] = face.mIndices[j];
+            num_indices++;
         }
     }
+
+    *vertices_out = vertices;
+    *indices_out = indices;
+    *num_indices_out = num_indices;
+    return true;
+}
+
+// Run the vertex cache, overdraw and vertex fetch optimisations on a mesh, returning the vertex cache statistics before and after.
+// The vertex count may shrink, as vertices no triangle uses are dropped.
+void object_optimise_mesh(struct model_file_vertex* vertices, size_t* num_vertices, uint32_t* indices, size_t num_indices, struct mesh_cache_stats* before, struct mesh_cache_stats* after) {
+    *before = mesh_analyse_vertex_cache(indices, num_indices, *num_vertices, MESH_OPTIMISE_ANALYSE_CACHE_SIZE);
+    *after = *before;
+
+    if (mesh_optimise_vertex_cache(indices, num_indices, *num_vertices) == false
+        || mesh_optimise_overdraw(vertices, *num_vertices, indices, num_indices) == false) {
+        printf("object_optimise_mesh(): Failed to allocate memory, leaving mesh unoptimised.\n");
+        return;
+    }
+
+    size_t reordered_vertices = mesh_optimise_vertex_fetch(vertices, *num_vertices, indices, num_indices);
+    if (reordered_vertices > 0) {
+        *num_vertices = reordered_vertices;
+    }
+
+    *after = mesh_analyse_vertex_cache(indices, num_indices, *num_vertices, MESH_OPTIMISE_ANALYSE_CACHE_SIZE);
+}
+
+// Load the mesh from the scene nodes
+// All meshes share one vertex list in the text format, so indices are offset by the number of vertices written before this mesh.
+// Only triangle faces are written, since the renderer draws triangles.
+// Returns the number of vertices written.
+unsigned int object_load_mesh(struct text_writer* writer, struct aiMesh* mesh, unsigned int vertex_base, const struct converter_options* options) {
+    // Initialise current mesh
+    struct model_file_vertex* vertices = NULL;
+    uint32_t* indices = NULL;
+    size_t num_vertices = mesh->mNumVertices;
+    size_t num_indices = 0;
+    if (object_mesh_to_arrays(mesh, &vertices, &indices, &num_indices) == false) {
+        printf("object_load_mesh(): Failed to allocate memory for mesh. Exiting.\n");
+        exit(-1);
+    }
+
+    if (options->optimise == true) {
+        struct mesh_cache_stats before;
+        struct mesh_cache_stats after;
+        object_optimise_mesh(vertices, &num_vertices, indices, num_indices, &before, &after);
+        printf("Optimised mesh with %zu triangles: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f.\n", num_indices / 3, before.acmr, after.acmr, before.atvr, after.atvr);
+    }
+
+    // Iterate through the mesh poisitons and print the positions, colours and normals to the new model file
+    for (size_t i=0; i < num_vertices; i++) {
+        const float* values[3] = {vertices[i].position, vertices[i].vertex_color, vertices[i].normal};
+        const int counts[3] = {3, 4, 3};
+        text_writer_reserve(writer, 10 * 65 + 2);
+        text_writer_char(writer, 'v');
+        for (int j=0; j < 3; j++) {
+            for (int k=0; k < counts[j]; k++) {
+                text_writer_char(writer, ' ');
+                text_writer_float(writer, values[j][k]);
+            }
+        }
+        text_writer_char(writer, '\n');
+    }
+
+    // Copy the face indicies
+    for (size_t i=0; i < num_indices; i++) {
+        text_writer_reserve(writer, 16);
+        text_writer_char(writer, 'f');
+        text_writer_char(writer, ' ');
+        text_writer_uint(writer, vertex_base + indices[i]);
+        text_writer_char(writer, '\n');
+    }
+
+    free(vertices);
+    free(indices);
+    return num_vertices;
 }
 
 // A recursive function that goes through all the meshes in the scene and calls the load mesh function whenever it hits a mesh node
-void object_assimp_load_node(FILE* output_file, struct aiNode* node, const struct aiScene* scene) {
+// The vertex base counts the vertices written so far, so each mesh's indices can be offset past them.
+void object_assimp_load_node(struct text_writer* writer, struct aiNode* node, const struct aiScene* scene, unsigned int* vertex_base, const struct converter_options* options) {
     if (node == NULL) return;
 
     for (size_t i=0; i < node->mNumMeshes; i++) {
         struct aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-        object_load_mesh(output_file, mesh);
+        *vertex_base = *vertex_base + object_load_mesh(writer, mesh, *vertex_base, options);
     }
 
     for (size_t i=0; i < node->mNumChildren; i++) {
-        object_assimp_load_node(output_file, node->mChildren[i], scene);
+        object_assimp_load_node(writer, node->mChildren[i], scene, vertex_base, options);
     }
 }
 
-int main(int argc, char* argv[]) {
-    // Process arguments.
-    if (argc != 2) {
-        printf("export_model_to_web: Usage: ./export_model_to_web 'model_name'. Exiting.\n");
-        return -1;
+// A growable list of the meshes found while walking the scene, used by the binary writer which needs to know every mesh up front.
+struct mesh_list {
+    struct aiMesh** meshes;
+    size_t num_meshes;
+    size_t capacity;
+};
+
+// Recursively collect every mesh referenced by the scene nodes into the mesh list.
+// Returns false if memory could not be allocated.
+bool object_assimp_collect_meshes(struct mesh_list* list, struct aiNode* node, const struct aiScene* scene) {
+    if (node == NULL) return true;
+
+    for (size_t i=0; i < node->mNumMeshes; i++) {
+        if (list->num_meshes == list->capacity) {
+            size_t capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+            struct aiMesh** meshes = realloc(list->meshes, sizeof(struct aiMesh*) * capacity);
+            if (meshes == NULL) return false;
+            list->meshes = meshes;
+            list->capacity = capacity;
+        }
+        list->meshes[list->num_meshes] = scene->mMeshes[node->mMeshes[i]];
+        list->num_meshes++;
     }
 
-    // Open the model file and scene and calculate the filesize:
-    const struct aiScene* scene = aiImportFile(argv[1], aiProcess_CalcTangentSpace|aiProcess_Triangulate|aiProcess_JoinIdenticalVertices|aiProcess_SortByPType|aiProcess_GenUVCoords|aiProcess_GenNormals);
-    if (scene == NULL) {
-        printf("object_new(): Failed to import model. Error: %s. Exiting.\n", aiGetErrorString());
-        return -1;
+    for (size_t i=0; i < node->mNumChildren; i++) {
+        if (object_assimp_collect_meshes(list, node->mChildren[i], scene) == false) return false;
     }
-    struct aiNode* node = scene->mRootNode;
+    return true;
+}
 
-    // Create the file to write the output model to.
-    FILE* output_file = fopen("output_model", "w+");
-    if (output_file == NULL) {
-        printf("object_new(): Failed to create new model file to export, exiting.\n");
+// A growable list of 16 bit indexable meshes ready to be written to a binary model.
+struct chunk_list {
+    struct mesh_chunk* chunks;
+    size_t num_chunks;
+    size_t capacity;
+};
 
-        return -1;
+// Append chunks to the chunk list, taking ownership of them. Returns false on allocation failure.
+bool object_append_chunks(struct chunk_list* list, struct mesh_chunk* chunks, size_t num_chunks) {
+    if (list->num_chunks + num_chunks > list->capacity) {
+        size_t capacity = (list->num_chunks + num_chunks) * 2;
+        struct mesh_chunk* grown = realloc(list->chunks, sizeof(struct mesh_chunk) * capacity);
+        if (grown == NULL) {
+            mesh_split_free(chunks, num_chunks);
+            return false;
+        }
+        list->chunks = grown;
+        list->capacity = capacity;
+    }
+    if (num_chunks > 0) {
+        memcpy(&list->chunks[list->num_chunks], chunks, sizeof(struct mesh_chunk) * num_chunks);
+    }
+    list->num_chunks = list->num_chunks + num_chunks;
+    free(chunks);
+    return true;
+}
+
+// Everything needed to turn the cluster tree into chunks and file nodes.
+struct cluster_build {
+    const struct model_file_vertex* vertices;
+    const uint32_t* indices;
+    struct mesh_cluster_node* nodes;
+    struct model_file_node* file_nodes;
+    uint32_t* remap;
+    struct chunk_list* list;
+    const struct converter_options* options;
+    struct mesh_cache_stats before;
+    struct mesh_cache_stats after;
+    size_t optimised_triangles;
+    size_t optimised_vertices;
+};
+
+// Turn a cluster node's subtree into chunks, depth first so every subtree's chunks are contiguous in the chunk list.
+// Each leaf is copied out, optionally optimised, and split if it still has more vertices than 16 bit indices can address.
+bool object_build_cluster(struct cluster_build* build, uint32_t node_index) {
+    struct mesh_cluster_node* node = &build->nodes[node_index];
+    struct model_file_node* file_node = &build->file_nodes[node_index];
+    memcpy(file_node->bounds_min, node->bounds_min, sizeof(float) * 3);
+    memcpy(file_node->bounds_max, node->bounds_max, sizeof(float) * 3);
+    file_node->first_child = node->first_child;
+    file_node->num_children = node->num_children;
+    file_node->first_mesh = build->list->num_chunks;
+
+    for (uint32_t i=node->first_child; i < node->first_child + node->num_children; i++) {
+        if (object_build_cluster(build, i) == false) return false;
+    }
+
+    if (node->num_children == 0 && node->num_triangles > 0) {
+        struct model_file_vertex* vertices = NULL;
+        uint32_t* indices = NULL;
+        size_t num_vertices = 0;
+        size_t num_indices = 0;
+        if (mesh_cluster_extract(build->vertices, build->indices, node, build->remap, &vertices, &num_vertices, &indices, &num_indices) == false) return false;
+
+        // Sum the cache misses before and after, so the statistics can be reported for the whole scene.
+        if (build->options->optimise == true) {
+            struct mesh_cache_stats before;
+            struct mesh_cache_stats after;
+            size_t original_vertices = num_vertices;
+            object_optimise_mesh(vertices, &num_vertices, indices, num_indices, &before, &after);
+            build->before.acmr = build->before.acmr + before.acmr * (num_indices / 3);
+            build->before.atvr = build->before.atvr + before.atvr * original_vertices;
+            build->after.acmr = build->after.acmr + after.acmr * (num_indices / 3);
+            build->after.atvr = build->after.atvr + after.atvr * original_vertices;
+            build->optimised_triangles = build->optimised_triangles + num_indices / 3;
+            build->optimised_vertices = build->optimised_vertices + original_vertices;
+        }
+
+        struct mesh_chunk* chunks = NULL;
+        size_t num_chunks = 0;
+        bool success = mesh_split(vertices, num_vertices, indices, num_indices, &chunks, &num_chunks);
+        free(vertices);
+        free(indices);
+        if (success == false || object_append_chunks(build->list, chunks, num_chunks) == false) return false;
+    }
+
+    file_node->num_meshes = build->list->num_chunks - file_node->first_mesh;
+    return true;
+}
+
+// Convert every collected mesh into one triangle list, partition it into a cluster tree, and turn each leaf
+// into one or more 16 bit indexable chunks, each its own entry in the mesh table.
+// The tree is returned as file nodes whose mesh ranges index the chunk list.
+bool object_build_chunks(struct mesh_list* meshes, struct chunk_list* list, struct model_file_node** nodes_out, size_t* num_nodes_out, const struct converter_options* options) {
+    *nodes_out = NULL;
+    *num_nodes_out = 0;
+
+    // Merge the meshes, offsetting each mesh's indices past the vertices before it.
+    size_t total_vertices = 0;
+    size_t total_indices = 0;
+    for (size_t i=0; i < meshes->num_meshes; i++) {
+        total_vertices = total_vertices + meshes->meshes[i]->mNumVertices;
+        total_indices = total_indices + (size_t)meshes->meshes[i]->mNumFaces * 3;
+    }
+    struct model_file_vertex* vertices = malloc(sizeof(struct model_file_vertex) * (total_vertices + 1));
+    uint32_t* indices = malloc(sizeof(uint32_t) * (total_indices + 1));
+    if (vertices == NULL || indices == NULL) {
+        free(vertices);
+        free(indices);
+        return false;
+    }
+
+    size_t num_vertices = 0;
+    size_t num_indices = 0;
+    for (size_t i=0; i < meshes->num_meshes; i++) {
+        struct model_file_vertex* mesh_vertices = NULL;
+        uint32_t* mesh_indices = NULL;
+        size_t mesh_num_indices = 0;
+        if (object_mesh_to_arrays(meshes->meshes[i], &mesh_vertices, &mesh_indices, &mesh_num_indices) == false) {
+            free(vertices);
+            free(indices);
+            return false;
+        }
+        memcpy(&vertices[num_vertices], mesh_vertices, sizeof(struct model_file_vertex) * meshes->meshes[i]->mNumVertices);
+        for (size_t j=0; j < mesh_num_indices; j++) {
+            indices[num_indices + j] = (uint32_t)num_vertices + mesh_indices[j];
+        }
+        num_vertices = num_vertices + meshes->meshes[i]->mNumVertices;
+        num_indices = num_indices + mesh_num_indices;
+        free(mesh_vertices);
+        free(mesh_indices);
+    }
+
+    // Partition the scene into clusters.
+    struct cluster_build build;
+    memset(&build, 0, sizeof(build));
+    size_t num_nodes = 0;
+    bool success = mesh_cluster_build(vertices, num_vertices, indices, &num_indices, &build.nodes, &num_nodes);
+    if (success == true) {
+        build.vertices = vertices;
+        build.indices = indices;
+        build.file_nodes = calloc(num_nodes + 1, sizeof(struct model_file_node));
+        build.remap = malloc(sizeof(uint32_t) * (num_vertices + 1));
+        build.list = list;
+        build.options = options;
+        success = build.file_nodes != NULL && build.remap != NULL;
+    }
+    if (success == true) {
+        memset(build.remap, 0xff, sizeof(uint32_t) * (num_vertices + 1));
+        success = object_build_cluster(&build, 0);
+    }
+
+    free(vertices);
+    free(indices);
+    free(build.nodes);
+    free(build.remap);
+    if (success == false) {
+        free(build.file_nodes);
+        return false;
+    }
+
+    size_t num_leaves = 0;
+    for (size_t i=0; i < num_nodes; i++) {
+        if (build.file_nodes[i].num_children == 0) num_leaves++;
+    }
+    printf("Clustered %zu triangles into %zu nodes, %zu leaves and %zu meshes.\n", num_indices / 3, num_nodes, num_leaves, list->num_chunks);
+    if (options->optimise == true && build.optimised_triangles > 0) {
+        printf("Optimised %zu triangles: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f.\n", build.optimised_triangles,
+            build.before.acmr / build.optimised_triangles, build.after.acmr / build.optimised_triangles,
+            build.before.atvr / build.optimised_vertices, build.after.atvr / build.optimised_vertices);
+    }
+
+    *nodes_out = build.file_nodes;
+    *num_nodes_out = num_nodes;
+    return true;
+}
+
+// Pad the output file with zeroes until it reaches the given offset.
+bool object_write_padding(FILE* output_file, uint64_t offset) {
+    static const char zeroes[MODEL_FORMAT_ALIGNMENT] = {0};
+    long position = ftell(output_file);
+    if (position < 0 || (uint64_t)position > offset) return false;
+    size_t padding = offset - (uint64_t)position;
+    return fwrite(zeroes, 1, padding, output_file) == padding;
+}
+
+// Measure how far quantisation moved a chunk's vertices, updating the worst position error in model units,
+// the worst normal error in degrees and the worst colour error in 0 to 1 units.
+void object_measure_quantisation(struct mesh_chunk* chunk, struct model_file_packed_vertex* packed, struct model_file_mesh* entry, double errors[3]) {
+    for (uint32_t i=0; i < chunk->num_vertices; i++) {
+        struct model_file_vertex* vertex = &chunk->vertices[i];
+        for (int k=0; k < 3; k++) {
+            double position = packed[i].position[k] / 65535.0 * entry->position_scale[k] + entry->position_offset[k];
+            double error = fabs(position - vertex->position[k]);
+            if (error > errors[0]) errors[0] = error;
+        }
+
+        float length = sqrtf(vertex->normal[0] * vertex->normal[0] + vertex->normal[1] * vertex->normal[1] + vertex->normal[2] * vertex->normal[2]);
+        if (length > 0.0f) {
+            float encoded[2] = {packed[i].normal[0] / 32767.0f, packed[i].normal[1] / 32767.0f};
+            float normal[3];
+            model_format_decode_octahedral(encoded, normal);
+            double cosine = (normal[0] * vertex->normal[0] + normal[1] * vertex->normal[1] + normal[2] * vertex->normal[2]) / length;
+            double error = acos(cosine > 1.0 ? 1.0 : (cosine < -1.0 ? -1.0 : cosine)) * 180.0 / M_PI;
+            if (error > errors[1]) errors[1] = error;
+        }
+
+        for (int k=0; k < 4; k++) {
+            float color = vertex->vertex_color[k] < 0.0f ? 0.0f : (vertex->vertex_color[k] > 1.0f ? 1.0f : vertex->vertex_color[k]);
+            double error = fabs(packed[i].vertex_color[k] / 255.0 - color);
+            if (error > errors[2]) errors[2] = error;
+        }
+    }
+}
+
+// Write the vertices and 16 bit indices of one chunk in the binary model layout.
+// Packed vertices are written when the chunk has been quantised.
+bool object_write_binary_mesh(FILE* output_file, struct mesh_chunk* chunk, struct model_file_packed_vertex* packed, struct model_file_mesh* entry) {
+    if (object_write_padding(output_file, entry->vertex_offset) == false) return false;
+    if (packed != NULL) {
+        if (fwrite(packed, sizeof(struct model_file_packed_vertex), chunk->num_vertices, output_file) != chunk->num_vertices) return false;
+    }
+    else {
+        if (fwrite(chunk->vertices, sizeof(struct model_file_vertex), chunk->num_vertices, output_file) != chunk->num_vertices) return false;
+    }
+
+    if (object_write_padding(output_file, entry->index_offset) == false) return false;
+    if (fwrite(chunk->indices, sizeof(uint16_t), chunk->num_indices, output_file) != chunk->num_indices) return false;
+    return true;
+}
+
+// Triangle counts and errors of each level of detail across every mesh, for the report.
+struct lod_stats {
+    size_t meshes[MODEL_FORMAT_MAX_LODS];
+    size_t triangles[MODEL_FORMAT_MAX_LODS];
+    float error[MODEL_FORMAT_MAX_LODS];
+};
+
+// Generate levels of detail for a chunk by simplifying it to half the triangles of the previous level,
+// until a level would save less than a tenth of the triangles or MODEL_FORMAT_MAX_LODS is reached.
+// Every level is simplified from the full detail triangles, and its error never drops below the level before it.
+// The chunk's indices are replaced with every level's indices one after another, and the levels are written to lods.
+// Returns the number of levels, or 0 on allocation failure.
+uint32_t object_generate_lods(struct mesh_chunk* chunk, struct model_file_lod* lods, struct lod_stats* stats, const struct converter_options* options) {
+    lods[0] = (struct model_file_lod){0, chunk->num_indices, 0.0f, 0};
+    stats->meshes[0]++;
+    stats->triangles[0] = stats->triangles[0] + chunk->num_indices / 3;
+    if (options->lod == false) return 1;
+
+    // Work on 32 bit copies, with room for every level, which together have at most twice the full detail indices.
+    uint32_t* original = malloc(sizeof(uint32_t) * (chunk->num_indices + 1));
+    uint32_t* simplified = malloc(sizeof(uint32_t) * (chunk->num_indices + 1));
+    uint16_t* levels = malloc(sizeof(uint16_t) * (chunk->num_indices * 2 + 1));
+    if (original == NULL || simplified == NULL || levels == NULL) {
+        free(original);
+        free(simplified);
+        free(levels);
+        return 0;
+    }
+    for (uint32_t i=0; i < chunk->num_indices; i++) {
+        original[i] = chunk->indices[i];
+    }
+    memcpy(levels, chunk->indices, sizeof(uint16_t) * chunk->num_indices);
+
+    uint32_t num_lods = 1;
+    uint32_t num_levels_indices = chunk->num_indices;
+    while (num_lods < MODEL_FORMAT_MAX_LODS) {
+        struct model_file_lod* previous = &lods[num_lods - 1];
+        size_t target = previous->num_indices / 6 * 3;
+        size_t num_indices = 0;
+        float error = 0.0f;
+        if (mesh_simplify(chunk->vertices, chunk->num_vertices, original, chunk->num_indices, target, simplified, &num_indices, &error) == false) {
+            free(original);
+            free(simplified);
+            free(levels);
+            return 0;
+        }
+        if (num_indices == 0 || num_indices * 10 > (size_t)previous->num_indices * 9) break;
+
+        if (options->optimise == true) {
+            mesh_optimise_vertex_cache(simplified, num_indices, chunk->num_vertices);
+        }
+        for (size_t i=0; i < num_indices; i++) {
+            levels[num_levels_indices + i] = (uint16_t)simplified[i];
+        }
+
+        lods[num_lods] = (struct model_file_lod){num_levels_indices, (uint32_t)num_indices, error > previous->error ? error : previous->error, 0};
+        stats->meshes[num_lods]++;
+        stats->triangles[num_lods] = stats->triangles[num_lods] + num_indices / 3;
+        if (lods[num_lods].error > stats->error[num_lods]) stats->error[num_lods] = lods[num_lods].error;
+        num_levels_indices = num_levels_indices + num_indices;
+        num_lods++;
+    }
+
+    free(original);
+    free(simplified);
+    free(chunk->indices);
+    chunk->indices = levels;
+    chunk->num_indices = num_levels_indices;
+    return num_lods;
+}
+
+// Free the packed vertex arrays of every chunk.
+void object_free_packed(struct model_file_packed_vertex** packed, size_t num_chunks) {
+    if (packed == NULL) return;
+    for (size_t i=0; i < num_chunks; i++) {
+        free(packed[i]);
+    }
+    free(packed);
+}
+
+// One mesh of a streamed model, with its vertices and levels of detail reordered for streaming.
+struct stream_mesh {
+    struct model_file_packed_vertex* vertices;
+    uint16_t* indices;
+};
+
+// Reorder a quantised chunk for streaming: vertices by first use from the coarsest level of detail to full detail,
+// and the levels' indices from coarsest to full detail, so every level only adds to the end of the ones before it.
+// The level of detail table entries written to stream_lods count the vertices each level needs.
+// Returns false on allocation failure.
+bool object_reorder_for_stream(struct mesh_chunk* chunk, struct model_file_packed_vertex* packed, struct model_file_mesh* entry, struct model_file_lod* lods, struct stream_mesh* mesh, struct model_stream_lod* stream_lods) {
+    uint32_t* remap = malloc(sizeof(uint32_t) * (chunk->num_vertices + 1));
+    mesh->vertices = malloc(sizeof(struct model_file_packed_vertex) * (chunk->num_vertices + 1));
+    mesh->indices = malloc(sizeof(uint16_t) * (chunk->num_indices + 1));
+    if (remap == NULL || mesh->vertices == NULL || mesh->indices == NULL) {
+        free(remap);
+        return false;
+    }
+    memset(remap, 0xff, sizeof(uint32_t) * chunk->num_vertices);
+
+    uint32_t num_vertices = 0;
+    uint32_t num_indices = 0;
+    for (uint32_t j=entry->num_lods; j > 0; j--) {
+        struct model_file_lod* lod = &lods[j - 1];
+        stream_lods[j - 1].first_index = num_indices;
+        stream_lods[j - 1].num_indices = lod->num_indices;
+        stream_lods[j - 1].error = lod->error;
+        for (uint32_t i=0; i < lod->num_indices; i++) {
+            uint16_t index = chunk->indices[lod->first_index + i];
+            if (remap[index] == UINT32_MAX) {
+                remap[index] = num_vertices;
+                mesh->vertices[num_vertices] = packed[index];
+                num_vertices++;
+            }
+            mesh->indices[num_indices] = (uint16_t)remap[index];
+            num_indices++;
+        }
+        stream_lods[j - 1].num_vertices = num_vertices;
+    }
+
+    // Vertices no level uses still belong to the mesh, and arrive with full detail.
+    for (uint32_t i=0; i < chunk->num_vertices; i++) {
+        if (remap[i] != UINT32_MAX) continue;
+        remap[i] = num_vertices;
+        mesh->vertices[num_vertices] = packed[i];
+        num_vertices++;
+    }
+    stream_lods[0].num_vertices = num_vertices;
+    free(remap);
+    return true;
+}
+
+// Write a quantised model as a compressed streamed model, for the web build to download and decode as it arrives.
+// Reports the size of the vertex and index data before and after, how early the coarsest levels of detail arrive,
+// and how fast the file decodes, after checking it decodes back to exactly what was written.
+bool object_write_stream(const char* output_filename, struct chunk_list* list, struct model_file_packed_vertex** packed, struct model_file_mesh* table, struct model_file_lod* lods, struct model_file_node* nodes, size_t num_nodes) {
+    size_t num_lods = 0;
+    for (size_t i=0; i < list->num_chunks; i++) {
+        num_lods = num_lods + table[i].num_lods;
+    }
+    struct model_stream_mesh* stream_table = calloc(list->num_chunks + 1, sizeof(struct model_stream_mesh));
+    struct model_stream_lod* stream_lods = calloc(num_lods + 1, sizeof(struct model_stream_lod));
+    struct stream_mesh* meshes = calloc(list->num_chunks + 1, sizeof(struct stream_mesh));
+    struct model_stream_bytes file = {NULL, 0, 0};
+    struct model_stream_bytes block = {NULL, 0, 0};
+    bool success = stream_table != NULL && stream_lods != NULL && meshes != NULL;
+
+    // Reorder every mesh, and fill in its mesh table entry.
+    uint64_t raw_vertex_bytes = 0;
+    uint64_t raw_index_bytes = 0;
+    for (size_t i=0; success && i < list->num_chunks; i++) {
+        struct model_stream_mesh* entry = &stream_table[i];
+        entry->num_vertices = table[i].num_vertices;
+        entry->num_indices = table[i].num_indices;
+        entry->first_lod = table[i].first_lod;
+        entry->num_lods = table[i].num_lods;
+        entry->translucent = 0;
+        for (uint32_t j=0; j < table[i].num_vertices; j++) {
+            if (packed[i][j].vertex_color[3] < 255) entry->translucent = 1;
+        }
+        memcpy(entry->position_offset, table[i].position_offset, sizeof(float) * 3);
+        memcpy(entry->position_scale, table[i].position_scale, sizeof(float) * 3);
+        memcpy(entry->bounds_min, table[i].bounds_min, sizeof(float) * 3);
+        memcpy(entry->bounds_max, table[i].bounds_max, sizeof(float) * 3);
+        memcpy(entry->bounds_centre, table[i].bounds_centre, sizeof(float) * 3);
+        entry->bounds_radius = table[i].bounds_radius;
+        success = object_reorder_for_stream(&list->chunks[i], packed[i], &table[i], &lods[table[i].first_lod], &meshes[i], &stream_lods[table[i].first_lod]);
+        raw_vertex_bytes = raw_vertex_bytes + (uint64_t)sizeof(struct model_file_packed_vertex) * entry->num_vertices;
+        raw_index_bytes = raw_index_bytes + (uint64_t)sizeof(uint16_t) * entry->num_indices;
+    }
+
+    // Lay out the header and tables, then the chunks in rounds from the coarsest level of every mesh to full detail.
+    struct model_stream_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_STREAM_MAGIC, MODEL_FORMAT_MAGIC_SIZE);
+    header.version = MODEL_STREAM_VERSION;
+    header.num_meshes = list->num_chunks;
+    header.num_nodes = num_nodes;
+    header.num_lods = num_lods;
+    header.num_chunks = num_lods;
+    success = success && model_stream_bytes_append(&file, &header, sizeof(header))
+        && model_stream_bytes_append(&file, stream_table, sizeof(struct model_stream_mesh) * list->num_chunks)
+        && model_stream_bytes_append(&file, nodes, sizeof(struct model_file_node) * num_nodes)
+        && model_stream_bytes_append(&file, stream_lods, sizeof(struct model_stream_lod) * num_lods);
+
+    uint64_t vertex_bytes = 0;
+    uint64_t index_bytes = 0;
+    size_t coarsest_bytes = 0;
+    for (uint32_t round=0; success && round < MODEL_FORMAT_MAX_LODS; round++) {
+        for (size_t i=0; success && i < list->num_chunks; i++) {
+            if (round >= stream_table[i].num_lods) continue;
+            uint32_t level = stream_table[i].num_lods - 1 - round;
+            struct model_stream_lod* lod = &stream_lods[stream_table[i].first_lod + level];
+            uint32_t first_vertex = level + 1 < stream_table[i].num_lods ? stream_lods[stream_table[i].first_lod + level + 1].num_vertices : 0;
+            struct model_stream_chunk chunk = {(uint32_t)i, level, first_vertex, lod->num_vertices - first_vertex, lod->num_indices, 0, 0, 0};
+
+            // Code the vertex stream and the index stream, then write the chunk header with their sizes in front of them.
+            size_t header_offset = file.size;
+            success = model_stream_bytes_append(&file, &chunk, sizeof(chunk));
+            block.size = 0;
+            success = success && model_stream_encode_vertices(meshes[i].vertices, first_vertex, chunk.num_vertices, &block);
+            size_t start = file.size;
+            success = success && model_stream_encode_block(block.data, block.size, &file);
+            chunk.vertex_size = file.size - start;
+            block.size = 0;
+            success = success && model_stream_encode_indices(&meshes[i].indices[lod->first_index], lod->num_indices, first_vertex, &block);
+            start = file.size;
+            success = success && model_stream_encode_block(block.data, block.size, &file);
+            chunk.index_size = file.size - start;
+            if (success == false) break;
+            memcpy(file.data + header_offset, &chunk, sizeof(chunk));
+            vertex_bytes = vertex_bytes + chunk.vertex_size;
+            index_bytes = index_bytes + chunk.index_size;
+        }
+        if (round == 0) coarsest_bytes = file.size;
+    }
+    if (success == true) {
+        header.file_size = file.size;
+        memcpy(file.data, &header, sizeof(header));
+    }
+
+    // Decode the file back, a piece at a time as a download would arrive, and check it matches.
+    if (success == true) {
+        struct model_stream_decoder decoder;
+        model_stream_init(&decoder);
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t offset=0; offset < file.size; offset = offset + OBJECT_STREAM_PIECE_SIZE) {
+            size_t size = file.size - offset < OBJECT_STREAM_PIECE_SIZE ? file.size - offset : OBJECT_STREAM_PIECE_SIZE;
+            model_stream_feed(&decoder, file.data + offset, size);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+        success = decoder.status == MODEL_STREAM_DONE;
+        for (size_t i=0; success && i < list->num_chunks; i++) {
+            success = memcmp(decoder.vertices[i], meshes[i].vertices, sizeof(struct model_file_packed_vertex) * stream_table[i].num_vertices) == 0
+                && memcmp(decoder.indices[i], meshes[i].indices, sizeof(uint16_t) * stream_table[i].num_indices) == 0;
+        }
+        for (size_t i=0; decoder.vertices != NULL && i < list->num_chunks; i++) {
+            free(decoder.vertices[i]);
+            free(decoder.indices[i]);
+        }
+        model_stream_free(&decoder);
+        if (success == false) {
+            printf("object_write_stream(): The streamed model does not decode back to the model written.\n");
+        }
+        else {
+            uint64_t raw_bytes = raw_vertex_bytes + raw_index_bytes;
+            printf("Streamed %zu meshes in %zu chunks: vertices %.1f KB -> %.1f KB, indices %.1f KB -> %.1f KB, %.1f KB in all (%.0f%% of the quantised geometry).\n",
+                list->num_chunks, num_lods, raw_vertex_bytes / 1024.0, vertex_bytes / 1024.0, raw_index_bytes / 1024.0, index_bytes / 1024.0,
+                file.size / 1024.0, raw_bytes > 0 ? file.size * 100.0 / raw_bytes : 0.0);
+            printf("The coarsest level of every mesh arrives in the first %.1f KB (%.0f%% of the file).\n", coarsest_bytes / 1024.0, coarsest_bytes * 100.0 / file.size);
+            printf("Decoded in %.2f ms: %.1f MB/s of file, %.1f MB/s of geometry.\n", seconds * 1000.0, file.size / 1048576.0 / seconds, raw_bytes / 1048576.0 / seconds);
+        }
+    }
+
+    if (success == true) {
+        FILE* output_file = fopen(output_filename, "wb");
+        if (output_file == NULL) {
+            printf("object_write_stream(): Failed to create '%s'.\n", output_filename);
+            success = false;
+        }
+        else {
+            success = fwrite(file.data, 1, file.size, output_file) == file.size;
+            if (success == false) printf("object_write_stream(): Failed to write to '%s'.\n", output_filename);
+            fclose(output_file);
+        }
+    }
+    else if (stream_table == NULL || file.data == NULL) {
+        printf("object_write_stream(): Failed to allocate memory for the streamed model.\n");
+    }
+
+    for (size_t i=0; meshes != NULL && i < list->num_chunks; i++) {
+        free(meshes[i].vertices);
+        free(meshes[i].indices);
+    }
+    free(meshes);
+    free(stream_table);
+    free(stream_lods);
+    free(file.data);
+    free(block.data);
+    return success;
+}
+
+// Write every mesh in the scene to a binary model file that the renderer can memory map.
+// The scene is partitioned into a cluster tree whose leaves become entries in the mesh table,
+// so indices never need offsetting and every entry can be drawn with 16 bit indices.
+// With quantisation, every entry is stored in the packed vertex layout and the precision lost is reported.
+// With streaming, the quantised model is written compressed for downloading instead.
+bool object_write_binary(const char* output_filename, const struct aiScene* scene, const struct converter_options* options) {
+    struct mesh_list meshes = {NULL, 0, 0};
+    struct chunk_list list = {NULL, 0, 0};
+    struct model_file_node* nodes = NULL;
+    size_t num_nodes = 0;
+    struct model_file_mesh* table = NULL;
+    struct model_file_packed_vertex** packed = NULL;
+    struct model_file_lod* lods = NULL;
+    FILE* output_file = NULL;
+    bool success = object_assimp_collect_meshes(&meshes, scene->mRootNode, scene) == true && object_build_chunks(&meshes, &list, &nodes, &num_nodes, options) == true;
+    free(meshes.meshes);
+    if (success == false) {
+        printf("object_write_binary(): Failed to allocate memory for meshes.\n");
+    }
+
+    if (success == true) {
+        table = calloc(list.num_chunks + 1, sizeof(struct model_file_mesh));
+        packed = calloc(list.num_chunks + 1, sizeof(struct model_file_packed_vertex*));
+        lods = calloc(list.num_chunks * MODEL_FORMAT_MAX_LODS + 1, sizeof(struct model_file_lod));
+        if (table == NULL || packed == NULL || lods == NULL) {
+            printf("object_write_binary(): Failed to allocate memory for mesh table.\n");
+            success = false;
+        }
+    }
+
+    // Generate the levels of detail first, as they add to each mesh's indices.
+    struct lod_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    size_t num_lods = 0;
+    for (size_t i=0; success == true && i < list.num_chunks; i++) {
+        table[i].first_lod = num_lods;
+        table[i].num_lods = object_generate_lods(&list.chunks[i], &lods[num_lods], &stats, options);
+        if (table[i].num_lods == 0) {
+            printf("object_write_binary(): Failed to allocate memory for levels of detail.\n");
+            success = false;
+        }
+        num_lods = num_lods + table[i].num_lods;
+    }
+    if (success == true && options->lod == true) {
+        for (int i=0; i < MODEL_FORMAT_MAX_LODS && stats.meshes[i] > 0; i++) {
+            printf("Level of detail %d: %zu meshes, %zu triangles, largest error %g units.\n", i, stats.meshes[i], stats.triangles[i], stats.error[i]);
+        }
+    }
+
+    // Lay out the file: header, mesh table, node table, level of detail table, then an aligned vertex and index blob per mesh.
+    struct model_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_FORMAT_MAGIC, MODEL_FORMAT_MAGIC_SIZE);
+    header.version = MODEL_FORMAT_VERSION;
+    header.header_size = sizeof(struct model_file_header);
+    header.vertex_size = sizeof(struct model_file_vertex);
+    header.num_meshes = list.num_chunks;
+    header.mesh_table_offset = model_format_align(sizeof(struct model_file_header));
+
+    header.num_nodes = num_nodes;
+    header.node_table_offset = model_format_align(header.mesh_table_offset + sizeof(struct model_file_mesh) * list.num_chunks);
+
+    header.num_lods = num_lods;
+    header.lod_table_offset = model_format_align(header.node_table_offset + sizeof(struct model_file_node) * num_nodes);
+
+    uint64_t offset = header.lod_table_offset + sizeof(struct model_file_lod) * num_lods;
+    uint64_t float_bytes = 0;
+    double errors[3] = {0.0, 0.0, 0.0};
+    for (size_t i=0; success == true && i < list.num_chunks; i++) {
+        table[i].num_vertices = list.chunks[i].num_vertices;
+        table[i].num_indices = list.chunks[i].num_indices;
+        table[i].index_size = sizeof(uint16_t);
+        table[i].vertex_format = MODEL_FORMAT_VERTEX_FLOAT;
+        for (int k=0; k < 3; k++) {
+            table[i].position_offset[k] = 0.0;
+            table[i].position_scale[k] = 1.0;
+        }
+        model_format_compute_bounds(list.chunks[i].vertices, table[i].num_vertices, table[i].bounds_min, table[i].bounds_max, table[i].bounds_centre, &table[i].bounds_radius);
+
+        // Quantise the chunk's vertices against its own bounds.
+        if (options->quantise == true) {
+            packed[i] = malloc(sizeof(struct model_file_packed_vertex) * (table[i].num_vertices + 1));
+            if (packed[i] == NULL) {
+                printf("object_write_binary(): Failed to allocate memory for packed vertices.\n");
+                success = false;
+                break;
+            }
+            table[i].vertex_format = MODEL_FORMAT_VERTEX_PACKED;
+            model_format_pack_vertices(list.chunks[i].vertices, table[i].num_vertices, packed[i], &table[i]);
+            object_measure_quantisation(&list.chunks[i], packed[i], &table[i], errors);
+        }
+        table[i].vertex_size = model_format_vertex_size(table[i].vertex_format);
+        float_bytes = float_bytes + (uint64_t)sizeof(struct model_file_vertex) * table[i].num_vertices;
+
+        table[i].vertex_offset = model_format_align(offset);
+        offset = table[i].vertex_offset + (uint64_t)table[i].vertex_size * table[i].num_vertices;
+        table[i].index_offset = model_format_align(offset);
+        offset = table[i].index_offset + (uint64_t)table[i].index_size * table[i].num_indices;
+    }
+    header.file_size = offset;
+
+    // Report what quantisation cost in precision and saved in memory.
+    if (success == true && options->quantise == true) {
+        uint64_t packed_bytes = float_bytes / sizeof(struct model_file_vertex) * sizeof(struct model_file_packed_vertex);
+        printf("Quantised %zu meshes: vertex data %.2f MB -> %.2f MB (%.0f%% smaller).\n", list.num_chunks, float_bytes / 1048576.0, packed_bytes / 1048576.0, float_bytes > 0 ? 100.0 - packed_bytes * 100.0 / float_bytes : 0.0);
+        printf("Largest errors: position %g units, normal %.4f degrees, colour %.4f.\n", errors[0], errors[1], errors[2]);
+    }
+
+    // Write the streamed format instead, or the file laid out above. A file that fails part way is removed,
+    // so a batch conversion never mistakes it for an up to date output.
+    if (success == true && options->stream == true) {
+        success = object_write_stream(output_filename, &list, packed, table, lods, nodes, num_nodes);
+    }
+    else if (success == true) {
+        output_file = fopen(output_filename, "wb");
+        if (output_file == NULL) {
+            printf("object_write_binary(): Failed to create '%s'.\n", output_filename);
+            success = false;
+        }
+        success = success && fwrite(&header, sizeof(header), 1, output_file) == 1;
+        success = success && object_write_padding(output_file, header.mesh_table_offset);
+        if (success && list.num_chunks > 0) {
+            success = fwrite(table, sizeof(struct model_file_mesh), list.num_chunks, output_file) == list.num_chunks;
+        }
+        success = success && object_write_padding(output_file, header.node_table_offset);
+        if (success && num_nodes > 0) {
+            success = fwrite(nodes, sizeof(struct model_file_node), num_nodes, output_file) == num_nodes;
+        }
+        success = success && object_write_padding(output_file, header.lod_table_offset);
+        if (success && num_lods > 0) {
+            success = fwrite(lods, sizeof(struct model_file_lod), num_lods, output_file) == num_lods;
+        }
+        for (size_t i=0; success && i < list.num_chunks; i++) {
+            success = object_write_binary_mesh(output_file, &list.chunks[i], packed[i], &table[i]);
+        }
+        if (output_file != NULL && success == false) {
+            printf("object_write_binary(): Failed to write to '%s'.\n", output_filename);
+        }
+    }
+
+    // Free everything, whichever step it got to.
+    if (output_file != NULL) {
+        if (fclose(output_file) != 0) success = false;
+        if (success == false) unlink(output_filename);
+    }
+    object_free_packed(packed, list.num_chunks);
+    free(table);
+    free(lods);
+    free(nodes);
+    mesh_split_free(list.chunks, list.num_chunks);
+    return success;
+}
+
+// Write every mesh in the scene to a text model file, which the renderer parses and the web build can embed.
+bool object_write_text(const char* output_filename, const struct aiScene* scene, const struct converter_options* options) {
+    struct text_writer writer;
+    if (text_writer_open(&writer, output_filename) == false) {
+        printf("object_write_text(): Failed to create '%s'.\n", output_filename);
+        return false;
     }
 
     // Load the recursive function to search the loaded scene and copy all meshes to the output model file
-    object_assimp_load_node(output_file, node, scene);
+    unsigned int vertex_base = 0;
+    object_assimp_load_node(&writer, scene->mRootNode, scene, &vertex_base, options);
+
+    if (text_writer_close(&writer) == false) {
+        printf("object_write_text(): Failed to write to '%s'.\n", output_filename);
+        return false;
+    }
+    return true;
+}
+
+// Convert a model file to the text model, or the binary or streamed model if the options ask for it.
+bool object_convert_file(const char* model_name, const char* output_filename, const struct converter_options* options) {
+    // Open the model file and scene
+    const struct aiScene* scene = aiImportFile(model_name, aiProcess_CalcTangentSpace|aiProcess_Triangulate|aiProcess_JoinIdenticalVertices|aiProcess_SortByPType|aiProcess_GenUVCoords|aiProcess_GenNormals);
+    if (scene == NULL) {
+        printf("object_convert_file(): Failed to import '%s'. Error: %s.\n", model_name, aiGetErrorString());
+        return false;
+    }
 
-    // Close loaded resources.
+    bool success = false;
+    if (options->binary == true) {
+        success = object_write_binary(output_filename, scene, options);
+    }
+    else {
+        success = object_write_text(output_filename, scene, options);
+    }
     aiReleaseImport(scene);
-    fclose(output_file);
+    return success;
+}
+
+// The hashes of the inputs a batch last converted, by input path, as kept in OBJECT_COOK_CACHE_FILENAME.
+struct cook_cache {
+    char** inputs;
+    uint64_t* hashes;
+    size_t count;
+    size_t capacity;
+};
+
+// Return the index of an input in the cache, or SIZE_MAX if it is not there.
+size_t cook_cache_find(struct cook_cache* cache, const char* input) {
+    for (size_t i=0; i < cache->count; i++) {
+        if (strcmp(cache->inputs[i], input) == 0) return i;
+    }
+    return SIZE_MAX;
+}
+
+// Remember an input's hash, replacing any it had. Returns false on allocation failure.
+bool cook_cache_set(struct cook_cache* cache, const char* input, uint64_t hash) {
+    size_t index = cook_cache_find(cache, input);
+    if (index != SIZE_MAX) {
+        cache->hashes[index] = hash;
+        return true;
+    }
+
+    if (cache->count == cache->capacity) {
+        size_t capacity = cache->capacity == 0 ? 64 : cache->capacity * 2;
+        char** inputs = realloc(cache->inputs, sizeof(char*) * capacity);
+        if (inputs == NULL) return false;
+        cache->inputs = inputs;
+        uint64_t* hashes = realloc(cache->hashes, sizeof(uint64_t) * capacity);
+        if (hashes == NULL) return false;
+        cache->hashes = hashes;
+        cache->capacity = capacity;
+    }
+    cache->inputs[cache->count] = strdup(input);
+    if (cache->inputs[cache->count] == NULL) return false;
+    cache->hashes[cache->count] = hash;
+    cache->count++;
+    return true;
+}
+
+// Read the cache file, one hash and input path per line. A missing or damaged cache just means everything is converted.
+void cook_cache_load(struct cook_cache* cache, const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) return;
+
+    char line[4096 + 32];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char* end = NULL;
+        uint64_t hash = strtoull(line, &end, 16);
+        size_t length = strlen(line);
+        if (end == line || *end != ' ' || length == 0 || line[length - 1] != '\n') continue;
+        line[length - 1] = '\0';
+        if (cook_cache_set(cache, end + 1, hash) == false) break;
+    }
+    fclose(file);
+}
+
+// Write the cache file. Returns false if it could not be written.
+bool cook_cache_save(struct cook_cache* cache, const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) return false;
+    bool success = true;
+    for (size_t i=0; i < cache->count; i++) {
+        success = fprintf(file, "%016llx %s\n", (unsigned long long)cache->hashes[i], cache->inputs[i]) > 0 && success;
+    }
+    return fclose(file) == 0 && success;
+}
+
+void cook_cache_free(struct cook_cache* cache) {
+    for (size_t i=0; i < cache->count; i++) {
+        free(cache->inputs[i]);
+    }
+    free(cache->inputs);
+    free(cache->hashes);
+}
+
+// Hash a file's contents with 64 bit FNV-1a, seeded with the converter version and the options that change its output,
+// so changing either converts the file again. Returns false if the file could not be read.
+bool object_hash_file(const char* filename, const struct converter_options* options, uint64_t* hash_out) {
+    FILE* file = fopen(filename, "rb");
+    unsigned char* buffer = malloc(OBJECT_TEXT_BUFFER_SIZE);
+    if (file == NULL || buffer == NULL) {
+        if (file != NULL) fclose(file);
+        free(buffer);
+        return false;
+    }
+
+    uint64_t hash = 14695981039346656037ull;
+    uint32_t seed[] = {OBJECT_COOK_VERSION, MODEL_FORMAT_VERSION, MODEL_STREAM_VERSION, options->binary, options->optimise, options->quantise, options->lod, options->stream};
+    for (size_t i=0; i < sizeof(seed); i++) {
+        hash = (hash ^ ((unsigned char*)seed)[i]) * 1099511628211ull;
+    }
+    size_t size = fread(buffer, 1, OBJECT_TEXT_BUFFER_SIZE, file);
+    while (size > 0) {
+        for (size_t i=0; i < size; i++) {
+            hash = (hash ^ buffer[i]) * 1099511628211ull;
+        }
+        size = fread(buffer, 1, OBJECT_TEXT_BUFFER_SIZE, file);
+    }
+    bool success = ferror(file) == 0;
+    fclose(file);
+    free(buffer);
+    *hash_out = hash;
+    return success;
+}
+
+// What became of an input of a batch conversion.
+#define COOK_PENDING 0
+#define COOK_CONVERTED 1
+#define COOK_UNCHANGED 2
+#define COOK_FAILED 3
+
+// One input of a batch conversion, and where its output goes.
+struct cook_job {
+    char* input;
+    char* output;
+    uint64_t hash;
+    int result;
+    double seconds;
+};
+
+// A batch conversion shared by its worker threads, which take the next job until there are none left.
+// The mutex guards the next job and the workers' progress messages, so lines from different threads never mix.
+// The cache is only read while the workers run.
+struct cook_batch {
+    struct cook_job* jobs;
+    size_t num_jobs;
+    size_t next_job;
+    pthread_mutex_t mutex;
+    struct cook_cache* cache;
+    const struct converter_options* options;
+    bool force;
+};
+
+// Add an input to a batch, naming its output after it in the output directory: 'tree.ply' becomes 'tree',
+// 'tree.bin' or 'tree.stream' depending on the format written. Returns false on allocation failure.
+bool cook_batch_add(struct cook_batch* batch, size_t* capacity, const char* input, const char* output_dir) {
+    if (batch->num_jobs == *capacity) {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        struct cook_job* jobs = realloc(batch->jobs, sizeof(struct cook_job) * *capacity);
+        if (jobs == NULL) return false;
+        batch->jobs = jobs;
+    }
+
+    const char* name = strrchr(input, '/') != NULL ? strrchr(input, '/') + 1 : input;
+    const char* extension = strrchr(name, '.');
+    int name_length = extension != NULL && extension != name ? (int)(extension - name) : (int)strlen(name);
+    const char* suffix = batch->options->stream == true ? ".stream" : batch->options->binary == true ? ".bin" : "";
+    size_t size = strlen(output_dir) + name_length + strlen(suffix) + 2;
+
+    struct cook_job* job = &batch->jobs[batch->num_jobs];
+    job->input = strdup(input);
+    job->output = malloc(size);
+    if (job->input == NULL || job->output == NULL) {
+        free(job->input);
+        free(job->output);
+        return false;
+    }
+    snprintf(job->output, size, "%s/%.*s%s", output_dir, name_length, name, suffix);
+    job->hash = 0;
+    job->result = COOK_PENDING;
+    job->seconds = 0.0;
+    batch->num_jobs++;
+    return true;
+}
+
+int cook_job_compare(const void* a, const void* b) {
+    return strcmp(((const struct cook_job*)a)->input, ((const struct cook_job*)b)->input);
+}
+
+// Fill a batch with every file in a directory that assimp can import, in name order, or with every path listed in a manifest file,
+// one per line. Blank lines and lines starting with '#' are skipped, and relative paths are relative to the manifest.
+// Returns false if the directory or manifest could not be read, or two inputs would write the same output.
+bool cook_batch_collect(struct cook_batch* batch, const char* path, const char* output_dir) {
+    size_t capacity = 0;
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) {
+        printf("cook_batch_collect(): Failed to find '%s'.\n", path);
+        return false;
+    }
+
+    if (S_ISDIR(path_stat.st_mode)) {
+        DIR* directory = opendir(path);
+        if (directory == NULL) {
+            printf("cook_batch_collect(): Failed to open directory '%s'.\n", path);
+            return false;
+        }
+        struct dirent* entry = readdir(directory);
+        while (entry != NULL) {
+            char input[4096];
+            const char* extension = strrchr(entry->d_name, '.');
+            snprintf(input, sizeof(input), "%s/%s", path, entry->d_name);
+            struct stat input_stat;
+            if (entry->d_name[0] != '.' && extension != NULL && aiIsExtensionSupported(extension) == AI_TRUE
+                && stat(input, &input_stat) == 0 && S_ISREG(input_stat.st_mode)) {
+                if (cook_batch_add(batch, &capacity, input, output_dir) == false) {
+                    printf("cook_batch_collect(): Failed to allocate memory for inputs.\n");
+                    closedir(directory);
+                    return false;
+                }
+            }
+            entry = readdir(directory);
+        }
+        closedir(directory);
+        qsort(batch->jobs, batch->num_jobs, sizeof(struct cook_job), cook_job_compare);
+    }
+    else {
+        FILE* manifest = fopen(path, "r");
+        if (manifest == NULL) {
+            printf("cook_batch_collect(): Failed to open manifest '%s'.\n", path);
+            return false;
+        }
+        const char* slash = strrchr(path, '/');
+        int directory_length = slash != NULL ? (int)(slash - path) : 0;
+        char line[4096];
+        while (fgets(line, sizeof(line), manifest) != NULL) {
+            size_t length = strcspn(line, "\r\n");
+            line[length] = '\0';
+            if (length == 0 || line[0] == '#') continue;
+
+            char input[4096 + 4096];
+            if (line[0] == '/' || slash == NULL) {
+                snprintf(input, sizeof(input), "%s", line);
+            }
+            else {
+                snprintf(input, sizeof(input), "%.*s/%s", directory_length, path, line);
+            }
+            if (cook_batch_add(batch, &capacity, input, output_dir) == false) {
+                printf("cook_batch_collect(): Failed to allocate memory for inputs.\n");
+                fclose(manifest);
+                return false;
+            }
+        }
+        fclose(manifest);
+    }
+
+    for (size_t i=0; i < batch->num_jobs; i++) {
+        for (size_t j=i + 1; j < batch->num_jobs; j++) {
+            if (strcmp(batch->jobs[i].output, batch->jobs[j].output) == 0) {
+                printf("cook_batch_collect(): '%s' and '%s' would both be written to '%s'.\n", batch->jobs[i].input, batch->jobs[j].input, batch->jobs[i].output);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Convert the batch's jobs one after another until none are left, skipping inputs whose hash matches the cache.
+void* cook_batch_worker(void* argument) {
+    struct cook_batch* batch = argument;
+    while (true) {
+        pthread_mutex_lock(&batch->mutex);
+        size_t index = batch->next_job;
+        batch->next_job++;
+        pthread_mutex_unlock(&batch->mutex);
+        if (index >= batch->num_jobs) break;
+
+        struct cook_job* job = &batch->jobs[index];
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (object_hash_file(job->input, batch->options, &job->hash) == false) {
+            pthread_mutex_lock(&batch->mutex);
+            printf("cook_batch_worker(): Failed to read '%s'.\n", job->input);
+            pthread_mutex_unlock(&batch->mutex);
+            job->result = COOK_FAILED;
+            continue;
+        }
+        size_t cached = cook_cache_find(batch->cache, job->input);
+        if (batch->force == false && cached != SIZE_MAX && batch->cache->hashes[cached] == job->hash && access(job->output, F_OK) == 0) {
+            job->result = COOK_UNCHANGED;
+            continue;
+        }
+
+        job->result = object_convert_file(job->input, job->output, batch->options) ? COOK_CONVERTED : COOK_FAILED;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        job->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        pthread_mutex_lock(&batch->mutex);
+        printf("%s '%s' -> '%s' in %.1f ms.\n", job->result == COOK_CONVERTED ? "Converted" : "Failed to convert", job->input, job->output, job->seconds * 1000.0);
+        fflush(stdout);
+        pthread_mutex_unlock(&batch->mutex);
+    }
+    return NULL;
+}
+
+// Convert every model in a directory or manifest into the output directory on up to num_threads threads, or one per core if 0.
+// Inputs that have not changed since the output directory's cache was written are skipped unless force is set.
+// Returns true if every input converted or was unchanged.
+bool cook_batch_run(const char* path, const char* output_dir, unsigned int num_threads, bool force, const struct converter_options* options) {
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (mkdir(output_dir, 0755) != 0 && errno != EEXIST) {
+        printf("cook_batch_run(): Failed to create output directory '%s'.\n", output_dir);
+        return false;
+    }
+    char cache_filename[4096];
+    snprintf(cache_filename, sizeof(cache_filename), "%s/%s", output_dir, OBJECT_COOK_CACHE_FILENAME);
+    struct cook_cache cache = {NULL, NULL, 0, 0};
+    cook_cache_load(&cache, cache_filename);
+
+    struct cook_batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.cache = &cache;
+    batch.options = options;
+    batch.force = force;
+    bool success = cook_batch_collect(&batch, path, output_dir);
+
+    // Convert on worker threads, and this one.
+    if (num_threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cores > 0 ? (unsigned int)cores : 1;
+    }
+    if (num_threads > OBJECT_COOK_MAX_THREADS) num_threads = OBJECT_COOK_MAX_THREADS;
+    if (num_threads > batch.num_jobs) num_threads = batch.num_jobs;
+    if (num_threads < 1) num_threads = 1;
+    if (success == true) {
+        pthread_mutex_init(&batch.mutex, NULL);
+        pthread_t threads[OBJECT_COOK_MAX_THREADS];
+        bool started[OBJECT_COOK_MAX_THREADS] = {false};
+        for (unsigned int i=1; i < num_threads; i++) {
+            started[i] = pthread_create(&threads[i], NULL, cook_batch_worker, &batch) == 0;
+        }
+        cook_batch_worker(&batch);
+        for (unsigned int i=1; i < num_threads; i++) {
+            if (started[i] == true) pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&batch.mutex);
+    }
+
+    // Remember the hashes of everything now up to date, keeping entries for inputs outside this batch.
+    size_t counts[4] = {0, 0, 0, 0};
+    for (size_t i=0; i < batch.num_jobs; i++) {
+        struct cook_job* job = &batch.jobs[i];
+        counts[job->result]++;
+        if (job->result == COOK_CONVERTED && cook_cache_set(&cache, job->input, job->hash) == false) {
+            success = false;
+        }
+    }
+    if (counts[COOK_CONVERTED] > 0 && cook_cache_save(&cache, cache_filename) == false) {
+        printf("cook_batch_run(): Failed to write '%s'.\n", cache_filename);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if (success == true) printf("Batch of %zu models on %u threads in %.2f s: %zu converted, %zu unchanged, %zu failed.\n", batch.num_jobs, num_threads, seconds, counts[COOK_CONVERTED], counts[COOK_UNCHANGED], counts[COOK_FAILED]);
+
+    for (size_t i=0; i < batch.num_jobs; i++) {
+        free(batch.jobs[i].input);
+        free(batch.jobs[i].output);
+    }
+    free(batch.jobs);
+    cook_cache_free(&cache);
+    return success && counts[COOK_FAILED] == 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Process arguments.
+    struct converter_options options = {false, false, false, false, false};
+    const char* model_name = NULL;
+    const char* output_filename = NULL;
+    const char* batch_path = NULL;
+    const char* output_dir = ".";
+    unsigned int num_threads = 0;
+    bool force = false;
+    bool valid = true;
+    for (int i=1; i < argc && valid == true; i++) {
+        if (strcmp(argv[i], "--binary") == 0) {
+            options.binary = true;
+        }
+        else if (strcmp(argv[i], "--optimise") == 0) {
+            options.optimise = true;
+        }
+        else if (strcmp(argv[i], "--lod") == 0) {
+            // Levels of detail are only stored in the binary format.
+            options.lod = true;
+            options.binary = true;
+        }
+        else if (strcmp(argv[i], "--quantise") == 0) {
+            // Only the binary format can store quantised vertices.
+            options.quantise = true;
+            options.binary = true;
+        }
+        else if (strcmp(argv[i], "--stream") == 0) {
+            // The streamed format compresses a quantised binary model.
+            options.stream = true;
+            options.quantise = true;
+            options.binary = true;
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_filename = argv[i + 1];
+            i++;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[i + 1];
+            i++;
+        }
+        else if (strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc) {
+            output_dir = argv[i + 1];
+            i++;
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            num_threads = (unsigned int)atoi(argv[i + 1]);
+            i++;
+        }
+        else if (strcmp(argv[i], "--force") == 0) {
+            force = true;
+        }
+        else if (model_name == NULL && argv[i][0] != '-') {
+            model_name = argv[i];
+        }
+        else {
+            valid = false;
+        }
+    }
+
+    if (valid == false || (model_name == NULL) == (batch_path == NULL)) {
+        printf("export_model_to_web: Usage: ./export_model_to_web [--binary] [--optimise] [--quantise] [--lod] [--stream] [--output file] 'model_name'\n");
+        printf("                     or:    ./export_model_to_web [options] --batch directory|manifest [--output-dir directory] [--jobs N] [--force]. Exiting.\n");
+        return -1;
+    }
+
+    // Convert everything in a directory or manifest.
+    if (batch_path != NULL) {
+        return cook_batch_run(batch_path, output_dir, num_threads, force, &options) ? 0 : -1;
+    }
+
+    // Write the model to the file asked for, or the file the renderer looks for by default.
+    if (output_filename == NULL) {
+        output_filename = options.stream == true ? MODEL_STREAM_DEFAULT_FILENAME : options.binary == true ? MODEL_FORMAT_DEFAULT_FILENAME : "output_model";
+    }
+    return object_convert_file(model_name, output_filename, &options) ? 0 : -1;
 }
@@ -0,0 +1,311 @@
+// Software occlusion culling for main.c.
+// Large occluder meshes are rasterised on the CPU into a small depth buffer every frame, and the bounds of clusters
+// and meshes are tested against it before they are queued for drawing, so whatever hills and walls hide is never drawn.
+// Nothing is read back from the GPU, so it behaves the same natively and on WebGL.
+//
+// - The buffer stores 1 / w, the reciprocal of the view depth, which interpolates linearly across the screen.
+//   It clears to zero, infinitely far away, and bigger values are closer.
+// - Triangles are rasterised four pixels at a time with the lanes_*() SIMD functions, against edge functions sampled at pixel centres.
+//   Triangles that face away or cross the near plane are skipped, which only ever makes the occluders smaller.
+// - The screen is split into bands of rows, one for each thread of the job system, each rasterised by a job which also records
+//   the farthest depth of every tile in the band. A box is tested a tile at a time, and only looks at pixels in tiles it is not entirely behind.
+//
+// Include after simd.h and job_system.h.
+
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+// The size of the depth buffer in pixels, and of its tiles. Both dimensions must be multiples of the tile size,
+// and the tile size a multiple of four.
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 144
+#define OCCLUSION_TILE 8
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE)
+
+// The most bands the screen is rasterised in, one row of tiles each.
+#define OCCLUSION_MAX_BANDS OCCLUSION_TILES_Y
+
+// A vertex transformed to the depth buffer: its position in pixels, and 1 / w.
+// Vertices behind the near plane are given a depth of -1, and triangles using them are skipped.
+struct occlusion_vertex {
+    float x;
+    float y;
+    float depth;
+};
+
+// The job rasterising one band of a buffer.
+struct occlusion_band {
+    struct occlusion_buffer* buffer;
+    uint32_t band;
+};
+
+// The depth buffer, the farthest depth of each tile, and the occluder triangles gathered for this frame.
+struct occlusion_buffer {
+    float* depth;
+    float* tiles;
+    struct occlusion_vertex* vertices;
+    size_t num_vertices;
+    size_t vertices_capacity;
+    uint32_t* indices;
+    size_t num_indices;
+    size_t indices_capacity;
+    float view_projection[16];
+    float near;
+    bool rasterised;
+    struct occlusion_band bands[OCCLUSION_MAX_BANDS];
+    uint32_t num_bands;
+};
+
+// Transform a point by a column major matrix of 16 floats.
+static void occlusion_transform(const float* matrix, const float point[3], float result[4]) {
+    for (int row=0; row < 4; row++) {
+        result[row] = matrix[row] * point[0] + matrix[4 + row] * point[1] + matrix[8 + row] * point[2] + matrix[12 + row];
+    }
+}
+
+// Rasterise the frame's occluder triangles into one band of rows, clearing it first, then record the farthest depth of its tiles.
+static void occlusion_rasterise_band(struct occlusion_buffer* buffer, uint32_t band) {
+    int first_row = (int)(OCCLUSION_TILES_Y * band / buffer->num_bands) * OCCLUSION_TILE;
+    int last_row = (int)(OCCLUSION_TILES_Y * (band + 1) / buffer->num_bands) * OCCLUSION_TILE;
+    memset(&buffer->depth[first_row * OCCLUSION_WIDTH], 0, sizeof(float) * OCCLUSION_WIDTH * (last_row - first_row));
+
+    const lanes offsets = lanes_set(0.5f, 1.5f, 2.5f, 3.5f);
+    const lanes zero = lanes_splat(0.0f);
+    for (size_t i=0; i < buffer->num_indices; i += 3) {
+        const struct occlusion_vertex* v0 = &buffer->vertices[buffer->indices[i]];
+        const struct occlusion_vertex* v1 = &buffer->vertices[buffer->indices[i + 1]];
+        const struct occlusion_vertex* v2 = &buffer->vertices[buffer->indices[i + 2]];
+        if (v0->depth < 0.0f || v1->depth < 0.0f || v2->depth < 0.0f) continue;
+
+        // Skip triangles facing away, which wind clockwise on screen.
+        float area = (v1->x - v0->x) * (v2->y - v0->y) - (v2->x - v0->x) * (v1->y - v0->y);
+        if (area <= 0.0f) continue;
+
+        // Find the pixels the triangle's box covers in this band, in whole groups of four along each row.
+        int min_x = (int)floorf(fminf(v0->x, fminf(v1->x, v2->x)));
+        int max_x = (int)ceilf(fmaxf(v0->x, fmaxf(v1->x, v2->x)));
+        int min_y = (int)floorf(fminf(v0->y, fminf(v1->y, v2->y)));
+        int max_y = (int)ceilf(fmaxf(v0->y, fmaxf(v1->y, v2->y)));
+        min_x = min_x < 0 ? 0 : min_x & ~3;
+        max_x = max_x > OCCLUSION_WIDTH ? OCCLUSION_WIDTH : max_x;
+        min_y = min_y < first_row ? first_row : min_y;
+        max_y = max_y > last_row ? last_row : max_y;
+        if (min_x >= max_x || min_y >= max_y) continue;
+
+        // Each edge function is a * x + b * y + c, positive on the inside of the edge.
+        // The depth is interpolated with the edge functions as barycentric weights.
+        float a0 = v1->y - v2->y, b0 = v2->x - v1->x, c0 = v1->x * v2->y - v2->x * v1->y;
+        float a1 = v2->y - v0->y, b1 = v0->x - v2->x, c1 = v2->x * v0->y - v0->x * v2->y;
+        float a2 = v0->y - v1->y, b2 = v1->x - v0->x, c2 = v0->x * v1->y - v1->x * v0->y;
+        float z0 = v0->depth / area;
+        float z1 = v1->depth / area;
+        float z2 = v2->depth / area;
+        float depth_a = a0 * z0 + a1 * z1 + a2 * z2;
+        float depth_b = b0 * z0 + b1 * z1 + b2 * z2;
+        float depth_c = c0 * z0 + c1 * z1 + c2 * z2;
+
+        for (int y=min_y; y < max_y; y++) {
+            float centre_y = y + 0.5f;
+            float* row = &buffer->depth[y * OCCLUSION_WIDTH];
+            for (int x=min_x; x < max_x; x += 4) {
+                lanes centre_x = lanes_add(lanes_splat((float)x), offsets);
+                lanes e0 = lanes_add(lanes_mul(lanes_splat(a0), centre_x), lanes_splat(b0 * centre_y + c0));
+                lanes e1 = lanes_add(lanes_mul(lanes_splat(a1), centre_x), lanes_splat(b1 * centre_y + c1));
+                lanes e2 = lanes_add(lanes_mul(lanes_splat(a2), centre_x), lanes_splat(b2 * centre_y + c2));
+                lanes inside = lanes_and(lanes_and(lanes_ge(e0, zero), lanes_ge(e1, zero)), lanes_ge(e2, zero));
+                if (lanes_any(inside) == 0) continue;
+
+                lanes depth = lanes_add(lanes_mul(lanes_splat(depth_a), centre_x), lanes_splat(depth_b * centre_y + depth_c));
+                lanes_store(&row[x], lanes_max(lanes_load(&row[x]), lanes_and(inside, depth)));
+            }
+        }
+    }
+
+    // Record the farthest depth in each of the band's tiles.
+    for (int tile_y=first_row / OCCLUSION_TILE; tile_y < last_row / OCCLUSION_TILE; tile_y++) {
+        for (int tile_x=0; tile_x < OCCLUSION_TILES_X; tile_x++) {
+            lanes farthest = lanes_splat(INFINITY);
+            for (int y=tile_y * OCCLUSION_TILE; y < (tile_y + 1) * OCCLUSION_TILE; y++) {
+                for (int x=tile_x * OCCLUSION_TILE; x < (tile_x + 1) * OCCLUSION_TILE; x += 4) {
+                    farthest = lanes_min(farthest, lanes_load(&buffer->depth[y * OCCLUSION_WIDTH + x]));
+                }
+            }
+            float values[4];
+            lanes_store(values, farthest);
+            buffer->tiles[tile_y * OCCLUSION_TILES_X + tile_x] = fminf(fminf(values[0], values[1]), fminf(values[2], values[3]));
+        }
+    }
+}
+
+// Rasterise a band as a job.
+static void occlusion_band_job(void* data) {
+    struct occlusion_band* band = data;
+    occlusion_rasterise_band(band->buffer, band->band);
+}
+
+// Allocate the depth buffer. Returns false on failure.
+static bool occlusion_init(struct occlusion_buffer* buffer) {
+    memset(buffer, 0, sizeof(struct occlusion_buffer));
+    buffer->depth = calloc(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, sizeof(float));
+    buffer->tiles = calloc(OCCLUSION_TILES_X * OCCLUSION_TILES_Y, sizeof(float));
+    if (buffer->depth == NULL || buffer->tiles == NULL) {
+        free(buffer->depth);
+        free(buffer->tiles);
+        return false;
+    }
+    for (uint32_t i=0; i < OCCLUSION_MAX_BANDS; i++) {
+        buffer->bands[i].buffer = buffer;
+        buffer->bands[i].band = i;
+    }
+    buffer->num_bands = 1;
+    return true;
+}
+
+// Start a frame: forget last frame's occluders, and remember the camera's view projection matrix, 16 floats in column major order,
+// and near plane distance. Pass the whole matrix, such as a cast cglm mat4, not its first column.
+static void occlusion_begin(struct occlusion_buffer* buffer, const float* view_projection, float near) {
+    memcpy(buffer->view_projection, view_projection, sizeof(float) * 16);
+    buffer->near = near;
+    buffer->num_vertices = 0;
+    buffer->num_indices = 0;
+    buffer->rasterised = false;
+}
+
+// Add an occluder's vertices, transformed by its world view projection matrix, 16 floats in column major order, and return the index of the first one.
+// positions holds x, y and z for each vertex. Returns UINT32_MAX on allocation failure.
+static uint32_t occlusion_add_vertices(struct occlusion_buffer* buffer, const float* matrix, const float* positions, size_t count) {
+    if (buffer->num_vertices + count > buffer->vertices_capacity) {
+        size_t capacity = buffer->vertices_capacity == 0 ? 4096 : buffer->vertices_capacity;
+        while (capacity < buffer->num_vertices + count) {
+            capacity = capacity * 2;
+        }
+        struct occlusion_vertex* vertices = realloc(buffer->vertices, sizeof(struct occlusion_vertex) * capacity);
+        if (vertices == NULL) return UINT32_MAX;
+        buffer->vertices = vertices;
+        buffer->vertices_capacity = capacity;
+    }
+
+    uint32_t base = (uint32_t)buffer->num_vertices;
+    for (size_t i=0; i < count; i++) {
+        float clip[4];
+        occlusion_transform(matrix, &positions[i * 3], clip);
+        struct occlusion_vertex* vertex = &buffer->vertices[base + i];
+        if (clip[3] < buffer->near) {
+            vertex->depth = -1.0f;
+            continue;
+        }
+        float inverse_w = 1.0f / clip[3];
+        vertex->x = (clip[0] * inverse_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        vertex->y = (clip[1] * inverse_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+        vertex->depth = inverse_w;
+    }
+    buffer->num_vertices = buffer->num_vertices + count;
+    return base;
+}
+
+// Add an occluder's triangles, as 16 or 32 bit indices relative to the base its vertices were added at.
+// Returns false on allocation failure.
+static bool occlusion_add_triangles(struct occlusion_buffer* buffer, uint32_t base, const void* indices, size_t count, bool wide) {
+    count = count / 3 * 3;
+    if (buffer->num_indices + count > buffer->indices_capacity) {
+        size_t capacity = buffer->indices_capacity == 0 ? 16384 : buffer->indices_capacity;
+        while (capacity < buffer->num_indices + count) {
+            capacity = capacity * 2;
+        }
+        uint32_t* grown = realloc(buffer->indices, sizeof(uint32_t) * capacity);
+        if (grown == NULL) return false;
+        buffer->indices = grown;
+        buffer->indices_capacity = capacity;
+    }
+
+    uint32_t* destination = &buffer->indices[buffer->num_indices];
+    for (size_t i=0; i < count; i++) {
+        destination[i] = base + (wide == true ? ((const uint32_t*)indices)[i] : ((const uint16_t*)indices)[i]);
+    }
+    buffer->num_indices = buffer->num_indices + count;
+    return true;
+}
+
+// Rasterise the frame's occluders as a band job for each thread of the job system, and wait for them all, helping with the bands left.
+static void occlusion_rasterise(struct occlusion_buffer* buffer, struct job_system* jobs) {
+    buffer->num_bands = jobs->num_workers + 1 < OCCLUSION_MAX_BANDS ? jobs->num_workers + 1 : OCCLUSION_MAX_BANDS;
+    struct job_counter counter = {0};
+    job_submit(jobs, occlusion_band_job, buffer->bands, sizeof(struct occlusion_band), buffer->num_bands, &counter);
+    job_wait(jobs, &counter);
+    buffer->rasterised = true;
+}
+
+// Return true if a world space box, given as a centre and half extents, is entirely hidden behind the occluders.
+// Boxes crossing the near plane or off screen are never hidden, and nothing is hidden until the frame has been rasterised.
+static bool occlusion_test_box(struct occlusion_buffer* buffer, const float centre[3], const float extent[3]) {
+    if (buffer->rasterised == false || buffer->num_indices == 0) return false;
+
+    // Project the corners, keeping the rectangle they cover and the depth of the nearest one.
+    float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    float nearest = 0.0f;
+    for (int i=0; i < 8; i++) {
+        float corner[3] = {
+            centre[0] + (i & 1 ? extent[0] : -extent[0]),
+            centre[1] + (i & 2 ? extent[1] : -extent[1]),
+            centre[2] + (i & 4 ? extent[2] : -extent[2])
+        };
+        float clip[4];
+        occlusion_transform(buffer->view_projection, corner, clip);
+        if (clip[3] < buffer->near) return false;
+        float inverse_w = 1.0f / clip[3];
+        float x = (clip[0] * inverse_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+        float y = (clip[1] * inverse_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+        min_x = fminf(min_x, x);
+        max_x = fmaxf(max_x, x);
+        min_y = fminf(min_y, y);
+        max_y = fmaxf(max_y, y);
+        nearest = fmaxf(nearest, inverse_w);
+    }
+
+    // Cover every pixel whose centre the rectangle might reach.
+    int x0 = (int)floorf(min_x);
+    int x1 = (int)ceilf(max_x);
+    int y0 = (int)floorf(min_y);
+    int y1 = (int)ceilf(max_y);
+    x0 = x0 < 0 ? 0 : x0;
+    y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > OCCLUSION_WIDTH ? OCCLUSION_WIDTH : x1;
+    y1 = y1 > OCCLUSION_HEIGHT ? OCCLUSION_HEIGHT : y1;
+    if (x0 >= x1 || y0 >= y1) return false;
+
+    // The box is hidden where every occluder pixel is nearer than its nearest corner.
+    for (int tile_y=y0 / OCCLUSION_TILE; tile_y <= (y1 - 1) / OCCLUSION_TILE; tile_y++) {
+        for (int tile_x=x0 / OCCLUSION_TILE; tile_x <= (x1 - 1) / OCCLUSION_TILE; tile_x++) {
+            if (buffer->tiles[tile_y * OCCLUSION_TILES_X + tile_x] > nearest) continue;
+
+            int row_start = tile_y * OCCLUSION_TILE > y0 ? tile_y * OCCLUSION_TILE : y0;
+            int row_end = (tile_y + 1) * OCCLUSION_TILE < y1 ? (tile_y + 1) * OCCLUSION_TILE : y1;
+            int column_start = tile_x * OCCLUSION_TILE > x0 ? tile_x * OCCLUSION_TILE : x0;
+            int column_end = (tile_x + 1) * OCCLUSION_TILE < x1 ? (tile_x + 1) * OCCLUSION_TILE : x1;
+            for (int y=row_start; y < row_end; y++) {
+                for (int x=column_start; x < column_end; x++) {
+                    if (buffer->depth[y * OCCLUSION_WIDTH + x] <= nearest) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Free the buffer.
+static void occlusion_free(struct occlusion_buffer* buffer) {
+    free(buffer->depth);
+    free(buffer->tiles);
+    free(buffer->vertices);
+    free(buffer->indices);
+}
+
+#endif
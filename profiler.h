@@ -0,0 +1,407 @@
+// A lightweight frame profiler for main.c.
+// - CPU scopes are nestable PROFILE_BEGIN()/PROFILE_END() pairs, recorded by any thread into a lock-free ring buffer.
+// - GPU scopes are PROFILE_GPU_BEGIN()/PROFILE_GPU_END() pairs around render passes, timed with GL_ARB_timer_query on
+//   desktop and EXT_disjoint_timer_query on WebGL. Results are read back a few frames later so the CPU never waits.
+// - Counters are PROFILE_COUNTER() values, such as draw calls and bytes uploaded.
+// - PROFILE_GPU_FRAME_TIME() is the GPU time of the latest frame read back, for main.c's dynamic resolution.
+// The last frame can be drawn as an overlay of coloured bars, and everything still in the ring can be exported
+// as Chrome trace JSON, which chrome://tracing and https://ui.perfetto.dev open.
+//
+// Build with -DPROFILER_ENABLED=0 to compile every macro out.
+// Include after the OpenGL headers.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+#if PROFILER_ENABLED
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#ifdef __EMSCRIPTEN__
+#include <GLES2/gl2ext.h>
+#endif
+
+// The number of events the ring holds. Must be a power of two.
+#define PROFILER_RING_SIZE 65536
+
+// The deepest CPU scopes can nest on one thread.
+#define PROFILER_MAX_DEPTH 32
+
+// GPU scopes per frame, and how many frames of queries are in flight before results are read back.
+#define PROFILER_GPU_SCOPES 8
+#define PROFILER_GPU_FRAMES 4
+
+// The overlay spans this much time across the width of the window.
+#define PROFILER_OVERLAY_MICROSECONDS 33333
+
+// The overlay's row height in pixels, and the most rows of nested CPU scopes it shows.
+#define PROFILER_OVERLAY_ROW 10
+#define PROFILER_OVERLAY_ROWS 6
+
+// Kinds of events in the ring.
+#define PROFILER_EVENT_SCOPE 0
+#define PROFILER_EVENT_COUNTER 1
+
+// GPU events are recorded as if from this thread. CPU threads are numbered from one.
+#define PROFILER_GPU_THREAD 0
+
+// One event in the ring.
+// A writer claims a slot by incrementing the ring's head, clears the slot's sequence, fills it in, and then publishes it
+// by setting the sequence to its position in the ring plus one. Readers skip slots whose sequence does not match,
+// or changes while they copy them, because a writer has lapped them.
+struct profiler_event {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+    double value;
+    uint32_t thread;
+    uint32_t depth;
+    uint32_t type;
+    _Atomic uint64_t sequence;
+};
+
+// An open CPU scope on a thread.
+struct profiler_open_scope {
+    const char* name;
+    uint64_t start;
+};
+
+// The GPU queries of one frame.
+struct profiler_gpu_frame {
+    GLuint queries[PROFILER_GPU_SCOPES];
+    const char* names[PROFILER_GPU_SCOPES];
+    uint32_t num_scopes;
+    uint64_t start;
+    bool open;
+};
+
+// The profiler state.
+// The last frame's bounds and GPU timings are kept for the overlay.
+struct profiler {
+    struct profiler_event ring[PROFILER_RING_SIZE];
+    _Atomic uint64_t head;
+    _Atomic uint32_t next_thread;
+    uint64_t frame_start;
+    uint64_t last_frame_start;
+    uint64_t last_frame_end;
+    uint32_t main_thread;
+    bool gpu_supported;
+    bool gpu_initialised;
+    struct profiler_gpu_frame gpu_frames[PROFILER_GPU_FRAMES];
+    uint32_t gpu_frame;
+    const char* gpu_names[PROFILER_GPU_SCOPES];
+    uint64_t gpu_durations[PROFILER_GPU_SCOPES];
+    uint32_t gpu_num_scopes;
+};
+
+static struct profiler profiler;
+static _Thread_local struct profiler_open_scope profiler_stack[PROFILER_MAX_DEPTH];
+static _Thread_local uint32_t profiler_depth = 0;
+static _Thread_local uint32_t profiler_thread = 0;
+
+// Return a monotonic time in microseconds.
+static uint64_t profiler_now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000 + (uint64_t)time.tv_nsec / 1000;
+}
+
+// Return the calling thread's profiler thread number, numbering it the first time.
+static uint32_t profiler_thread_id() {
+    if (profiler_thread == 0) {
+        profiler_thread = atomic_fetch_add(&profiler.next_thread, 1) + 1;
+    }
+    return profiler_thread;
+}
+
+// Write an event into the ring.
+static void profiler_record(uint32_t type, const char* name, uint64_t start, uint64_t duration, double value, uint32_t thread, uint32_t depth) {
+    uint64_t position = atomic_fetch_add_explicit(&profiler.head, 1, memory_order_relaxed);
+    struct profiler_event* event = &profiler.ring[position & (PROFILER_RING_SIZE - 1)];
+    atomic_store_explicit(&event->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->name = name;
+    event->start = start;
+    event->duration = duration;
+    event->value = value;
+    event->thread = thread;
+    event->depth = depth;
+    event->type = type;
+    atomic_store_explicit(&event->sequence, position + 1, memory_order_release);
+}
+
+// Copy the event at a position in the ring. Returns false if it has been overwritten or is still being written.
+static bool profiler_read(uint64_t position, struct profiler_event* copy) {
+    struct profiler_event* event = &profiler.ring[position & (PROFILER_RING_SIZE - 1)];
+    uint64_t sequence = atomic_load_explicit(&event->sequence, memory_order_acquire);
+    if (sequence != position + 1) return false;
+    copy->name = event->name;
+    copy->start = event->start;
+    copy->duration = event->duration;
+    copy->value = event->value;
+    copy->thread = event->thread;
+    copy->depth = event->depth;
+    copy->type = event->type;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&event->sequence, memory_order_relaxed) == sequence;
+}
+
+// Open a CPU scope on the calling thread. Scopes deeper than PROFILER_MAX_DEPTH are not recorded.
+static void profiler_begin(const char* name) {
+    if (profiler_depth < PROFILER_MAX_DEPTH) {
+        profiler_stack[profiler_depth].name = name;
+        profiler_stack[profiler_depth].start = profiler_now();
+    }
+    profiler_depth++;
+}
+
+// Close the calling thread's innermost CPU scope and record it.
+static void profiler_end() {
+    if (profiler_depth == 0) return;
+    profiler_depth--;
+    if (profiler_depth >= PROFILER_MAX_DEPTH) return;
+    struct profiler_open_scope* scope = &profiler_stack[profiler_depth];
+    uint64_t start = scope->start;
+    profiler_record(PROFILER_EVENT_SCOPE, scope->name, start, profiler_now() - start, 0.0, profiler_thread_id(), profiler_depth + 1);
+}
+
+// Record a counter's value.
+static void profiler_counter(const char* name, double value) {
+    profiler_record(PROFILER_EVENT_COUNTER, name, profiler_now(), 0, value, profiler_thread_id(), 0);
+}
+
+// Check for timer queries and create the query objects. Needs a current OpenGL context.
+static void profiler_gpu_init() {
+    profiler.gpu_initialised = true;
+    #ifdef __EMSCRIPTEN__
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    profiler.gpu_supported = extensions != NULL && strstr(extensions, "EXT_disjoint_timer_query") != NULL;
+    #else
+    profiler.gpu_supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    #endif
+    if (profiler.gpu_supported == false) return;
+
+    for (uint32_t i=0; i < PROFILER_GPU_FRAMES; i++) {
+        #ifdef __EMSCRIPTEN__
+        glGenQueriesEXT(PROFILER_GPU_SCOPES, profiler.gpu_frames[i].queries);
+        #else
+        glGenQueries(PROFILER_GPU_SCOPES, profiler.gpu_frames[i].queries);
+        #endif
+    }
+}
+
+// Start timing a GPU scope. GPU scopes cannot nest, and only PROFILER_GPU_SCOPES are timed per frame.
+static void profiler_gpu_begin(const char* name) {
+    if (profiler.gpu_initialised == false) profiler_gpu_init();
+    struct profiler_gpu_frame* frame = &profiler.gpu_frames[profiler.gpu_frame];
+    if (profiler.gpu_supported == false || frame->open == true || frame->num_scopes == PROFILER_GPU_SCOPES) return;
+
+    frame->names[frame->num_scopes] = name;
+    #ifdef __EMSCRIPTEN__
+    glBeginQueryEXT(GL_TIME_ELAPSED_EXT, frame->queries[frame->num_scopes]);
+    #else
+    glBeginQuery(GL_TIME_ELAPSED, frame->queries[frame->num_scopes]);
+    #endif
+    frame->open = true;
+}
+
+// Stop timing the open GPU scope.
+static void profiler_gpu_end() {
+    struct profiler_gpu_frame* frame = &profiler.gpu_frames[profiler.gpu_frame];
+    if (frame->open == false) return;
+    #ifdef __EMSCRIPTEN__
+    glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+    #else
+    glEndQuery(GL_TIME_ELAPSED);
+    #endif
+    frame->open = false;
+    frame->num_scopes++;
+}
+
+// Read back a frame's GPU timings if they have all arrived, recording them back to back from the start of the frame.
+// Results are dropped if they have not arrived by the time the frame's queries are reused, or if the GPU was disjoint.
+static void profiler_gpu_collect(struct profiler_gpu_frame* frame) {
+    if (frame->num_scopes == 0) return;
+    for (uint32_t i=0; i < frame->num_scopes; i++) {
+        GLint available = 0;
+        #ifdef __EMSCRIPTEN__
+        glGetQueryObjectivEXT(frame->queries[i], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        #else
+        glGetQueryObjectiv(frame->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        #endif
+        if (available == 0) return;
+    }
+    #ifdef __EMSCRIPTEN__
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint != 0) return;
+    #endif
+
+    uint64_t start = frame->start;
+    for (uint32_t i=0; i < frame->num_scopes; i++) {
+        GLuint64 nanoseconds = 0;
+        #ifdef __EMSCRIPTEN__
+        glGetQueryObjectui64vEXT(frame->queries[i], GL_QUERY_RESULT_EXT, &nanoseconds);
+        #else
+        glGetQueryObjectui64v(frame->queries[i], GL_QUERY_RESULT, &nanoseconds);
+        #endif
+        profiler.gpu_names[i] = frame->names[i];
+        profiler.gpu_durations[i] = nanoseconds / 1000;
+        profiler_record(PROFILER_EVENT_SCOPE, frame->names[i], start, nanoseconds / 1000, 0.0, PROFILER_GPU_THREAD, 1);
+        start = start + nanoseconds / 1000;
+    }
+    profiler.gpu_num_scopes = frame->num_scopes;
+}
+
+// Mark the start of a frame on the main thread: record the previous frame, and move the GPU queries on to the next set,
+// collecting the oldest set's results before reusing it.
+static void profiler_frame() {
+    uint64_t now = profiler_now();
+    profiler.main_thread = profiler_thread_id();
+    if (profiler.frame_start != 0) {
+        profiler_record(PROFILER_EVENT_SCOPE, "frame", profiler.frame_start, now - profiler.frame_start, 0.0, profiler.main_thread, 0);
+        profiler.last_frame_start = profiler.frame_start;
+        profiler.last_frame_end = now;
+    }
+    profiler.frame_start = now;
+
+    if (profiler.gpu_supported == true) {
+        profiler_gpu_end();
+        profiler.gpu_frame = (profiler.gpu_frame + 1) % PROFILER_GPU_FRAMES;
+        struct profiler_gpu_frame* frame = &profiler.gpu_frames[profiler.gpu_frame];
+        profiler_gpu_collect(frame);
+        frame->num_scopes = 0;
+        frame->start = now;
+    }
+}
+
+// Return the GPU time of the latest frame whose results have arrived, in microseconds, or 0 if none have.
+static uint64_t profiler_gpu_frame_time() {
+    uint64_t total = 0;
+    for (uint32_t i=0; i < profiler.gpu_num_scopes; i++) {
+        total = total + profiler.gpu_durations[i];
+    }
+    return total;
+}
+
+// Fill a rectangle of the window with a colour, measured in pixels from the bottom left.
+static void profiler_overlay_rectangle(int x, int y, int width, int height, float red, float green, float blue) {
+    if (width < 1) width = 1;
+    glScissor(x, y, width, height);
+    glClearColor(red, green, blue, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// Pick a stable colour for a scope from its name.
+static void profiler_overlay_color(const char* name, float color[3]) {
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    color[0] = 0.35 + (hash & 0xFF) / 255.0 * 0.65;
+    color[1] = 0.35 + ((hash >> 8) & 0xFF) / 255.0 * 0.65;
+    color[2] = 0.35 + ((hash >> 16) & 0xFF) / 255.0 * 0.65;
+}
+
+// Draw the last frame along the bottom of the window as rows of bars: one row per depth of nested CPU scopes on the main thread,
+// and a row of GPU scopes laid end to end under them. PROFILER_OVERLAY_MICROSECONDS spans the full width, and
+// white ticks mark 60 and 30 frames per second. Drawing only uses scissored clears, so it needs no shader.
+static void profiler_draw_overlay(int width) {
+    GLfloat clear_color[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+    GLboolean scissor_enabled = glIsEnabled(GL_SCISSOR_TEST);
+    glEnable(GL_SCISSOR_TEST);
+    int rows = PROFILER_OVERLAY_ROWS + 1;
+    profiler_overlay_rectangle(0, 0, width, rows * PROFILER_OVERLAY_ROW + 2, 0.1, 0.1, 0.1);
+    float scale = (float)width / PROFILER_OVERLAY_MICROSECONDS;
+
+    // CPU scopes of the last frame, newest first, stopping at the first event that started before it.
+    uint64_t head = atomic_load(&profiler.head);
+    uint64_t oldest = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+    for (uint64_t position = head; position > oldest; position--) {
+        struct profiler_event event;
+        if (profiler_read(position - 1, &event) == false) continue;
+        if (event.thread != profiler.main_thread || event.type != PROFILER_EVENT_SCOPE) continue;
+        if (event.start < profiler.last_frame_start) {
+            if (event.depth == 0) break;
+            continue;
+        }
+        if (event.start + event.duration > profiler.last_frame_end || event.depth >= PROFILER_OVERLAY_ROWS) continue;
+        float color[3];
+        profiler_overlay_color(event.name, color);
+        int y = (rows - 1 - event.depth) * PROFILER_OVERLAY_ROW + 1;
+        profiler_overlay_rectangle((event.start - profiler.last_frame_start) * scale, y, event.duration * scale, PROFILER_OVERLAY_ROW - 1, color[0], color[1], color[2]);
+    }
+
+    // GPU scopes from the latest frame whose results have arrived.
+    uint64_t start = 0;
+    for (uint32_t i=0; i < profiler.gpu_num_scopes; i++) {
+        float color[3];
+        profiler_overlay_color(profiler.gpu_names[i], color);
+        profiler_overlay_rectangle(start * scale, 1, profiler.gpu_durations[i] * scale, PROFILER_OVERLAY_ROW - 1, color[0] * 0.6, color[1] * 0.6, color[2] * 0.6);
+        start = start + profiler.gpu_durations[i];
+    }
+
+    profiler_overlay_rectangle(16667 * scale, 0, 1, rows * PROFILER_OVERLAY_ROW + 2, 1.0, 1.0, 1.0);
+    profiler_overlay_rectangle(33333 * scale - 1, 0, 1, rows * PROFILER_OVERLAY_ROW + 2, 1.0, 1.0, 1.0);
+
+    glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+    if (scissor_enabled == GL_FALSE) glDisable(GL_SCISSOR_TEST);
+}
+
+// Write every event still in the ring to a file as Chrome trace JSON. Returns false if the file cannot be written.
+static bool profiler_export_chrome_trace(const char* filename) {
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) return false;
+
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", PROFILER_GPU_THREAD);
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"main\"}}", profiler.main_thread);
+
+    uint64_t head = atomic_load(&profiler.head);
+    uint64_t oldest = head > PROFILER_RING_SIZE ? head - PROFILER_RING_SIZE : 0;
+    for (uint64_t position = oldest; position < head; position++) {
+        struct profiler_event event;
+        if (profiler_read(position, &event) == false) continue;
+        if (event.type == PROFILER_EVENT_COUNTER) {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%.17g}}",
+                event.name, (unsigned long long)event.start, event.thread, event.value);
+        }
+        else {
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u}",
+                event.name, (unsigned long long)event.start, (unsigned long long)event.duration, event.thread);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+#define PROFILE_BEGIN(name) profiler_begin(name)
+#define PROFILE_END() profiler_end()
+#define PROFILE_GPU_BEGIN(name) profiler_gpu_begin(name)
+#define PROFILE_GPU_END() profiler_gpu_end()
+#define PROFILE_COUNTER(name, value) profiler_counter(name, value)
+#define PROFILE_FRAME() profiler_frame()
+#define PROFILE_GPU_FRAME_TIME() profiler_gpu_frame_time()
+
+#else
+
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END() ((void)0)
+#define PROFILE_GPU_BEGIN(name) ((void)0)
+#define PROFILE_GPU_END() ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#define PROFILE_GPU_FRAME_TIME() ((uint64_t)0)
+
+#endif
+
+#endif
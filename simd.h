@@ -0,0 +1,96 @@
+// Four wide float vectors for main.c's hot loops, behind one set of lanes_*() functions:
+// SSE natively, WebAssembly SIMD on the web (built with -msimd128), and plain C anywhere else.
+//
+// Comparisons return masks, which are only meant for lanes_and() and lanes_any().
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define SIMD_AVAILABLE 1
+typedef v128_t lanes;
+
+static inline lanes lanes_load(const float* pointer) { return wasm_v128_load(pointer); }
+static inline void lanes_store(float* pointer, lanes value) { wasm_v128_store(pointer, value); }
+static inline lanes lanes_splat(float value) { return wasm_f32x4_splat(value); }
+static inline lanes lanes_set(float a, float b, float c, float d) { return wasm_f32x4_make(a, b, c, d); }
+static inline lanes lanes_add(lanes a, lanes b) { return wasm_f32x4_add(a, b); }
+static inline lanes lanes_sub(lanes a, lanes b) { return wasm_f32x4_sub(a, b); }
+static inline lanes lanes_mul(lanes a, lanes b) { return wasm_f32x4_mul(a, b); }
+static inline lanes lanes_min(lanes a, lanes b) { return wasm_f32x4_pmin(a, b); }
+static inline lanes lanes_max(lanes a, lanes b) { return wasm_f32x4_pmax(a, b); }
+static inline lanes lanes_abs(lanes a) { return wasm_f32x4_abs(a); }
+static inline lanes lanes_ge(lanes a, lanes b) { return wasm_f32x4_ge(a, b); }
+static inline lanes lanes_and(lanes mask, lanes value) { return wasm_v128_and(mask, value); }
+static inline int lanes_any(lanes mask) { return wasm_i32x4_bitmask(mask) != 0; }
+
+// Transpose four rows of four lanes into four columns.
+static inline void lanes_transpose(lanes* r0, lanes* r1, lanes* r2, lanes* r3) {
+    lanes t0 = wasm_i32x4_shuffle(*r0, *r1, 0, 4, 1, 5);
+    lanes t1 = wasm_i32x4_shuffle(*r2, *r3, 0, 4, 1, 5);
+    lanes t2 = wasm_i32x4_shuffle(*r0, *r1, 2, 6, 3, 7);
+    lanes t3 = wasm_i32x4_shuffle(*r2, *r3, 2, 6, 3, 7);
+    *r0 = wasm_i32x4_shuffle(t0, t1, 0, 1, 4, 5);
+    *r1 = wasm_i32x4_shuffle(t0, t1, 2, 3, 6, 7);
+    *r2 = wasm_i32x4_shuffle(t2, t3, 0, 1, 4, 5);
+    *r3 = wasm_i32x4_shuffle(t2, t3, 2, 3, 6, 7);
+}
+
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define SIMD_AVAILABLE 1
+typedef __m128 lanes;
+
+static inline lanes lanes_load(const float* pointer) { return _mm_loadu_ps(pointer); }
+static inline void lanes_store(float* pointer, lanes value) { _mm_storeu_ps(pointer, value); }
+static inline lanes lanes_splat(float value) { return _mm_set1_ps(value); }
+static inline lanes lanes_set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+static inline lanes lanes_add(lanes a, lanes b) { return _mm_add_ps(a, b); }
+static inline lanes lanes_sub(lanes a, lanes b) { return _mm_sub_ps(a, b); }
+static inline lanes lanes_mul(lanes a, lanes b) { return _mm_mul_ps(a, b); }
+static inline lanes lanes_min(lanes a, lanes b) { return _mm_min_ps(a, b); }
+static inline lanes lanes_max(lanes a, lanes b) { return _mm_max_ps(a, b); }
+static inline lanes lanes_abs(lanes a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline lanes lanes_ge(lanes a, lanes b) { return _mm_cmpge_ps(a, b); }
+static inline lanes lanes_and(lanes mask, lanes value) { return _mm_and_ps(mask, value); }
+static inline int lanes_any(lanes mask) { return _mm_movemask_ps(mask) != 0; }
+
+// Transpose four rows of four lanes into four columns.
+static inline void lanes_transpose(lanes* r0, lanes* r1, lanes* r2, lanes* r3) {
+    _MM_TRANSPOSE4_PS(*r0, *r1, *r2, *r3);
+}
+
+#else
+#define SIMD_AVAILABLE 0
+typedef struct {
+    float v[4];
+} lanes;
+
+static inline lanes lanes_load(const float* pointer) { lanes r; for (int i=0; i < 4; i++) r.v[i] = pointer[i]; return r; }
+static inline void lanes_store(float* pointer, lanes value) { for (int i=0; i < 4; i++) pointer[i] = value.v[i]; }
+static inline lanes lanes_splat(float value) { lanes r; for (int i=0; i < 4; i++) r.v[i] = value; return r; }
+static inline lanes lanes_set(float a, float b, float c, float d) { lanes r = {{a, b, c, d}}; return r; }
+static inline lanes lanes_add(lanes a, lanes b) { for (int i=0; i < 4; i++) a.v[i] = a.v[i] + b.v[i]; return a; }
+static inline lanes lanes_sub(lanes a, lanes b) { for (int i=0; i < 4; i++) a.v[i] = a.v[i] - b.v[i]; return a; }
+static inline lanes lanes_mul(lanes a, lanes b) { for (int i=0; i < 4; i++) a.v[i] = a.v[i] * b.v[i]; return a; }
+static inline lanes lanes_min(lanes a, lanes b) { for (int i=0; i < 4; i++) a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i]; return a; }
+static inline lanes lanes_max(lanes a, lanes b) { for (int i=0; i < 4; i++) a.v[i] = b.v[i] > a.v[i] ? b.v[i] : a.v[i]; return a; }
+static inline lanes lanes_abs(lanes a) { for (int i=0; i < 4; i++) a.v[i] = a.v[i] < 0.0f ? -a.v[i] : a.v[i]; return a; }
+static inline lanes lanes_ge(lanes a, lanes b) { for (int i=0; i < 4; i++) a.v[i] = a.v[i] >= b.v[i] ? 1.0f : 0.0f; return a; }
+static inline lanes lanes_and(lanes mask, lanes value) { for (int i=0; i < 4; i++) value.v[i] = mask.v[i] != 0.0f ? value.v[i] : 0.0f; return value; }
+static inline int lanes_any(lanes mask) { return mask.v[0] != 0.0f || mask.v[1] != 0.0f || mask.v[2] != 0.0f || mask.v[3] != 0.0f; }
+
+// Transpose four rows of four lanes into four columns.
+static inline void lanes_transpose(lanes* r0, lanes* r1, lanes* r2, lanes* r3) {
+    lanes rows[4] = {*r0, *r1, *r2, *r3};
+    for (int i=0; i < 4; i++) {
+        r0->v[i] = rows[i].v[0];
+        r1->v[i] = rows[i].v[1];
+        r2->v[i] = rows[i].v[2];
+        r3->v[i] = rows[i].v[3];
+    }
+}
+#endif
+
+#endif
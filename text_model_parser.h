@@ -0,0 +1,380 @@
+// A fast parser for the plain text model format written by object_converter_tool.c.
+// The whole file is read in one go, split into newline aligned chunks, and each chunk is parsed
+// in a single pass on its own thread with a hand written number parser instead of sscanf().
+// The per-chunk results are then merged in file order, so the output matches a serial parse.
+//
+// Shared by main.c and benchmark_text_loader.c.
+
+#ifndef TEXT_MODEL_PARSER_H
+#define TEXT_MODEL_PARSER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "model_format.h"
+
+// Threads are used everywhere except web builds compiled without pthread support.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define TEXT_MODEL_PARSER_THREADS 0
+#else
+#define TEXT_MODEL_PARSER_THREADS 1
+#include <pthread.h>
+#endif
+
+// Upper bound on worker threads, and the smallest chunk worth handing to a thread.
+#define TEXT_MODEL_PARSER_MAX_THREADS 64
+#define TEXT_MODEL_PARSER_MIN_CHUNK_SIZE (1 << 20)
+
+// Number of values on a vertex line: position, colour and normal.
+#define TEXT_MODEL_VERTEX_VALUES 10
+
+// The parsed contents of a text model.
+// Vertices use the binary model vertex layout, which matches struct vertex in main.c.
+// Indices are kept at 32 bits as the text format does not limit their size.
+struct text_model {
+    struct model_file_vertex* vertices;
+    size_t num_vertices;
+    uint32_t* indices;
+    size_t num_indices;
+};
+
+// A newline aligned range of the file and the vertices and indices parsed from it.
+struct text_model_chunk {
+    const char* start;
+    const char* end;
+    struct text_model model;
+    size_t vertex_capacity;
+    size_t index_capacity;
+    bool failed;
+};
+
+// Powers of ten that are exactly representable as doubles.
+static const double text_model_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Skip spaces and tabs, without moving past the end of the line.
+static inline const char* text_model_skip_spaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+// Parse a decimal float such as the '%f' output of the converter.
+// Returns a pointer past the number, or NULL if there is no number before the end of the line.
+// Anything the fast path does not handle (inf, nan, huge exponents) is passed on to strtof().
+static inline const char* text_model_parse_float(const char* p, const char* end, float* value) {
+    p = text_model_skip_spaces(p, end);
+    const char* start = p;
+    if (start >= end) return NULL;
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    // Accumulate up to 17 significant digits into an integer, tracking the decimal exponent.
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool has_digits = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (mantissa < 100000000000000000ULL) mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        else exponent++;
+        has_digits = true;
+        p++;
+    }
+
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+            }
+            has_digits = true;
+            p++;
+        }
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E') && has_digits) {
+        const char* exponent_start = p;
+        p++;
+        bool exponent_negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            exponent_negative = *p == '-';
+            p++;
+        }
+        if (p < end && *p >= '0' && *p <= '9') {
+            int written_exponent = 0;
+            while (p < end && *p >= '0' && *p <= '9') {
+                if (written_exponent < 10000) written_exponent = written_exponent * 10 + (*p - '0');
+                p++;
+            }
+            exponent = exponent + (exponent_negative ? -written_exponent : written_exponent);
+        }
+        else {
+            p = exponent_start;
+        }
+    }
+
+    // Use the exact fast path when the number is plain and the scale is an exact power of ten.
+    bool terminated = p >= end || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n';
+    if (has_digits && terminated && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        if (exponent < 0) result = result / text_model_powers_of_ten[-exponent];
+        else result = result * text_model_powers_of_ten[exponent];
+        *value = (float)(negative ? -result : result);
+        return p;
+    }
+
+    // Fall back to the C library for anything unusual.
+    char* parsed_end = NULL;
+    float result = strtof(start, &parsed_end);
+    if (parsed_end == start || parsed_end > end) return NULL;
+    *value = result;
+    return parsed_end;
+}
+
+// Parse a decimal integer index. Negative values wrap like they did with sscanf().
+// Returns a pointer past the number, or NULL if there is no number before the end of the line.
+static inline const char* text_model_parse_index(const char* p, const char* end, uint32_t* value) {
+    p = text_model_skip_spaces(p, end);
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    if (p >= end || *p < '0' || *p > '9') return NULL;
+
+    uint32_t result = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (uint32_t)(*p - '0');
+        p++;
+    }
+    *value = negative ? (uint32_t)0 - result : result;
+    return p;
+}
+
+// Make room for at least one more vertex and index in a chunk. Returns false on allocation failure.
+static bool text_model_chunk_reserve(struct text_model_chunk* chunk, bool vertex) {
+    if (vertex == true && chunk->model.num_vertices == chunk->vertex_capacity) {
+        size_t capacity = chunk->vertex_capacity < 64 ? 64 : chunk->vertex_capacity * 2;
+        struct model_file_vertex* vertices = realloc(chunk->model.vertices, sizeof(struct model_file_vertex) * capacity);
+        if (vertices == NULL) return false;
+        chunk->model.vertices = vertices;
+        chunk->vertex_capacity = capacity;
+    }
+
+    if (vertex == false && chunk->model.num_indices == chunk->index_capacity) {
+        size_t capacity = chunk->index_capacity < 64 ? 64 : chunk->index_capacity * 2;
+        uint32_t* indices = realloc(chunk->model.indices, sizeof(uint32_t) * capacity);
+        if (indices == NULL) return false;
+        chunk->model.indices = indices;
+        chunk->index_capacity = capacity;
+    }
+    return true;
+}
+
+// Parse every line in a chunk in a single pass.
+// Vertex lines start with 'v ' and hold up to ten floats; any missing values keep their defaults.
+// Face lines start with 'f' and hold one index. All other lines are ignored.
+static void* text_model_parse_chunk(void* argument) {
+    struct text_model_chunk* chunk = argument;
+    const char* p = chunk->start;
+    const char* end = chunk->end;
+
+    // Guess the capacity from the chunk size to avoid most reallocations.
+    // The converter writes roughly 60 to 90 byte vertex lines and 5 to 8 byte face lines.
+    size_t size = end - p;
+    chunk->vertex_capacity = size / 256 + 64;
+    chunk->index_capacity = size / 16 + 64;
+    chunk->model.vertices = malloc(sizeof(struct model_file_vertex) * chunk->vertex_capacity);
+    chunk->model.indices = malloc(sizeof(uint32_t) * chunk->index_capacity);
+    if (chunk->model.vertices == NULL || chunk->model.indices == NULL) {
+        chunk->failed = true;
+        return NULL;
+    }
+
+    while (p < end) {
+        const char* line_end = memchr(p, '\n', end - p);
+        if (line_end == NULL) line_end = end;
+
+        if (p[0] == 'v' && p + 1 < line_end && p[1] == ' ') {
+            if (text_model_chunk_reserve(chunk, true) == false) {
+                chunk->failed = true;
+                return NULL;
+            }
+            struct model_file_vertex* vertex = &chunk->model.vertices[chunk->model.num_vertices];
+            float values[TEXT_MODEL_VERTEX_VALUES] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0};
+            const char* q = p + 1;
+            for (int i=0; i < TEXT_MODEL_VERTEX_VALUES && q != NULL; i++) {
+                q = text_model_parse_float(q, line_end, &values[i]);
+            }
+            memcpy(vertex->position, &values[0], sizeof(float) * 3);
+            memcpy(vertex->vertex_color, &values[3], sizeof(float) * 4);
+            memcpy(vertex->normal, &values[7], sizeof(float) * 3);
+            chunk->model.num_vertices++;
+        }
+        else if (p[0] == 'f') {
+            if (text_model_chunk_reserve(chunk, false) == false) {
+                chunk->failed = true;
+                return NULL;
+            }
+            uint32_t index = 0;
+            text_model_parse_index(p + 1, line_end, &index);
+            chunk->model.indices[chunk->model.num_indices] = index;
+            chunk->model.num_indices++;
+        }
+
+        p = line_end + 1;
+    }
+    return NULL;
+}
+
+// Read a whole file into a NUL terminated heap buffer. Returns NULL on failure.
+static char* text_model_read_file(const char* filename, size_t* size) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("text_model_read_file(): Failed to open '%s'.\n", filename);
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    long file_size = ftell(file);
+    rewind(file);
+    if (file_size < 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    char* buffer = malloc((size_t)file_size + 1);
+    if (buffer == NULL) {
+        printf("text_model_read_file(): Failed to allocate memory for '%s'.\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    *size = fread(buffer, 1, (size_t)file_size, file);
+    buffer[*size] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+// Free the arrays of a parsed text model.
+static void text_model_free(struct text_model* model) {
+    free(model->vertices);
+    free(model->indices);
+    model->vertices = NULL;
+    model->indices = NULL;
+    model->num_vertices = 0;
+    model->num_indices = 0;
+}
+
+// Parse a text model file using up to num_threads threads, or one per core if num_threads is 0.
+// Returns false and leaves the model empty on failure.
+static bool text_model_parse(const char* filename, unsigned int num_threads, struct text_model* model) {
+    memset(model, 0, sizeof(struct text_model));
+
+    size_t size = 0;
+    char* buffer = text_model_read_file(filename, &size);
+    if (buffer == NULL) return false;
+
+    // Pick a thread count, keeping each chunk large enough to be worth a thread.
+    if (num_threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cores > 0 ? (unsigned int)cores : 1;
+    }
+    if (TEXT_MODEL_PARSER_THREADS == 0) num_threads = 1;
+    if (num_threads > TEXT_MODEL_PARSER_MAX_THREADS) num_threads = TEXT_MODEL_PARSER_MAX_THREADS;
+    if (num_threads > size / TEXT_MODEL_PARSER_MIN_CHUNK_SIZE) num_threads = size / TEXT_MODEL_PARSER_MIN_CHUNK_SIZE;
+    if (num_threads < 1) num_threads = 1;
+
+    struct text_model_chunk chunks[TEXT_MODEL_PARSER_MAX_THREADS];
+    memset(chunks, 0, sizeof(struct text_model_chunk) * num_threads);
+
+    // Split the file into chunks that start just after a newline.
+    const char* file_end = buffer + size;
+    const char* chunk_start = buffer;
+    for (unsigned int i=0; i < num_threads; i++) {
+        const char* chunk_end = file_end;
+        if (i + 1 < num_threads) {
+            chunk_end = buffer + size / num_threads * (i + 1);
+            if (chunk_end < chunk_start) chunk_end = chunk_start;
+            const char* newline = memchr(chunk_end, '\n', file_end - chunk_end);
+            chunk_end = newline == NULL ? file_end : newline + 1;
+        }
+        chunks[i].start = chunk_start;
+        chunks[i].end = chunk_end;
+        chunk_start = chunk_end;
+    }
+
+    // Parse the first chunk on this thread and the rest on workers.
+    #if TEXT_MODEL_PARSER_THREADS
+    pthread_t threads[TEXT_MODEL_PARSER_MAX_THREADS];
+    bool started[TEXT_MODEL_PARSER_MAX_THREADS] = {false};
+    for (unsigned int i=1; i < num_threads; i++) {
+        started[i] = pthread_create(&threads[i], NULL, text_model_parse_chunk, &chunks[i]) == 0;
+    }
+    text_model_parse_chunk(&chunks[0]);
+    for (unsigned int i=1; i < num_threads; i++) {
+        if (started[i] == true) pthread_join(threads[i], NULL);
+        else text_model_parse_chunk(&chunks[i]);
+    }
+    #else
+    for (unsigned int i=0; i < num_threads; i++) {
+        text_model_parse_chunk(&chunks[i]);
+    }
+    #endif
+    free(buffer);
+
+    // Merge the chunks in file order.
+    bool failed = false;
+    for (unsigned int i=0; i < num_threads; i++) {
+        failed = failed || chunks[i].failed;
+        model->num_vertices = model->num_vertices + chunks[i].model.num_vertices;
+        model->num_indices = model->num_indices + chunks[i].model.num_indices;
+    }
+
+    if (failed == false && num_threads == 1) {
+        // A single chunk already holds the final arrays.
+        *model = chunks[0].model;
+        return true;
+    }
+
+    if (failed == false) {
+        model->vertices = malloc(sizeof(struct model_file_vertex) * (model->num_vertices + 1));
+        model->indices = malloc(sizeof(uint32_t) * (model->num_indices + 1));
+        failed = model->vertices == NULL || model->indices == NULL;
+    }
+
+    size_t vertices_index = 0;
+    size_t indices_index = 0;
+    for (unsigned int i=0; i < num_threads; i++) {
+        if (failed == false) {
+            memcpy(&model->vertices[vertices_index], chunks[i].model.vertices, sizeof(struct model_file_vertex) * chunks[i].model.num_vertices);
+            memcpy(&model->indices[indices_index], chunks[i].model.indices, sizeof(uint32_t) * chunks[i].model.num_indices);
+            vertices_index = vertices_index + chunks[i].model.num_vertices;
+            indices_index = indices_index + chunks[i].model.num_indices;
+        }
+        text_model_free(&chunks[i].model);
+    }
+
+    if (failed == true) {
+        printf("text_model_parse(): Failed to allocate memory while parsing '%s'.\n", filename);
+        text_model_free(model);
+        return false;
+    }
+    return true;
+}
+
+#endif
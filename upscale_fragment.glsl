@@ -0,0 +1,11 @@
+// Samples the dynamic resolution render target with bilinear filtering, keeping samples half a texel inside the part
+// drawn this frame so texels left over from larger frames never bleed in at the right and top edges.
+
+uniform sampler2D scene;
+uniform highp vec4 region;
+
+varying highp vec2 texture_coordinate;
+
+void main(void) {
+    gl_FragColor = vec4(texture2D(scene, min(texture_coordinate, region.xy - region.zw)).rgb, 1.0);
+}
\ No newline at end of file
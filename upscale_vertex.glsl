@@ -0,0 +1,13 @@
+// Draws the dynamic resolution render target stretched over the window, with one triangle that covers the whole screen.
+
+attribute highp vec2 position;
+
+varying highp vec2 texture_coordinate;
+
+// The part of the render target drawn into this frame, as a fraction of its size, then half a texel.
+uniform highp vec4 region;
+
+void main(void) {
+    texture_coordinate = (position * 0.5 + 0.5) * region.xy;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
\ No newline at end of file
@@ -1,3 +1,7 @@
+// Variants are compiled with some of these defined, picked by the features of the mesh being drawn:
+// - QUANTISED: the mesh's normals are octahedral encoded.
+// - INSTANCED: the model matrix and tint are per instance attributes, rather than uniforms set before each draw.
+
 attribute highp vec3 position;
 attribute highp vec3 vertex_normal;
 attribute highp vec4 vertex_color;
@@ -6,13 +10,62 @@ varying highp vec3 fragment_position;
 varying highp vec3 fragment_normal;
 varying highp vec4 fragment_color;
 
+#ifdef INSTANCED
+// Per instance attributes: the object's world transform and a colour its vertex colours are multiplied by.
+attribute highp mat4 instance_model;
+attribute highp vec4 instance_tint;
+#else
 uniform highp mat4 model;
+uniform highp vec4 tint;
+#endif
+
 uniform highp mat4 view;
 uniform highp mat4 projection;
 
+// Quantised meshes store positions as 0..1 across the mesh's bounds, which these turn back into model space.
+// Float meshes use a scale of one and an offset of zero.
+uniform highp vec3 position_offset;
+uniform highp vec3 position_scale;
+
+#ifdef QUANTISED
+// Decode an octahedral encoded normal written by object_converter_tool --quantise.
+highp vec3 decode_octahedral(highp vec2 encoded) {
+    highp vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (normal.z < 0.0) {
+        highp vec2 signs = vec2(encoded.x >= 0.0 ? 1.0 : -1.0, encoded.y >= 0.0 ? 1.0 : -1.0);
+        normal.xy = (1.0 - abs(encoded.yx)) * signs;
+    }
+    return normalize(normal);
+}
+#endif
+
+// Turn a model space normal into world space with the world transform's cofactor matrix, its inverse transpose scaled by its determinant,
+// which keeps normals perpendicular to their surfaces under rotations and non uniform scales. GLSL ES 1.00 has no inverse(),
+// the scale goes when the normal is normalised, and the determinant's sign keeps the normals of mirrored objects facing out.
+highp vec3 world_normal(highp mat4 world, highp vec3 normal) {
+    highp vec3 x = world[0].xyz;
+    highp vec3 y = world[1].xyz;
+    highp vec3 z = world[2].xyz;
+    highp mat3 cofactor = mat3(cross(y, z), cross(z, x), cross(x, y));
+    highp float handedness = dot(x, cross(y, z)) < 0.0 ? -1.0 : 1.0;
+    return normalize(cofactor * normal) * handedness;
+}
+
 void main(void) {
-    gl_Position = projection * view * model * vec4(position, 1.0);
-    fragment_position = vec3(model * vec4(position, 1.0));
-    fragment_normal = vertex_normal;
-    fragment_color = vertex_color;
+#ifdef INSTANCED
+    highp mat4 world = instance_model;
+    highp vec4 world_tint = instance_tint;
+#else
+    highp mat4 world = model;
+    highp vec4 world_tint = tint;
+#endif
+    highp vec3 model_position = position * position_scale + position_offset;
+    gl_Position = projection * view * world * vec4(model_position, 1.0);
+    fragment_position = vec3(world * vec4(model_position, 1.0));
+#ifdef QUANTISED
+    fragment_normal = world_normal(world, decode_octahedral(vertex_normal.xy));
+#else
+    fragment_normal = world_normal(world, vertex_normal);
+#endif
+    fragment_color = vertex_color * world_tint;
 }
\ No newline at end of file